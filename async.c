@@ -1,162 +1,1178 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include <ev.h>
 
 #include "crt.h"
+#include "async.h"
+#include "async_io.h"
+#include "async_uring.h"
+#include "async_stats.h"
 
-typedef int async_main_t(crt_t *crt, void *arg);
-typedef struct async_task async_task_t;
+static void async_task_run(async_task_t *self);
+static void async_task_reap(async_task_t *self);
+static void async_task_finish(async_task_t *self);
+static void async_task_cancel_queue(async_task_t *self);
+static void async_task_deadline_arm(async_task_t *self);
+static void async_task_deadline_fn(async_timer_t *timer);
+static void async_loop_notify(async_loop_t *self);
+static void async_loop_prepare_fn(struct ev_loop *loop, ev_prepare *w, int revents);
+static void async_loop_check_fn(struct ev_loop *loop, ev_check *w, int revents);
+static void async_loop_idle_fn(struct ev_loop *loop, ev_idle *w, int revents);
+static void async_loop_remote_fn(struct ev_loop *loop, ev_async *w, int revents);
+
+static async_loop_t async_loop_default_obj;
+static _Thread_local async_loop_t *async_loop_current;     /* Loop draining on this thread */
 
-struct async_task
+/* Pooled tasks are laid out back to back, each on its own cache lines */
+#define ASYNC_SLAB_STRIDE   ((sizeof(async_task_t) + ASYNC_CACHELINE - 1) & ~(size_t)(ASYNC_CACHELINE - 1))
+
+struct async_slab
 {
-    crt_t           at_crt;                 /* Main co-routine object */
-    async_main_t   *at_main;                /* Async task body function */
-    void           *at_main_data;           /* Task body function context */
-    bool            at_done;                /* True if task completed */
-    int             at_returncode;          /* Exit status */
-    ev_timer        at_timer;               /* Generic sleep/timeout watcher */
-    void           *at_what_scheduled;      /* What scheduled this task */
+    struct async_slab  *as_next;
+    _Alignas(ASYNC_CACHELINE)
+    char                as_tasks[];
 };
 
-static void async_task_run(async_task_t *self);
+void async_loop_init(async_loop_t *self, struct ev_loop *loop)
+{
+    static const unsigned weights[ASYNC_PRIO_CLASSES] = ASYNC_PRIO_WEIGHTS;
+    int ii;
+
+    memset(self, 0, sizeof(*self));
+
+    self->al_ev = loop;
+    self->al_budget = ASYNC_LOOP_BUDGET;
+
+    for (ii = 0; ii < ASYNC_PRIO_CLASSES; ii++)
+    {
+        self->al_runq[ii].arq_tail = &self->al_runq[ii].arq_head;
+        self->al_runq[ii].arq_weight = weights[ii];
+        self->al_runq[ii].arq_credit = weights[ii];
+    }
+    self->al_prio_age = ASYNC_PRIO_AGE;
+
+    ev_prepare_init(&self->al_prepare, async_loop_prepare_fn);
+    self->al_prepare.data = self;
+    ev_prepare_start(loop, &self->al_prepare);
+    ev_unref(loop);
+
+    /*
+     * Lowest priority so the check watcher runs after all the other callbacks
+     * of the same iteration -- tasks woken by those are resumed in one pass
+     */
+    ev_check_init(&self->al_check, async_loop_check_fn);
+    self->al_check.data = self;
+    ev_set_priority(&self->al_check, EV_MINPRI);
+    ev_check_start(loop, &self->al_check);
+    ev_unref(loop);
+
+    ev_idle_init(&self->al_idle, async_loop_idle_fn);
+    self->al_idle.data = self;
+
+    /* Does not keep the loop alive by itself, like the two above */
+    ev_async_init(&self->al_remote, async_loop_remote_fn);
+    self->al_remote.data = self;
+    ev_async_start(loop, &self->al_remote);
+    ev_unref(loop);
+
+    ASYNC_STATS_INIT(self);
+}
+
+void async_loop_fini(async_loop_t *self)
+{
+    ev_ref(self->al_ev);
+    ev_prepare_stop(self->al_ev, &self->al_prepare);
+    ev_ref(self->al_ev);
+    ev_check_stop(self->al_ev, &self->al_check);
+    ev_ref(self->al_ev);
+    ev_async_stop(self->al_ev, &self->al_remote);
+    ev_idle_stop(self->al_ev, &self->al_idle);
+    ev_timer_stop(self->al_ev, &self->al_wheel.aw_tick);
+    if (self->al_uring != NULL) async_uring_free(self->al_uring);
+
+    struct async_slab *slab;
+    while ((slab = self->al_slabs) != NULL)
+    {
+        self->al_slabs = slab->as_next;
+        free(slab);
+    }
+
+    self->al_free = NULL;
+    self->al_nfree = 0;
+
+    ASYNC_STATS_FINI(self);
+}
+
+/**
+ * Carve a new slab of ASYNC_SLAB_TASKS tasks onto the free list
+ */
+static int async_loop_slab_alloc(async_loop_t *self)
+{
+    struct async_slab *slab;
+    size_t size;
+    size_t ii;
+
+    size = sizeof(struct async_slab) + ASYNC_SLAB_TASKS * ASYNC_SLAB_STRIDE;
+    slab = aligned_alloc(ASYNC_CACHELINE, size);
+    if (slab == NULL) return -1;
+
+    slab->as_next = self->al_slabs;
+    self->al_slabs = slab;
+
+    /* Link in reverse so the free list hands tasks out in address order */
+    for (ii = ASYNC_SLAB_TASKS; ii > 0; ii--)
+    {
+        async_task_t *task = (async_task_t *)(slab->as_tasks + (ii - 1) * ASYNC_SLAB_STRIDE);
+
+        task->at_next = self->al_free;
+        self->al_free = task;
+    }
+
+    self->al_nfree += ASYNC_SLAB_TASKS;
+    self->al_pooled += ASYNC_SLAB_TASKS;
+
+    return 0;
+}
+
+/**
+ * Make sure at least @p count pooled tasks can be spawned without allocating
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int async_loop_reserve(async_loop_t *self, size_t count)
+{
+    while (self->al_nfree < count)
+    {
+        if (async_loop_slab_alloc(self) != 0) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Set the resumes per round of each priority class, see struct async_loop.
+ * A class of weight 0 runs only when no other class is ready, or once it
+ * has been passed over for @p age resumes; @p age 0 disables aging.
+ * @p weights NULL keeps the current weights.
+ */
+void async_loop_priorities(async_loop_t *self, const unsigned weights[ASYNC_PRIO_CLASSES], unsigned age)
+{
+    int ii;
+
+    for (ii = 0; weights != NULL && ii < ASYNC_PRIO_CLASSES; ii++)
+    {
+        self->al_runq[ii].arq_weight = weights[ii];
+        self->al_runq[ii].arq_credit = weights[ii];
+    }
+
+    self->al_prio_age = (age == 0) ? UINT_MAX : age;
+}
+
+async_loop_t *async_loop_default(void)
+{
+    if (async_loop_default_obj.al_ev == NULL)
+    {
+        async_loop_init(&async_loop_default_obj, EV_DEFAULT);
+    }
+
+    return &async_loop_default_obj;
+}
+
+void async_loop_run(async_loop_t *self)
+{
+    ev_run(self->al_ev, 0);
+}
+
+static void async_loop_push(async_loop_t *self, async_task_t *task)
+{
+    async_runq_t *q = &self->al_runq[task->at_prio];
+
+    task->at_next = NULL;
+    task->at_queued = true;
+    task->at_runq = task->at_prio;
+    ASYNC_STATS_WAKE(self, task);
+
+    /* An active idle watcher keeps the loop alive and polling without blocking */
+    if (self->al_runq_len == 0) ev_idle_start(self->al_ev, &self->al_idle);
+
+    *q->arq_tail = task;
+    q->arq_tail = &task->at_next;
+    q->arq_len++;
+    self->al_runq_len++;
+}
+
+/**
+ * Class to resume from next: an aged one, else the highest ready class with
+ * credit left. Refills the credits once the round is over.
+ */
+static async_runq_t *async_loop_pick(async_loop_t *self)
+{
+    async_runq_t *credited = NULL;
+    async_runq_t *ready = NULL;
+    async_runq_t *q;
+    int ii;
+
+    for (ii = 0; ii < ASYNC_PRIO_CLASSES; ii++)
+    {
+        q = &self->al_runq[ii];
+        if (q->arq_len == 0) continue;
+
+        if (q->arq_skipped >= self->al_prio_age) return q;
+        if (credited == NULL && q->arq_credit > 0) credited = q;
+        if (ready == NULL) ready = q;
+    }
+
+    if (credited != NULL) return credited;
+
+    for (ii = 0; ii < ASYNC_PRIO_CLASSES; ii++) self->al_runq[ii].arq_credit = self->al_runq[ii].arq_weight;
+
+    for (ii = 0; ii < ASYNC_PRIO_CLASSES; ii++)
+    {
+        q = &self->al_runq[ii];
+        if (q->arq_len > 0 && q->arq_credit > 0) return q;
+    }
+
+    /* Only classes of weight 0 are ready */
+    return ready;
+}
+
+/**
+ * Take the next task off the ready queue
+ */
+async_task_t *async_loop_pop(async_loop_t *self)
+{
+    async_runq_t *q;
+    async_task_t *task;
+    int ii;
+
+    if (self->al_runq_len == 0) return NULL;
+
+    for (;;)
+    {
+        q = async_loop_pick(self);
+        task = q->arq_head;
+
+        q->arq_head = task->at_next;
+        if (q->arq_head == NULL) q->arq_tail = &q->arq_head;
+        q->arq_len--;
+        self->al_runq_len--;
+
+        if (task->at_runq == task->at_prio) break;
+
+        /* Its class changed while it was queued, it moves over only now */
+        async_loop_push(self, task);
+    }
+
+    if (q->arq_credit > 0) q->arq_credit--;
+
+    /* Age the classes passed over */
+    q->arq_skipped = 0;
+    for (ii = 0; ii < ASYNC_PRIO_CLASSES; ii++)
+    {
+        if (self->al_runq[ii].arq_len > 0 && &self->al_runq[ii] != q) self->al_runq[ii].arq_skipped++;
+    }
+
+    task->at_next = NULL;
+    task->at_queued = false;
+
+    return task;
+}
+
+/**
+ * Resume at most al_budget tasks from the ready queue. Tasks queued while
+ * draining go to the tail and may run in the same pass. Events that tasks
+ * fed to the loop are dispatched in place, so their wakeups are picked up by
+ * this pass instead of costing another loop iteration.
+ */
+static void async_loop_drain(async_loop_t *self)
+{
+    async_loop_t *outer = async_loop_current;
+    async_task_t *task;
+    unsigned budget;
+
+    async_loop_current = self;
+    ASYNC_STATS_PASS(self);
+
+    budget = self->al_budget;
+    while (budget > 0)
+    {
+        task = async_loop_pop(self);
+        if (task == NULL)
+        {
+            /* Wake group waiters once for all the completions of this pass */
+            if (self->al_notify != NULL)
+            {
+                async_loop_notify(self);
+                ASYNC_STATS_PASS(self);
+                continue;
+            }
+
+            if (ev_pending_count(self->al_ev) == 0) break;
+
+            ev_invoke_pending(self->al_ev);
+            ASYNC_STATS_PASS(self);
+
+            task = async_loop_pop(self);
+            if (task == NULL) break;
+        }
+
+        /* Unwinding a cancelled task is cheap, a mass cancel completes in one pass */
+        if (task->at_flags & ASYNC_TASK_CANCELLED)
+        {
+            task->at_flags &= ~ASYNC_TASK_CANCELLED;
+        }
+        else
+        {
+            budget--;
+        }
+
+        async_task_run(task);
+    }
+
+    if (self->al_notify != NULL) async_loop_notify(self);
+
+    async_loop_current = outer;
+
+    /* Still busy after a full pass, give the owner a chance to hand out work */
+    if (self->al_runq_len > 0 && self->al_surplus_fn != NULL) self->al_surplus_fn(self);
+}
+
+void async_loop_prepare_fn(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+    (void)revents;
+
+    async_loop_t *self = w->data;
+
+    if (self->al_runq_len == 0 && self->al_starved_fn != NULL) self->al_starved_fn(self);
+
+    /* Nothing left to run, let the loop block */
+    if (self->al_runq_len == 0) ev_idle_stop(loop, &self->al_idle);
+}
+
+void async_loop_check_fn(struct ev_loop *loop, ev_check *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_loop_drain(w->data);
+}
+
+void async_loop_idle_fn(struct ev_loop *loop, ev_idle *w, int revents)
+{
+    (void)loop;
+    (void)w;
+    (void)revents;
+}
+
+/**
+ * Take over the whole post and remote wakeup lists at once; run the posts,
+ * then queue the tasks locally in the order they were woken
+ */
+void async_loop_remote_fn(struct ev_loop *loop, ev_async *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_loop_t *self = w->data;
+    async_post_t *posts;
+    async_post_t *pprev = NULL;
+    async_post_t *post;
+    async_task_t *list;
+    async_task_t *prev = NULL;
+    async_task_t *task;
+
+    posts = atomic_exchange_explicit(&self->al_post_head, NULL, memory_order_acquire);
+
+    while (posts != NULL)
+    {
+        post = posts;
+        posts = post->ap_next;
+        post->ap_next = pprev;
+        pprev = post;
+    }
+
+    while ((post = pprev) != NULL)
+    {
+        pprev = post->ap_next;
+        post->ap_fn(self, post);
+    }
+
+    list = atomic_exchange_explicit(&self->al_remote_head, NULL, memory_order_acquire);
+
+    while (list != NULL)
+    {
+        task = list;
+        list = task->at_remote_next;
+        task->at_remote_next = prev;
+        prev = task;
+    }
+
+    while ((task = prev) != NULL)
+    {
+        prev = task->at_remote_next;
+        task->at_remote_next = NULL;
+        atomic_store_explicit(&task->at_remote_queued, false, memory_order_release);
+
+        /* Migrated meanwhile, forward to its current loop */
+        if (atomic_load_explicit(&task->at_loop, memory_order_acquire) != self)
+        {
+            async_task_wake_from_any_thread(task);
+            continue;
+        }
+
+        /* Finished while the wakeup was in flight */
+        if (task->at_flags & ASYNC_TASK_REAP)
+        {
+            async_task_reap(task);
+            continue;
+        }
+
+        async_task_wake(task, &self->al_remote);
+    }
+}
 
 void async_task_start(async_task_t *self, async_main_t *task_main, void *data)
 {
-    memset(self, 0, sizeof(*self));
+    async_task_start_on(async_loop_default(), self, task_main, data);
+}
+
+/**
+ * Initialize the task and bind it to @p loop without scheduling it
+ */
+void async_task_init(async_loop_t *loop, async_task_t *self, async_main_t *task_main, void *data)
+{
+    /* The locals arena is cleared by CRT_LOCALS() on first entry */
+    memset(self, 0, offsetof(async_task_t, at_locals));
 
     self->at_main = task_main;
     self->at_main_data = data;
+    self->at_loop = loop;
+    self->at_prio = ASYNC_PRIO_NORMAL;
 
-    CRT_INIT(&self->at_crt);
+    async_timer_init(&self->at_timer, self);
+    async_timer_init(&self->at_deadline_timer, self);
+    self->at_deadline_timer.atm_fn = async_task_deadline_fn;
+    ev_init(&self->at_io, async_io_fn);
+    self->at_io.data = self;
+    CRT_INIT_LOCALS(&self->at_crt, self->at_locals, sizeof(self->at_locals));
+}
 
-    async_task_run(self);
+void async_task_start_on(async_loop_t *loop, async_task_t *self, async_main_t *task_main, void *data)
+{
+    async_task_init(loop, self, task_main, data);
+    async_task_wake(self, NULL);
+}
+
+/**
+ * Start the task in priority class @p prio, see ASYNC_PRIO_*
+ */
+void async_task_start_prio(async_loop_t *loop, async_task_t *self, int prio, async_main_t *task_main, void *data)
+{
+    async_task_init(loop, self, task_main, data);
+    async_task_set_priority(self, prio);
+    async_task_wake(self, NULL);
+}
+
+/**
+ * Move the task to priority class @p prio, see ASYNC_PRIO_*. A task on the
+ * ready queue stays in its old class until it comes up there, then moves to
+ * the tail of the new one. Must be called on the task's loop thread.
+ */
+void async_task_set_priority(async_task_t *self, int prio)
+{
+    assert(prio >= 0 && prio < ASYNC_PRIO_CLASSES);
+
+    self->at_prio = prio;
+}
+
+/*
+ * Take an initialized pooled task off the free list, without scheduling it
+ */
+static async_task_t *async_task_alloc(async_loop_t *loop, async_main_t *task_main, void *data)
+{
+    async_task_t *self;
+
+    if (loop->al_free == NULL && async_loop_slab_alloc(loop) != 0) return NULL;
+
+    self = loop->al_free;
+    loop->al_free = self->at_next;
+    loop->al_nfree--;
+
+    async_task_init(loop, self, task_main, data);
+    self->at_flags = ASYNC_TASK_POOLED;
+
+    return self;
+}
+
+/**
+ * Allocate a task from the loop's pool and schedule it. The task is
+ * returned to the pool as soon as it completes; the returned pointer is
+ * only valid until then. A task migrated by the runtime is returned to the
+ * pool of the loop it finished on, so loops that share tasks must be
+ * finalized together.
+ *
+ * @return NULL if out of memory
+ */
+async_task_t *async_spawn(async_loop_t *loop, async_main_t *task_main, void *data)
+{
+    async_task_t *self = async_task_alloc(loop, task_main, data);
+
+    if (self != NULL) async_task_wake(self, NULL);
+
+    return self;
 }
 
 void async_task_run(async_task_t *self)
 {
     if (!self->at_done)
     {
+        async_loop_t *loop = self->at_loop;
+        async_task_t *outer = atomic_load_explicit(&loop->al_running, memory_order_relaxed);
+
+        /* Heartbeat: a watchdog that sees the same slice twice found a long one */
+        atomic_store_explicit(&loop->al_running, self, memory_order_relaxed);
+        atomic_store_explicit(&loop->al_slices,
+                atomic_load_explicit(&loop->al_slices, memory_order_relaxed) + 1, memory_order_release);
+
         /* Run coroutine */
+        ASYNC_STATS_RESUME(self);
         self->at_returncode = self->at_main(&self->at_crt, self->at_main_data);
+        ASYNC_STATS_SUSPEND(self);
+
+        /* Back to the task that woke this one synchronously, if any */
+        atomic_store_explicit(&loop->al_running, outer, memory_order_relaxed);
         self->at_done = !CRT_RUNNING(&self->at_crt);
+        if (self->at_done)
+        {
+            async_task_finish(self);
+        }
+        else if (self->at_deadline != 0.0 &&
+                (self->at_deadline_armed == 0.0 || self->at_deadline < self->at_deadline_armed))
+        {
+            /* Parked with a deadline the timer does not cover yet */
+            async_task_deadline_arm(self);
+        }
+    }
+
+    /* Still queued tasks are reaped by the run that takes them off the queue */
+    if (self->at_done && (self->at_flags & ASYNC_TASK_POOLED) && !self->at_queued)
+    {
+        async_task_reap(self);
+    }
+}
+
+/*
+ * The task just completed: release its stack and settle its groups
+ */
+void async_task_finish(async_task_t *self)
+{
+    async_group_t *group;
+    async_task_t *task;
+
+    CRT_FINI(&self->at_crt);
+
+    /* Left armed by the last timeout, the task may go away now */
+    if (self->at_deadline_armed != 0.0)
+    {
+        async_timer_stop(self->at_loop, &self->at_deadline_timer);
+        self->at_deadline_armed = 0.0;
+    }
+
+    /* Children outliving their parent are cancelled and no longer refer to its groups */
+    while ((group = self->at_groups) != NULL)
+    {
+        async_group_cancel(group);
+        while ((task = group->ag_head) != NULL) async_group_remove(task);
+
+        self->at_groups = group->ag_owner_next;
+        group->ag_owner = NULL;
+        group->ag_owner_next = NULL;
+    }
+
+    group = self->at_group;
+    if (group == NULL) return;
+
+    if (group->ag_ndone++ == 0)
+    {
+        group->ag_first_data = self->at_main_data;
+        group->ag_first_rc = self->at_returncode;
+    }
+
+    async_group_remove(self);
+
+    if (group->ag_waiters.awq_head == NULL || group->ag_notify_queued) return;
+
+    if (self->at_loop->al_direct)
+    {
+        while ((task = async_waitq_pop(&group->ag_waiters)) != NULL) async_task_wake(task, group);
+        return;
+    }
+
+    group->ag_notify_queued = true;
+    group->ag_notify_next = self->at_loop->al_notify;
+    self->at_loop->al_notify = group;
+}
+
+/*
+ * Wake the waiters of all groups that had completions since the last call
+ */
+void async_loop_notify(async_loop_t *self)
+{
+    async_group_t *group;
+    async_task_t *task;
+
+    while ((group = self->al_notify) != NULL)
+    {
+        self->al_notify = group->ag_notify_next;
+        group->ag_notify_next = NULL;
+        group->ag_notify_queued = false;
+
+        while ((task = async_waitq_pop(&group->ag_waiters)) != NULL) async_task_wake(task, group);
+    }
+}
+
+/**
+ * Return a finished pooled task to the free list of the loop it finished on
+ */
+void async_task_reap(async_task_t *self)
+{
+    async_loop_t *loop = self->at_loop;
+
+    /* Still linked on a remote wakeup list, the remote drain reaps it */
+    if (atomic_load_explicit(&self->at_remote_queued, memory_order_acquire))
+    {
+        self->at_flags |= ASYNC_TASK_REAP;
+        return;
+    }
+
+    async_timer_stop(loop, &self->at_timer);
+    ev_io_stop(loop->al_ev, &self->at_io);
+
+    self->at_flags = 0;
+    self->at_next = loop->al_free;
+    loop->al_free = self;
+    loop->al_nfree++;
+}
+
+/**
+ * Mark the task as runnable; @p what is recorded as the reason it was woken
+ */
+void async_task_wake(async_task_t *self, void *what)
+{
+    if (self->at_done) return;
+
+    self->at_what_scheduled = what;
+
+    if (self->at_loop->al_direct)
+    {
+        async_task_run(self);
+        return;
+    }
+
+    if (!self->at_queued) async_loop_push(self->at_loop, self);
+}
+
+/**
+ * Wake a task from any thread. Wakeups are pushed onto a lock-free list of
+ * the task's loop; only the push that finds the list empty signals the loop,
+ * so a burst of wakeups costs a single loop wakeup. Called by a task of the
+ * same loop, it is a plain wakeup.
+ */
+void async_task_wake_from_any_thread(async_task_t *self)
+{
+    async_loop_t *loop = atomic_load_explicit(&self->at_loop, memory_order_acquire);
+    async_task_t *head;
+
+    if (loop == async_loop_current)
+    {
+        async_task_wake(self, NULL);
+        return;
+    }
+
+    /* Already pending, the loop will see it */
+    if (atomic_exchange_explicit(&self->at_remote_queued, true, memory_order_acq_rel)) return;
+
+    head = atomic_load_explicit(&loop->al_remote_head, memory_order_relaxed);
+    do
+    {
+        self->at_remote_next = head;
+    }
+    while (!atomic_compare_exchange_weak_explicit(&loop->al_remote_head, &head, self,
+                memory_order_release, memory_order_relaxed));
+
+    if (head == NULL) ev_async_send(loop->al_ev, &loop->al_remote);
+}
+
+static void async_task_deadline_arm(async_task_t *self)
+{
+    async_loop_t *loop = self->at_loop;
+
+    self->at_deadline_armed = self->at_deadline;
+    async_timer_start(loop, &self->at_deadline_timer, self->at_deadline - ev_now(loop->al_ev));
+}
+
+/*
+ * The deadline timer went off. The timeout it was armed for may be over,
+ * then it is re-armed for the current deadline, if any.
+ */
+static void async_task_deadline_fn(async_timer_t *timer)
+{
+    async_task_t *self = timer->atm_task;
+
+    self->at_deadline_armed = 0.0;
+
+    if (self->at_done || self->at_deadline == 0.0) return;
+
+    if (ev_now(self->at_loop->al_ev) < self->at_deadline)
+    {
+        async_task_deadline_arm(self);
+        return;
+    }
+
+    CRT_TIMEOUT(&self->at_crt);
+    async_task_wake(self, timer);
+}
+
+/**
+ * Enter a timeout of @p timeout seconds, see CRT_AWAIT_TIMEOUT()
+ *
+ * @return 0 on success, -1 if nested deeper than ASYNC_DEADLINE_DEPTH
+ */
+int async_deadline_push(async_task_t *self, double timeout)
+{
+    double deadline;
+
+    if (self->at_ndeadlines >= ASYNC_DEADLINE_DEPTH) return -1;
+
+    deadline = ev_now(self->at_loop->al_ev) + timeout;
+
+    self->at_deadlines[self->at_ndeadlines++] = self->at_deadline;
+    if (self->at_deadline == 0.0 || deadline < self->at_deadline) self->at_deadline = deadline;
+
+    return 0;
+}
+
+/**
+ * Leave the innermost timeout; @p status is what the awaited expression
+ * ended with
+ *
+ * @return True if it timed out on an enclosing deadline, which must handle it
+ */
+bool async_deadline_pop(async_task_t *self, int status)
+{
+    double outer = self->at_deadlines[--self->at_ndeadlines];
+
+    self->at_deadline = outer;
+
+    if (status != CRT_ERROR_TIMEOUT) return false;
+
+    return outer != 0.0 && outer <= ev_now(self->at_loop->al_ev);
+}
+
+/**
+ * Run @p post->ap_fn on the loop thread, from any thread. Posts use the
+ * ev_async of remote wakeups: only the post that finds the list empty
+ * signals the loop, and a burst is handled in one callback. The post must
+ * stay valid until its callback ran.
+ */
+void async_loop_post(async_loop_t *self, async_post_t *post)
+{
+    async_post_t *head;
+
+    head = atomic_load_explicit(&self->al_post_head, memory_order_relaxed);
+    do
+    {
+        post->ap_next = head;
     }
+    while (!atomic_compare_exchange_weak_explicit(&self->al_post_head, &head, post,
+                memory_order_release, memory_order_relaxed));
+
+    if (head == NULL) ev_async_send(self->al_ev, &self->al_remote);
 }
 
+/* Cancellation of a task reaches the children in its groups right away */
+static void async_task_cancel_children(async_task_t *self)
+{
+    async_group_t *group;
+
+    for (group = self->at_groups; group != NULL; group = group->ag_owner_next)
+    {
+        async_group_cancel(group);
+    }
+}
+
+/**
+ * Cancel the task; it unwinds from where it waits. Cancelling a task that
+ * already finished does nothing.
+ */
 void async_task_cancel(async_task_t *self)
 {
+    if (self->at_done) return;
+
+    if (self->at_groups != NULL) async_task_cancel_children(self);
+
     CRT_CANCEL(&self->at_crt);
-    async_task_run(self);
+    async_task_wake(self, NULL);
 }
 
-void async_task_ev_generic_fn(struct ev_loop *loop, ev_watcher *watcher, int revents)
+/*
+ * Mark the task cancelled and queue it, never resuming it inline
+ */
+static void async_task_cancel_queue(async_task_t *self)
 {
-    (void)revents;
-    (void)loop;
+    if (self->at_done) return;
 
-    async_task_t *self = watcher->data;
+    if (self->at_groups != NULL) async_task_cancel_children(self);
 
-    self->at_what_scheduled = watcher;
+    CRT_CANCEL(&self->at_crt);
+    self->at_flags |= ASYNC_TASK_CANCELLED;
+    self->at_what_scheduled = NULL;
 
-    async_task_run(self);
+    if (!self->at_queued) async_loop_push(self->at_loop, self);
 }
 
 /**
- * Sleep for @p timeout seconds
+ * Cancel @p count tasks at once. The tasks are only marked and queued here;
+ * they unwind in the next pass of their loop, outside the ready queue
+ * budget. All tasks must belong to loops of the calling thread.
  */
-void async_task_sleep(crt_t *crt, double timeout)
+void async_task_cancel_many(async_task_t **tasks, size_t count)
 {
-    async_task_t *self = (async_task_t *)crt;
+    size_t ii;
 
-    CRT(crt)
+    for (ii = 0; ii < count; ii++)
     {
-        self->at_timer.data = self;
+        async_task_cancel_queue(tasks[ii]);
+    }
+}
 
-        ev_timer_init(&self->at_timer, (void *)async_task_ev_generic_fn, timeout, 0.0);
-        ev_timer_start(EV_DEFAULT, &self->at_timer);
+/**
+ * Initialize a group owned by @p owner (may be NULL)
+ */
+void async_group_init(async_group_t *self, async_task_t *owner)
+{
+    memset(self, 0, sizeof(*self));
 
-        do
+    async_waitq_init(&self->ag_waiters);
+
+    if (owner != NULL)
+    {
+        self->ag_owner = owner;
+        self->ag_owner_next = owner->at_groups;
+        owner->at_groups = self;
+    }
+}
+
+/**
+ * Detach an empty group from its owner
+ */
+void async_group_fini(async_group_t *self)
+{
+    async_group_t **pgroup;
+
+    if (self->ag_owner == NULL) return;
+
+    for (pgroup = &self->ag_owner->at_groups; *pgroup != NULL; pgroup = &(*pgroup)->ag_owner_next)
+    {
+        if (*pgroup == self)
         {
-            CRT_YIELD();
+            *pgroup = self->ag_owner_next;
+            break;
         }
-        while (self->at_what_scheduled != &self->at_timer);
     }
-    CRT_END;
 
-    ev_timer_stop(EV_DEFAULT, &self->at_timer);
+    self->ag_owner = NULL;
+    self->ag_owner_next = NULL;
 }
 
-async_task_t t1;
-async_task_t t2;
+/**
+ * Add @p task to the group; a task belongs to at most one group
+ */
+void async_group_add(async_group_t *self, async_task_t *task)
+{
+    if (task->at_group != NULL) async_group_remove(task);
 
+    task->at_group = self;
+    task->at_group_next = self->ag_head;
+    task->at_group_pprev = &self->ag_head;
+    if (self->ag_head != NULL) self->ag_head->at_group_pprev = &task->at_group_next;
+    self->ag_head = task;
+    self->ag_count++;
+}
 
-int task_t(crt_t *crt, void *data)
+/**
+ * Spawn a pooled task as a child of the group, see async_spawn()
+ */
+async_task_t *async_group_spawn(async_group_t *self, async_loop_t *loop, async_main_t *task_main, void *data)
 {
-    (void)data;
+    async_task_t *task = async_task_alloc(loop, task_main, data);
 
-    static int ii = 0;
+    if (task == NULL) return NULL;
 
-    CRT(crt)
-    {
-        for (ii = 0; ii < 3; ii++)
-        {
-            printf("T1 = %d\n", ii);
-            CRT_AWAIT(async_task_sleep(crt, 1.0), -1);
-        }
+    /* Join the group first, in direct mode the task may complete right away */
+    async_group_add(self, task);
+    async_task_wake(task, NULL);
 
-    }
-    CRT_END;
+    return task;
+}
+
+void async_group_remove(async_task_t *task)
+{
+    async_group_t *group = task->at_group;
 
-    printf("t1 ENDED = %d\n", CRT_STATUS(crt));
+    if (group == NULL) return;
 
-    printf("t1 will cancel t2 now\n");
-    async_task_cancel(&t2);
+    *task->at_group_pprev = task->at_group_next;
+    if (task->at_group_next != NULL) task->at_group_next->at_group_pprev = task->at_group_pprev;
 
-    return 1;
+    task->at_group = NULL;
+    task->at_group_next = NULL;
+    task->at_group_pprev = NULL;
+    group->ag_count--;
 }
 
-int task_t2(crt_t *crt, void *data)
+/**
+ * Cancel all members of the group in one batch, see async_task_cancel_many()
+ */
+void async_group_cancel(async_group_t *self)
 {
-    (void)data;
+    async_task_t *task;
 
-    static int ii = 0;
+    for (task = self->ag_head; task != NULL; task = task->at_group_next)
+    {
+        async_task_cancel_queue(task);
+    }
+}
+
+/*
+ * Park until the group reports completions
+ */
+static void async_group_wait(crt_t *crt, async_group_t *group)
+{
+    async_task_t *self = ASYNC_TASK(crt);
 
     CRT(crt)
     {
-        for (ii = 0; ii < 10; ii++)
+        async_waitq_push(&group->ag_waiters, self);
+        CRT_YIELD();
+    }
+    CRT_END;
+
+    async_waitq_remove(self);
+}
+
+/**
+ * Wait until all children completed. If the waiting task is cancelled or
+ * times out, the children are cancelled too and still waited for, then the
+ * cancellation or timeout propagates.
+ */
+void async_group_join(crt_t *crt, async_group_t *group)
+{
+    CRT_LOCALS(crt, struct { int status; }, l)
+    {
+        while (group->ag_count > 0)
         {
-            printf("T2 = %d\n", ii);
-            CRT_AWAIT(async_task_sleep(crt, 1.0), -1);
+            CRT_AWAIT_NC(async_group_wait(crt, group));
+
+            if ((CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) && l->status == CRT_OK)
+            {
+                l->status = CRT_STATUS(crt);
+                async_group_cancel(group);
+            }
         }
+
+        if (l->status != CRT_OK) CRT_EXIT(l->status);
     }
     CRT_END;
+}
 
+/**
+ * Wait for the first child to complete and cancel the others. *data and *rc
+ * are the data and return code of that child. The cancelled children unwind
+ * in the next pass; join the group before it goes away.
+ */
+void async_group_any(crt_t *crt, async_group_t *group, void **data, int *rc)
+{
+    CRT_LOCALS(crt, struct { int status; }, l)
+    {
+        while (group->ag_ndone == 0 && group->ag_count > 0)
+        {
+            CRT_AWAIT_NC(async_group_wait(crt, group));
+
+            /* Cancelled or timed out while waiting, take the children down too */
+            if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt))
+            {
+                l->status = CRT_STATUS(crt);
+                async_group_cancel(group);
+                CRT_AWAIT_NC(async_group_join(crt, group));
+                CRT_EXIT(l->status);
+            }
+        }
+
+        if (group->ag_ndone == 0) CRT_EXIT(CRT_ERROR);
+
+        *data = group->ag_first_data;
+        *rc = group->ag_first_rc;
+
+        async_group_cancel(group);
+    }
+    CRT_END;
+}
+
+/**
+ * True if the task holds no loop-bound resources and may be resumed on
+ * another loop
+ */
+bool async_task_migratable(async_task_t *self)
+{
+    if (self->at_flags & ASYNC_TASK_PINNED) return false;
+    if (async_timer_active(self->at_loop, &self->at_timer)) return false;
+    if (async_timer_active(self->at_loop, &self->at_deadline_timer)) return false;
+    if (ev_is_active(&self->at_io)) return false;
+    if (self->at_uring_busy || self->at_uring_cancel) return false;
+    /* Group members and owners, and parked tasks, are reached through pointers of their loop */
+    if (self->at_group != NULL || self->at_groups != NULL) return false;
+    if (self->at_waitq != NULL) return false;
+
+    return true;
+}
 
-    if (CRT_CANCELLED(crt))
+void async_task_ev_generic_fn(struct ev_loop *loop, ev_watcher *watcher, int revents)
+{
+    (void)revents;
+    (void)loop;
+
+    async_task_wake(watcher->data, watcher);
+}
+
+void async_waitq_init(async_waitq_t *self)
+{
+    self->awq_head = NULL;
+    self->awq_tail = &self->awq_head;
+}
+
+/**
+ * Append @p task; a task is on at most one wait queue at a time
+ */
+void async_waitq_push(async_waitq_t *self, async_task_t *task)
+{
+    task->at_waitq = self;
+    task->at_wait_next = NULL;
+    task->at_wait_pprev = self->awq_tail;
+    *self->awq_tail = task;
+    self->awq_tail = &task->at_wait_next;
+}
+
+/**
+ * Take the longest waiting task off the queue, NULL if empty
+ */
+async_task_t *async_waitq_pop(async_waitq_t *self)
+{
+    async_task_t *task = self->awq_head;
+
+    if (task != NULL) async_waitq_remove(task);
+
+    return task;
+}
+
+/**
+ * Unlink @p task from the wait queue it is on, if any. Awaitables call this
+ * when they exit so cancelled tasks do not linger on the queue.
+ */
+void async_waitq_remove(async_task_t *task)
+{
+    async_waitq_t *q = task->at_waitq;
+
+    if (q == NULL) return;
+
+    *task->at_wait_pprev = task->at_wait_next;
+    if (task->at_wait_next != NULL)
     {
-        printf("t2 was cancelled\n");
+        task->at_wait_next->at_wait_pprev = task->at_wait_pprev;
     }
     else
     {
-        printf("t2 ENDED: %d\n", CRT_STATUS(crt));
+        q->awq_tail = task->at_wait_pprev;
     }
 
-
-    return 2;
+    task->at_waitq = NULL;
+    task->at_wait_next = NULL;
+    task->at_wait_pprev = NULL;
 }
 
-int main(void)
+/**
+ * Suspend until something wakes the task up
+ */
+void async_task_park(crt_t *crt)
 {
+    CRT(crt)
+    {
+        CRT_YIELD();
+    }
+    CRT_END;
+}
 
-    async_task_start(&t1, task_t, NULL);
-    async_task_start(&t2, task_t2, NULL);
+/**
+ * Let the other ready tasks run first
+ */
+void async_task_yield(crt_t *crt)
+{
+    async_task_t *self = ASYNC_TASK(crt);
 
-    ev_run(EV_DEFAULT, 0);
+    CRT(crt)
+    {
+        if (!self->at_loop->al_direct)
+        {
+            async_task_wake(self, self);
+            CRT_YIELD();
+        }
+    }
+    CRT_END;
+}
 
-    printf("MAIN EXIT: t1 = %d, t2 = %d\n", t1.at_returncode, t2.at_returncode);
+/**
+ * Start a budget of @p iterations uses of ASYNC_BUDGET_YIELD() or @p slice
+ * seconds, whichever is spent first; 0 disables either limit
+ */
+void async_budget_init(async_budget_t *self, unsigned iterations, double slice)
+{
+    self->ab_iterations = iterations;
+    self->ab_slice = slice;
+    async_budget_restart(self);
+}
 
-    return 0;
+/**
+ * Refill the budget, done by ASYNC_BUDGET_YIELD() after yielding
+ */
+void async_budget_restart(async_budget_t *self)
+{
+    self->ab_count = 0;
+    if (self->ab_slice != 0.0) self->ab_start = ev_time();
 }
 
+/**
+ * Sleep for @p timeout seconds
+ */
+void async_task_sleep(crt_t *crt, double timeout)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        async_timer_start(self->at_loop, &self->at_timer, timeout);
+
+        do
+        {
+            CRT_YIELD();
+        }
+        while (async_timer_active(self->at_loop, &self->at_timer));
+    }
+    CRT_END;
+
+    async_timer_stop(self->at_loop, &self->at_timer);
+}
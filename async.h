@@ -0,0 +1,419 @@
+#if !defined(ASYNC_H_INCLUDED)
+#define ASYNC_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <ev.h>
+
+#include "crt.h"
+
+#if !defined(ASYNC_TASK_LOCALS_SIZE)
+#define ASYNC_TASK_LOCALS_SIZE      128                 /* Per-task frame-local arena */
+#endif
+
+#if !defined(ASYNC_WHEEL_BITS)
+#define ASYNC_WHEEL_BITS            8                   /* log2 of slots per wheel level */
+#endif
+
+#define ASYNC_WHEEL_SLOTS           (1 << ASYNC_WHEEL_BITS)
+#define ASYNC_WHEEL_MASK            (ASYNC_WHEEL_SLOTS - 1)
+#define ASYNC_WHEEL_LEVELS          4
+#define ASYNC_WHEEL_RESOLUTION      0.001               /* Default tick length in seconds */
+
+#define ASYNC_TASK_PINNED           (1 << 0)            /* Never migrate to another loop */
+#define ASYNC_TASK_POOLED           (1 << 1)            /* Allocated by async_spawn(), reaped when done */
+#define ASYNC_TASK_REAP             (1 << 2)            /* Done, reap once off the remote wakeup list */
+#define ASYNC_TASK_CANCELLED        (1 << 3)            /* Cancel pending, resume unwinds the task */
+
+#define ASYNC_CACHELINE             64
+
+#if !defined(ASYNC_SLAB_TASKS)
+#define ASYNC_SLAB_TASKS            64                  /* Pooled tasks allocated at once */
+#endif
+
+#if !defined(ASYNC_DEADLINE_DEPTH)
+#define ASYNC_DEADLINE_DEPTH        4                   /* Max nested CRT_AWAIT_TIMEOUT() per task */
+#endif
+
+#define ASYNC_TIMER_HEAP            0                   /* One ev_timer per timer, libev heap */
+#define ASYNC_TIMER_WHEEL           1                   /* Hierarchical timer wheel, one ev_timer tick */
+#define ASYNC_TIMER_URING           2                   /* One io_uring timeout per timer, see async_uring.h */
+
+#if !defined(ASYNC_LOOP_BUDGET)
+#define ASYNC_LOOP_BUDGET           64                  /* Max task resumes per loop iteration */
+#endif
+
+#define ASYNC_PRIO_HIGH             0                   /* Latency sensitive, control plane */
+#define ASYNC_PRIO_NORMAL           1                   /* Default class */
+#define ASYNC_PRIO_LOW              2                   /* Bulk work */
+#define ASYNC_PRIO_CLASSES          3
+
+#define ASYNC_PRIO_WEIGHTS          { 16, 4, 1 }        /* Default resumes per round, by class */
+
+#if !defined(ASYNC_PRIO_AGE)
+#define ASYNC_PRIO_AGE              256                 /* Resumes a ready class may be passed over */
+#endif
+
+typedef int async_main_t(crt_t *crt, void *arg);
+typedef struct async_task async_task_t;
+typedef struct async_loop async_loop_t;
+typedef struct async_timer async_timer_t;
+typedef struct async_wheel async_wheel_t;
+typedef struct async_group async_group_t;
+typedef struct async_waitq async_waitq_t;
+typedef void async_timer_fn(async_timer_t *timer);
+typedef struct async_post async_post_t;
+typedef struct async_task_stats async_task_stats_t;
+typedef struct async_stats async_stats_t;
+typedef struct async_budget async_budget_t;
+typedef struct async_runq async_runq_t;
+typedef void async_post_fn(async_loop_t *loop, async_post_t *post);
+
+/*
+ * Timer bound to a task; expiry wakes the task with the timer as the reason,
+ * or calls atm_fn instead if set. The backend is chosen per loop.
+ */
+struct async_timer
+{
+    union
+    {
+        ev_timer        atm_ev;             /* ASYNC_TIMER_HEAP */
+        struct
+        {
+            async_timer_t  *atm_next;       /* Wheel slot link */
+            async_timer_t **atm_pprev;      /* Wheel slot back link, NULL if not armed */
+            uint64_t        atm_expire;     /* Expiry tick */
+        };
+        uint32_t        atm_slot;           /* ASYNC_TIMER_URING: timeout slot, 0 if not armed */
+    };
+    async_task_t       *atm_task;           /* Task to wake */
+    async_timer_fn     *atm_fn;             /* Expiry handler, NULL to wake atm_task */
+};
+
+/*
+ * Hierarchical timer wheel -- O(1) start/stop, amortized O(1) expiry. Level n
+ * covers deltas of up to ASYNC_WHEEL_SLOTS^(n+1) ticks, longer timeouts are
+ * clamped to the top level.
+ */
+struct async_wheel
+{
+    ev_timer        aw_tick;                /* Drives the wheel while timers are armed */
+    double          aw_resolution;          /* Tick length in seconds */
+    unsigned        aw_coalesce;            /* Round expiry up to a multiple of this many ticks */
+    unsigned        aw_count;               /* Number of armed timers */
+    double          aw_base;                /* Loop time of tick 0 */
+    uint64_t        aw_next;                /* Next tick to process */
+    async_timer_t  *aw_slot[ASYNC_WHEEL_LEVELS][ASYNC_WHEEL_SLOTS];
+};
+
+/* What woke a parked task, as told by at_what_scheduled */
+#define ASYNC_WAIT_YIELD            0                   /* async_task_yield() */
+#define ASYNC_WAIT_TIMER            1                   /* Sleep or timeout */
+#define ASYNC_WAIT_IO               2                   /* File descriptor readiness */
+#define ASYNC_WAIT_REMOTE           3                   /* Another thread */
+#define ASYNC_WAIT_OTHER            4                   /* Channels, locks, groups, offload, cancel */
+#define ASYNC_WAIT_KINDS            5
+
+#if defined(ASYNC_STATS)
+/*
+ * Per task counters of the scheduler instrumentation, see async_stats.h.
+ * Times are in async_stats_clock() ticks.
+ */
+struct async_task_stats
+{
+    uint64_t        ats_resumes;            /* Times resumed */
+    uint64_t        ats_timed;              /* Resumes that were timed */
+    uint64_t        ats_run;                /* Time on CPU of the timed resumes */
+    uint64_t        ats_longest;            /* Longest timed resume */
+    uint64_t        ats_parked[ASYNC_WAIT_KINDS];   /* Time parked before the timed resumes, by ASYNC_WAIT_* */
+    uint64_t        ats_start;              /* Start of the running resume, if timed */
+    uint64_t        ats_park;               /* End of the last resume, 0 before the first */
+    uint64_t        ats_woken;              /* Wakeup after that, 0 if not queued */
+    struct async_stats_fn *ats_fn;          /* Entry of at_main in ats_loop's table */
+    async_loop_t   *ats_loop;               /* Loop ats_fn belongs to */
+};
+#endif
+
+/*
+ * Ready queue of one priority class
+ */
+struct async_runq
+{
+    async_task_t   *arq_head;               /* Ready queue head */
+    async_task_t  **arq_tail;               /* Ready queue tail link */
+    unsigned        arq_len;                /* Ready queue length */
+    unsigned        arq_weight;             /* Resumes per round, 0 to run only when the others are empty */
+    unsigned        arq_credit;             /* Resumes left in this round */
+    unsigned        arq_skipped;            /* Resumes of other classes while this one was ready */
+};
+
+/*
+ * Per event loop scheduler state. Watchers do not resume tasks directly,
+ * they only queue them on the ready queue which is drained once per loop
+ * iteration from the check watcher.
+ *
+ * The ready queue has one FIFO per priority class. Classes are served by
+ * weighted round-robin: in each round a class gets up to arq_weight
+ * resumes, higher classes first, and the credits are refilled once no ready
+ * class has any left. A ready class passed over for al_prio_age resumes is
+ * served next regardless of its credit.
+ */
+struct async_loop
+{
+    struct ev_loop *al_ev;                  /* libev loop */
+    async_runq_t    al_runq[ASYNC_PRIO_CLASSES];    /* Ready queues by priority class */
+    unsigned        al_runq_len;            /* Ready tasks in all classes */
+    unsigned        al_prio_age;            /* Max resumes a ready class is passed over */
+    unsigned        al_budget;              /* Max resumes per drain pass */
+    bool            al_direct;              /* Resume tasks synchronously, bypass the queue */
+    ev_prepare      al_prepare;             /* Lets the loop block once the queue is empty */
+    ev_check        al_check;               /* Drains the ready queue */
+    ev_idle         al_idle;                /* Active while the ready queue is not empty */
+    int             al_timer_backend;       /* ASYNC_TIMER_HEAP or ASYNC_TIMER_WHEEL */
+    async_wheel_t   al_wheel;               /* Timer wheel */
+    void          (*al_surplus_fn)(async_loop_t *self);     /* Tasks left over after a drain pass */
+    void          (*al_starved_fn)(async_loop_t *self);     /* Ready queue empty before blocking */
+    void           *al_owner;               /* Owner of the hooks above */
+    ev_async        al_remote;              /* Signalled on wakeups from other threads */
+    _Atomic(async_task_t *) al_remote_head; /* Remote wakeups, newest first */
+    async_task_t   *al_free;                /* Pooled task free list */
+    size_t          al_nfree;               /* Tasks on the free list */
+    size_t          al_pooled;              /* Pooled tasks allocated */
+    struct async_slab *al_slabs;            /* Pooled task slabs, freed by async_loop_fini() */
+    async_group_t  *al_notify;              /* Groups with completions to report this pass */
+    _Atomic(async_post_t *) al_post_head;   /* Posts from other threads, newest first */
+    _Atomic(async_task_t *) al_running;     /* Task being resumed, for the watchdog */
+    _Atomic unsigned long al_slices;        /* Resumes started, the watchdog's heartbeat */
+    struct async_uring *al_uring;           /* io_uring I/O backend, NULL for libev readiness */
+#if defined(ASYNC_STATS)
+    _Atomic(async_stats_t *) al_stats;      /* Per function statistics, see async_stats.h */
+    uint64_t        al_stats_now;           /* Clock at the end of the last timed resume or ev pass */
+    ev_check        al_stats_check;         /* Reads the clock after polling, before the callbacks */
+#endif
+};
+
+/*
+ * Callback run on a loop's thread on behalf of another thread, see
+ * async_loop_post()
+ */
+struct async_post
+{
+    async_post_t   *ap_next;                /* Post list link */
+    async_post_fn  *ap_fn;                  /* Called on the loop thread */
+};
+
+/*
+ * The first cache line holds everything the scheduler touches on a resume,
+ * followed by the co-routine state. Pooled tasks are cache-line aligned.
+ */
+struct async_task
+{
+    async_task_t   *at_next;                /* Ready queue / free list link */
+    _Atomic(async_loop_t *) at_loop;        /* Home loop, changed by a stealing worker */
+    async_main_t   *at_main;                /* Async task body function */
+    void           *at_main_data;           /* Task body function context */
+    void           *at_what_scheduled;      /* What scheduled this task */
+    int             at_returncode;          /* Exit status */
+    unsigned        at_flags;               /* ASYNC_TASK_* flags */
+    bool            at_queued;              /* True if on the ready queue */
+    bool            at_done;                /* True if task completed */
+    uint8_t         at_prio;                /* ASYNC_PRIO_* class */
+    uint8_t         at_runq;                /* Class queued in, at_prio may have changed since */
+    crt_t           at_crt;                 /* Main co-routine object */
+    async_timer_t   at_timer;               /* Generic sleep/timeout timer */
+    ev_io           at_io;                  /* I/O readiness watcher, reused across waits */
+    int             at_uring_res;           /* Result of the io_uring operation */
+    bool            at_uring_busy;          /* io_uring operation in flight */
+    bool            at_uring_cancel;        /* Its cancellation waits for a free entry */
+    async_task_t   *at_uring_next;          /* Link of the ring's cancellations to queue */
+    async_task_t   *at_remote_next;         /* Remote wakeup link */
+    atomic_bool     at_remote_queued;       /* True if on a remote wakeup list */
+    async_group_t  *at_group;               /* Group the task belongs to */
+    async_group_t  *at_groups;              /* Groups owned by the task */
+    async_task_t   *at_group_next;          /* Group member list link */
+    async_task_t  **at_group_pprev;         /* Group member list back link */
+    async_waitq_t  *at_waitq;               /* Wait queue the task is parked on */
+    async_task_t   *at_wait_next;           /* Wait queue link */
+    async_task_t  **at_wait_pprev;          /* Wait queue back link */
+    double          at_deadline;            /* Loop time the innermost timeout expires, 0 if none */
+    double          at_deadline_armed;      /* Expiry the deadline timer is armed for, 0 if not armed */
+    unsigned        at_ndeadlines;          /* Nested timeouts */
+    double          at_deadlines[ASYNC_DEADLINE_DEPTH];     /* Deadlines of the enclosing timeouts */
+    async_timer_t   at_deadline_timer;      /* Delivers CRT_ERROR_TIMEOUT, armed while parked */
+#if defined(ASYNC_STATS)
+    async_task_stats_t at_stats;            /* Instrumentation counters */
+#endif
+    _Alignas(CRT_LOCALS_ALIGN)
+    char            at_locals[ASYNC_TASK_LOCALS_SIZE];  /* Frame-local arena */
+};
+
+/*
+ * FIFO of tasks parked on a resource, linked through the tasks themselves
+ */
+struct async_waitq
+{
+    async_task_t   *awq_head;               /* Longest waiting task */
+    async_task_t  **awq_tail;               /* Link of the newest task */
+};
+
+/*
+ * Task group (nursery). Children are spawned into the group and leave it when
+ * they complete. The owner, if any, waits for them with async_group_join()
+ * or async_group_any(); a group must not go away before it is empty.
+ *
+ * Cancelling the owner cancels the children, and when the owner completes
+ * the children still running are cancelled and detached from the group.
+ * Waiters are woken once per scheduler pass, however many children
+ * completed in it. All members must run on the owner's loop.
+ */
+struct async_group
+{
+    async_task_t   *ag_head;                /* Member list */
+    size_t          ag_count;               /* Number of members */
+    async_task_t   *ag_owner;               /* Parent task, or NULL */
+    async_group_t  *ag_owner_next;          /* Owner's group list link */
+    async_waitq_t   ag_waiters;             /* Tasks in join/any */
+    async_group_t  *ag_notify_next;         /* Loop notification list link */
+    bool            ag_notify_queued;       /* On the loop notification list */
+    size_t          ag_ndone;               /* Children completed so far */
+    void           *ag_first_data;          /* Data of the first child to complete */
+    int             ag_first_rc;            /* Its return code */
+};
+
+/*
+ * Iteration and time budget of a long loop inside a task, see
+ * ASYNC_BUDGET_YIELD()
+ */
+struct async_budget
+{
+    unsigned        ab_count;               /* Iterations since the last yield */
+    unsigned        ab_iterations;          /* Yield after this many, 0 for no limit */
+    double          ab_slice;               /* Yield after this many seconds, 0 for no limit */
+    double          ab_start;               /* ev_time() at the start of the slice */
+};
+
+/**
+ * Task that owns the co-routine @p crt
+ */
+#define ASYNC_TASK(crt)     ((async_task_t *)((char *)(crt) - offsetof(async_task_t, at_crt)))
+
+/**
+ * Await @p expr with a deadline @p timeout seconds from now. Everything
+ * awaited inside inherits the deadline, a nested timeout can only shorten
+ * it. On expiry the suspended awaitables unwind as if cancelled and the
+ * status here is CRT_ERROR_TIMEOUT, see CRT_TIMEDOUT(). Expiry of an
+ * enclosing deadline and cancellation propagate, as with CRT_AWAIT().
+ *
+ * Entering and leaving a timeout costs no timer operation: the deadline
+ * timer is armed only when the task parks, and stays armed as long as it
+ * does not go off later than the current deadline.
+ */
+#define CRT_AWAIT_TIMEOUT(expr, timeout, ...)                                   \
+do                                                                              \
+{                                                                               \
+    if (async_deadline_push(ASYNC_TASK(__crt), (timeout)) != 0)                 \
+    {                                                                           \
+        CRT_EXIT(CRT_ERROR_STACK_OVERFLOW);                                     \
+    }                                                                           \
+                                                                                \
+    CRT_AWAIT_NC(expr, __VA_ARGS__);                                            \
+                                                                                \
+    if (async_deadline_pop(ASYNC_TASK(__crt), CRT_STATUS(__crt)))               \
+    {                                                                           \
+        CRT_EXIT(CRT_ERROR_TIMEOUT);                                            \
+    }                                                                           \
+    if (CRT_CANCELLED(__crt)) CRT_EXIT(CRT_ERROR_CANCEL);                       \
+}                                                                               \
+while (0)
+
+/**
+ * Yield to the other ready tasks once the budget @p B is spent, i.e. after
+ * ab_iterations uses or ab_slice seconds since the last yield, whichever
+ * comes first. Checking the time costs a clock read per use; with only an
+ * iteration budget it is a counter increment.
+ *
+ *      async_budget_init(&l->budget, 1000, 0.0005);
+ *      for (l->ii = 0; l->ii < count; l->ii++)
+ *      {
+ *          work(l->ii);
+ *          ASYNC_BUDGET_YIELD(crt, &l->budget);
+ *      }
+ *
+ * Cancellation and expired deadlines propagate, as with CRT_AWAIT().
+ */
+#define ASYNC_BUDGET_YIELD(crt, B, ...)                                         \
+do                                                                              \
+{                                                                               \
+    if (async_budget_spent(B))                                                  \
+    {                                                                           \
+        CRT_AWAIT(async_task_yield(crt), __VA_ARGS__);                          \
+        async_budget_restart(B);                                                \
+    }                                                                           \
+}                                                                               \
+while (0)
+
+extern void async_loop_init(async_loop_t *self, struct ev_loop *loop);
+extern void async_loop_fini(async_loop_t *self);
+extern async_loop_t *async_loop_default(void);
+extern void async_loop_run(async_loop_t *self);
+extern async_task_t *async_loop_pop(async_loop_t *self);
+extern int async_loop_reserve(async_loop_t *self, size_t count);
+extern void async_loop_priorities(async_loop_t *self, const unsigned weights[ASYNC_PRIO_CLASSES], unsigned age);
+extern void async_loop_post(async_loop_t *self, async_post_t *post);
+
+extern void async_loop_timer_wheel(async_loop_t *self, double resolution, unsigned coalesce);
+
+extern void async_timer_init(async_timer_t *self, async_task_t *task);
+extern void async_timer_start(async_loop_t *loop, async_timer_t *self, double after);
+extern void async_timer_stop(async_loop_t *loop, async_timer_t *self);
+extern bool async_timer_active(async_loop_t *loop, async_timer_t *self);
+extern double async_timer_remaining(async_loop_t *loop, async_timer_t *self);
+extern void async_timer_expire(async_timer_t *self);
+
+extern void async_task_init(async_loop_t *loop, async_task_t *self, async_main_t *task_main, void *data);
+extern async_task_t *async_spawn(async_loop_t *loop, async_main_t *task_main, void *data);
+extern void async_task_start(async_task_t *self, async_main_t *task_main, void *data);
+extern void async_task_start_on(async_loop_t *loop, async_task_t *self, async_main_t *task_main, void *data);
+extern void async_task_start_prio(async_loop_t *loop, async_task_t *self, int prio, async_main_t *task_main, void *data);
+extern void async_task_set_priority(async_task_t *self, int prio);
+extern void async_task_wake(async_task_t *self, void *what);
+extern void async_task_wake_from_any_thread(async_task_t *self);
+extern void async_task_cancel(async_task_t *self);
+extern void async_task_cancel_many(async_task_t **tasks, size_t count);
+extern bool async_task_migratable(async_task_t *self);
+extern void async_task_ev_generic_fn(struct ev_loop *loop, ev_watcher *watcher, int revents);
+
+extern int async_deadline_push(async_task_t *self, double timeout);
+extern bool async_deadline_pop(async_task_t *self, int status);
+
+extern void async_group_init(async_group_t *self, async_task_t *owner);
+extern void async_group_fini(async_group_t *self);
+extern void async_group_add(async_group_t *self, async_task_t *task);
+extern async_task_t *async_group_spawn(async_group_t *self, async_loop_t *loop, async_main_t *task_main, void *data);
+extern void async_group_remove(async_task_t *task);
+extern void async_group_cancel(async_group_t *self);
+extern void async_group_join(crt_t *crt, async_group_t *group);
+extern void async_group_any(crt_t *crt, async_group_t *group, void **data, int *rc);
+
+extern void async_waitq_init(async_waitq_t *self);
+extern void async_waitq_push(async_waitq_t *self, async_task_t *task);
+extern async_task_t *async_waitq_pop(async_waitq_t *self);
+extern void async_waitq_remove(async_task_t *task);
+
+extern void async_task_park(crt_t *crt);
+extern void async_task_yield(crt_t *crt);
+extern void async_task_sleep(crt_t *crt, double timeout);
+
+extern void async_budget_init(async_budget_t *self, unsigned iterations, double slice);
+extern void async_budget_restart(async_budget_t *self);
+
+static inline bool async_budget_spent(async_budget_t *self)
+{
+    if (++self->ab_count >= self->ab_iterations && self->ab_iterations != 0) return true;
+
+    return self->ab_slice != 0.0 && ev_time() - self->ab_start >= self->ab_slice;
+}
+
+#endif /* ASYNC_H_INCLUDED */
@@ -0,0 +1,385 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "async.h"
+#include "async_chan.h"
+
+/*
+ * Progress is handed down the wait queues one task at a time: whoever moves
+ * items wakes one task on the other side, and a woken task that leaves room
+ * (or items) behind wakes the next task on its own side. A burst of parked
+ * tasks therefore costs one wakeup each and no thundering herd.
+ */
+
+static inline void async_chan_lock(async_chan_t *self)
+{
+    if (!(self->ac_flags & ASYNC_CHAN_SHARED)) return;
+
+    while (atomic_flag_test_and_set_explicit(&self->ac_lock, memory_order_acquire))
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+static inline void async_chan_unlock(async_chan_t *self)
+{
+    if (!(self->ac_flags & ASYNC_CHAN_SHARED)) return;
+
+    atomic_flag_clear_explicit(&self->ac_lock, memory_order_release);
+}
+
+static inline size_t async_chan_used(async_chan_t *self)
+{
+    return self->ac_tail - self->ac_head;
+}
+
+static inline size_t async_chan_space(async_chan_t *self)
+{
+    return self->ac_mask + 1 - async_chan_used(self);
+}
+
+/*
+ * Copy up to @p count items into the ring, returns the number copied
+ */
+static size_t async_chan_put(async_chan_t *self, const char *items, size_t count)
+{
+    size_t idx = self->ac_tail & self->ac_mask;
+    size_t first;
+
+    if (count > async_chan_space(self)) count = async_chan_space(self);
+
+    first = self->ac_mask + 1 - idx;
+    if (first > count) first = count;
+
+    memcpy(self->ac_buf + idx * self->ac_size, items, first * self->ac_size);
+    memcpy(self->ac_buf, items + first * self->ac_size, (count - first) * self->ac_size);
+
+    self->ac_tail += count;
+
+    return count;
+}
+
+/*
+ * Copy up to @p count items out of the ring, returns the number copied
+ */
+static size_t async_chan_get(async_chan_t *self, char *items, size_t count)
+{
+    size_t idx = self->ac_head & self->ac_mask;
+    size_t first;
+
+    if (count > async_chan_used(self)) count = async_chan_used(self);
+
+    first = self->ac_mask + 1 - idx;
+    if (first > count) first = count;
+
+    memcpy(items, self->ac_buf + idx * self->ac_size, first * self->ac_size);
+    memcpy(items + first * self->ac_size, self->ac_buf, (count - first) * self->ac_size);
+
+    self->ac_head += count;
+
+    return count;
+}
+
+/*
+ * Wake the longest waiting task of @p q, called with the lock held so the
+ * task cannot finish before the wakeup is queued
+ */
+static void async_chan_wake(async_chan_t *self, async_waitq_t *q)
+{
+    async_task_t *task = async_waitq_pop(q);
+
+    if (task == NULL) return;
+
+    if (self->ac_flags & ASYNC_CHAN_SHARED)
+    {
+        async_task_wake_from_any_thread(task);
+    }
+    else
+    {
+        async_task_wake(task, self);
+    }
+}
+
+/* After a send: wake a receiver, and the next sender if there is room left */
+static void async_chan_sent(async_chan_t *self)
+{
+    if (async_chan_used(self) > 0) async_chan_wake(self, &self->ac_recvq);
+    if (async_chan_space(self) > 0) async_chan_wake(self, &self->ac_sendq);
+}
+
+/* After a receive: wake a sender, and the next receiver if items are left */
+static void async_chan_received(async_chan_t *self)
+{
+    if (async_chan_space(self) > 0) async_chan_wake(self, &self->ac_sendq);
+    if (async_chan_used(self) > 0) async_chan_wake(self, &self->ac_recvq);
+}
+
+/* Park the running task on @p q unless a previous park is still pending */
+static void async_chan_park(async_waitq_t *q, async_task_t *task)
+{
+    if (task->at_waitq == NULL) async_waitq_push(q, task);
+}
+
+/*
+ * Leave the wait queue @p q on exit, also when cancelled. A task that was
+ * woken but unwinds (@p abandoned) without taking its turn passes the
+ * wakeup on to the next task of its side, or the wakeup would be lost.
+ */
+static void async_chan_leave(async_chan_t *self, async_task_t *task, async_waitq_t *q, bool abandoned)
+{
+    bool woken;
+
+    async_chan_lock(self);
+
+    woken = (task->at_waitq == NULL);
+    async_waitq_remove(task);
+
+    if (woken && abandoned)
+    {
+        if (q == &self->ac_sendq && async_chan_space(self) > 0) async_chan_wake(self, q);
+        if (q == &self->ac_recvq && async_chan_used(self) > 0) async_chan_wake(self, q);
+    }
+
+    async_chan_unlock(self);
+}
+
+/**
+ * Initialize a channel of @p capacity items of @p size bytes each; the
+ * capacity is rounded up to a power of 2
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int async_chan_init(async_chan_t *self, size_t size, size_t capacity, unsigned flags)
+{
+    size_t cap = 1;
+
+    memset(self, 0, sizeof(*self));
+
+    while (cap < capacity) cap <<= 1;
+
+    self->ac_buf = malloc(cap * size);
+    if (self->ac_buf == NULL) return -1;
+
+    self->ac_size = size;
+    self->ac_mask = cap - 1;
+    self->ac_flags = flags;
+    async_waitq_init(&self->ac_sendq);
+    async_waitq_init(&self->ac_recvq);
+    atomic_flag_clear(&self->ac_lock);
+
+    return 0;
+}
+
+void async_chan_fini(async_chan_t *self)
+{
+    free(self->ac_buf);
+    self->ac_buf = NULL;
+}
+
+/**
+ * Refuse further sends; receivers drain what is left and then fail
+ */
+void async_chan_close(async_chan_t *self)
+{
+    async_chan_lock(self);
+
+    self->ac_closed = true;
+
+    while (self->ac_sendq.awq_head != NULL) async_chan_wake(self, &self->ac_sendq);
+    while (self->ac_recvq.awq_head != NULL) async_chan_wake(self, &self->ac_recvq);
+
+    async_chan_unlock(self);
+}
+
+size_t async_chan_len(async_chan_t *self)
+{
+    size_t len;
+
+    async_chan_lock(self);
+    len = async_chan_used(self);
+    async_chan_unlock(self);
+
+    return len;
+}
+
+/**
+ * Send one item; *rc is 0 on success, -1 if the channel was closed
+ */
+void async_chan_send(crt_t *crt, async_chan_t *chan, const void *item, int *rc)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            async_chan_lock(chan);
+
+            if (chan->ac_closed)
+            {
+                async_chan_unlock(chan);
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            if (async_chan_put(chan, item, 1) > 0)
+            {
+                async_chan_sent(chan);
+                async_chan_unlock(chan);
+                break;
+            }
+
+            async_chan_park(&chan->ac_sendq, self);
+            async_chan_unlock(chan);
+
+            CRT_YIELD();
+        }
+
+        *rc = 0;
+    }
+    CRT_END;
+
+    if (self->at_waitq != NULL || CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt) || (chan->ac_flags & ASYNC_CHAN_SHARED))
+    {
+        async_chan_leave(chan, self, &chan->ac_sendq, CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt));
+    }
+}
+
+/**
+ * Receive one item; *rc is 0 on success, -1 if the channel was closed and
+ * is empty
+ */
+void async_chan_recv(crt_t *crt, async_chan_t *chan, void *item, int *rc)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            async_chan_lock(chan);
+
+            if (async_chan_get(chan, item, 1) > 0)
+            {
+                async_chan_received(chan);
+                async_chan_unlock(chan);
+                break;
+            }
+
+            if (chan->ac_closed)
+            {
+                async_chan_unlock(chan);
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            async_chan_park(&chan->ac_recvq, self);
+            async_chan_unlock(chan);
+
+            CRT_YIELD();
+        }
+
+        *rc = 0;
+    }
+    CRT_END;
+
+    if (self->at_waitq != NULL || CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt) || (chan->ac_flags & ASYNC_CHAN_SHARED))
+    {
+        async_chan_leave(chan, self, &chan->ac_recvq, CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt));
+    }
+}
+
+/**
+ * Send all @p count items, parking whenever the channel is full. *rc is the
+ * number of items sent, less than @p count if the channel was closed.
+ */
+void async_chan_send_many(crt_t *crt, async_chan_t *chan, const void *items, size_t count, size_t *rc)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT_LOCALS(crt, struct { size_t done; }, l)
+    {
+        for (;;)
+        {
+            async_chan_lock(chan);
+
+            if (chan->ac_closed)
+            {
+                async_chan_unlock(chan);
+                *rc = l->done;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            l->done += async_chan_put(chan, (const char *)items + l->done * chan->ac_size, count - l->done);
+            if (l->done >= count)
+            {
+                async_chan_sent(chan);
+                async_chan_unlock(chan);
+                break;
+            }
+
+            /* Partially sent, let a receiver make room */
+            if (async_chan_used(chan) > 0) async_chan_wake(chan, &chan->ac_recvq);
+
+            async_chan_park(&chan->ac_sendq, self);
+            async_chan_unlock(chan);
+
+            CRT_YIELD();
+        }
+
+        *rc = l->done;
+    }
+    CRT_END;
+
+    if (self->at_waitq != NULL || CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt) || (chan->ac_flags & ASYNC_CHAN_SHARED))
+    {
+        async_chan_leave(chan, self, &chan->ac_sendq, CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt));
+    }
+}
+
+/**
+ * Receive between 1 and @p max items, parking while the channel is empty.
+ * *rc is the number of items received, 0 if the channel was closed and is
+ * empty.
+ */
+void async_chan_recv_many(crt_t *crt, async_chan_t *chan, void *items, size_t max, size_t *rc)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            async_chan_lock(chan);
+
+            *rc = async_chan_get(chan, items, max);
+            if (*rc > 0)
+            {
+                async_chan_received(chan);
+                async_chan_unlock(chan);
+                break;
+            }
+
+            if (chan->ac_closed)
+            {
+                async_chan_unlock(chan);
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            async_chan_park(&chan->ac_recvq, self);
+            async_chan_unlock(chan);
+
+            CRT_YIELD();
+        }
+    }
+    CRT_END;
+
+    if (self->at_waitq != NULL || CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt) || (chan->ac_flags & ASYNC_CHAN_SHARED))
+    {
+        async_chan_leave(chan, self, &chan->ac_recvq, CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt));
+    }
+}
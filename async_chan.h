@@ -0,0 +1,48 @@
+#if !defined(ASYNC_CHAN_H_INCLUDED)
+#define ASYNC_CHAN_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "async.h"
+
+/*
+ * Bounded channels of fixed-size items between tasks. Tasks that find the
+ * channel full (send) or empty (recv) park on the channel's wait queue until
+ * the other side makes progress.
+ *
+ * A local channel is used by tasks of a single loop and takes no locks or
+ * atomics; its tasks must not migrate. A shared channel (ASYNC_CHAN_SHARED)
+ * may be used from tasks on any loop.
+ */
+
+#define ASYNC_CHAN_SHARED           (1 << 0)            /* Used across loops/threads */
+
+typedef struct async_chan async_chan_t;
+
+struct async_chan
+{
+    char           *ac_buf;                 /* Ring of ac_mask + 1 items */
+    size_t          ac_size;                /* Item size */
+    size_t          ac_mask;                /* Capacity - 1, capacity is a power of 2 */
+    size_t          ac_head;                /* Next item to receive */
+    size_t          ac_tail;                /* Next slot to send to */
+    async_waitq_t   ac_sendq;               /* Senders waiting for space */
+    async_waitq_t   ac_recvq;               /* Receivers waiting for items */
+    unsigned        ac_flags;               /* ASYNC_CHAN_* */
+    bool            ac_closed;              /* No more sends accepted */
+    atomic_flag     ac_lock;                /* Shared channels only */
+};
+
+extern int async_chan_init(async_chan_t *self, size_t size, size_t capacity, unsigned flags);
+extern void async_chan_fini(async_chan_t *self);
+extern void async_chan_close(async_chan_t *self);
+extern size_t async_chan_len(async_chan_t *self);
+
+extern void async_chan_send(crt_t *crt, async_chan_t *chan, const void *item, int *rc);
+extern void async_chan_recv(crt_t *crt, async_chan_t *chan, void *item, int *rc);
+extern void async_chan_send_many(crt_t *crt, async_chan_t *chan, const void *items, size_t count, size_t *rc);
+extern void async_chan_recv_many(crt_t *crt, async_chan_t *chan, void *items, size_t max, size_t *rc);
+
+#endif /* ASYNC_CHAN_H_INCLUDED */
@@ -0,0 +1,76 @@
+#include <stdio.h>
+
+#include "crt.h"
+#include "async.h"
+
+/*
+ * Example of two async tasks, the first one cancels the second one
+ */
+async_task_t t1;
+async_task_t t2;
+
+
+int task_t(crt_t *crt, void *data)
+{
+    (void)data;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < 3; l->ii++)
+        {
+            printf("T1 = %d\n", l->ii);
+            CRT_AWAIT(async_task_sleep(crt, 1.0), -1);
+        }
+
+    }
+    CRT_END;
+
+    printf("t1 ENDED = %d\n", CRT_STATUS(crt));
+
+    printf("t1 will cancel t2 now\n");
+    async_task_cancel(&t2);
+
+    return 1;
+}
+
+int task_t2(crt_t *crt, void *data)
+{
+    (void)data;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < 10; l->ii++)
+        {
+            printf("T2 = %d\n", l->ii);
+            CRT_AWAIT(async_task_sleep(crt, 1.0), -1);
+        }
+    }
+    CRT_END;
+
+
+    if (CRT_CANCELLED(crt))
+    {
+        printf("t2 was cancelled\n");
+    }
+    else
+    {
+        printf("t2 ENDED: %d\n", CRT_STATUS(crt));
+    }
+
+
+    return 2;
+}
+
+int main(void)
+{
+
+    async_task_start(&t1, task_t, NULL);
+    async_task_start(&t2, task_t2, NULL);
+
+    async_loop_run(async_loop_default());
+
+    printf("MAIN EXIT: t1 = %d, t2 = %d\n", t1.at_returncode, t2.at_returncode);
+
+    return 0;
+}
+
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ev.h>
+
+#include "async.h"
+#include "async_io.h"
+#include "async_uring.h"
+
+#define ASYNC_IO_AGAIN(e)       ((e) == EAGAIN || (e) == EWOULDBLOCK)
+
+/*
+ * Loops with an io_uring hand the whole awaitable to async_uring.c, which
+ * runs it at the same frame depth
+ */
+#if defined(__linux__)
+#define ASYNC_IO_URING(crt)     (ASYNC_TASK(crt)->at_loop->al_uring != NULL)
+#else
+#define ASYNC_IO_URING(crt)     false
+#endif
+
+/**
+ * Readiness callback: one-shot, the watcher is stopped before the task is
+ * woken so that a runnable task never holds an armed watcher
+ */
+void async_io_fn(struct ev_loop *loop, ev_io *w, int revents)
+{
+    (void)revents;
+
+    ev_io_stop(loop, w);
+    async_task_wake(w->data, w);
+}
+
+int async_io_nonblock(int fd)
+{
+    int flags;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Wait until @p fd becomes ready for @p events (EV_READ and/or EV_WRITE)
+ */
+void async_io_wait(crt_t *crt, int fd, int events)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_io_wait(crt, fd, events);
+        return;
+    }
+
+    CRT(crt)
+    {
+        ev_io_set(&self->at_io, fd, events);
+        ev_io_start(self->at_loop->al_ev, &self->at_io);
+
+        do
+        {
+            CRT_YIELD();
+        }
+        while (ev_is_active(&self->at_io));
+    }
+    CRT_END;
+
+    ev_io_stop(self->at_loop->al_ev, &self->at_io);
+}
+
+/**
+ * Read up to @p len bytes; *rc is 0 on end of file
+ */
+void async_read(crt_t *crt, int fd, void *buf, size_t len, ssize_t *rc)
+{
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_read(crt, fd, buf, len, rc);
+        return;
+    }
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            *rc = read(fd, buf, len);
+            if (*rc >= 0) break;
+
+            if (errno == EINTR) continue;
+            if (!ASYNC_IO_AGAIN(errno)) CRT_EXIT(CRT_ERROR);
+
+            CRT_AWAIT(async_io_wait(crt, fd, EV_READ));
+        }
+    }
+    CRT_END;
+}
+
+/**
+ * Write all of @p buf; *rc is @p len on success
+ */
+void async_write(crt_t *crt, int fd, const void *buf, size_t len, ssize_t *rc)
+{
+    ssize_t n;
+
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_write(crt, fd, buf, len, rc);
+        return;
+    }
+
+    CRT_LOCALS(crt, struct { size_t done; }, l)
+    {
+        while (l->done < len)
+        {
+            n = write(fd, (const char *)buf + l->done, len - l->done);
+            if (n >= 0)
+            {
+                l->done += n;
+                continue;
+            }
+
+            if (errno == EINTR) continue;
+            if (!ASYNC_IO_AGAIN(errno))
+            {
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            CRT_AWAIT(async_io_wait(crt, fd, EV_WRITE));
+        }
+
+        *rc = l->done;
+    }
+    CRT_END;
+}
+
+/**
+ * Write all of @p iov; the vectors are advanced in place as data is written
+ */
+void async_writev(crt_t *crt, int fd, struct iovec *iov, int iovcnt, ssize_t *rc)
+{
+    ssize_t n;
+
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_writev(crt, fd, iov, iovcnt, rc);
+        return;
+    }
+
+    CRT_LOCALS(crt, struct { size_t done; int first; }, l)
+    {
+        for (;;)
+        {
+            while (l->first < iovcnt && iov[l->first].iov_len == 0) l->first++;
+            if (l->first >= iovcnt) break;
+
+            n = writev(fd, iov + l->first, iovcnt - l->first);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                if (!ASYNC_IO_AGAIN(errno))
+                {
+                    *rc = -1;
+                    CRT_EXIT(CRT_ERROR);
+                }
+
+                CRT_AWAIT(async_io_wait(crt, fd, EV_WRITE));
+                continue;
+            }
+
+            l->done += n;
+
+            /* Consume the written part */
+            while (n > 0)
+            {
+                size_t chunk = iov[l->first].iov_len < (size_t)n ? iov[l->first].iov_len : (size_t)n;
+
+                iov[l->first].iov_base = (char *)iov[l->first].iov_base + chunk;
+                iov[l->first].iov_len -= chunk;
+                n -= chunk;
+
+                if (iov[l->first].iov_len == 0) l->first++;
+            }
+        }
+
+        *rc = l->done;
+    }
+    CRT_END;
+}
+
+/**
+ * Accept a connection; the new socket is non-blocking. *rc is the new
+ * descriptor.
+ */
+void async_accept(crt_t *crt, int fd, struct sockaddr *addr, socklen_t *addrlen, int *rc)
+{
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_accept(crt, fd, addr, addrlen, rc);
+        return;
+    }
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+#if defined(__linux__)
+            *rc = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+            *rc = accept(fd, addr, addrlen);
+            if (*rc >= 0 && async_io_nonblock(*rc) != 0)
+            {
+                close(*rc);
+                *rc = -1;
+            }
+#endif
+            if (*rc >= 0) break;
+
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (!ASYNC_IO_AGAIN(errno)) CRT_EXIT(CRT_ERROR);
+
+            CRT_AWAIT(async_io_wait(crt, fd, EV_READ));
+        }
+    }
+    CRT_END;
+}
+
+/**
+ * Connect the non-blocking socket @p fd; *rc is 0 on success
+ */
+void async_connect(crt_t *crt, int fd, const struct sockaddr *addr, socklen_t addrlen, int *rc)
+{
+    socklen_t errlen;
+    int err;
+
+    CRT(crt)
+    {
+        *rc = connect(fd, addr, addrlen);
+        if (*rc == 0) CRT_EXIT(CRT_OK);
+        if (errno != EINPROGRESS && errno != EINTR) CRT_EXIT(CRT_ERROR);
+
+        CRT_AWAIT(async_io_wait(crt, fd, EV_WRITE));
+
+        errlen = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) err = errno;
+        if (err != 0)
+        {
+            errno = err;
+            *rc = -1;
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        *rc = 0;
+    }
+    CRT_END;
+}
+
+/**
+ * Flush @p fd to storage; *rc is 0 on success. Without an io_uring this
+ * blocks the loop for the duration of fsync(), see async_offload() for
+ * slow storage.
+ */
+void async_fsync(crt_t *crt, int fd, int *rc)
+{
+    if (ASYNC_IO_URING(crt))
+    {
+        async_uring_fsync(crt, fd, rc);
+        return;
+    }
+
+    CRT(crt)
+    {
+        while ((*rc = fsync(fd)) != 0)
+        {
+            if (errno != EINTR) CRT_EXIT(CRT_ERROR);
+        }
+    }
+    CRT_END;
+}
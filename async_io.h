@@ -0,0 +1,33 @@
+#if !defined(ASYNC_IO_H_INCLUDED)
+#define ASYNC_IO_H_INCLUDED
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "async.h"
+
+/*
+ * Non-blocking I/O awaitables. All of them try the system call first and park
+ * the task on its at_io watcher only if it would block. Results follow the
+ * system call conventions: -1 and errno on error.
+ *
+ * Arguments are evaluated again on every resume, so they must not change
+ * between resumes of the same CRT_AWAIT().
+ *
+ * On a loop with an io_uring (see async_uring.h) the same awaitables submit
+ * ring operations instead.
+ */
+
+extern void async_io_fn(struct ev_loop *loop, ev_io *w, int revents);
+extern int async_io_nonblock(int fd);
+
+extern void async_io_wait(crt_t *crt, int fd, int events);
+extern void async_read(crt_t *crt, int fd, void *buf, size_t len, ssize_t *rc);
+extern void async_write(crt_t *crt, int fd, const void *buf, size_t len, ssize_t *rc);
+extern void async_writev(crt_t *crt, int fd, struct iovec *iov, int iovcnt, ssize_t *rc);
+extern void async_accept(crt_t *crt, int fd, struct sockaddr *addr, socklen_t *addrlen, int *rc);
+extern void async_connect(crt_t *crt, int fd, const struct sockaddr *addr, socklen_t addrlen, int *rc);
+extern void async_fsync(crt_t *crt, int fd, int *rc);
+
+#endif /* ASYNC_IO_H_INCLUDED */
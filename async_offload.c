@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "async.h"
+#include "async_offload.h"
+
+/*
+ * A call slot belongs to the task from async_offload() until the completion
+ * is handled on the task's loop. A task that unwinds before that only marks
+ * the slot abandoned: the pool thread skips the call if it has not started
+ * yet, and the completion returns the slot to the pool.
+ */
+
+static void *async_pool_thread(void *arg);
+static void async_offload_done_fn(async_loop_t *loop, async_post_t *post);
+
+/**
+ * Start a pool of @p nthreads threads with @p queue_max call slots, i.e. at
+ * most that many calls queued or running; 0 selects the defaults
+ *
+ * @return 0 on success, -1 on error
+ */
+int async_pool_init(async_pool_t *self, int nthreads, size_t queue_max)
+{
+    size_t ii;
+
+    memset(self, 0, sizeof(*self));
+
+    if (nthreads <= 0) nthreads = ASYNC_POOL_THREADS;
+    if (queue_max == 0) queue_max = ASYNC_POOL_QUEUE;
+
+    self->apl_tail = &self->apl_head;
+    async_waitq_init(&self->apl_waiters);
+
+    self->apl_jobs = calloc(queue_max, sizeof(*self->apl_jobs));
+    self->apl_threads = calloc(nthreads, sizeof(*self->apl_threads));
+    if (self->apl_jobs == NULL || self->apl_threads == NULL) goto error;
+
+    for (ii = queue_max; ii > 0; ii--)
+    {
+        async_job_t *job = &self->apl_jobs[ii - 1];
+
+        job->aj_pool = self;
+        job->aj_post.ap_fn = async_offload_done_fn;
+        job->aj_next = self->apl_free;
+        self->apl_free = job;
+    }
+
+    pthread_mutex_init(&self->apl_mutex, NULL);
+    pthread_cond_init(&self->apl_cond, NULL);
+
+    for (self->apl_nthreads = 0; self->apl_nthreads < nthreads; self->apl_nthreads++)
+    {
+        if (pthread_create(&self->apl_threads[self->apl_nthreads], NULL, async_pool_thread, self) != 0)
+        {
+            async_pool_fini(self);
+            return -1;
+        }
+    }
+
+    return 0;
+
+error:
+    free(self->apl_jobs);
+    free(self->apl_threads);
+    return -1;
+}
+
+/**
+ * Stop the pool once the queued calls ran. Tasks must not wait for the pool
+ * anymore and all completions must have been handled by their loops.
+ */
+void async_pool_fini(async_pool_t *self)
+{
+    int ii;
+
+    pthread_mutex_lock(&self->apl_mutex);
+    self->apl_stop = true;
+    pthread_cond_broadcast(&self->apl_cond);
+    pthread_mutex_unlock(&self->apl_mutex);
+
+    for (ii = 0; ii < self->apl_nthreads; ii++) pthread_join(self->apl_threads[ii], NULL);
+
+    pthread_cond_destroy(&self->apl_cond);
+    pthread_mutex_destroy(&self->apl_mutex);
+
+    free(self->apl_threads);
+    free(self->apl_jobs);
+    self->apl_threads = NULL;
+    self->apl_jobs = NULL;
+    self->apl_nthreads = 0;
+}
+
+void *async_pool_thread(void *arg)
+{
+    async_pool_t *self = arg;
+    async_job_t *job;
+
+    pthread_mutex_lock(&self->apl_mutex);
+
+    for (;;)
+    {
+        while (self->apl_head == NULL && !self->apl_stop)
+        {
+            pthread_cond_wait(&self->apl_cond, &self->apl_mutex);
+        }
+
+        if ((job = self->apl_head) == NULL) break;
+
+        self->apl_head = job->aj_next;
+        if (self->apl_head == NULL) self->apl_tail = &self->apl_head;
+
+        pthread_mutex_unlock(&self->apl_mutex);
+
+        if (!atomic_load_explicit(&job->aj_abandoned, memory_order_acquire)) job->aj_fn(job->aj_arg);
+
+        async_loop_post(job->aj_loop, &job->aj_post);
+
+        pthread_mutex_lock(&self->apl_mutex);
+    }
+
+    pthread_mutex_unlock(&self->apl_mutex);
+
+    return NULL;
+}
+
+/* Wake the longest waiting task if a slot is free, with apl_mutex held */
+static void async_pool_wake(async_pool_t *self)
+{
+    async_task_t *task;
+
+    if (self->apl_free == NULL) return;
+
+    task = async_waitq_pop(&self->apl_waiters);
+    if (task != NULL) async_task_wake_from_any_thread(task);
+}
+
+static async_job_t *async_pool_get(async_pool_t *self)
+{
+    async_job_t *job;
+
+    pthread_mutex_lock(&self->apl_mutex);
+
+    job = self->apl_free;
+    if (job != NULL) self->apl_free = job->aj_next;
+
+    pthread_mutex_unlock(&self->apl_mutex);
+
+    return job;
+}
+
+static void async_pool_put(async_pool_t *self, async_job_t *job)
+{
+    pthread_mutex_lock(&self->apl_mutex);
+
+    job->aj_next = self->apl_free;
+    self->apl_free = job;
+    async_pool_wake(self);
+
+    pthread_mutex_unlock(&self->apl_mutex);
+}
+
+static bool async_pool_parked(async_pool_t *self, async_task_t *task)
+{
+    bool parked;
+
+    pthread_mutex_lock(&self->apl_mutex);
+    parked = (task->at_waitq != NULL);
+    pthread_mutex_unlock(&self->apl_mutex);
+
+    return parked;
+}
+
+/* Leave the wait queue, or pass on a wakeup that will not be used */
+static void async_pool_leave(async_pool_t *self, async_task_t *task)
+{
+    pthread_mutex_lock(&self->apl_mutex);
+
+    if (task->at_waitq != NULL)
+    {
+        async_waitq_remove(task);
+    }
+    else
+    {
+        async_pool_wake(self);
+    }
+
+    pthread_mutex_unlock(&self->apl_mutex);
+}
+
+/*
+ * Park until a call slot is free -- backpressure once all slots are in flight
+ */
+static void async_pool_wait(crt_t *crt, async_pool_t *pool)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    bool parked;
+
+    CRT(crt)
+    {
+        pthread_mutex_lock(&pool->apl_mutex);
+
+        parked = (pool->apl_free == NULL);
+        if (parked) async_waitq_push(&pool->apl_waiters, self);
+
+        pthread_mutex_unlock(&pool->apl_mutex);
+
+        if (!parked) CRT_EXIT(CRT_OK);
+
+        do
+        {
+            CRT_YIELD();
+        }
+        while (async_pool_parked(pool, self));
+    }
+    CRT_END;
+
+    if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) async_pool_leave(pool, self);
+}
+
+/*
+ * The completion of a call reached the loop of its task
+ */
+void async_offload_done_fn(async_loop_t *loop, async_post_t *post)
+{
+    async_job_t *job = (async_job_t *)post;
+
+    ev_unref(loop->al_ev);
+
+    if (atomic_load_explicit(&job->aj_abandoned, memory_order_relaxed))
+    {
+        async_pool_put(job->aj_pool, job);
+        return;
+    }
+
+    job->aj_done = true;
+    async_task_wake(job->aj_task, job);
+}
+
+static void async_offload_wait(crt_t *crt, async_job_t *job)
+{
+    CRT(crt)
+    {
+        while (!job->aj_done) CRT_YIELD();
+    }
+    CRT_END;
+}
+
+/**
+ * Run the blocking call fn(arg) on a pool thread and wait for it to
+ * complete. If the task is cancelled or times out meanwhile, the call is
+ * skipped if it has not started yet, otherwise it still runs to completion
+ * and @p arg must stay valid until then.
+ */
+void async_offload(crt_t *crt, async_pool_t *pool, async_offload_fn *fn, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT_LOCALS(crt, struct { async_job_t *job; }, l)
+    {
+        while ((l->job = async_pool_get(pool)) == NULL)
+        {
+            CRT_AWAIT(async_pool_wait(crt, pool));
+        }
+
+        l->job->aj_fn = fn;
+        l->job->aj_arg = arg;
+        l->job->aj_task = self;
+        l->job->aj_loop = self->at_loop;
+        l->job->aj_done = false;
+        atomic_store_explicit(&l->job->aj_abandoned, false, memory_order_relaxed);
+
+        pthread_mutex_lock(&pool->apl_mutex);
+
+        l->job->aj_next = NULL;
+        *pool->apl_tail = l->job;
+        pool->apl_tail = &l->job->aj_next;
+        pthread_cond_signal(&pool->apl_cond);
+
+        pthread_mutex_unlock(&pool->apl_mutex);
+
+        /* A call in flight keeps the loop alive until its completion arrives */
+        ev_ref(l->job->aj_loop->al_ev);
+
+        CRT_AWAIT_NC(async_offload_wait(crt, l->job));
+
+        if (!l->job->aj_done)
+        {
+            /* Unwound while the call is in flight, its completion frees the slot */
+            atomic_store_explicit(&l->job->aj_abandoned, true, memory_order_release);
+            CRT_EXIT(CRT_STATUS(crt));
+        }
+
+        async_pool_put(pool, l->job);
+
+        /* The call completed, but the wait was cut short all the same */
+        if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) CRT_EXIT(CRT_STATUS(crt));
+    }
+    CRT_END;
+}
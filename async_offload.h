@@ -0,0 +1,62 @@
+#if !defined(ASYNC_OFFLOAD_H_INCLUDED)
+#define ASYNC_OFFLOAD_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "async.h"
+
+/*
+ * Thread pool for blocking calls (stat(), fsync(), compression, ...). A task
+ * hands a call to the pool and parks; the call runs on a pool thread and
+ * its completion is posted back to the task's loop, where completions that
+ * arrive together cost one loop wakeup.
+ *
+ * The pool has a fixed number of call slots. Once they are all in flight,
+ * further tasks park until one frees up.
+ *
+ *      CRT_AWAIT(async_offload(crt, &pool, do_fsync, &req));
+ */
+
+#define ASYNC_POOL_THREADS          4                   /* Default pool threads */
+#define ASYNC_POOL_QUEUE            256                 /* Default call slots */
+
+typedef void async_offload_fn(void *arg);
+typedef struct async_pool async_pool_t;
+typedef struct async_job async_job_t;
+
+struct async_job
+{
+    async_post_t    aj_post;                /* Completion, posted to aj_loop */
+    async_job_t    *aj_next;                /* Queue / free list link */
+    async_pool_t   *aj_pool;                /* Owning pool */
+    async_offload_fn *aj_fn;                /* Blocking call */
+    void           *aj_arg;                 /* Its argument */
+    async_task_t   *aj_task;                /* Task waiting for it */
+    async_loop_t   *aj_loop;                /* Loop of that task */
+    bool            aj_done;                /* Completed, set on the loop thread */
+    atomic_bool     aj_abandoned;           /* Task unwound, nobody waits for it */
+};
+
+struct async_pool
+{
+    pthread_mutex_t apl_mutex;              /* Guards everything below */
+    pthread_cond_t  apl_cond;               /* Signalled when calls are queued */
+    pthread_t      *apl_threads;            /* Pool threads */
+    int             apl_nthreads;           /* Number of pool threads */
+    async_job_t    *apl_jobs;               /* Call slots */
+    async_job_t    *apl_free;               /* Free call slots */
+    async_job_t    *apl_head;               /* Queued calls, oldest first */
+    async_job_t   **apl_tail;               /* Queue tail link */
+    async_waitq_t   apl_waiters;            /* Tasks waiting for a free slot */
+    bool            apl_stop;               /* Threads exit once the queue is empty */
+};
+
+extern int async_pool_init(async_pool_t *self, int nthreads, size_t queue_max);
+extern void async_pool_fini(async_pool_t *self);
+
+extern void async_offload(crt_t *crt, async_pool_t *pool, async_offload_fn *fn, void *arg);
+
+#endif /* ASYNC_OFFLOAD_H_INCLUDED */
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ev.h>
+
+#include "async.h"
+#include "async_rt.h"
+
+static _Thread_local async_worker_t *async_worker_current;
+
+static void async_worker_wakeup_fn(struct ev_loop *loop, ev_async *w, int revents);
+static void async_worker_surplus_fn(async_loop_t *loop);
+static void async_worker_starved_fn(async_loop_t *loop);
+static void *async_worker_thread(void *arg);
+
+/*
+ * Chase-Lev deque with the C11 memory orderings from "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Le et al.). Fixed size, the owner
+ * simply keeps the task local when it is full.
+ */
+static bool async_deque_push(async_deque_t *self, async_task_t *task)
+{
+    long b = atomic_load_explicit(&self->ad_bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&self->ad_top, memory_order_acquire);
+
+    if (b - t >= ASYNC_DEQUE_SIZE) return false;
+
+    atomic_store_explicit(&self->ad_buf[b & (ASYNC_DEQUE_SIZE - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->ad_bottom, b + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static async_task_t *async_deque_take(async_deque_t *self)
+{
+    async_task_t *task = NULL;
+    long b;
+    long t;
+
+    b = atomic_load_explicit(&self->ad_bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&self->ad_bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&self->ad_top, memory_order_relaxed);
+
+    if (t <= b)
+    {
+        task = atomic_load_explicit(&self->ad_buf[b & (ASYNC_DEQUE_SIZE - 1)], memory_order_relaxed);
+        if (t == b)
+        {
+            /* Last element, race against thieves */
+            if (!atomic_compare_exchange_strong_explicit(&self->ad_top, &t, t + 1,
+                        memory_order_seq_cst, memory_order_relaxed))
+            {
+                task = NULL;
+            }
+            atomic_store_explicit(&self->ad_bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else
+    {
+        atomic_store_explicit(&self->ad_bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+/**
+ * Steal from the top; NULL if empty or if another thief won the race
+ */
+static async_task_t *async_deque_steal(async_deque_t *self)
+{
+    async_task_t *task;
+    long t;
+    long b;
+
+    t = atomic_load_explicit(&self->ad_top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&self->ad_bottom, memory_order_acquire);
+
+    if (t >= b) return NULL;
+
+    task = atomic_load_explicit(&self->ad_buf[t & (ASYNC_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&self->ad_top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed))
+    {
+        return NULL;
+    }
+
+    return task;
+}
+
+/**
+ * Create @p nworkers workers, each with its own ev_loop. If @p pin is set,
+ * worker n is pinned to CPU n (modulo the number of online CPUs).
+ */
+int async_runtime_init(async_runtime_t *self, int nworkers, bool pin)
+{
+    async_worker_t *worker;
+    struct ev_loop *loop;
+    long ncpus;
+    int ii;
+
+    memset(self, 0, sizeof(*self));
+
+    self->ar_steal = true;
+    self->ar_workers = aligned_alloc(_Alignof(async_worker_t), nworkers * sizeof(*self->ar_workers));
+    if (self->ar_workers == NULL) return -1;
+
+    memset(self->ar_workers, 0, nworkers * sizeof(*self->ar_workers));
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1) ncpus = 1;
+
+    for (ii = 0; ii < nworkers; ii++)
+    {
+        worker = &self->ar_workers[ii];
+
+        loop = ev_loop_new(EVFLAG_AUTO);
+        if (loop == NULL) break;
+
+        async_loop_init(&worker->awr_loop, loop);
+        worker->awr_loop.al_owner = worker;
+        worker->awr_loop.al_surplus_fn = async_worker_surplus_fn;
+        worker->awr_loop.al_starved_fn = async_worker_starved_fn;
+
+        worker->awr_rt = self;
+        worker->awr_index = ii;
+        worker->awr_cpu = pin ? (int)(ii % ncpus) : -1;
+
+        /* Keeps the worker loop alive until the runtime is stopped */
+        ev_async_init(&worker->awr_wakeup, async_worker_wakeup_fn);
+        worker->awr_wakeup.data = worker;
+        ev_async_start(loop, &worker->awr_wakeup);
+
+        self->ar_nworkers++;
+    }
+
+    if (self->ar_nworkers != nworkers)
+    {
+        async_runtime_fini(self);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Enable or disable work stealing; only while the runtime is not running
+ */
+void async_runtime_steal(async_runtime_t *self, bool enable)
+{
+    self->ar_steal = enable;
+}
+
+int async_runtime_start(async_runtime_t *self)
+{
+    int ii;
+
+    for (ii = 0; ii < self->ar_nworkers; ii++)
+    {
+        if (pthread_create(&self->ar_workers[ii].awr_thread, NULL, async_worker_thread, &self->ar_workers[ii]) != 0)
+        {
+            /* Stop the ones that are already running */
+            self->ar_nworkers = ii;
+            self->ar_running = true;
+            async_runtime_stop(self);
+            return -1;
+        }
+    }
+
+    self->ar_running = true;
+
+    return 0;
+}
+
+/**
+ * Break all worker loops and join the threads. Tasks that did not finish
+ * are left as they are.
+ */
+void async_runtime_stop(async_runtime_t *self)
+{
+    int ii;
+
+    if (!self->ar_running) return;
+
+    atomic_store(&self->ar_stop, true);
+
+    for (ii = 0; ii < self->ar_nworkers; ii++)
+    {
+        ev_async_send(self->ar_workers[ii].awr_loop.al_ev, &self->ar_workers[ii].awr_wakeup);
+    }
+
+    for (ii = 0; ii < self->ar_nworkers; ii++)
+    {
+        pthread_join(self->ar_workers[ii].awr_thread, NULL);
+    }
+
+    self->ar_running = false;
+}
+
+void async_runtime_fini(async_runtime_t *self)
+{
+    async_worker_t *worker;
+    struct ev_loop *loop;
+    int ii;
+
+    async_runtime_stop(self);
+
+    for (ii = 0; ii < self->ar_nworkers; ii++)
+    {
+        worker = &self->ar_workers[ii];
+        loop = worker->awr_loop.al_ev;
+
+        ev_async_stop(loop, &worker->awr_wakeup);
+        async_loop_fini(&worker->awr_loop);
+        ev_loop_destroy(loop);
+    }
+
+    free(self->ar_workers);
+    self->ar_workers = NULL;
+    self->ar_nworkers = 0;
+}
+
+async_worker_t *async_runtime_worker(async_runtime_t *self, int index)
+{
+    return &self->ar_workers[index % self->ar_nworkers];
+}
+
+/**
+ * Worker of the calling thread, NULL if not called from a worker
+ */
+async_worker_t *async_worker_self(void)
+{
+    return async_worker_current;
+}
+
+void *async_worker_thread(void *arg)
+{
+    async_worker_t *self = arg;
+    cpu_set_t cpus;
+
+    if (self->awr_cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(self->awr_cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    async_worker_current = self;
+
+    async_loop_run(&self->awr_loop);
+
+    async_worker_current = NULL;
+
+    return NULL;
+}
+
+void async_worker_wakeup_fn(struct ev_loop *loop, ev_async *w, int revents)
+{
+    (void)revents;
+
+    async_worker_t *self = w->data;
+
+    /* Otherwise a poke, the prepare watcher goes looking for work */
+    if (atomic_load(&self->awr_rt->ar_stop)) ev_break(loop, EVBREAK_ALL);
+}
+
+/**
+ * Wake up one idle worker so that it comes looking for work
+ */
+static void async_worker_poke(async_worker_t *self)
+{
+    async_runtime_t *rt = self->awr_rt;
+    async_worker_t *other;
+    int ii;
+
+    for (ii = 1; ii < rt->ar_nworkers; ii++)
+    {
+        other = &rt->ar_workers[(self->awr_index + ii) % rt->ar_nworkers];
+
+        if (atomic_load_explicit(&other->awr_idle, memory_order_relaxed) &&
+                atomic_exchange(&other->awr_idle, false))
+        {
+            ev_async_send(other->awr_loop.al_ev, &other->awr_wakeup);
+            return;
+        }
+    }
+}
+
+/**
+ * Make a task taken from a deque runnable on this worker
+ */
+static void async_worker_adopt(async_worker_t *self, async_task_t *task)
+{
+    atomic_store_explicit(&task->at_loop, &self->awr_loop, memory_order_release);
+    task->at_queued = false;
+
+    async_task_wake(task, task->at_what_scheduled);
+}
+
+/**
+ * The ready queue is still busy after a full drain pass: move up to half of
+ * the leftover migratable tasks to the deque where idle workers can get them.
+ *
+ * Whatever is still on offer at the end of the next pass was not wanted by
+ * anyone and goes back to the ready queue, so a shared task waits in the
+ * deque for at most one drain pass.
+ */
+void async_worker_surplus_fn(async_loop_t *loop)
+{
+    async_worker_t *self = loop->al_owner;
+    async_task_t *task;
+    unsigned count;
+    unsigned ii;
+    int shared = 0;
+    int taken = 0;
+
+    if (!self->awr_rt->ar_steal || self->awr_rt->ar_nworkers < 2) return;
+
+    /* The other workers are busy too, offer again next pass */
+    while ((task = async_deque_take(&self->awr_deque)) != NULL)
+    {
+        async_worker_adopt(self, task);
+        taken++;
+    }
+
+    if (taken > 0) return;
+
+    count = loop->al_runq_len / 2;
+    if (count > ASYNC_STEAL_BATCH) count = ASYNC_STEAL_BATCH;
+
+    for (ii = 0; ii < count; ii++)
+    {
+        task = async_loop_pop(loop);
+        if (task == NULL) break;
+
+        /* Still logically on a ready queue, wakeups must not queue it locally */
+        task->at_queued = true;
+
+        if (async_task_migratable(task) && async_deque_push(&self->awr_deque, task))
+        {
+            shared++;
+            continue;
+        }
+
+        task->at_queued = false;
+        async_task_wake(task, task->at_what_scheduled);
+    }
+
+    if (shared > 0) async_worker_poke(self);
+}
+
+/**
+ * Nothing to run: take back own surplus first, then steal from the others
+ */
+void async_worker_starved_fn(async_loop_t *loop)
+{
+    async_worker_t *self = loop->al_owner;
+    async_runtime_t *rt = self->awr_rt;
+    async_worker_t *victim;
+    async_task_t *task;
+    int n = 0;
+    int ii;
+
+    if (!rt->ar_steal) return;
+
+    while (n < ASYNC_STEAL_BATCH && (task = async_deque_take(&self->awr_deque)) != NULL)
+    {
+        async_worker_adopt(self, task);
+        n++;
+    }
+
+    if (n > 0) return;
+
+    /* Announce before looking, so that work shared meanwhile results in a poke */
+    atomic_store(&self->awr_idle, true);
+
+    for (ii = 1; ii < rt->ar_nworkers && n == 0; ii++)
+    {
+        victim = &rt->ar_workers[(self->awr_index + ii) % rt->ar_nworkers];
+
+        while (n < ASYNC_STEAL_BATCH / 2 && (task = async_deque_steal(&victim->awr_deque)) != NULL)
+        {
+            async_worker_adopt(self, task);
+            self->awr_stolen++;
+            n++;
+        }
+    }
+
+    if (n > 0) atomic_store(&self->awr_idle, false);
+}
+
+/**
+ * Start a task on @p worker; may be called from any thread. The task is
+ * initialized here and first runs on the worker's loop.
+ */
+void async_task_spawn_on(async_worker_t *worker, async_task_t *self, async_main_t *task_main, void *data)
+{
+    async_task_init(&worker->awr_loop, self, task_main, data);
+
+    /* Same thread, no hand-over required */
+    if (async_worker_current == worker)
+    {
+        async_task_wake(self, NULL);
+        return;
+    }
+
+    async_task_wake_from_any_thread(self);
+}
@@ -0,0 +1,75 @@
+#if !defined(ASYNC_RT_H_INCLUDED)
+#define ASYNC_RT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "async.h"
+
+#if !defined(ASYNC_DEQUE_SIZE)
+#define ASYNC_DEQUE_SIZE            256                 /* Steal deque capacity, power of 2 */
+#endif
+
+#define ASYNC_STEAL_BATCH           32                  /* Max tasks shared/stolen at once */
+
+typedef struct async_runtime async_runtime_t;
+typedef struct async_worker async_worker_t;
+typedef struct async_deque async_deque_t;
+
+/*
+ * Chase-Lev work-stealing deque: the owner pushes and takes at the bottom,
+ * other workers steal from the top
+ */
+struct async_deque
+{
+    _Alignas(64) atomic_long        ad_top;
+    _Alignas(64) atomic_long        ad_bottom;
+    _Atomic(async_task_t *)         ad_buf[ASYNC_DEQUE_SIZE];
+};
+
+/*
+ * Thread-per-core runtime: every worker owns one ev_loop and runs it on its
+ * own (optionally pinned) thread. Tasks stay on their home loop; other
+ * threads hand tasks over through async_task_wake_from_any_thread().
+ *
+ * With work stealing enabled, runnable tasks that hold no loop-bound
+ * resources (armed timer or I/O watcher, group membership, a wait queue) may
+ * be resumed on another worker. Tasks that other tasks touch directly in any
+ * other way (async_task_wake(), cancel) must be marked ASYNC_TASK_PINNED.
+ * Surplus tasks that no idle worker takes within one drain pass of their
+ * loop return to its ready queue.
+ */
+struct async_worker
+{
+    async_loop_t        awr_loop;           /* Worker loop */
+    async_runtime_t    *awr_rt;             /* Owning runtime */
+    int                 awr_index;          /* Worker index */
+    int                 awr_cpu;            /* CPU the thread is pinned to, -1 if none */
+    pthread_t           awr_thread;         /* Worker thread */
+    ev_async            awr_wakeup;         /* Stop/steal notification, keeps the loop alive */
+    async_deque_t       awr_deque;          /* Surplus runnable tasks, open for stealing */
+    atomic_bool         awr_idle;           /* Found nothing to run and is about to block */
+    long                awr_stolen;         /* Tasks this worker stole */
+};
+
+struct async_runtime
+{
+    async_worker_t     *ar_workers;         /* Worker array */
+    int                 ar_nworkers;        /* Number of workers */
+    atomic_bool         ar_stop;            /* Set by async_runtime_stop() */
+    bool                ar_running;         /* Threads were started */
+    bool                ar_steal;           /* Work stealing enabled */
+};
+
+extern int async_runtime_init(async_runtime_t *self, int nworkers, bool pin);
+extern void async_runtime_steal(async_runtime_t *self, bool enable);
+extern int async_runtime_start(async_runtime_t *self);
+extern void async_runtime_stop(async_runtime_t *self);
+extern void async_runtime_fini(async_runtime_t *self);
+extern async_worker_t *async_runtime_worker(async_runtime_t *self, int index);
+extern async_worker_t *async_worker_self(void);
+
+extern void async_task_spawn_on(async_worker_t *worker, async_task_t *self, async_main_t *task_main, void *data);
+
+#endif /* ASYNC_RT_H_INCLUDED */
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "async.h"
+#include "async_snap.h"
+
+/* After ev.h: elf.h defines EV_NONE as a macro */
+#if defined(__linux__)
+#include <link.h>
+#include <elf.h>
+#endif
+
+/*
+ * Records are native endian and native layout, which the build ID pins down
+ * together with everything else. Deadlines and timers are saved as the time
+ * left on the writer's loop clock and rebased on the reader's.
+ */
+
+#define ASYNC_SNAP_ALIGN(n)     (((n) + 7) & ~(size_t)7)
+
+/* Deadlines that expired before the snapshot still have to fire */
+#define ASYNC_SNAP_EXPIRED      1e-9
+
+static uint64_t async_snap_build;
+
+static uint64_t async_snap_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len-- > 0)
+    {
+        hash ^= *p++;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+#if defined(__linux__)
+/*
+ * Hash the GNU build ID note of the main program, or its executable segments
+ * if it was linked without one. The main program is reported first.
+ */
+static int async_snap_phdr_fn(struct dl_phdr_info *info, size_t size, void *arg)
+{
+    uint64_t *hash = arg;
+    const ElfW(Phdr) *ph;
+    const ElfW(Nhdr) *note;
+    const char *p;
+    const char *end;
+    int ii;
+
+    (void)size;
+
+    for (ii = 0; ii < info->dlpi_phnum; ii++)
+    {
+        ph = &info->dlpi_phdr[ii];
+        if (ph->p_type != PT_NOTE) continue;
+
+        p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+        end = p + ph->p_memsz;
+
+        while (p + sizeof(*note) <= end)
+        {
+            note = (const ElfW(Nhdr) *)p;
+            p += sizeof(*note);
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(p, "GNU", 4) == 0)
+            {
+                *hash = async_snap_hash(*hash, p + 4, note->n_descsz);
+                return 1;
+            }
+
+            p += ((note->n_namesz + 3) & ~3u) + ((note->n_descsz + 3) & ~3u);
+        }
+    }
+
+    for (ii = 0; ii < info->dlpi_phnum; ii++)
+    {
+        ph = &info->dlpi_phdr[ii];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+
+        *hash = async_snap_hash(*hash, (const void *)(info->dlpi_addr + ph->p_vaddr), ph->p_filesz);
+    }
+
+    return 1;
+}
+#endif
+
+/**
+ * Identity of the running binary, the same in every process running it
+ */
+uint64_t async_snap_build_id(void)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t layout[] = { sizeof(async_task_t), ASYNC_SNAP_MAGIC };
+
+    if (async_snap_build != 0) return async_snap_build;
+
+    hash = async_snap_hash(hash, layout, sizeof(layout));
+#if defined(__linux__)
+    dl_iterate_phdr(async_snap_phdr_fn, &hash);
+#else
+    hash = async_snap_hash(hash, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+#endif
+
+    async_snap_build = (hash != 0) ? hash : 1;
+
+    return async_snap_build;
+}
+
+/* Functions are stored relative to this one, which moves with the image */
+static int64_t async_snap_fn_offset(async_main_t *fn)
+{
+    return (int64_t)((intptr_t)fn - (intptr_t)async_task_snapshot);
+}
+
+static async_main_t *async_snap_fn(int64_t offset)
+{
+    return (async_main_t *)((intptr_t)async_task_snapshot + (intptr_t)offset);
+}
+
+/* Seconds left until the loop time @p at, 0 for none */
+static double async_snap_left(async_loop_t *loop, double at)
+{
+    double left;
+
+    if (at == 0.0) return 0.0;
+
+    left = at - ev_now(loop->al_ev);
+
+    return (left > ASYNC_SNAP_EXPIRED) ? left : ASYNC_SNAP_EXPIRED;
+}
+
+static double async_snap_at(async_loop_t *loop, double left)
+{
+    return (left > 0.0) ? ev_now(loop->al_ev) + left : 0.0;
+}
+
+/* Stack slots in use: up to the innermost suspended frame and its status */
+static unsigned async_snap_slots(const crt_t *crt)
+{
+    unsigned slots = crt->crt_top + 2;
+
+    return (slots < (unsigned)crt->crt_stack_size) ? slots : (unsigned)crt->crt_stack_size;
+}
+
+/**
+ * Bytes async_task_snapshot() needs for the task
+ */
+size_t async_task_snapshot_size(async_task_t *self)
+{
+    crt_t *crt = &self->at_crt;
+
+    return ASYNC_SNAP_ALIGN(sizeof(async_snap_record_t) + self->at_ndeadlines * sizeof(double) +
+            async_snap_slots(crt) * sizeof(crt_point_t) + crt->crt_locals_top);
+}
+
+/**
+ * Write a snapshot record of the suspended task @p self to @p buf. The task
+ * itself is not touched; it is up to the caller to drop it.
+ *
+ * @return Record size, -1 with errno ENOSPC if @p size is too small, EBUSY if
+ *         the task is running or holds on to loop state, EINVAL if it is done
+ */
+ssize_t async_task_snapshot(async_task_t *self, void *buf, size_t size)
+{
+    async_loop_t *loop = self->at_loop;
+    crt_t *crt = &self->at_crt;
+    async_snap_record_t *rec = buf;
+    size_t need = async_task_snapshot_size(self);
+    char *p;
+    unsigned ii;
+
+    if (self->at_done)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (crt->crt_depth != -1 || atomic_load_explicit(&loop->al_running, memory_order_relaxed) == self ||
+            self->at_waitq != NULL || self->at_group != NULL || self->at_groups != NULL ||
+            self->at_uring_busy || atomic_load(&self->at_remote_queued))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (size < need)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->asr_magic = ASYNC_SNAP_MAGIC;
+    rec->asr_size = need;
+    rec->asr_build = async_snap_build_id();
+    rec->asr_main = async_snap_fn_offset(self->at_main);
+    rec->asr_timer = async_timer_active(loop, &self->at_timer) ? async_timer_remaining(loop, &self->at_timer) : -1.0;
+    rec->asr_deadline = async_snap_left(loop, self->at_deadline);
+    rec->asr_flags = self->at_flags & (ASYNC_TASK_PINNED | ASYNC_TASK_CANCELLED);
+    rec->asr_top = crt->crt_top;
+    rec->asr_stack_size = crt->crt_stack_size;
+    rec->asr_slots = async_snap_slots(crt);
+    rec->asr_locals = crt->crt_locals_top;
+    rec->asr_prio = self->at_prio;
+    rec->asr_ndeadlines = self->at_ndeadlines;
+
+    p = (char *)(rec + 1);
+
+    for (ii = 0; ii < self->at_ndeadlines; ii++)
+    {
+        double left = async_snap_left(loop, self->at_deadlines[ii]);
+
+        memcpy(p, &left, sizeof(left));
+        p += sizeof(left);
+    }
+
+    memcpy(p, crt->crt_stack, rec->asr_slots * sizeof(crt_point_t));
+    p += rec->asr_slots * sizeof(crt_point_t);
+
+    memcpy(p, crt->crt_locals, rec->asr_locals);
+    p += rec->asr_locals;
+
+    memset(p, 0, (char *)buf + need - p);
+
+    return need;
+}
+
+/**
+ * Rebuild a task on @p loop from the snapshot record at @p buf and wake it;
+ * its at_main_data becomes @p data
+ *
+ * @return Record size, -1 with errno ENOEXEC if the record was written by
+ *         another binary, EINVAL if it is malformed, ENOMEM if out of memory
+ */
+ssize_t async_task_restore(async_loop_t *loop, async_task_t *self, const void *buf, size_t size, void *data)
+{
+    const async_snap_record_t *rec = buf;
+    crt_t *crt = &self->at_crt;
+    crt_point_t *stack;
+    const char *p;
+    unsigned ii;
+
+    if (size < sizeof(*rec) || rec->asr_magic != ASYNC_SNAP_MAGIC || rec->asr_size > size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rec->asr_build != async_snap_build_id())
+    {
+        errno = ENOEXEC;
+        return -1;
+    }
+
+    if (rec->asr_size < sizeof(*rec) + rec->asr_ndeadlines * sizeof(double) +
+                rec->asr_slots * sizeof(crt_point_t) + rec->asr_locals ||
+            rec->asr_ndeadlines > ASYNC_DEADLINE_DEPTH || rec->asr_prio >= ASYNC_PRIO_CLASSES ||
+            rec->asr_locals > sizeof(self->at_locals) || rec->asr_slots > rec->asr_stack_size ||
+            rec->asr_stack_size < CRT_STACK_DEPTH || rec->asr_stack_size > CRT_STACK_MAX ||
+            rec->asr_top < 0 || rec->asr_top >= rec->asr_stack_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* A stack that outgrew crt_inline goes back to the heap, at the same size */
+    stack = NULL;
+    if (rec->asr_stack_size > CRT_STACK_DEPTH)
+    {
+        stack = calloc(rec->asr_stack_size, sizeof(*stack));
+        if (stack == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    async_task_init(loop, self, async_snap_fn(rec->asr_main), data);
+    self->at_flags = rec->asr_flags;
+    self->at_prio = rec->asr_prio;
+
+    /* The stack pointer of a snapshot is meaningless, crt_stack is rebased here */
+    if (stack != NULL)
+    {
+        crt->crt_stack = stack;
+        crt->crt_stack_size = rec->asr_stack_size;
+        crt->crt_flags |= CRT_FLAG_GROWN;
+    }
+
+    crt->crt_top = rec->asr_top;
+
+    p = (const char *)(rec + 1);
+
+    self->at_ndeadlines = rec->asr_ndeadlines;
+    for (ii = 0; ii < rec->asr_ndeadlines; ii++)
+    {
+        double left;
+
+        memcpy(&left, p, sizeof(left));
+        self->at_deadlines[ii] = async_snap_at(loop, left);
+        p += sizeof(left);
+    }
+    self->at_deadline = async_snap_at(loop, rec->asr_deadline);
+
+    memcpy(crt->crt_stack, p, rec->asr_slots * sizeof(crt_point_t));
+    p += rec->asr_slots * sizeof(crt_point_t);
+
+    memcpy(crt->crt_locals, p, rec->asr_locals);
+    crt->crt_locals_top = rec->asr_locals;
+
+    if (rec->asr_timer >= 0.0) async_timer_start(loop, &self->at_timer, rec->asr_timer);
+
+    async_task_wake(self, NULL);
+
+    return rec->asr_size;
+}
@@ -0,0 +1,65 @@
+#if !defined(ASYNC_SNAP_H_INCLUDED)
+#define ASYNC_SNAP_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "async.h"
+
+/*
+ * Checkpoint and restore of suspended tasks, e.g. to carry long running
+ * session tasks over a restart of the process.
+ *
+ * A snapshot record holds the task's co-routine stack, the frame-locals in
+ * use, its body function, priority class, the time left on its sleep timer
+ * and its deadlines. Records are stamped with the build ID of the binary and
+ * only restore into the same binary; the body function is stored relative to
+ * the image, which must be the one this library is linked into, so address
+ * randomization does not matter.
+ *
+ *      n = async_task_snapshot(task, buf, size);           // old process
+ *      ...
+ *      n = async_task_restore(loop, task, buf, size, data); // new process
+ *
+ * The restored task is resumed as if woken: waits that check their condition
+ * again carry on (I/O readiness, async_task_sleep()), its sleep and deadlines
+ * keep running from where they were. at_main_data is not saved, the restore
+ * sets it. Everything the task points to must be valid in the new process too:
+ * only plain data in the locals, descriptors inherited at the same numbers.
+ * A task that is parked on a wait queue, belongs to a group, owns one or has
+ * an io_uring operation in flight cannot be snapshot.
+ */
+
+#define ASYNC_SNAP_MAGIC            0x50414e53u         /* "SNAP" */
+
+typedef struct async_snap_record async_snap_record_t;
+
+/*
+ * Fixed part of a record, followed by the deadlines (seconds left, 0 for
+ * none), the co-routine stack slots and the locals, padded to 8 bytes
+ */
+struct async_snap_record
+{
+    uint32_t        asr_magic;              /* ASYNC_SNAP_MAGIC */
+    uint32_t        asr_size;               /* Record size in bytes */
+    uint64_t        asr_build;              /* async_snap_build_id() of the writer */
+    int64_t         asr_main;               /* at_main relative to the image */
+    double          asr_timer;              /* Sleep left in seconds, -1 if not armed */
+    double          asr_deadline;           /* Innermost deadline, seconds left, 0 for none */
+    uint32_t        asr_flags;              /* ASYNC_TASK_PINNED, ASYNC_TASK_CANCELLED */
+    int32_t         asr_top;                /* crt_top */
+    uint16_t        asr_stack_size;         /* crt_stack_size */
+    uint16_t        asr_slots;              /* Stack slots saved */
+    uint16_t        asr_locals;             /* Locals bytes saved */
+    uint8_t         asr_prio;               /* at_prio */
+    uint8_t         asr_ndeadlines;         /* Enclosing deadlines saved */
+};
+
+extern uint64_t async_snap_build_id(void);
+
+extern size_t async_task_snapshot_size(async_task_t *self);
+extern ssize_t async_task_snapshot(async_task_t *self, void *buf, size_t size);
+extern ssize_t async_task_restore(async_loop_t *loop, async_task_t *self, const void *buf, size_t size, void *data);
+
+#endif /* ASYNC_SNAP_H_INCLUDED */
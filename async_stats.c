@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include "async.h"
+#include "async_stats.h"
+
+/*
+ * Clock calibration: the cycle counter and CLOCK_MONOTONIC are sampled once
+ * at first use, the ratio is taken against a second sample when it is
+ * needed for reporting
+ */
+static _Atomic uint64_t async_stats_tick0;
+static _Atomic uint64_t async_stats_ns0;
+
+static uint64_t async_stats_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void async_stats_calibrate(void)
+{
+    uint64_t expect = 0;
+
+    if (atomic_load_explicit(&async_stats_tick0, memory_order_acquire) != 0) return;
+
+    atomic_store_explicit(&async_stats_ns0, async_stats_ns(), memory_order_relaxed);
+    atomic_compare_exchange_strong(&async_stats_tick0, &expect, async_stats_clock());
+}
+
+/**
+ * Nanoseconds per async_stats_clock() tick
+ */
+double async_stats_ns_per_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t tick0;
+    uint64_t ns0;
+    uint64_t ns;
+
+    async_stats_calibrate();
+
+    tick0 = atomic_load_explicit(&async_stats_tick0, memory_order_acquire);
+    ns0 = atomic_load_explicit(&async_stats_ns0, memory_order_relaxed);
+
+    /* Too short a baseline for a useful ratio, stretch it */
+    while ((ns = async_stats_ns()) < ns0 + 10000000) nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+
+    return (double)(ns - ns0) / (double)(async_stats_clock() - tick0);
+#else
+    return 1.0;
+#endif
+}
+
+uint64_t async_hist_count(const async_hist_t *self)
+{
+    uint64_t count = 0;
+    size_t ii;
+
+    for (ii = 0; ii < ASYNC_HIST_BUCKETS; ii++)
+    {
+        count += atomic_load_explicit(&self->ah_count[ii], memory_order_relaxed);
+    }
+
+    return count;
+}
+
+/* Middle of the value range of a bucket */
+static uint64_t async_hist_value(unsigned index)
+{
+    unsigned shift;
+
+    if (index < ASYNC_HIST_SUB) return index;
+
+    shift = index / ASYNC_HIST_SUB - 1;
+
+    return ((uint64_t)(ASYNC_HIST_SUB + index % ASYNC_HIST_SUB) << shift) + ((1ull << shift) >> 1);
+}
+
+/**
+ * Value below which @p percent of the recorded values are, 0 if empty
+ */
+uint64_t async_hist_percentile(const async_hist_t *self, double percent)
+{
+    uint64_t count = async_hist_count(self);
+    uint64_t target;
+    uint64_t sum = 0;
+    unsigned ii;
+
+    if (count == 0) return 0;
+
+    target = (uint64_t)((double)count * percent / 100.0 + 0.5);
+    if (target == 0) target = 1;
+
+    for (ii = 0; ii < ASYNC_HIST_BUCKETS; ii++)
+    {
+        sum += atomic_load_explicit(&self->ah_count[ii], memory_order_relaxed);
+        if (sum >= target) return async_hist_value(ii);
+    }
+
+    return async_hist_value(ASYNC_HIST_BUCKETS - 1);
+}
+
+/**
+ * Add the counts of @p from, which may still be recorded to, to @p self
+ */
+void async_hist_merge(async_hist_t *self, const async_hist_t *from)
+{
+    size_t ii;
+
+    for (ii = 0; ii < ASYNC_HIST_BUCKETS; ii++)
+    {
+        async_stats_add(&self->ah_count[ii], atomic_load_explicit(&from->ah_count[ii], memory_order_relaxed));
+    }
+}
+
+void async_stats_snapshot_init(async_stats_snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+}
+
+void async_stats_snapshot_fini(async_stats_snapshot_t *snap)
+{
+    size_t ii;
+
+    for (ii = 0; ii < snap->ass_count; ii++) free(snap->ass_fn[ii]);
+
+    snap->ass_count = 0;
+}
+
+static const char *async_stats_kind_name[ASYNC_WAIT_KINDS] =
+{
+    "yield", "timer", "io", "remote", "other",
+};
+
+static void async_stats_dump_hist(FILE *out, const char *name, const async_hist_t *hist, double scale)
+{
+    uint64_t count = async_hist_count(hist);
+
+    if (count == 0) return;
+
+    fprintf(out, "    %-8s n %-10llu p50 %10.0f ns  p99 %10.0f ns  p99.9 %10.0f ns\n", name,
+            (unsigned long long)count,
+            (double)async_hist_percentile(hist, 50.0) * scale,
+            (double)async_hist_percentile(hist, 99.0) * scale,
+            (double)async_hist_percentile(hist, 99.9) * scale);
+}
+
+/* Time on CPU of all the resumes, from the timed ones */
+static double async_stats_scaled(uint64_t run, uint64_t timed, uint64_t resumes)
+{
+    return timed == 0 ? 0.0 : (double)run * (double)resumes / (double)timed;
+}
+
+/**
+ * Print the statistics of each function of @p snap, busiest first
+ */
+void async_stats_dump(const async_stats_snapshot_t *snap, FILE *out)
+{
+    const async_stats_fn_t *order[ASYNC_STATS_FUNCS];
+    double run[ASYNC_STATS_FUNCS];
+    const async_stats_fn_t *fs;
+    double scale = snap->ass_ns_per_tick;
+    double fs_run;
+    Dl_info info;
+    size_t ii;
+    size_t jj;
+    int kind;
+
+    /* Insertion sort by time on CPU */
+    for (ii = 0; ii < snap->ass_count; ii++)
+    {
+        fs = snap->ass_fn[ii];
+        fs_run = async_stats_scaled(fs->asf_run, async_hist_count(&fs->asf_run_hist), fs->asf_resumes);
+
+        for (jj = ii; jj > 0 && run[jj - 1] < fs_run; jj--)
+        {
+            order[jj] = order[jj - 1];
+            run[jj] = run[jj - 1];
+        }
+        order[jj] = fs;
+        run[jj] = fs_run;
+    }
+
+    for (ii = 0; ii < snap->ass_count; ii++)
+    {
+        fs = order[ii];
+
+        if (dladdr((void *)(uintptr_t)fs->asf_fn, &info) != 0 && info.dli_sname != NULL)
+        {
+            fprintf(out, "%s:", info.dli_sname);
+        }
+        else
+        {
+            fprintf(out, "%p:", (void *)(uintptr_t)fs->asf_fn);
+        }
+
+        fprintf(out, " %llu resumes, %.3f ms on CPU, longest %.0f ns\n",
+                (unsigned long long)fs->asf_resumes, run[ii] * scale / 1e6,
+                (double)fs->asf_longest * scale);
+
+        async_stats_dump_hist(out, "run", &fs->asf_run_hist, scale);
+        for (kind = 0; kind < ASYNC_WAIT_KINDS; kind++)
+        {
+            async_stats_dump_hist(out, async_stats_kind_name[kind], &fs->asf_park_hist[kind], scale);
+        }
+    }
+}
+
+#if defined(ASYNC_STATS)
+
+static void async_stats_merge(async_stats_fn_t *self, const async_stats_fn_t *from)
+{
+    uint64_t longest;
+    int kind;
+
+    async_stats_add(&self->asf_resumes, atomic_load_explicit(&from->asf_resumes, memory_order_relaxed));
+    async_stats_add(&self->asf_run, atomic_load_explicit(&from->asf_run, memory_order_relaxed));
+
+    longest = atomic_load_explicit(&from->asf_longest, memory_order_relaxed);
+    if (longest > atomic_load_explicit(&self->asf_longest, memory_order_relaxed))
+    {
+        atomic_store_explicit(&self->asf_longest, longest, memory_order_relaxed);
+    }
+
+    async_hist_merge(&self->asf_run_hist, &from->asf_run_hist);
+    for (kind = 0; kind < ASYNC_WAIT_KINDS; kind++)
+    {
+        async_hist_merge(&self->asf_park_hist[kind], &from->asf_park_hist[kind]);
+    }
+}
+
+/**
+ * Find or add the entry of @p fn in the table of @p loop. Called on the
+ * loop thread only, when a task first runs there.
+ *
+ * @return NULL when the table is full or out of memory; the task still
+ * keeps its own counters
+ */
+async_stats_fn_t *async_stats_lookup(async_loop_t *loop, async_main_t *fn)
+{
+    async_stats_t *stats = atomic_load_explicit(&loop->al_stats, memory_order_relaxed);
+    async_stats_fn_t *fs;
+    size_t hash;
+    size_t ii;
+
+    if (stats == NULL)
+    {
+        async_stats_calibrate();
+
+        stats = calloc(1, sizeof(*stats));
+        if (stats == NULL) return NULL;
+
+        atomic_store_explicit(&loop->al_stats, stats, memory_order_release);
+    }
+
+    hash = ((uintptr_t)fn >> 4) * 0x9e3779b97f4a7c15ull >> 32;
+
+    for (ii = 0; ii < ASYNC_STATS_FUNCS; ii++)
+    {
+        _Atomic(async_stats_fn_t *) *slot = &stats->as_fn[(hash + ii) % ASYNC_STATS_FUNCS];
+
+        fs = atomic_load_explicit(slot, memory_order_relaxed);
+        if (fs == NULL)
+        {
+            fs = calloc(1, sizeof(*fs));
+            if (fs == NULL) return NULL;
+
+            fs->asf_fn = fn;
+            atomic_store_explicit(slot, fs, memory_order_release);
+            return fs;
+        }
+
+        if (fs->asf_fn == fn) return fs;
+    }
+
+    return NULL;
+}
+
+static void async_stats_check_fn(struct ev_loop *ev, ev_check *w, int revents)
+{
+    async_loop_t *loop = w->data;
+
+    (void)ev;
+    (void)revents;
+
+    ASYNC_STATS_PASS(loop);
+}
+
+/**
+ * Read the clock once per loop iteration, as soon as polling returns: the
+ * highest priority check watcher runs before the callbacks that wake tasks
+ */
+void async_stats_init(async_loop_t *loop)
+{
+    ev_check_init(&loop->al_stats_check, async_stats_check_fn);
+    loop->al_stats_check.data = loop;
+    ev_set_priority(&loop->al_stats_check, EV_MAXPRI);
+    ev_check_start(loop->al_ev, &loop->al_stats_check);
+    ev_unref(loop->al_ev);
+}
+
+void async_stats_fini(async_loop_t *loop)
+{
+    async_stats_t *stats = atomic_exchange(&loop->al_stats, NULL);
+    size_t ii;
+
+    ev_ref(loop->al_ev);
+    ev_check_stop(loop->al_ev, &loop->al_stats_check);
+
+    if (stats == NULL) return;
+
+    for (ii = 0; ii < ASYNC_STATS_FUNCS; ii++) free(atomic_load(&stats->as_fn[ii]));
+
+    free(stats);
+}
+
+/**
+ * Merge the per function statistics of @p loop into @p snap. May be called
+ * from any thread while the loop runs; counters then lag by a few updates.
+ *
+ * @return 0 on success, -1 if out of memory or @p snap is full
+ */
+int async_stats_snapshot(async_loop_t *loop, async_stats_snapshot_t *snap)
+{
+    async_stats_t *stats = atomic_load_explicit(&loop->al_stats, memory_order_acquire);
+    async_stats_fn_t *from;
+    async_stats_fn_t *to;
+    size_t ii;
+    size_t jj;
+
+    snap->ass_ns_per_tick = async_stats_ns_per_tick();
+
+    if (stats == NULL) return 0;
+
+    for (ii = 0; ii < ASYNC_STATS_FUNCS; ii++)
+    {
+        from = atomic_load_explicit(&stats->as_fn[ii], memory_order_acquire);
+        if (from == NULL) continue;
+
+        for (jj = 0; jj < snap->ass_count && snap->ass_fn[jj]->asf_fn != from->asf_fn; jj++);
+
+        if (jj == snap->ass_count)
+        {
+            if (snap->ass_count == ASYNC_STATS_FUNCS) return -1;
+
+            to = calloc(1, sizeof(*to));
+            if (to == NULL) return -1;
+
+            to->asf_fn = from->asf_fn;
+            snap->ass_fn[snap->ass_count++] = to;
+        }
+
+        async_stats_merge(snap->ass_fn[jj], from);
+    }
+
+    return 0;
+}
+
+/**
+ * Print the counters of a single task
+ */
+void async_task_stats_dump(async_task_t *task, FILE *out)
+{
+    async_task_stats_t *st = &task->at_stats;
+    double scale = async_stats_ns_per_tick();
+    int kind;
+
+    fprintf(out, "task %p: %llu resumes, %.0f ns on CPU, longest %.0f ns, parked", (void *)task,
+            (unsigned long long)st->ats_resumes, async_stats_scaled(st->ats_run, st->ats_timed, st->ats_resumes) * scale,
+            (double)st->ats_longest * scale);
+
+    for (kind = 0; kind < ASYNC_WAIT_KINDS; kind++)
+    {
+        fprintf(out, " %s %.0f ns", async_stats_kind_name[kind],
+                async_stats_scaled(st->ats_parked[kind], st->ats_timed, st->ats_resumes) * scale);
+    }
+
+    fprintf(out, "\n");
+}
+
+#else
+
+async_stats_fn_t *async_stats_lookup(async_loop_t *loop, async_main_t *fn)
+{
+    (void)loop;
+    (void)fn;
+
+    return NULL;
+}
+
+void async_stats_init(async_loop_t *loop)
+{
+    (void)loop;
+}
+
+void async_stats_fini(async_loop_t *loop)
+{
+    (void)loop;
+}
+
+/* Built without ASYNC_STATS, there is nothing to report */
+int async_stats_snapshot(async_loop_t *loop, async_stats_snapshot_t *snap)
+{
+    (void)loop;
+
+    snap->ass_ns_per_tick = 1.0;
+
+    return 0;
+}
+
+void async_task_stats_dump(async_task_t *task, FILE *out)
+{
+    (void)task;
+    (void)out;
+}
+
+#endif /* ASYNC_STATS */
@@ -0,0 +1,250 @@
+#if !defined(ASYNC_STATS_H_INCLUDED)
+#define ASYNC_STATS_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "async.h"
+
+/*
+ * Opt-in scheduler instrumentation, enabled by defining ASYNC_STATS for all
+ * sources (it changes the layout of async_task_t). Without it the hooks
+ * compile to nothing.
+ *
+ * Every resume is counted, but only one in ASYNC_STATS_SAMPLE of each task
+ * is timed: reading the cycle counter costs more than the rest of a resume
+ * on some virtual machines. Times on CPU and parked, the longest resume and
+ * the histograms come from the timed resumes; totals are scaled up to all
+ * of them when reported. Time parked runs from the end of the previous
+ * resume to the wakeup, without the wait in the ready queue; both ends take
+ * the last clock the loop read, at the end of a timed resume or when
+ * polling returned, so short parks round to 0. Resumes that are not timed
+ * cost a few loads and stores, about 10 ns per resume on average at the
+ * default sample rate on a virtual machine that takes 25 ns to read the
+ * clock.
+ *
+ * The task's own counters are in at_stats; per task body function (at_main),
+ * each loop records the resumes, the time on CPU per resume and the time
+ * parked per kind of wakeup (ASYNC_WAIT_*) in log-linear histograms. Only
+ * the loop thread writes them, with plain relaxed stores, so any thread may
+ * take a snapshot at any time without locks.
+ *
+ *      async_stats_snapshot_t snap;
+ *
+ *      async_stats_snapshot_init(&snap);
+ *      async_stats_snapshot(loop, &snap);      // once per loop to merge
+ *      async_stats_dump(&snap, stdout);
+ *      async_stats_snapshot_fini(&snap);
+ *
+ * Function names are looked up with dladdr(), link with -rdynamic to see
+ * those of the executable.
+ */
+
+#if !defined(ASYNC_STATS_FUNCS)
+#define ASYNC_STATS_FUNCS           64                  /* Functions tracked per loop */
+#endif
+
+#if !defined(ASYNC_STATS_SAMPLE)
+#define ASYNC_STATS_SAMPLE          8                   /* Time one resume in that many, power of 2 */
+#endif
+
+/* Histogram buckets: 2^ASYNC_HIST_SUB_BITS per power of 2, 12.5% precision */
+#define ASYNC_HIST_SUB_BITS         3
+#define ASYNC_HIST_SUB              (1 << ASYNC_HIST_SUB_BITS)
+#define ASYNC_HIST_BUCKETS          ((64 - ASYNC_HIST_SUB_BITS + 1) * ASYNC_HIST_SUB)
+
+typedef struct async_hist async_hist_t;
+typedef struct async_stats_fn async_stats_fn_t;
+typedef struct async_stats_snapshot async_stats_snapshot_t;
+
+struct async_hist
+{
+    _Atomic uint64_t    ah_count[ASYNC_HIST_BUCKETS];
+};
+
+struct async_stats_fn
+{
+    async_main_t       *asf_fn;             /* Task body function */
+    _Atomic uint64_t    asf_resumes;        /* Resumes of its tasks */
+    _Atomic uint64_t    asf_run;            /* Time on CPU of the timed resumes */
+    _Atomic uint64_t    asf_longest;        /* Longest timed resume */
+    async_hist_t        asf_run_hist;       /* Time on CPU per timed resume */
+    async_hist_t        asf_park_hist[ASYNC_WAIT_KINDS];    /* Time parked, by wakeup kind */
+};
+
+struct async_stats
+{
+    _Atomic(async_stats_fn_t *) as_fn[ASYNC_STATS_FUNCS];   /* Open addressing by function */
+};
+
+struct async_stats_snapshot
+{
+    async_stats_fn_t   *ass_fn[ASYNC_STATS_FUNCS];  /* Merged per function */
+    size_t              ass_count;
+    double              ass_ns_per_tick;    /* Clock ticks to nanoseconds */
+};
+
+/**
+ * Current time in clock ticks: the cycle counter where there is one
+ */
+static inline uint64_t async_stats_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline unsigned async_hist_index(uint64_t value)
+{
+    unsigned msb;
+
+    if (value < ASYNC_HIST_SUB) return (unsigned)value;
+
+    msb = 63 - __builtin_clzll(value);
+
+    return (msb - ASYNC_HIST_SUB_BITS + 1) * ASYNC_HIST_SUB +
+            (unsigned)((value >> (msb - ASYNC_HIST_SUB_BITS)) & (ASYNC_HIST_SUB - 1));
+}
+
+/* Single writer: a relaxed load and store, no read-modify-write */
+static inline void async_stats_add(_Atomic uint64_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+            memory_order_relaxed);
+}
+
+static inline void async_hist_record(async_hist_t *self, uint64_t value)
+{
+    async_stats_add(&self->ah_count[async_hist_index(value)], 1);
+}
+
+extern async_stats_fn_t *async_stats_lookup(async_loop_t *loop, async_main_t *fn);
+extern void async_stats_init(async_loop_t *loop);
+extern void async_stats_fini(async_loop_t *loop);
+extern uint64_t async_hist_count(const async_hist_t *self);
+extern uint64_t async_hist_percentile(const async_hist_t *self, double percent);
+extern void async_hist_merge(async_hist_t *self, const async_hist_t *from);
+extern void async_stats_snapshot_init(async_stats_snapshot_t *snap);
+extern void async_stats_snapshot_fini(async_stats_snapshot_t *snap);
+extern int async_stats_snapshot(async_loop_t *loop, async_stats_snapshot_t *snap);
+extern void async_stats_dump(const async_stats_snapshot_t *snap, FILE *out);
+extern double async_stats_ns_per_tick(void);
+extern void async_task_stats_dump(async_task_t *task, FILE *out);
+
+#if defined(ASYNC_STATS)
+
+static inline int async_stats_kind(async_task_t *task)
+{
+    void *what = task->at_what_scheduled;
+
+    if (what == task) return ASYNC_WAIT_YIELD;
+    if (what == &task->at_timer || what == &task->at_deadline_timer) return ASYNC_WAIT_TIMER;
+    if (what == &task->at_io) return ASYNC_WAIT_IO;
+    if (what == &task->at_loop->al_remote) return ASYNC_WAIT_REMOTE;
+
+    return ASYNC_WAIT_OTHER;
+}
+
+static inline void async_stats_resume(async_task_t *task)
+{
+    async_task_stats_t *st = &task->at_stats;
+    async_loop_t *loop = task->at_loop;
+    uint64_t woken = st->ats_woken;
+    uint64_t parked;
+    int kind;
+
+    if (st->ats_loop != loop)
+    {
+        st->ats_fn = async_stats_lookup(loop, task->at_main);
+        st->ats_loop = loop;
+    }
+
+    st->ats_woken = 0;
+
+    /* Everything but the count comes from the timed resumes */
+    if ((st->ats_resumes & (ASYNC_STATS_SAMPLE - 1)) != 0) return;
+
+    if (st->ats_park != 0)
+    {
+        /* Woken synchronously by another task, it did not go through the queue */
+        if (woken == 0) woken = loop->al_stats_now;
+
+        /* Woken before its own suspend was stamped, e.g. a yield */
+        parked = woken > st->ats_park ? woken - st->ats_park : 0;
+
+        kind = async_stats_kind(task);
+        st->ats_parked[kind] += parked;
+        if (st->ats_fn != NULL) async_hist_record(&st->ats_fn->asf_park_hist[kind], parked);
+    }
+
+    st->ats_start = async_stats_clock();
+}
+
+static inline void async_stats_suspend(async_task_t *task)
+{
+    async_task_stats_t *st = &task->at_stats;
+    async_stats_fn_t *fs = st->ats_fn;
+    async_loop_t *loop = task->at_loop;
+    uint64_t now;
+    uint64_t slice;
+
+    if ((st->ats_resumes++ & (ASYNC_STATS_SAMPLE - 1)) != 0)
+    {
+        st->ats_park = loop->al_stats_now;
+        if (fs != NULL) async_stats_add(&fs->asf_resumes, 1);
+        return;
+    }
+
+    now = async_stats_clock();
+    slice = now - st->ats_start;
+
+    st->ats_timed++;
+    st->ats_run += slice;
+    if (slice > st->ats_longest) st->ats_longest = slice;
+    st->ats_park = now;
+    loop->al_stats_now = now;
+
+    if (fs == NULL) return;
+
+    async_stats_add(&fs->asf_resumes, 1);
+    async_stats_add(&fs->asf_run, slice);
+    if (slice > atomic_load_explicit(&fs->asf_longest, memory_order_relaxed))
+    {
+        atomic_store_explicit(&fs->asf_longest, slice, memory_order_relaxed);
+    }
+    async_hist_record(&fs->asf_run_hist, slice);
+}
+
+/* Only the first wakeup counts, a queued task may be pushed again */
+static inline void async_stats_wake(async_loop_t *loop, async_task_t *task)
+{
+    if (task->at_stats.ats_woken == 0) task->at_stats.ats_woken = loop->al_stats_now;
+}
+
+#define ASYNC_STATS_INIT(loop)      async_stats_init(loop)
+#define ASYNC_STATS_PASS(loop)      ((loop)->al_stats_now = async_stats_clock())
+#define ASYNC_STATS_RESUME(task)    async_stats_resume(task)
+#define ASYNC_STATS_SUSPEND(task)   async_stats_suspend(task)
+#define ASYNC_STATS_WAKE(loop, task) async_stats_wake(loop, task)
+#define ASYNC_STATS_FINI(loop)      async_stats_fini(loop)
+
+#else
+
+#define ASYNC_STATS_INIT(loop)      ((void)0)
+#define ASYNC_STATS_PASS(loop)      ((void)0)
+#define ASYNC_STATS_RESUME(task)    ((void)0)
+#define ASYNC_STATS_SUSPEND(task)   ((void)0)
+#define ASYNC_STATS_WAKE(loop, task) ((void)0)
+#define ASYNC_STATS_FINI(loop)      ((void)0)
+
+#endif /* ASYNC_STATS */
+
+#endif /* ASYNC_STATS_H_INCLUDED */
@@ -0,0 +1,795 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ev.h>
+
+#include "async.h"
+#include "async_io.h"
+#include "async_stream.h"
+
+#define ASYNC_IO_AGAIN(e)       ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#define ASYNC_STREAM_WQUEUE     16                      /* Initial write queue capacity */
+
+static void async_stream_flush_fn(struct ev_loop *loop, ev_prepare *w, int revents);
+static void async_stream_writable_fn(struct ev_loop *loop, ev_io *w, int revents);
+
+/**
+ * Initialize a pool of chunks of @p size bytes, header included (0 for
+ * ASYNC_STREAM_CHUNK), that keeps up to @p max_free released chunks for reuse
+ */
+void async_chunk_pool_init(async_chunk_pool_t *self, size_t size, size_t max_free)
+{
+    memset(self, 0, sizeof(*self));
+
+    if (size == 0) size = ASYNC_STREAM_CHUNK;
+    if (size < sizeof(async_chunk_t) + ASYNC_STREAM_READ_MIN) size = sizeof(async_chunk_t) + ASYNC_STREAM_READ_MIN;
+
+    self->acp_size = size - sizeof(async_chunk_t);
+    self->acp_max_free = max_free;
+}
+
+/**
+ * Free the released chunks; every stream and view of the pool must be gone
+ */
+void async_chunk_pool_fini(async_chunk_pool_t *self)
+{
+    async_chunk_t *chunk;
+
+    while ((chunk = self->acp_free) != NULL)
+    {
+        self->acp_free = chunk->ack_next;
+        free(chunk);
+    }
+
+    self->acp_nfree = 0;
+}
+
+/**
+ * Empty chunk holding one reference, NULL if out of memory
+ */
+async_chunk_t *async_chunk_get(async_chunk_pool_t *self)
+{
+    async_chunk_t *chunk = self->acp_free;
+
+    if (chunk != NULL)
+    {
+        self->acp_free = chunk->ack_next;
+        self->acp_nfree--;
+    }
+    else
+    {
+        chunk = malloc(sizeof(*chunk) + self->acp_size);
+        if (chunk == NULL) return NULL;
+
+        chunk->ack_pool = self;
+    }
+
+    chunk->ack_next = NULL;
+    chunk->ack_refs = 1;
+    chunk->ack_len = 0;
+    self->acp_live++;
+
+    return chunk;
+}
+
+/**
+ * Return a chunk without references to its pool, see async_chunk_put()
+ */
+void async_chunk_free(async_chunk_t *chunk)
+{
+    async_chunk_pool_t *pool = chunk->ack_pool;
+
+    pool->acp_live--;
+
+    if (pool->acp_nfree >= pool->acp_max_free)
+    {
+        free(chunk);
+        return;
+    }
+
+    chunk->ack_next = pool->acp_free;
+    pool->acp_free = chunk;
+    pool->acp_nfree++;
+}
+
+/**
+ * Drop the view's references; the view is empty afterwards
+ */
+void async_view_release(async_view_t *self)
+{
+    async_chunk_t *chunk = self->av_chunk;
+    async_chunk_t *next;
+    size_t left = self->av_len;
+    size_t seg = self->av_seg;
+
+    while (chunk != NULL)
+    {
+        next = chunk->ack_next;
+        async_chunk_put(chunk);
+
+        left -= seg;
+        if (left == 0) break;
+
+        chunk = next;
+        seg = left < chunk->ack_len ? left : chunk->ack_len;
+    }
+
+    memset(self, 0, sizeof(*self));
+}
+
+/**
+ * Describe the view in up to @p iovcnt vectors
+ *
+ * @return Number of vectors used, -1 if @p iovcnt are not enough
+ */
+int async_view_iov(const async_view_t *self, struct iovec *iov, int iovcnt)
+{
+    const async_chunk_t *chunk = self->av_chunk;
+    size_t left = self->av_len;
+    int count = 0;
+
+    if (left == 0) return 0;
+    if (iovcnt < 1) return -1;
+
+    iov[0].iov_base = self->av_data;
+    iov[0].iov_len = self->av_seg;
+    left -= self->av_seg;
+
+    for (count = 1; left > 0; count++)
+    {
+        if (count >= iovcnt) return -1;
+
+        chunk = chunk->ack_next;
+        iov[count].iov_base = (void *)chunk->ack_data;
+        iov[count].iov_len = left < chunk->ack_len ? left : chunk->ack_len;
+        left -= iov[count].iov_len;
+    }
+
+    return count;
+}
+
+/**
+ * Copy the view to av_len bytes at @p dst, for the odd parser that needs
+ * a view that spans chunks in one piece
+ */
+void async_view_copy(const async_view_t *self, void *dst)
+{
+    const async_chunk_t *chunk = self->av_chunk;
+    size_t left = self->av_len;
+    size_t seg = self->av_seg;
+    char *p = dst;
+
+    if (left == 0) return;
+
+    memcpy(p, self->av_data, seg);
+
+    for (left -= seg, p += seg; left > 0; left -= seg, p += seg)
+    {
+        chunk = chunk->ack_next;
+        seg = left < chunk->ack_len ? left : chunk->ack_len;
+        memcpy(p, chunk->ack_data, seg);
+    }
+}
+
+/**
+ * Initialize a stream over the non-blocking descriptor @p fd, which stays
+ * owned by the caller
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int async_stream_init(async_stream_t *self, async_loop_t *loop, async_chunk_pool_t *pool, int fd)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->ast_wiov = malloc(ASYNC_STREAM_WQUEUE * sizeof(*self->ast_wiov));
+    self->ast_wref = malloc(ASYNC_STREAM_WQUEUE * sizeof(*self->ast_wref));
+    if (self->ast_wiov == NULL || self->ast_wref == NULL)
+    {
+        free(self->ast_wiov);
+        free(self->ast_wref);
+        return -1;
+    }
+
+    self->ast_loop = loop;
+    self->ast_pool = pool;
+    self->ast_fd = fd;
+    self->ast_wcap = ASYNC_STREAM_WQUEUE;
+
+    ev_prepare_init(&self->ast_flush, async_stream_flush_fn);
+    self->ast_flush.data = self;
+    ev_io_init(&self->ast_wio, async_stream_writable_fn, fd, EV_WRITE);
+    self->ast_wio.data = self;
+    async_waitq_init(&self->ast_drainq);
+
+    return 0;
+}
+
+/* Drop the queued writes from ast_whead on */
+static void async_stream_discard(async_stream_t *self)
+{
+    for (; self->ast_whead < self->ast_wtail; self->ast_whead++)
+    {
+        if (self->ast_wref[self->ast_whead] != NULL) async_chunk_put(self->ast_wref[self->ast_whead]);
+    }
+
+    self->ast_whead = self->ast_wtail = 0;
+    self->ast_wlen = 0;
+}
+
+/**
+ * Release the buffers; queued writes that were not flushed are lost and no
+ * task may be in async_stream_drain()
+ */
+void async_stream_fini(async_stream_t *self)
+{
+    async_chunk_t *chunk;
+    async_chunk_t *next;
+
+    ev_prepare_stop(self->ast_loop->al_ev, &self->ast_flush);
+    ev_io_stop(self->ast_loop->al_ev, &self->ast_wio);
+
+    async_stream_discard(self);
+
+    for (chunk = self->ast_rhead; chunk != NULL; chunk = next)
+    {
+        next = chunk->ack_next;
+        async_chunk_put(chunk);
+    }
+
+    if (self->ast_rspare != NULL) async_chunk_put(self->ast_rspare);
+    if (self->ast_wchunk != NULL) async_chunk_put(self->ast_wchunk);
+
+    free(self->ast_wiov);
+    free(self->ast_wref);
+
+    self->ast_rhead = self->ast_rtail = self->ast_rspare = self->ast_wchunk = NULL;
+    self->ast_wiov = NULL;
+    self->ast_wref = NULL;
+}
+
+/*
+ * One read() into the last chunk, and into a fresh chunk as well when the
+ * last one is nearly full
+ */
+static ssize_t async_stream_readv(async_stream_t *self)
+{
+    async_chunk_pool_t *pool = self->ast_pool;
+    async_chunk_t *tail = self->ast_rtail;
+    struct iovec iov[2];
+    size_t room;
+    ssize_t n;
+    int cnt = 0;
+
+    if (tail == NULL)
+    {
+        tail = async_chunk_get(pool);
+        if (tail == NULL) return -1;
+
+        self->ast_rhead = self->ast_rtail = tail;
+        self->ast_roff = 0;
+    }
+    else if (self->ast_rlen == 0 && tail->ack_refs == 1)
+    {
+        /* Everything read was consumed and released, start over */
+        tail->ack_len = 0;
+        self->ast_roff = 0;
+    }
+
+    room = pool->acp_size - tail->ack_len;
+    if (room > 0)
+    {
+        iov[cnt].iov_base = tail->ack_data + tail->ack_len;
+        iov[cnt].iov_len = room;
+        cnt++;
+    }
+
+    if (room < ASYNC_STREAM_READ_MIN)
+    {
+        if (self->ast_rspare == NULL && (self->ast_rspare = async_chunk_get(pool)) == NULL)
+        {
+            if (cnt == 0) return -1;
+        }
+        else
+        {
+            iov[cnt].iov_base = self->ast_rspare->ack_data;
+            iov[cnt].iov_len = pool->acp_size;
+            cnt++;
+        }
+    }
+
+    n = cnt == 1 ? read(self->ast_fd, iov[0].iov_base, iov[0].iov_len) : readv(self->ast_fd, iov, cnt);
+    self->ast_reads++;
+    if (n <= 0) return n;
+
+    if ((size_t)n <= room)
+    {
+        tail->ack_len += n;
+    }
+    else
+    {
+        /* Spilled over into the spare chunk, which becomes the last one */
+        tail->ack_len += room;
+        tail->ack_next = self->ast_rspare;
+        self->ast_rtail = self->ast_rspare;
+        self->ast_rtail->ack_len = n - room;
+        self->ast_rspare = NULL;
+
+        /* Nothing unread was left in the old one */
+        if (self->ast_rlen == 0 && room == 0)
+        {
+            self->ast_rhead = self->ast_rtail;
+            self->ast_roff = 0;
+            async_chunk_put(tail);
+        }
+    }
+
+    self->ast_rlen += n;
+
+    return n;
+}
+
+/*
+ * Hand out the first @p len unread bytes in @p view and move past them.
+ * Chunks the stream is done with keep the references of the view.
+ */
+static void async_stream_take(async_stream_t *self, size_t len, async_view_t *view)
+{
+    async_chunk_t *chunk = self->ast_rhead;
+    size_t off = self->ast_roff;
+    size_t seg;
+
+    view->av_chunk = chunk;
+    view->av_data = chunk->ack_data + off;
+    view->av_len = len;
+    view->av_seg = chunk->ack_len - off < len ? chunk->ack_len - off : len;
+
+    self->ast_rlen -= len;
+    self->ast_scanned = 0;
+
+    for (;;)
+    {
+        seg = chunk->ack_len - off < len ? chunk->ack_len - off : len;
+        async_chunk_ref(chunk);
+        len -= seg;
+        off += seg;
+
+        /* The stream keeps the chunk read into, and the one holding unread bytes */
+        if (chunk == self->ast_rtail || off < chunk->ack_len) break;
+
+        self->ast_rhead = chunk->ack_next;
+        async_chunk_put(chunk);
+        chunk = self->ast_rhead;
+        off = 0;
+
+        if (len == 0) break;
+    }
+
+    self->ast_roff = off;
+}
+
+/* Length up to and including the first @p delim among the unread bytes, 0 if none */
+static size_t async_stream_find(async_stream_t *self, int delim)
+{
+    async_chunk_t *chunk = self->ast_rhead;
+    size_t skip = self->ast_scanned;
+    size_t off = self->ast_roff;
+    size_t pos = 0;
+    size_t seg;
+    const char *hit;
+
+    /* What was searched for another delimiter has to be searched again */
+    if (self->ast_scan_delim != delim)
+    {
+        self->ast_scan_delim = delim;
+        skip = 0;
+    }
+
+    if (self->ast_rlen == skip) return 0;
+
+    for (; chunk != NULL; chunk = chunk->ack_next, off = 0)
+    {
+        seg = chunk->ack_len - off;
+
+        if (skip >= seg)
+        {
+            skip -= seg;
+            pos += seg;
+            continue;
+        }
+
+        hit = memchr(chunk->ack_data + off + skip, delim, seg - skip);
+        if (hit != NULL) return pos + (size_t)(hit - (chunk->ack_data + off)) + 1;
+
+        skip = 0;
+        pos += seg;
+    }
+
+    self->ast_scanned = self->ast_rlen;
+
+    return 0;
+}
+
+/**
+ * Read more data into the buffer; *rc is the number of bytes read, 0 on end
+ * of file
+ */
+void async_stream_fill(crt_t *crt, async_stream_t *stream, ssize_t *rc)
+{
+    CRT(crt)
+    {
+        for (;;)
+        {
+            *rc = async_stream_readv(stream);
+            if (*rc > 0) break;
+            if (*rc == 0)
+            {
+                stream->ast_eof = true;
+                break;
+            }
+
+            if (errno == EINTR) continue;
+            if (!ASYNC_IO_AGAIN(errno)) CRT_EXIT(CRT_ERROR);
+
+            CRT_AWAIT(async_io_wait(crt, stream->ast_fd, EV_READ));
+        }
+    }
+    CRT_END;
+}
+
+/**
+ * Wait for the next @p delim and return the bytes up to and including it
+ * in @p view, which must be released. *rc is the length of the view, 0 at
+ * end of file, -1 on error: read errors, and EMSGSIZE when the first @p max
+ * bytes hold no delimiter; nothing is consumed then. At end of file the bytes after the last delimiter stay
+ * unread, see async_stream_pending().
+ */
+void async_stream_read_until(crt_t *crt, async_stream_t *stream, int delim, size_t max,
+        async_view_t *view, ssize_t *rc)
+{
+    size_t len;
+
+    CRT(crt)
+    {
+        while ((len = async_stream_find(stream, delim)) == 0)
+        {
+            if (stream->ast_eof)
+            {
+                memset(view, 0, sizeof(*view));
+                *rc = 0;
+                CRT_EXIT(CRT_OK);
+            }
+
+            if (stream->ast_rlen >= max)
+            {
+                errno = EMSGSIZE;
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            CRT_AWAIT(async_stream_fill(crt, stream, rc));
+            if (*rc < 0) CRT_EXIT(CRT_ERROR);
+        }
+
+        /* A single read may have brought in more than @p max */
+        if (len > max)
+        {
+            errno = EMSGSIZE;
+            *rc = -1;
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        async_stream_take(stream, len, view);
+        *rc = len;
+    }
+    CRT_END;
+}
+
+/**
+ * Wait for @p len bytes and return them in @p view, which must be released.
+ * *rc is @p len, 0 if the stream ends before, -1 on error.
+ */
+void async_stream_read_exact(crt_t *crt, async_stream_t *stream, size_t len, async_view_t *view, ssize_t *rc)
+{
+    CRT(crt)
+    {
+        while (stream->ast_rlen < len)
+        {
+            if (stream->ast_eof)
+            {
+                memset(view, 0, sizeof(*view));
+                *rc = 0;
+                CRT_EXIT(CRT_OK);
+            }
+
+            CRT_AWAIT(async_stream_fill(crt, stream, rc));
+            if (*rc < 0) CRT_EXIT(CRT_ERROR);
+        }
+
+        if (len > 0)
+        {
+            async_stream_take(stream, len, view);
+        }
+        else
+        {
+            memset(view, 0, sizeof(*view));
+        }
+
+        *rc = len;
+    }
+    CRT_END;
+}
+
+/* Queue @p len bytes at @p base, referencing @p chunk if not NULL */
+static int async_stream_queue(async_stream_t *self, char *base, size_t len, async_chunk_t *chunk)
+{
+    struct iovec *last;
+    unsigned count;
+    void *p;
+
+    /* Adjacent to the last write, e.g. small writes copied to the same chunk */
+    if (self->ast_wtail > self->ast_whead)
+    {
+        last = &self->ast_wiov[self->ast_wtail - 1];
+
+        if (self->ast_wref[self->ast_wtail - 1] == chunk && (char *)last->iov_base + last->iov_len == base)
+        {
+            last->iov_len += len;
+            self->ast_wlen += len;
+            return 0;
+        }
+    }
+
+    if (self->ast_wtail == self->ast_wcap)
+    {
+        count = self->ast_wtail - self->ast_whead;
+
+        if (self->ast_whead >= self->ast_wcap / 2)
+        {
+            memmove(self->ast_wiov, self->ast_wiov + self->ast_whead, count * sizeof(*self->ast_wiov));
+            memmove(self->ast_wref, self->ast_wref + self->ast_whead, count * sizeof(*self->ast_wref));
+            self->ast_whead = 0;
+            self->ast_wtail = count;
+        }
+        else
+        {
+            p = realloc(self->ast_wiov, self->ast_wcap * 2 * sizeof(*self->ast_wiov));
+            if (p == NULL) return -1;
+            self->ast_wiov = p;
+
+            p = realloc(self->ast_wref, self->ast_wcap * 2 * sizeof(*self->ast_wref));
+            if (p == NULL) return -1;
+            self->ast_wref = p;
+
+            self->ast_wcap *= 2;
+        }
+    }
+
+    self->ast_wiov[self->ast_wtail].iov_base = base;
+    self->ast_wiov[self->ast_wtail].iov_len = len;
+    self->ast_wref[self->ast_wtail] = chunk;
+    self->ast_wtail++;
+    self->ast_wlen += len;
+
+    if (chunk != NULL) async_chunk_ref(chunk);
+
+    return 0;
+}
+
+/* Flush before the loop polls next, unless waiting for room already */
+static inline void async_stream_schedule(async_stream_t *self)
+{
+    if (!ev_is_active(&self->ast_flush) && !ev_is_active(&self->ast_wio))
+    {
+        ev_prepare_start(self->ast_loop->al_ev, &self->ast_flush);
+    }
+}
+
+static int async_stream_failed(async_stream_t *self)
+{
+    errno = self->ast_error;
+
+    return -1;
+}
+
+/**
+ * Queue a copy of @p data. Small writes of one loop iteration end up
+ * contiguous in a chunk and go out as a single vector.
+ *
+ * @return 0 on success, -1 if out of memory or an earlier write failed
+ */
+int async_stream_write(async_stream_t *self, const void *data, size_t len)
+{
+    async_chunk_t *chunk = self->ast_wchunk;
+    const char *p = data;
+    size_t room;
+    size_t n;
+
+    if (self->ast_error != 0) return async_stream_failed(self);
+    if (len == 0) return 0;
+
+    /* Everything copied before went out, start over */
+    if (chunk != NULL && chunk->ack_refs == 1) chunk->ack_len = 0;
+
+    while (len > 0)
+    {
+        if (chunk == NULL || chunk->ack_len == self->ast_pool->acp_size)
+        {
+            if (chunk != NULL) async_chunk_put(chunk);
+
+            chunk = self->ast_wchunk = async_chunk_get(self->ast_pool);
+            if (chunk == NULL) return -1;
+        }
+
+        room = self->ast_pool->acp_size - chunk->ack_len;
+        n = len < room ? len : room;
+
+        memcpy(chunk->ack_data + chunk->ack_len, p, n);
+        if (async_stream_queue(self, chunk->ack_data + chunk->ack_len, n, chunk) != 0) return -1;
+
+        chunk->ack_len += n;
+        self->ast_copied += n;
+        p += n;
+        len -= n;
+    }
+
+    async_stream_schedule(self);
+
+    return 0;
+}
+
+/**
+ * Queue the bytes of @p view without copying them; the queue holds its own
+ * references, the view may be released right away
+ *
+ * @return 0 on success, -1 if out of memory or an earlier write failed
+ */
+int async_stream_write_view(async_stream_t *self, const async_view_t *view)
+{
+    async_chunk_t *chunk = view->av_chunk;
+    size_t left = view->av_len;
+    size_t seg = view->av_seg;
+    char *base = view->av_data;
+
+    if (self->ast_error != 0) return async_stream_failed(self);
+    if (left == 0) return 0;
+
+    for (;;)
+    {
+        if (async_stream_queue(self, base, seg, chunk) != 0) return -1;
+
+        left -= seg;
+        if (left == 0) break;
+
+        chunk = chunk->ack_next;
+        base = chunk->ack_data;
+        seg = left < chunk->ack_len ? left : chunk->ack_len;
+    }
+
+    async_stream_schedule(self);
+
+    return 0;
+}
+
+static void async_stream_drained(async_stream_t *self)
+{
+    async_task_t *task;
+
+    while ((task = async_waitq_pop(&self->ast_drainq)) != NULL) async_task_wake(task, &self->ast_drainq);
+}
+
+/**
+ * Write out what is queued, as far as the descriptor takes it; the rest
+ * goes out once it is writable. Called before the loop polls, call it
+ * directly to send right away.
+ */
+void async_stream_flush(async_stream_t *self)
+{
+    struct ev_loop *ev = self->ast_loop->al_ev;
+    size_t done;
+    ssize_t n;
+    int cnt;
+
+    ev_prepare_stop(ev, &self->ast_flush);
+
+    while (self->ast_whead < self->ast_wtail)
+    {
+        cnt = self->ast_wtail - self->ast_whead;
+        if (cnt > ASYNC_STREAM_IOV) cnt = ASYNC_STREAM_IOV;
+
+        n = writev(self->ast_fd, self->ast_wiov + self->ast_whead, cnt);
+        self->ast_writes++;
+
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+
+            if (ASYNC_IO_AGAIN(errno))
+            {
+                ev_io_start(ev, &self->ast_wio);
+                return;
+            }
+
+            self->ast_error = errno;
+            async_stream_discard(self);
+            break;
+        }
+
+        self->ast_wlen -= n;
+
+        /* Release what went out */
+        while (n > 0)
+        {
+            struct iovec *iov = &self->ast_wiov[self->ast_whead];
+
+            done = iov->iov_len < (size_t)n ? iov->iov_len : (size_t)n;
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+            n -= done;
+
+            if (iov->iov_len > 0) break;
+
+            if (self->ast_wref[self->ast_whead] != NULL) async_chunk_put(self->ast_wref[self->ast_whead]);
+            self->ast_whead++;
+        }
+    }
+
+    self->ast_whead = self->ast_wtail = 0;
+    ev_io_stop(ev, &self->ast_wio);
+
+    async_stream_drained(self);
+}
+
+static void async_stream_flush_fn(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_stream_flush(w->data);
+}
+
+static void async_stream_writable_fn(struct ev_loop *loop, ev_io *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_stream_flush(w->data);
+}
+
+/**
+ * Wait until everything queued is written; *rc is 0, or -1 with errno set
+ * if a write failed
+ */
+void async_stream_drain(crt_t *crt, async_stream_t *stream, int *rc)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        if (stream->ast_whead < stream->ast_wtail && !ev_is_active(&stream->ast_wio)) async_stream_flush(stream);
+
+        if (stream->ast_whead < stream->ast_wtail)
+        {
+            async_waitq_push(&stream->ast_drainq, self);
+
+            do
+            {
+                CRT_YIELD();
+            }
+            while (self->at_waitq != NULL);
+        }
+
+        if (stream->ast_error != 0)
+        {
+            *rc = async_stream_failed(stream);
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        *rc = 0;
+    }
+    CRT_END;
+
+    async_waitq_remove(self);
+}
@@ -0,0 +1,168 @@
+#if !defined(ASYNC_STREAM_H_INCLUDED)
+#define ASYNC_STREAM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "async.h"
+
+/*
+ * Buffered byte stream over a non-blocking descriptor, for protocol parsers.
+ *
+ * Data is read into a chain of fixed-size chunks from a pool. Reads return
+ * views into the chunks instead of copies: a view holds a reference on the
+ * chunks it spans, which stay alive until the view is released, however far
+ * the stream moved on. A view spans chunks when the data straddles one;
+ * av_seg tells how much of it is contiguous at av_data.
+ *
+ * Writes are queued and gathered with writev() once per loop iteration, from
+ * a prepare watcher of the stream's loop. async_stream_write() copies into a
+ * chunk of the stream so that small writes coalesce, async_stream_write_view()
+ * queues a reference to the chunks of a view instead. Writes that fail are
+ * reported by the next async_stream_write*() or async_stream_drain().
+ *
+ *      CRT_AWAIT(async_stream_read_until(crt, &c->stream, '\n', 4096, &l->line, &l->rc));
+ *      if (l->rc <= 0) break;
+ *
+ *      async_stream_write(&c->stream, "OK ", 3);
+ *      async_stream_write_view(&c->stream, &l->line);
+ *      async_view_release(&l->line);
+ *
+ * A stream, its pool and its views belong to one loop; one task at a time
+ * may read, any task of the loop may write.
+ */
+
+#if !defined(ASYNC_STREAM_CHUNK)
+#define ASYNC_STREAM_CHUNK          16384               /* Default chunk allocation size */
+#endif
+
+#if !defined(ASYNC_STREAM_READ_MIN)
+#define ASYNC_STREAM_READ_MIN       1024                /* Read into a second chunk too below this much room */
+#endif
+
+#if !defined(ASYNC_STREAM_IOV)
+#define ASYNC_STREAM_IOV            256                 /* Vectors per writev() */
+#endif
+
+typedef struct async_chunk async_chunk_t;
+typedef struct async_chunk_pool async_chunk_pool_t;
+typedef struct async_view async_view_t;
+typedef struct async_stream async_stream_t;
+
+/*
+ * Buffer chunk. Chunks of a stream are filled in order and never move, a
+ * chunk's ack_next only changes from NULL once.
+ */
+struct async_chunk
+{
+    async_chunk_t      *ack_next;           /* Next chunk of the stream, free list link */
+    async_chunk_pool_t *ack_pool;           /* Pool the chunk returns to */
+    unsigned            ack_refs;           /* The stream, views and queued writes */
+    unsigned            ack_len;            /* Bytes filled */
+    char                ack_data[];
+};
+
+/*
+ * Free list of chunks of one size, not thread-safe
+ */
+struct async_chunk_pool
+{
+    async_chunk_t  *acp_free;               /* Free list */
+    size_t          acp_nfree;              /* Chunks on the free list */
+    size_t          acp_max_free;           /* Chunks kept on the free list, more are freed */
+    size_t          acp_size;               /* Data bytes per chunk */
+    size_t          acp_live;               /* Chunks handed out */
+};
+
+/*
+ * Bytes of a stream; av_len is 0 for an empty view
+ */
+struct async_view
+{
+    async_chunk_t  *av_chunk;               /* Chunk of the first byte */
+    char           *av_data;                /* First byte */
+    size_t          av_len;                 /* Bytes in the view */
+    size_t          av_seg;                 /* Bytes contiguous at av_data, the rest follows in the next chunks */
+};
+
+struct async_stream
+{
+    async_loop_t       *ast_loop;           /* Loop of the watchers */
+    async_chunk_pool_t *ast_pool;           /* Chunk source */
+    int                 ast_fd;             /* Non-blocking descriptor, not owned */
+    async_chunk_t      *ast_rhead;          /* Chunk of the first unread byte */
+    async_chunk_t      *ast_rtail;          /* Chunk read into */
+    async_chunk_t      *ast_rspare;         /* Next chunk to read into, not linked yet */
+    size_t              ast_roff;           /* Offset of the first unread byte in ast_rhead */
+    size_t              ast_rlen;           /* Unread bytes */
+    size_t              ast_scanned;        /* Unread bytes searched for ast_scan_delim already */
+    int                 ast_scan_delim;     /* Delimiter ast_scanned refers to */
+    bool                ast_eof;            /* End of file read */
+    struct iovec       *ast_wiov;           /* Queued writes, ast_whead..ast_wtail */
+    async_chunk_t     **ast_wref;           /* Chunk each queued write references, or NULL */
+    unsigned            ast_whead;          /* First queued write */
+    unsigned            ast_wtail;          /* End of the queued writes */
+    unsigned            ast_wcap;           /* Capacity of ast_wiov/ast_wref */
+    size_t              ast_wlen;           /* Bytes queued */
+    async_chunk_t      *ast_wchunk;         /* Chunk async_stream_write() copies to */
+    ev_prepare          ast_flush;          /* Flushes the queue before the loop polls */
+    ev_io               ast_wio;            /* Waits for room in the socket buffer */
+    async_waitq_t       ast_drainq;         /* Tasks in async_stream_drain() */
+    int                 ast_error;          /* errno of the first failed write */
+    uint64_t            ast_copied;         /* Bytes copied by async_stream_write() */
+    uint64_t            ast_reads;          /* read() system calls */
+    uint64_t            ast_writes;         /* writev() system calls */
+};
+
+extern void async_chunk_pool_init(async_chunk_pool_t *self, size_t size, size_t max_free);
+extern void async_chunk_pool_fini(async_chunk_pool_t *self);
+extern async_chunk_t *async_chunk_get(async_chunk_pool_t *self);
+extern void async_chunk_free(async_chunk_t *chunk);
+
+extern void async_view_release(async_view_t *self);
+extern int async_view_iov(const async_view_t *self, struct iovec *iov, int iovcnt);
+extern void async_view_copy(const async_view_t *self, void *dst);
+
+extern int async_stream_init(async_stream_t *self, async_loop_t *loop, async_chunk_pool_t *pool, int fd);
+extern void async_stream_fini(async_stream_t *self);
+extern void async_stream_fill(crt_t *crt, async_stream_t *stream, ssize_t *rc);
+extern void async_stream_read_until(crt_t *crt, async_stream_t *stream, int delim, size_t max,
+        async_view_t *view, ssize_t *rc);
+extern void async_stream_read_exact(crt_t *crt, async_stream_t *stream, size_t len, async_view_t *view, ssize_t *rc);
+extern int async_stream_write(async_stream_t *self, const void *data, size_t len);
+extern int async_stream_write_view(async_stream_t *self, const async_view_t *view);
+extern void async_stream_flush(async_stream_t *self);
+extern void async_stream_drain(crt_t *crt, async_stream_t *stream, int *rc);
+
+static inline void async_chunk_ref(async_chunk_t *chunk)
+{
+    chunk->ack_refs++;
+}
+
+/* Drop a reference, the last one returns the chunk to its pool */
+static inline void async_chunk_put(async_chunk_t *chunk)
+{
+    if (--chunk->ack_refs == 0) async_chunk_free(chunk);
+}
+
+/**
+ * Bytes read but not returned in a view yet
+ */
+static inline size_t async_stream_pending(const async_stream_t *self)
+{
+    return self->ast_rlen;
+}
+
+/**
+ * Bytes queued for writing, for back-pressure: a writer that finds too many
+ * awaits async_stream_drain()
+ */
+static inline size_t async_stream_queued(const async_stream_t *self)
+{
+    return self->ast_wlen;
+}
+
+#endif /* ASYNC_STREAM_H_INCLUDED */
@@ -0,0 +1,430 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "async.h"
+#include "async_sync.h"
+
+/*
+ * A task waiting on a primitive is granted the lock or unit by whoever
+ * releases it: the task is taken off the wait queue and woken, and finds
+ * itself off the queue when it resumes. Wakeups that leave it on the queue
+ * are spurious and it parks again.
+ */
+
+static inline void async_sync_lock(atomic_flag *lock, unsigned flags)
+{
+    if (!(flags & ASYNC_SYNC_SHARED)) return;
+
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+static inline void async_sync_unlock(atomic_flag *lock, unsigned flags)
+{
+    if (!(flags & ASYNC_SYNC_SHARED)) return;
+
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+static void async_sync_wake(async_task_t *task, unsigned flags, void *what)
+{
+    if (flags & ASYNC_SYNC_SHARED)
+    {
+        async_task_wake_from_any_thread(task);
+    }
+    else
+    {
+        async_task_wake(task, what);
+    }
+}
+
+/* True once a releaser took @p task off the wait queue guarded by @p lock */
+static bool async_sync_granted(async_task_t *task, atomic_flag *lock, unsigned flags)
+{
+    bool granted;
+
+    async_sync_lock(lock, flags);
+    granted = (task->at_waitq == NULL);
+    async_sync_unlock(lock, flags);
+
+    return granted;
+}
+
+void async_mutex_init(async_mutex_t *self, unsigned flags)
+{
+    memset(self, 0, sizeof(*self));
+
+    atomic_init(&self->am_state, ASYNC_MUTEX_UNLOCKED);
+    self->am_flags = flags;
+    async_waitq_init(&self->am_waiters);
+    atomic_flag_clear(&self->am_lock);
+}
+
+/**
+ * Take the mutex if it is free, without waiting
+ */
+bool async_mutex_trylock(async_mutex_t *self)
+{
+    unsigned state = ASYNC_MUTEX_UNLOCKED;
+
+    if (!(self->am_flags & ASYNC_SYNC_SHARED))
+    {
+        if (atomic_load_explicit(&self->am_state, memory_order_relaxed) != ASYNC_MUTEX_UNLOCKED) return false;
+
+        atomic_store_explicit(&self->am_state, ASYNC_MUTEX_LOCKED, memory_order_relaxed);
+        return true;
+    }
+
+    return atomic_compare_exchange_strong_explicit(&self->am_state, &state, ASYNC_MUTEX_LOCKED,
+            memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+ * Take the mutex or mark it contended, with am_lock held. An unlock that
+ * sees the mark looks for waiters.
+ */
+static bool async_mutex_take_locked(async_mutex_t *self)
+{
+    if (!(self->am_flags & ASYNC_SYNC_SHARED))
+    {
+        if (atomic_load_explicit(&self->am_state, memory_order_relaxed) == ASYNC_MUTEX_UNLOCKED)
+        {
+            atomic_store_explicit(&self->am_state, ASYNC_MUTEX_LOCKED, memory_order_relaxed);
+            return true;
+        }
+
+        atomic_store_explicit(&self->am_state, ASYNC_MUTEX_CONTENDED, memory_order_relaxed);
+        return false;
+    }
+
+    /* Taken this way the mutex stays marked contended, which is merely conservative */
+    return atomic_exchange_explicit(&self->am_state, ASYNC_MUTEX_CONTENDED,
+            memory_order_acquire) == ASYNC_MUTEX_UNLOCKED;
+}
+
+/**
+ * Release the mutex; the longest waiting task, if any, owns it from now on
+ */
+void async_mutex_unlock(async_mutex_t *self)
+{
+    unsigned state = ASYNC_MUTEX_LOCKED;
+    async_task_t *task;
+
+    if (!(self->am_flags & ASYNC_SYNC_SHARED))
+    {
+        if (atomic_load_explicit(&self->am_state, memory_order_relaxed) == ASYNC_MUTEX_LOCKED)
+        {
+            atomic_store_explicit(&self->am_state, ASYNC_MUTEX_UNLOCKED, memory_order_relaxed);
+            return;
+        }
+    }
+    else if (atomic_compare_exchange_strong_explicit(&self->am_state, &state, ASYNC_MUTEX_UNLOCKED,
+                memory_order_release, memory_order_relaxed))
+    {
+        return;
+    }
+
+    async_sync_lock(&self->am_lock, self->am_flags);
+
+    task = async_waitq_pop(&self->am_waiters);
+    if (task == NULL)
+    {
+        atomic_store_explicit(&self->am_state, ASYNC_MUTEX_UNLOCKED, memory_order_release);
+    }
+    else
+    {
+        if (self->am_waiters.awq_head == NULL)
+        {
+            atomic_store_explicit(&self->am_state, ASYNC_MUTEX_LOCKED, memory_order_relaxed);
+        }
+
+        async_sync_wake(task, self->am_flags, self);
+    }
+
+    async_sync_unlock(&self->am_lock, self->am_flags);
+}
+
+/*
+ * The waiting task unwinds: leave the queue, or pass on a lock that was
+ * handed over meanwhile
+ */
+static void async_mutex_abandon(async_mutex_t *self, async_task_t *task)
+{
+    bool granted;
+
+    async_sync_lock(&self->am_lock, self->am_flags);
+
+    granted = (task->at_waitq == NULL);
+    async_waitq_remove(task);
+
+    async_sync_unlock(&self->am_lock, self->am_flags);
+
+    if (granted) async_mutex_unlock(self);
+}
+
+/**
+ * Lock the mutex, parking until it is handed over
+ */
+void async_mutex_lock(crt_t *crt, async_mutex_t *mutex)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    bool taken;
+
+    CRT(crt)
+    {
+        if (async_mutex_trylock(mutex)) CRT_EXIT(CRT_OK);
+
+        async_sync_lock(&mutex->am_lock, mutex->am_flags);
+
+        taken = async_mutex_take_locked(mutex);
+        if (!taken) async_waitq_push(&mutex->am_waiters, self);
+
+        async_sync_unlock(&mutex->am_lock, mutex->am_flags);
+
+        if (taken) CRT_EXIT(CRT_OK);
+
+        do
+        {
+            CRT_YIELD();
+        }
+        while (!async_sync_granted(self, &mutex->am_lock, mutex->am_flags));
+    }
+    CRT_END;
+
+    if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) async_mutex_abandon(mutex, self);
+}
+
+/**
+ * Initialize a semaphore with @p count units
+ */
+void async_sem_init(async_sem_t *self, size_t count, unsigned flags)
+{
+    memset(self, 0, sizeof(*self));
+
+    atomic_init(&self->asem_count, count);
+    self->asem_flags = flags;
+    async_waitq_init(&self->asem_waiters);
+    atomic_flag_clear(&self->asem_lock);
+}
+
+/**
+ * Take a unit if one is available, without waiting
+ */
+bool async_sem_tryacquire(async_sem_t *self)
+{
+    size_t count = atomic_load_explicit(&self->asem_count, memory_order_relaxed);
+
+    if (!(self->asem_flags & ASYNC_SYNC_SHARED))
+    {
+        if (count == 0) return false;
+
+        atomic_store_explicit(&self->asem_count, count - 1, memory_order_relaxed);
+        return true;
+    }
+
+    while (count > 0)
+    {
+        if (atomic_compare_exchange_weak_explicit(&self->asem_count, &count, count - 1,
+                    memory_order_acquire, memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Return a unit; it goes straight to the longest waiting task, if any
+ */
+void async_sem_release(async_sem_t *self)
+{
+    async_task_t *task;
+
+    async_sync_lock(&self->asem_lock, self->asem_flags);
+
+    task = async_waitq_pop(&self->asem_waiters);
+    if (task == NULL)
+    {
+        atomic_fetch_add_explicit(&self->asem_count, 1, memory_order_release);
+    }
+    else
+    {
+        async_sync_wake(task, self->asem_flags, self);
+    }
+
+    async_sync_unlock(&self->asem_lock, self->asem_flags);
+}
+
+static void async_sem_abandon(async_sem_t *self, async_task_t *task)
+{
+    bool granted;
+
+    async_sync_lock(&self->asem_lock, self->asem_flags);
+
+    granted = (task->at_waitq == NULL);
+    async_waitq_remove(task);
+
+    async_sync_unlock(&self->asem_lock, self->asem_flags);
+
+    if (granted) async_sem_release(self);
+}
+
+/**
+ * Take a unit, parking until one is handed over
+ */
+void async_sem_acquire(crt_t *crt, async_sem_t *sem)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    bool taken;
+
+    CRT(crt)
+    {
+        if (async_sem_tryacquire(sem)) CRT_EXIT(CRT_OK);
+
+        /* Releases only add units while nobody waits, so a unit seen here is free to take */
+        async_sync_lock(&sem->asem_lock, sem->asem_flags);
+
+        taken = async_sem_tryacquire(sem);
+        if (!taken) async_waitq_push(&sem->asem_waiters, self);
+
+        async_sync_unlock(&sem->asem_lock, sem->asem_flags);
+
+        if (taken) CRT_EXIT(CRT_OK);
+
+        do
+        {
+            CRT_YIELD();
+        }
+        while (!async_sync_granted(self, &sem->asem_lock, sem->asem_flags));
+    }
+    CRT_END;
+
+    if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) async_sem_abandon(sem, self);
+}
+
+void async_cond_init(async_cond_t *self, unsigned flags)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->acv_flags = flags;
+    async_waitq_init(&self->acv_waiters);
+    atomic_flag_clear(&self->acv_lock);
+}
+
+/*
+ * Hand a signalled task the mutex if it is free, or queue it on the mutex;
+ * called with both locks held
+ */
+static void async_cond_requeue(async_cond_t *self, async_task_t *task)
+{
+    async_mutex_t *mutex = self->acv_mutex;
+
+    if (async_mutex_take_locked(mutex))
+    {
+        async_sync_wake(task, self->acv_flags, self);
+    }
+    else
+    {
+        async_waitq_push(&mutex->am_waiters, task);
+    }
+}
+
+/**
+ * Wake the longest waiting task
+ */
+void async_cond_signal(async_cond_t *self)
+{
+    async_task_t *task;
+
+    async_sync_lock(&self->acv_lock, self->acv_flags);
+
+    /* Pop and requeue under the mutex lock, a waiter never sees itself on neither queue */
+    if (self->acv_waiters.awq_head != NULL)
+    {
+        async_sync_lock(&self->acv_mutex->am_lock, self->acv_flags);
+
+        task = async_waitq_pop(&self->acv_waiters);
+        async_cond_requeue(self, task);
+
+        async_sync_unlock(&self->acv_mutex->am_lock, self->acv_flags);
+    }
+
+    async_sync_unlock(&self->acv_lock, self->acv_flags);
+}
+
+/**
+ * Wake all waiting tasks; they get the mutex one after the other
+ */
+void async_cond_broadcast(async_cond_t *self)
+{
+    async_task_t *task;
+
+    async_sync_lock(&self->acv_lock, self->acv_flags);
+
+    if (self->acv_waiters.awq_head != NULL)
+    {
+        async_sync_lock(&self->acv_mutex->am_lock, self->acv_flags);
+
+        while ((task = async_waitq_pop(&self->acv_waiters)) != NULL) async_cond_requeue(self, task);
+
+        async_sync_unlock(&self->acv_mutex->am_lock, self->acv_flags);
+    }
+
+    async_sync_unlock(&self->acv_lock, self->acv_flags);
+}
+
+static void async_cond_abandon(async_cond_t *self, async_mutex_t *mutex, async_task_t *task)
+{
+    bool granted;
+
+    /* The task is on either queue, or on none once it got the mutex */
+    async_sync_lock(&self->acv_lock, self->acv_flags);
+    async_sync_lock(&mutex->am_lock, self->acv_flags);
+
+    granted = (task->at_waitq == NULL);
+    async_waitq_remove(task);
+
+    async_sync_unlock(&mutex->am_lock, self->acv_flags);
+    async_sync_unlock(&self->acv_lock, self->acv_flags);
+
+    if (granted) async_mutex_unlock(mutex);
+}
+
+/**
+ * Unlock @p mutex, wait for a signal and lock it again. Both must be of the
+ * same kind (local or shared), and all waiters of a condition variable must
+ * use the same mutex.
+ */
+void async_cond_wait(crt_t *crt, async_cond_t *cond, async_mutex_t *mutex)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        async_sync_lock(&cond->acv_lock, cond->acv_flags);
+
+        cond->acv_mutex = mutex;
+        async_waitq_push(&cond->acv_waiters, self);
+
+        async_sync_unlock(&cond->acv_lock, cond->acv_flags);
+
+        async_mutex_unlock(mutex);
+
+        /* Signals move the task between the queues under the mutex lock too */
+        do
+        {
+            CRT_YIELD();
+        }
+        while (!async_sync_granted(self, &mutex->am_lock, mutex->am_flags));
+    }
+    CRT_END;
+
+    if (CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) async_cond_abandon(cond, mutex, self);
+}
@@ -0,0 +1,79 @@
+#if !defined(ASYNC_SYNC_H_INCLUDED)
+#define ASYNC_SYNC_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "async.h"
+
+/*
+ * Mutex, counting semaphore and condition variable for tasks. Waiters park
+ * on a wait queue in FIFO order; releasing hands the lock or unit straight
+ * to the longest waiting task, so a woken task never finds it taken again
+ * and nobody can barge in between.
+ *
+ * The awaitables fail with the cancellation or timeout of the waiting task
+ * without holding the lock or unit; one handed over meanwhile is passed on.
+ *
+ * Local primitives are used by tasks of a single loop and take no locks or
+ * atomics; their tasks must not migrate. Shared ones (ASYNC_SYNC_SHARED) may
+ * be used from tasks on any loop; the uncontended paths are a single atomic
+ * operation.
+ */
+
+#define ASYNC_SYNC_SHARED           (1 << 0)            /* Used across loops/threads */
+
+#define ASYNC_MUTEX_UNLOCKED        0
+#define ASYNC_MUTEX_LOCKED          1
+#define ASYNC_MUTEX_CONTENDED       2                   /* Locked, tasks may be waiting */
+
+typedef struct async_mutex async_mutex_t;
+typedef struct async_sem async_sem_t;
+typedef struct async_cond async_cond_t;
+
+struct async_mutex
+{
+    atomic_uint     am_state;               /* ASYNC_MUTEX_* */
+    unsigned        am_flags;               /* ASYNC_SYNC_* */
+    async_waitq_t   am_waiters;             /* Tasks waiting for the lock */
+    atomic_flag     am_lock;                /* Guards am_waiters, shared mutexes only */
+};
+
+struct async_sem
+{
+    atomic_size_t   asem_count;             /* Units available, 0 while tasks wait */
+    unsigned        asem_flags;             /* ASYNC_SYNC_* */
+    async_waitq_t   asem_waiters;           /* Tasks waiting for a unit */
+    atomic_flag     asem_lock;              /* Shared semaphores only */
+};
+
+/*
+ * Signalled waiters that would only block on the mutex are moved to the
+ * mutex's wait queue instead of being woken, a broadcast wakes them one by
+ * one as the mutex is handed down
+ */
+struct async_cond
+{
+    async_mutex_t  *acv_mutex;              /* Mutex of the current waiters */
+    unsigned        acv_flags;              /* ASYNC_SYNC_* */
+    async_waitq_t   acv_waiters;            /* Tasks waiting for a signal */
+    atomic_flag     acv_lock;               /* Shared condition variables only */
+};
+
+extern void async_mutex_init(async_mutex_t *self, unsigned flags);
+extern bool async_mutex_trylock(async_mutex_t *self);
+extern void async_mutex_lock(crt_t *crt, async_mutex_t *mutex);
+extern void async_mutex_unlock(async_mutex_t *self);
+
+extern void async_sem_init(async_sem_t *self, size_t count, unsigned flags);
+extern bool async_sem_tryacquire(async_sem_t *self);
+extern void async_sem_acquire(crt_t *crt, async_sem_t *sem);
+extern void async_sem_release(async_sem_t *self);
+
+extern void async_cond_init(async_cond_t *self, unsigned flags);
+extern void async_cond_wait(crt_t *crt, async_cond_t *cond, async_mutex_t *mutex);
+extern void async_cond_signal(async_cond_t *self);
+extern void async_cond_broadcast(async_cond_t *self);
+
+#endif /* ASYNC_SYNC_H_INCLUDED */
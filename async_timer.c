@@ -0,0 +1,313 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <ev.h>
+
+#include "async.h"
+#include "async_uring.h"
+
+/*
+ * The wheel follows the classic cascading layout: a timer is stored at the
+ * lowest level whose span covers its delta from the next tick to process.
+ * Whenever the level 0 index wraps, the current slot of the level above is
+ * re-inserted, which moves its timers one level down.
+ */
+
+static void async_wheel_tick_fn(struct ev_loop *loop, ev_timer *w, int revents);
+static void async_timer_ev_fn(struct ev_loop *loop, ev_timer *w, int revents);
+
+/**
+ * Wake the timer's task, or call its handler
+ */
+void async_timer_expire(async_timer_t *self)
+{
+    if (self->atm_fn != NULL)
+    {
+        self->atm_fn(self);
+        return;
+    }
+
+    async_task_wake(self->atm_task, self);
+}
+
+/**
+ * Switch the loop timers to a timer wheel with ticks of @p resolution seconds.
+ * If @p coalesce is larger than 1, expiry ticks are rounded up to a multiple
+ * of it so that nearby deadlines share a slot and fire in one pass.
+ *
+ * Must be called while no timers are armed.
+ */
+void async_loop_timer_wheel(async_loop_t *self, double resolution, unsigned coalesce)
+{
+    async_wheel_t *wheel = &self->al_wheel;
+
+    assert(wheel->aw_count == 0);
+
+    memset(wheel, 0, sizeof(*wheel));
+
+    wheel->aw_resolution = resolution > 0.0 ? resolution : ASYNC_WHEEL_RESOLUTION;
+    wheel->aw_coalesce = coalesce;
+    wheel->aw_base = ev_now(self->al_ev);
+
+    ev_init(&wheel->aw_tick, async_wheel_tick_fn);
+    wheel->aw_tick.data = self;
+
+    self->al_timer_backend = ASYNC_TIMER_WHEEL;
+}
+
+static uint64_t async_wheel_now(async_loop_t *loop)
+{
+    async_wheel_t *self = &loop->al_wheel;
+
+    return (uint64_t)((ev_now(loop->al_ev) - self->aw_base) / self->aw_resolution);
+}
+
+static void async_wheel_unlink(async_timer_t *timer)
+{
+    *timer->atm_pprev = timer->atm_next;
+    if (timer->atm_next != NULL) timer->atm_next->atm_pprev = timer->atm_pprev;
+
+    timer->atm_next = NULL;
+    timer->atm_pprev = NULL;
+}
+
+static void async_wheel_link(async_wheel_t *self, async_timer_t *timer)
+{
+    async_timer_t **slot;
+    uint64_t expire;
+    uint64_t delta;
+    int level;
+
+    expire = timer->atm_expire;
+    if (expire < self->aw_next) expire = self->aw_next;
+
+    delta = expire - self->aw_next;
+
+    for (level = 0; level < ASYNC_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < (1ull << (ASYNC_WHEEL_BITS * (level + 1)))) break;
+    }
+
+    /* Beyond the top level -- park in the farthest slot, re-linked when it fires */
+    if (delta >= (1ull << (ASYNC_WHEEL_BITS * ASYNC_WHEEL_LEVELS)))
+    {
+        expire = self->aw_next + (1ull << (ASYNC_WHEEL_BITS * ASYNC_WHEEL_LEVELS)) - 1;
+    }
+
+    slot = &self->aw_slot[level][(expire >> (ASYNC_WHEEL_BITS * level)) & ASYNC_WHEEL_MASK];
+
+    timer->atm_next = *slot;
+    if (*slot != NULL) (*slot)->atm_pprev = &timer->atm_next;
+    timer->atm_pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * Re-insert all timers from a slot; the list head is moved to a local
+ * variable first so that unlinking works while iterating
+ */
+static void async_wheel_cascade(async_wheel_t *self, int level, unsigned index)
+{
+    async_timer_t *list;
+    async_timer_t *timer;
+
+    list = self->aw_slot[level][index];
+    self->aw_slot[level][index] = NULL;
+    if (list != NULL) list->atm_pprev = &list;
+
+    while ((timer = list) != NULL)
+    {
+        async_wheel_unlink(timer);
+        async_wheel_link(self, timer);
+    }
+}
+
+/**
+ * Process all ticks up to and including @p now
+ */
+static void async_wheel_run(async_loop_t *loop, uint64_t now)
+{
+    async_wheel_t *self = &loop->al_wheel;
+    async_timer_t *list;
+    async_timer_t *timer;
+    unsigned index;
+    unsigned cindex;
+    int level;
+
+    while (self->aw_next <= now && self->aw_count > 0)
+    {
+        index = self->aw_next & ASYNC_WHEEL_MASK;
+
+        if (index == 0)
+        {
+            for (level = 1; level < ASYNC_WHEEL_LEVELS; level++)
+            {
+                cindex = (self->aw_next >> (ASYNC_WHEEL_BITS * level)) & ASYNC_WHEEL_MASK;
+                async_wheel_cascade(self, level, cindex);
+                if (cindex != 0) break;
+            }
+        }
+
+        self->aw_next++;
+
+        list = self->aw_slot[0][index];
+        self->aw_slot[0][index] = NULL;
+        if (list != NULL) list->atm_pprev = &list;
+
+        while ((timer = list) != NULL)
+        {
+            async_wheel_unlink(timer);
+
+            /* Clamped timeout that is not due yet */
+            if (timer->atm_expire >= self->aw_next)
+            {
+                async_wheel_link(self, timer);
+                continue;
+            }
+
+            self->aw_count--;
+            async_timer_expire(timer);
+        }
+    }
+}
+
+void async_wheel_tick_fn(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    (void)revents;
+
+    async_loop_t *self = w->data;
+
+    async_wheel_run(self, async_wheel_now(self));
+
+    if (self->al_wheel.aw_count == 0) ev_timer_stop(loop, w);
+}
+
+void async_timer_ev_fn(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_timer_expire(w->data);
+}
+
+void async_timer_init(async_timer_t *self, async_task_t *task)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->atm_task = task;
+}
+
+/**
+ * Arm (or re-arm) the timer to wake its task in @p after seconds
+ */
+void async_timer_start(async_loop_t *loop, async_timer_t *self, double after)
+{
+    async_wheel_t *wheel = &loop->al_wheel;
+    uint64_t expire;
+
+    if (loop->al_timer_backend == ASYNC_TIMER_URING)
+    {
+        async_uring_timer_start(loop->al_uring, self, after);
+        return;
+    }
+
+    if (loop->al_timer_backend == ASYNC_TIMER_HEAP)
+    {
+        ev_timer_stop(loop->al_ev, &self->atm_ev);
+        ev_timer_init(&self->atm_ev, async_timer_ev_fn, after, 0.0);
+        self->atm_ev.data = self;
+        ev_timer_start(loop->al_ev, &self->atm_ev);
+        return;
+    }
+
+    if (self->atm_pprev != NULL)
+    {
+        async_wheel_unlink(self);
+        wheel->aw_count--;
+    }
+
+    if (wheel->aw_count == 0)
+    {
+        /* The wheel was idle, skip the ticks that passed meanwhile */
+        wheel->aw_next = async_wheel_now(loop);
+    }
+
+    if (!ev_is_active(&wheel->aw_tick))
+    {
+        ev_timer_set(&wheel->aw_tick, wheel->aw_resolution, wheel->aw_resolution);
+        ev_timer_start(loop->al_ev, &wheel->aw_tick);
+    }
+
+    /* Never fire early: round up to the first tick that starts after the deadline */
+    expire = (uint64_t)ceil((ev_now(loop->al_ev) + after - wheel->aw_base) / wheel->aw_resolution);
+    if (wheel->aw_coalesce > 1)
+    {
+        expire = (expire + wheel->aw_coalesce - 1) / wheel->aw_coalesce * wheel->aw_coalesce;
+    }
+
+    self->atm_expire = expire;
+    async_wheel_link(wheel, self);
+    wheel->aw_count++;
+}
+
+void async_timer_stop(async_loop_t *loop, async_timer_t *self)
+{
+    async_wheel_t *wheel = &loop->al_wheel;
+
+    if (loop->al_timer_backend == ASYNC_TIMER_URING)
+    {
+        async_uring_timer_stop(loop->al_uring, self);
+        return;
+    }
+
+    if (loop->al_timer_backend == ASYNC_TIMER_HEAP)
+    {
+        ev_timer_stop(loop->al_ev, &self->atm_ev);
+        return;
+    }
+
+    if (self->atm_pprev == NULL) return;
+
+    async_wheel_unlink(self);
+
+    if (--wheel->aw_count == 0) ev_timer_stop(loop->al_ev, &wheel->aw_tick);
+}
+
+bool async_timer_active(async_loop_t *loop, async_timer_t *self)
+{
+    if (loop->al_timer_backend == ASYNC_TIMER_URING) return self->atm_slot != 0;
+
+    if (loop->al_timer_backend == ASYNC_TIMER_HEAP)
+    {
+        return ev_is_active(&self->atm_ev);
+    }
+
+    return self->atm_pprev != NULL;
+}
+
+/**
+ * Seconds until an armed timer expires, 0 if it is not armed or already
+ * due
+ */
+double async_timer_remaining(async_loop_t *loop, async_timer_t *self)
+{
+    async_wheel_t *wheel = &loop->al_wheel;
+    double left;
+
+    if (!async_timer_active(loop, self)) return 0.0;
+
+    if (loop->al_timer_backend == ASYNC_TIMER_URING) return async_uring_timer_remaining(loop->al_uring, self);
+
+    if (loop->al_timer_backend == ASYNC_TIMER_HEAP)
+    {
+        left = ev_timer_remaining(loop->al_ev, &self->atm_ev);
+    }
+    else
+    {
+        left = wheel->aw_base + (double)self->atm_expire * wheel->aw_resolution - ev_now(loop->al_ev);
+    }
+
+    return (left > 0.0) ? left : 0.0;
+}
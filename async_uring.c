@@ -0,0 +1,878 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ev.h>
+
+#include "async.h"
+#include "async_io.h"
+#include "async_uring.h"
+
+#if defined(__linux__)
+
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * The user_data of an entry is the task waiting for it, a timeout slot
+ * tagged with the low bit (tasks are pointer-aligned), or 0 for entries
+ * whose completion is of no interest: cancellations and timeout removals.
+ */
+#define ASYNC_URING_IGNORE          0ull
+#define ASYNC_URING_TIMEOUT         1ull
+#define ASYNC_URING_TIMEOUTS        64                  /* Initial timeout slots */
+#define ASYNC_URING_RW_MAX          (1u << 30)          /* Longest read or write, results are int */
+
+static void async_uring_io_fn(struct ev_loop *loop, ev_io *w, int revents);
+static void async_uring_prepare_fn(struct ev_loop *loop, ev_prepare *w, int revents);
+static bool async_uring_cancel(async_uring_t *self, async_task_t *task);
+static void async_uring_timeout_prep(async_uring_t *self, struct io_uring_sqe *sqe, uint32_t slot);
+
+static int async_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int async_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Operations in flight keep the loop alive, like active watchers */
+static inline void async_uring_busy(async_uring_t *self)
+{
+    if (self->aur_inflight++ == 0) ev_ref(self->aur_loop->al_ev);
+}
+
+static inline void async_uring_idle(async_uring_t *self)
+{
+    if (--self->aur_inflight == 0) ev_unref(self->aur_loop->al_ev);
+}
+
+static int async_uring_map(async_uring_t *self, struct io_uring_params *p)
+{
+    char *sq;
+    char *cq;
+
+    self->aur_sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    self->aur_cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if ((p->features & IORING_FEAT_SINGLE_MMAP) && self->aur_cq_size > self->aur_sq_size)
+    {
+        self->aur_sq_size = self->aur_cq_size;
+    }
+
+    self->aur_sq_map = mmap(NULL, self->aur_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            self->aur_fd, IORING_OFF_SQ_RING);
+    if (self->aur_sq_map == MAP_FAILED) return -1;
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        self->aur_cq_map = self->aur_sq_map;
+    }
+    else
+    {
+        self->aur_cq_map = mmap(NULL, self->aur_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                self->aur_fd, IORING_OFF_CQ_RING);
+        if (self->aur_cq_map == MAP_FAILED) return -1;
+    }
+
+    self->aur_sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    self->aur_sqes = mmap(NULL, self->aur_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            self->aur_fd, IORING_OFF_SQES);
+    if (self->aur_sqes == MAP_FAILED) return -1;
+
+    sq = self->aur_sq_map;
+    self->aur_sq_head = (unsigned *)(sq + p->sq_off.head);
+    self->aur_sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    self->aur_sq_flags = (unsigned *)(sq + p->sq_off.flags);
+    self->aur_sq_array = (unsigned *)(sq + p->sq_off.array);
+    self->aur_sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+    self->aur_sq_entries = p->sq_entries;
+
+    cq = self->aur_cq_map;
+    self->aur_cq_head = (unsigned *)(cq + p->cq_off.head);
+    self->aur_cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    self->aur_cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+    self->aur_cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    return 0;
+}
+
+/**
+ * Move the I/O awaitables of the loop to an io_uring with @p entries
+ * submission queue entries (0 for ASYNC_URING_ENTRIES), and its timers too
+ * with ASYNC_URING_TIMERS. Must be called before any I/O or timer of the
+ * loop is in flight.
+ *
+ * @return 0 on success, -1 if the kernel has no usable io_uring (the loop
+ *         stays on libev then)
+ */
+int async_loop_io_uring(async_loop_t *self, unsigned entries, unsigned flags)
+{
+    struct io_uring_params p;
+    async_uring_t *ring;
+    unsigned cq_entries;
+
+    assert(self->al_uring == NULL);
+
+    if (entries == 0) entries = ASYNC_URING_ENTRIES;
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) return -1;
+
+    ring->aur_loop = self;
+    ring->aur_flags = flags;
+    ring->aur_sq_map = ring->aur_cq_map = ring->aur_sqes = MAP_FAILED;
+
+    /* Every parked task may have an operation in flight, leave room for their completions */
+    cq_entries = entries * 16;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = cq_entries;
+    ring->aur_fd = async_uring_setup(entries, &p);
+
+    if (ring->aur_fd < 0 && errno == EINVAL)
+    {
+        /* Before 5.19 */
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+        p.cq_entries = cq_entries;
+        ring->aur_fd = async_uring_setup(entries, &p);
+    }
+
+    if (ring->aur_fd < 0)
+    {
+        free(ring);
+        return -1;
+    }
+
+    /* Completions must never be dropped, parked tasks would never wake */
+    if (!(p.features & IORING_FEAT_NODROP))
+    {
+        async_uring_free(ring);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ring->aur_ts = calloc(p.sq_entries, sizeof(*ring->aur_ts));
+    if (ring->aur_ts == NULL || async_uring_map(ring, &p) != 0)
+    {
+        async_uring_free(ring);
+        return -1;
+    }
+
+    ev_io_init(&ring->aur_io, async_uring_io_fn, ring->aur_fd, EV_READ);
+    ring->aur_io.data = ring;
+    ev_io_start(self->al_ev, &ring->aur_io);
+    ev_unref(self->al_ev);
+
+    ev_prepare_init(&ring->aur_prepare, async_uring_prepare_fn);
+    ring->aur_prepare.data = ring;
+    ev_prepare_start(self->al_ev, &ring->aur_prepare);
+    ev_unref(self->al_ev);
+
+    self->al_uring = ring;
+    if (flags & ASYNC_URING_TIMERS) self->al_timer_backend = ASYNC_TIMER_URING;
+
+    return 0;
+}
+
+/**
+ * Close the ring of a loop, called by async_loop_fini(); nothing may be in
+ * flight
+ */
+void async_uring_free(async_uring_t *self)
+{
+    async_loop_t *loop = self->aur_loop;
+
+    if (ev_is_active(&self->aur_io))
+    {
+        ev_ref(loop->al_ev);
+        ev_io_stop(loop->al_ev, &self->aur_io);
+        ev_ref(loop->al_ev);
+        ev_prepare_stop(loop->al_ev, &self->aur_prepare);
+    }
+
+    if (self->aur_sqes != MAP_FAILED) munmap(self->aur_sqes, self->aur_sqes_size);
+    if (self->aur_cq_map != MAP_FAILED && self->aur_cq_map != self->aur_sq_map)
+    {
+        munmap(self->aur_cq_map, self->aur_cq_size);
+    }
+    if (self->aur_sq_map != MAP_FAILED) munmap(self->aur_sq_map, self->aur_sq_size);
+    if (self->aur_fd >= 0) close(self->aur_fd);
+
+    if (loop->al_uring == self)
+    {
+        loop->al_uring = NULL;
+        if (loop->al_timer_backend == ASYNC_TIMER_URING) loop->al_timer_backend = ASYNC_TIMER_HEAP;
+    }
+
+    free(self->aur_timeouts);
+    free(self->aur_ts);
+    free(self);
+}
+
+static void async_uring_timeout_done(async_uring_t *self, uint32_t slot)
+{
+    async_timer_t *timer = self->aur_timeouts[slot].aut_timer;
+
+    self->aur_timeouts[slot].aut_timer = NULL;
+    self->aur_timeouts[slot].aut_next = self->aur_free_timeout;
+    self->aur_free_timeout = slot;
+
+    async_uring_idle(self);
+
+    /* Stopped meanwhile, possibly re-armed in another slot */
+    if (timer == NULL) return;
+
+    timer->atm_slot = 0;
+    async_timer_expire(timer);
+}
+
+/* Handle the completions that came in */
+static void async_uring_reap(async_uring_t *self)
+{
+    unsigned head = *self->aur_cq_head;
+    struct io_uring_cqe *cqe;
+    async_task_t *task;
+    uint64_t data;
+    int res;
+
+    while (head != atomic_load_explicit((_Atomic unsigned *)self->aur_cq_tail, memory_order_acquire))
+    {
+        cqe = &self->aur_cqes[head & self->aur_cq_mask];
+        data = cqe->user_data;
+        res = cqe->res;
+
+        /* Free the slot first, whatever a woken task does next */
+        atomic_store_explicit((_Atomic unsigned *)self->aur_cq_head, ++head, memory_order_release);
+
+        if (data == ASYNC_URING_IGNORE) continue;
+
+        self->aur_completed++;
+
+        if (data & ASYNC_URING_TIMEOUT)
+        {
+            async_uring_timeout_done(self, (uint32_t)(data >> 1));
+            continue;
+        }
+
+        task = (async_task_t *)(uintptr_t)data;
+        task->at_uring_res = res;
+        task->at_uring_busy = false;
+        async_uring_idle(self);
+
+        async_task_wake(task, &task->at_io);
+    }
+}
+
+/*
+ * Submit the queued entries. A ring with completions the kernel could not
+ * post takes no more entries until they are reaped.
+ */
+static int async_uring_submit(async_uring_t *self)
+{
+    unsigned flags;
+    int retries = 0;
+    int n;
+
+    for (;;)
+    {
+        flags = (*self->aur_sq_flags & IORING_SQ_CQ_OVERFLOW) ? IORING_ENTER_GETEVENTS : 0;
+        if (self->aur_pending == 0 && flags == 0) return 0;
+
+        n = async_uring_enter(self->aur_fd, self->aur_pending, 0, flags);
+        self->aur_enters++;
+
+        if (n >= 0)
+        {
+            self->aur_pending -= n;
+            self->aur_submitted += n;
+            if (self->aur_pending == 0 || n == 0) return 0;
+            continue;
+        }
+
+        if (errno == EINTR) continue;
+        if ((errno != EAGAIN && errno != EBUSY) || retries++ > 0) return -1;
+
+        async_uring_reap(self);
+    }
+}
+
+/*
+ * Next free submission queue entry, cleared, NULL if the queue is full and
+ * cannot be submitted. The kernel reads entries in io_uring_enter() only,
+ * so they are published right away.
+ */
+static struct io_uring_sqe *async_uring_sqe(async_uring_t *self)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *self->aur_sq_tail;
+    unsigned index;
+
+    if (tail - atomic_load_explicit((_Atomic unsigned *)self->aur_sq_head, memory_order_acquire) ==
+            self->aur_sq_entries)
+    {
+        async_uring_submit(self);
+        if (tail - atomic_load_explicit((_Atomic unsigned *)self->aur_sq_head, memory_order_acquire) ==
+                self->aur_sq_entries)
+        {
+            return NULL;
+        }
+    }
+
+    index = tail & self->aur_sq_mask;
+    sqe = &self->aur_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    self->aur_sq_array[index] = index;
+    atomic_store_explicit((_Atomic unsigned *)self->aur_sq_tail, tail + 1, memory_order_release);
+    self->aur_pending++;
+
+    return sqe;
+}
+
+void async_uring_io_fn(struct ev_loop *loop, ev_io *w, int revents)
+{
+    (void)loop;
+    (void)revents;
+
+    async_uring_reap(w->data);
+}
+
+/* Queue the timer arms and cancellations that found no free entry */
+static void async_uring_deferred(async_uring_t *self)
+{
+    struct io_uring_sqe *sqe;
+    async_task_t *task;
+    uint32_t slot;
+
+    while ((slot = self->aur_deferred) != 0)
+    {
+        /* Stopped before it ever reached the ring */
+        if (self->aur_timeouts[slot].aut_timer == NULL)
+        {
+            self->aur_deferred = self->aur_timeouts[slot].aut_next;
+            self->aur_timeouts[slot].aut_deferred = false;
+            self->aur_timeouts[slot].aut_next = self->aur_free_timeout;
+            self->aur_free_timeout = slot;
+            async_uring_idle(self);
+            continue;
+        }
+
+        sqe = async_uring_sqe(self);
+        if (sqe == NULL) return;
+
+        self->aur_deferred = self->aur_timeouts[slot].aut_next;
+        self->aur_timeouts[slot].aut_deferred = false;
+        async_uring_timeout_prep(self, sqe, slot);
+    }
+
+    while ((task = self->aur_cancels) != NULL)
+    {
+        self->aur_cancels = task->at_uring_next;
+        task->at_uring_next = NULL;
+        task->at_uring_cancel = false;
+
+        if (!async_uring_cancel(self, task))
+        {
+            task->at_uring_cancel = true;
+            task->at_uring_next = self->aur_cancels;
+            self->aur_cancels = task;
+            return;
+        }
+    }
+}
+
+/**
+ * Once per loop iteration, before it polls: submit everything queued while
+ * the tasks ran, handle what completed during the submission, and queue
+ * what had to wait for room
+ */
+void async_uring_prepare_fn(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+    async_uring_t *self = w->data;
+
+    (void)loop;
+    (void)revents;
+
+    async_uring_submit(self);
+    async_uring_reap(self);
+
+    if (self->aur_deferred == 0 && self->aur_cancels == NULL) return;
+
+    async_uring_deferred(self);
+    async_uring_submit(self);
+}
+
+/**
+ * Arm a ring timeout for @p timer, see async_timer_start()
+ */
+void async_uring_timer_start(async_uring_t *self, async_timer_t *timer, double after)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t count;
+    uint32_t slot;
+    void *p;
+
+    if (timer->atm_slot != 0) async_uring_timer_stop(self, timer);
+
+    if (self->aur_free_timeout == 0)
+    {
+        count = self->aur_ntimeouts ? self->aur_ntimeouts * 2 : ASYNC_URING_TIMEOUTS;
+
+        p = realloc(self->aur_timeouts, count * sizeof(*self->aur_timeouts));
+        if (p == NULL) abort();
+        self->aur_timeouts = p;
+
+        /* Slot 0 stands for not armed */
+        for (slot = count - 1; slot > 0 && slot >= self->aur_ntimeouts; slot--)
+        {
+            self->aur_timeouts[slot].aut_timer = NULL;
+            self->aur_timeouts[slot].aut_next = self->aur_free_timeout;
+            self->aur_free_timeout = slot;
+        }
+
+        self->aur_ntimeouts = count;
+    }
+
+    slot = self->aur_free_timeout;
+    self->aur_free_timeout = self->aur_timeouts[slot].aut_next;
+    self->aur_timeouts[slot].aut_timer = timer;
+    timer->atm_slot = slot;
+
+    if (after < 0.0) after = 0.0;
+
+    self->aur_timeouts[slot].aut_expire = ev_now(self->aur_loop->al_ev) + after;
+    async_uring_busy(self);
+
+    /* The queue is full and the kernel takes no more: the timer cannot fail, arm it later */
+    sqe = async_uring_sqe(self);
+    if (sqe == NULL)
+    {
+        self->aur_timeouts[slot].aut_deferred = true;
+        self->aur_timeouts[slot].aut_next = self->aur_deferred;
+        self->aur_deferred = slot;
+        return;
+    }
+
+    async_uring_timeout_prep(self, sqe, slot);
+}
+
+/* Fill @p sqe with the ring timeout of @p slot, due at its aut_expire */
+static void async_uring_timeout_prep(async_uring_t *self, struct io_uring_sqe *sqe, uint32_t slot)
+{
+    struct __kernel_timespec *ts;
+    double after;
+
+    after = self->aur_timeouts[slot].aut_expire - ev_now(self->aur_loop->al_ev);
+    if (after < 0.0) after = 0.0;
+
+    /* Read at submission, kept with the entry until then */
+    ts = &self->aur_ts[sqe - self->aur_sqes];
+    ts->tv_sec = (long long)after;
+    ts->tv_nsec = (long long)((after - (double)ts->tv_sec) * 1e9);
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)slot << 1 | ASYNC_URING_TIMEOUT;
+}
+
+/**
+ * Disarm the ring timeout of @p timer. Its slot stays taken until the
+ * kernel confirms, a late expiry finds it detached from the timer.
+ */
+void async_uring_timer_stop(async_uring_t *self, async_timer_t *timer)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t slot = timer->atm_slot;
+
+    if (slot == 0) return;
+
+    self->aur_timeouts[slot].aut_timer = NULL;
+    timer->atm_slot = 0;
+
+    /* Never reached the ring, async_uring_deferred() frees the slot */
+    if (self->aur_timeouts[slot].aut_deferred) return;
+
+    /* Without an entry the timeout runs out unheeded */
+    sqe = async_uring_sqe(self);
+    if (sqe == NULL) return;
+
+    sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)slot << 1 | ASYNC_URING_TIMEOUT;
+    sqe->user_data = ASYNC_URING_IGNORE;
+}
+
+/**
+ * Seconds until the ring timeout of @p timer is due, 0 if it is not armed
+ * or already due
+ */
+double async_uring_timer_remaining(async_uring_t *self, async_timer_t *timer)
+{
+    double left;
+
+    if (timer->atm_slot == 0) return 0.0;
+
+    left = self->aur_timeouts[timer->atm_slot].aut_expire - ev_now(self->aur_loop->al_ev);
+
+    return (left > 0.0) ? left : 0.0;
+}
+
+static void async_uring_prep(struct io_uring_sqe *op, int opcode, int fd, const void *addr, size_t len)
+{
+    memset(op, 0, sizeof(*op));
+
+    op->opcode = opcode;
+    op->fd = fd;
+    op->addr = (uintptr_t)addr;
+    op->len = len < ASYNC_URING_RW_MAX ? (unsigned)len : ASYNC_URING_RW_MAX;
+    op->off = (uint64_t)-1;                             /* Current file position */
+}
+
+/*
+ * Park until the task's operation completed, and until a cancellation
+ * that waits for a free entry is off the ring's list
+ */
+static void async_uring_park(crt_t *crt)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    CRT(crt)
+    {
+        while (self->at_uring_busy || self->at_uring_cancel) CRT_YIELD();
+    }
+    CRT_END;
+}
+
+/*
+ * Queue the cancellation of the operation of @p task, if still in flight;
+ * false if there is no free entry for it. Once off the ring's list, a task
+ * whose operation completed meanwhile is still parked and woken here.
+ */
+static bool async_uring_cancel(async_uring_t *self, async_task_t *task)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!task->at_uring_busy)
+    {
+        async_task_wake(task, &task->at_io);
+        return true;
+    }
+
+    sqe = async_uring_sqe(self);
+    if (sqe == NULL) return false;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)task;
+    sqe->user_data = ASYNC_URING_IGNORE;
+
+    return true;
+}
+
+/*
+ * Queue @p op for the task and wait for its completion; *res is the result
+ * of the operation. @p op is read once, when the operation is queued.
+ *
+ * A cancel or timeout while in flight cancels the operation as well, and
+ * propagates once its completion arrived.
+ */
+static void async_uring_run(crt_t *crt, const struct io_uring_sqe *op, int *res)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    async_uring_t *ring = self->at_loop->al_uring;
+    struct io_uring_sqe *sqe;
+
+    CRT_LOCALS(crt, struct { int status; }, l)
+    {
+        sqe = async_uring_sqe(ring);
+        if (sqe == NULL)
+        {
+            *res = -EBUSY;
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        *sqe = *op;
+        sqe->user_data = (uintptr_t)self;
+        self->at_uring_busy = true;
+        async_uring_busy(ring);
+
+        for (;;)
+        {
+            CRT_AWAIT_NC(async_uring_park(crt));
+
+            if ((CRT_CANCELLED(crt) || CRT_TIMEDOUT(crt)) && l->status == CRT_OK)
+            {
+                l->status = CRT_STATUS(crt);
+
+                /* An idle socket would never complete, the prepare watcher retries */
+                if (self->at_uring_busy && !async_uring_cancel(ring, self))
+                {
+                    self->at_uring_cancel = true;
+                    self->at_uring_next = ring->aur_cancels;
+                    ring->aur_cancels = self;
+                }
+            }
+
+            if (!self->at_uring_busy && !self->at_uring_cancel) break;
+        }
+
+        *res = self->at_uring_res;
+        if (l->status != CRT_OK) CRT_EXIT(l->status);
+    }
+    CRT_END;
+}
+
+/**
+ * async_io_wait() on the ring: a one-shot poll. Unlike libev readiness, a
+ * poll the kernel refuses (EBADF, ...) fails with CRT_ERROR and errno set.
+ */
+void async_uring_io_wait(crt_t *crt, int fd, int events)
+{
+    struct io_uring_sqe op;
+
+    async_uring_prep(&op, IORING_OP_POLL_ADD, fd, NULL, 0);
+    op.off = 0;
+    op.poll32_events = ((events & EV_READ) ? POLLIN : 0) | ((events & EV_WRITE) ? POLLOUT : 0);
+
+    CRT_LOCALS(crt, struct { int res; }, l)
+    {
+        CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+
+        if (l->res < 0)
+        {
+            errno = -l->res;
+            CRT_EXIT(CRT_ERROR);
+        }
+    }
+    CRT_END;
+}
+
+/*
+ * Results of the operations below: a descriptor in non-blocking mode makes
+ * the ring fail an operation that would block with -EAGAIN instead of
+ * waiting, these wait for readiness and retry then
+ */
+
+void async_uring_read(crt_t *crt, int fd, void *buf, size_t len, ssize_t *rc)
+{
+    struct io_uring_sqe op;
+
+    async_uring_prep(&op, IORING_OP_READ, fd, buf, len);
+
+    CRT_LOCALS(crt, struct { int res; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+            if (l->res >= 0) break;
+
+            if (l->res == -EINTR) continue;
+            if (l->res != -EAGAIN)
+            {
+                errno = -l->res;
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            CRT_AWAIT(async_uring_io_wait(crt, fd, EV_READ));
+        }
+
+        *rc = l->res;
+    }
+    CRT_END;
+}
+
+void async_uring_write(crt_t *crt, int fd, const void *buf, size_t len, ssize_t *rc)
+{
+    struct io_uring_sqe op;
+
+    CRT_LOCALS(crt, struct { size_t done; int res; }, l)
+    {
+        while (l->done < len)
+        {
+            async_uring_prep(&op, IORING_OP_WRITE, fd, (const char *)buf + l->done, len - l->done);
+            CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+
+            if (l->res >= 0)
+            {
+                l->done += l->res;
+                continue;
+            }
+
+            if (l->res == -EINTR) continue;
+            if (l->res != -EAGAIN)
+            {
+                errno = -l->res;
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            CRT_AWAIT(async_uring_io_wait(crt, fd, EV_WRITE));
+        }
+
+        *rc = l->done;
+    }
+    CRT_END;
+}
+
+void async_uring_writev(crt_t *crt, int fd, struct iovec *iov, int iovcnt, ssize_t *rc)
+{
+    struct io_uring_sqe op;
+    size_t n;
+    size_t chunk;
+
+    CRT_LOCALS(crt, struct { size_t done; int first; int res; }, l)
+    {
+        for (;;)
+        {
+            while (l->first < iovcnt && iov[l->first].iov_len == 0) l->first++;
+            if (l->first >= iovcnt) break;
+
+            async_uring_prep(&op, IORING_OP_WRITEV, fd, iov + l->first, iovcnt - l->first);
+            CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+
+            if (l->res < 0)
+            {
+                if (l->res == -EINTR) continue;
+                if (l->res != -EAGAIN)
+                {
+                    errno = -l->res;
+                    *rc = -1;
+                    CRT_EXIT(CRT_ERROR);
+                }
+
+                CRT_AWAIT(async_uring_io_wait(crt, fd, EV_WRITE));
+                continue;
+            }
+
+            l->done += l->res;
+
+            /* Consume the written part */
+            for (n = l->res; n > 0; )
+            {
+                chunk = iov[l->first].iov_len < n ? iov[l->first].iov_len : n;
+
+                iov[l->first].iov_base = (char *)iov[l->first].iov_base + chunk;
+                iov[l->first].iov_len -= chunk;
+                n -= chunk;
+
+                if (iov[l->first].iov_len == 0) l->first++;
+            }
+        }
+
+        *rc = l->done;
+    }
+    CRT_END;
+}
+
+void async_uring_accept(crt_t *crt, int fd, struct sockaddr *addr, socklen_t *addrlen, int *rc)
+{
+    struct io_uring_sqe op;
+
+    async_uring_prep(&op, IORING_OP_ACCEPT, fd, addr, 0);
+    op.off = (uintptr_t)addrlen;
+    op.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+    CRT_LOCALS(crt, struct { int res; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+            if (l->res >= 0) break;
+
+            if (l->res == -EINTR || l->res == -ECONNABORTED) continue;
+            if (l->res != -EAGAIN)
+            {
+                errno = -l->res;
+                *rc = -1;
+                CRT_EXIT(CRT_ERROR);
+            }
+
+            CRT_AWAIT(async_uring_io_wait(crt, fd, EV_READ));
+        }
+
+        *rc = l->res;
+    }
+    CRT_END;
+}
+
+void async_uring_fsync(crt_t *crt, int fd, int *rc)
+{
+    struct io_uring_sqe op;
+
+    async_uring_prep(&op, IORING_OP_FSYNC, fd, NULL, 0);
+    op.off = 0;
+
+    CRT_LOCALS(crt, struct { int res; }, l)
+    {
+        do
+        {
+            CRT_AWAIT(async_uring_run(crt, &op, &l->res));
+        }
+        while (l->res == -EINTR);
+
+        if (l->res < 0)
+        {
+            errno = -l->res;
+            *rc = -1;
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        *rc = 0;
+    }
+    CRT_END;
+}
+
+#else /* !__linux__ */
+
+int async_loop_io_uring(async_loop_t *self, unsigned entries, unsigned flags)
+{
+    (void)self;
+    (void)entries;
+    (void)flags;
+
+    errno = ENOSYS;
+
+    return -1;
+}
+
+void async_uring_free(async_uring_t *self)
+{
+    (void)self;
+}
+
+void async_uring_timer_start(async_uring_t *self, async_timer_t *timer, double after)
+{
+    (void)self;
+    (void)timer;
+    (void)after;
+}
+
+void async_uring_timer_stop(async_uring_t *self, async_timer_t *timer)
+{
+    (void)self;
+    (void)timer;
+}
+
+double async_uring_timer_remaining(async_uring_t *self, async_timer_t *timer)
+{
+    (void)self;
+    (void)timer;
+
+    return 0.0;
+}
+
+#endif /* __linux__ */
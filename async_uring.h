@@ -0,0 +1,112 @@
+#if !defined(ASYNC_URING_H_INCLUDED)
+#define ASYNC_URING_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "async.h"
+
+/*
+ * io_uring backend for the I/O awaitables of async_io.h and, optionally, the
+ * task timers. Once a loop has a ring, async_read(), async_write(),
+ * async_writev(), async_accept(), async_fsync() and async_io_wait() submit
+ * an operation instead of waiting for readiness and calling the system call
+ * themselves; the co-routine API does not change.
+ *
+ * Operations are queued while tasks run and submitted together with one
+ * io_uring_enter() from a prepare watcher, before the loop polls. The ring
+ * descriptor is watched by the libev loop like any other; completions carry
+ * the parked task in their user_data and wake it directly. Timers become
+ * IORING_OP_TIMEOUT operations with ASYNC_URING_TIMERS.
+ *
+ * A task that is cancelled or times out while its operation is in flight
+ * cancels the operation and unwinds only once its completion arrived, the
+ * kernel may use the task's buffers until then.
+ *
+ * Timer arms and cancellations that find the submission queue full, with
+ * the kernel refusing more, are kept aside and queued by the next prepare
+ * watcher run that finds room; an operation fails with EBUSY instead.
+ *
+ *      async_loop_init(&loop, ev_loop_new(EVBACKEND_EPOLL));
+ *      if (async_loop_io_uring(&loop, 256, ASYNC_URING_TIMERS) != 0) ...  // libev then
+ *
+ * The ring is set up with raw system calls, liburing is not needed.
+ */
+
+#define ASYNC_URING_TIMERS          (1 << 0)            /* Timers on the ring too */
+
+#define ASYNC_URING_ENTRIES         256                 /* Default submission queue size */
+
+typedef struct async_uring async_uring_t;
+typedef struct async_uring_timeout async_uring_timeout_t;
+
+#if defined(__linux__)
+
+#include <linux/io_uring.h>
+
+/* Armed ring timeout; slot 0 of the table is never used */
+struct async_uring_timeout
+{
+    async_timer_t  *aut_timer;              /* Timer to expire, NULL once stopped */
+    double          aut_expire;             /* Loop time it is due, the ring does not tell */
+    uint32_t        aut_next;               /* Free or deferred slot list link */
+    bool            aut_deferred;           /* Not queued yet, the submission queue was full */
+};
+
+struct async_uring
+{
+    async_loop_t   *aur_loop;               /* Loop the ring belongs to */
+    int             aur_fd;                 /* Ring descriptor */
+    unsigned        aur_flags;              /* ASYNC_URING_* */
+    void           *aur_sq_map;             /* Submission ring mapping */
+    size_t          aur_sq_size;
+    void           *aur_cq_map;             /* Completion ring mapping, may be aur_sq_map */
+    size_t          aur_cq_size;
+    struct io_uring_sqe *aur_sqes;          /* Submission queue entries */
+    size_t          aur_sqes_size;
+    unsigned       *aur_sq_head;            /* Advanced by the kernel */
+    unsigned       *aur_sq_tail;
+    unsigned       *aur_sq_flags;
+    unsigned       *aur_sq_array;
+    unsigned        aur_sq_mask;
+    unsigned        aur_sq_entries;
+    unsigned       *aur_cq_head;
+    unsigned       *aur_cq_tail;            /* Advanced by the kernel */
+    unsigned        aur_cq_mask;
+    struct io_uring_cqe *aur_cqes;
+    unsigned        aur_pending;            /* Entries queued since the last submission */
+    unsigned        aur_inflight;           /* Operations and timeouts without completion */
+    struct __kernel_timespec *aur_ts;       /* Timeout of each submission queue entry */
+    async_uring_timeout_t *aur_timeouts;    /* Armed timeouts by slot */
+    uint32_t        aur_ntimeouts;          /* Slots in aur_timeouts */
+    uint32_t        aur_free_timeout;       /* Free slot list, 0 if empty */
+    uint32_t        aur_deferred;           /* Timeouts to queue once entries are free, 0 if none */
+    async_task_t   *aur_cancels;            /* Cancellations to queue once entries are free */
+    ev_io           aur_io;                 /* Ring readable: completions to reap */
+    ev_prepare      aur_prepare;            /* Submits the queued entries */
+    uint64_t        aur_enters;             /* io_uring_enter() calls */
+    uint64_t        aur_submitted;          /* Entries submitted */
+    uint64_t        aur_completed;          /* Completions reaped */
+};
+
+#endif
+
+extern int async_loop_io_uring(async_loop_t *self, unsigned entries, unsigned flags);
+extern void async_uring_free(async_uring_t *self);
+
+extern void async_uring_io_wait(crt_t *crt, int fd, int events);
+extern void async_uring_read(crt_t *crt, int fd, void *buf, size_t len, ssize_t *rc);
+extern void async_uring_write(crt_t *crt, int fd, const void *buf, size_t len, ssize_t *rc);
+extern void async_uring_writev(crt_t *crt, int fd, struct iovec *iov, int iovcnt, ssize_t *rc);
+extern void async_uring_accept(crt_t *crt, int fd, struct sockaddr *addr, socklen_t *addrlen, int *rc);
+extern void async_uring_fsync(crt_t *crt, int fd, int *rc);
+
+extern void async_uring_timer_start(async_uring_t *self, async_timer_t *timer, double after);
+extern void async_uring_timer_stop(async_uring_t *self, async_timer_t *timer);
+extern double async_uring_timer_remaining(async_uring_t *self, async_timer_t *timer);
+
+#endif /* ASYNC_URING_H_INCLUDED */
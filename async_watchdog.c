@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "async.h"
+#include "async_watchdog.h"
+
+#define ASYNC_WATCHDOG_PERIOD_MIN   0.001               /* Shortest sampling period */
+
+static double async_watchdog_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Read the running task of a loop stuck in @p slice. Everything is read
+ * from under the running task, so the report only counts if the heartbeat
+ * did not move meanwhile.
+ *
+ * Only the task object itself is read: the slice may end and the task
+ * finish during the capture, which frees a grown stack, and a stack given
+ * with CRT_INIT_STACK() belongs to the caller. Tasks that are not on their
+ * built-in stack are reported without resume points.
+ */
+static bool async_watchdog_capture(async_loop_t *loop, unsigned long slice, async_stall_t *stall)
+{
+    async_task_t *task = atomic_load_explicit(&loop->al_running, memory_order_acquire);
+    crt_t *crt;
+    int ii;
+
+    if (task == NULL) return false;
+
+    crt = &task->at_crt;
+
+    stall->asl_loop = loop;
+    stall->asl_task = task;
+    stall->asl_main = task->at_main;
+    stall->asl_depth = crt->crt_depth;
+
+    if (stall->asl_depth < 0) stall->asl_depth = 0;
+    if (stall->asl_depth >= CRT_STACK_DEPTH) stall->asl_depth = CRT_STACK_DEPTH - 1;
+    if (stall->asl_depth >= ASYNC_WATCHDOG_DEPTH) stall->asl_depth = ASYNC_WATCHDOG_DEPTH - 1;
+
+    /* The pointer is compared, never followed */
+    if (crt->crt_stack != crt->crt_inline) stall->asl_depth = -1;
+
+    for (ii = 0; ii <= stall->asl_depth; ii++) stall->asl_points[ii] = crt->crt_inline[ii];
+
+    atomic_thread_fence(memory_order_acquire);
+
+    return atomic_load_explicit(&loop->al_slices, memory_order_relaxed) == slice &&
+            atomic_load_explicit(&loop->al_running, memory_order_relaxed) == task;
+}
+
+/* Sample the heartbeat of @p watch, with awd_mutex held */
+static void async_watchdog_check(async_watchdog_t *self, async_watch_t *watch, double now)
+{
+    async_loop_t *loop = watch->awt_loop;
+    async_stall_t stall;
+    unsigned long slice;
+
+    slice = atomic_load_explicit(&loop->al_slices, memory_order_acquire);
+
+    /* Idle, or a new slice since the last sample */
+    if (atomic_load_explicit(&loop->al_running, memory_order_relaxed) == NULL || slice != watch->awt_slice)
+    {
+        watch->awt_slice = slice;
+        watch->awt_since = now;
+        watch->awt_reported = false;
+        return;
+    }
+
+    if (watch->awt_reported || now - watch->awt_since < self->awd_threshold) return;
+
+    watch->awt_reported = true;
+
+    if (!async_watchdog_capture(loop, slice, &stall)) return;
+
+    stall.asl_duration = now - watch->awt_since;
+    atomic_fetch_add_explicit(&self->awd_stalls, 1, memory_order_relaxed);
+
+    if (self->awd_fn != NULL) self->awd_fn(self, &stall);
+}
+
+static void *async_watchdog_thread(void *arg)
+{
+    async_watchdog_t *self = arg;
+    struct timespec ts;
+    double period;
+    double now;
+    int ii;
+
+    /* A stall is seen between one and 1.25 thresholds into the slice */
+    period = self->awd_threshold / 4;
+    if (period < ASYNC_WATCHDOG_PERIOD_MIN) period = ASYNC_WATCHDOG_PERIOD_MIN;
+
+    pthread_mutex_lock(&self->awd_mutex);
+
+    while (!self->awd_stop)
+    {
+        now = async_watchdog_now();
+
+        for (ii = 0; ii < self->awd_nwatch; ii++) async_watchdog_check(self, &self->awd_watch[ii], now);
+
+        now += period;
+        ts.tv_sec = (time_t)now;
+        ts.tv_nsec = (long)((now - (double)ts.tv_sec) * 1e9);
+
+        while (!self->awd_stop && pthread_cond_timedwait(&self->awd_cond, &self->awd_mutex, &ts) != ETIMEDOUT);
+    }
+
+    pthread_mutex_unlock(&self->awd_mutex);
+
+    return NULL;
+}
+
+/**
+ * Start a watchdog reporting slices longer than @p threshold seconds
+ * through @p fn, which may be NULL to only count them in awd_stalls
+ *
+ * @return 0 on success, -1 on error
+ */
+int async_watchdog_init(async_watchdog_t *self, double threshold, async_stall_fn *fn, void *data)
+{
+    pthread_condattr_t attr;
+
+    memset(self, 0, sizeof(*self));
+
+    self->awd_threshold = threshold;
+    self->awd_fn = fn;
+    self->awd_data = data;
+
+    pthread_mutex_init(&self->awd_mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->awd_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&self->awd_thread, NULL, async_watchdog_thread, self) != 0)
+    {
+        pthread_cond_destroy(&self->awd_cond);
+        pthread_mutex_destroy(&self->awd_mutex);
+        return -1;
+    }
+
+    return 0;
+}
+
+void async_watchdog_fini(async_watchdog_t *self)
+{
+    pthread_mutex_lock(&self->awd_mutex);
+    self->awd_stop = true;
+    pthread_cond_signal(&self->awd_cond);
+    pthread_mutex_unlock(&self->awd_mutex);
+
+    pthread_join(self->awd_thread, NULL);
+
+    pthread_cond_destroy(&self->awd_cond);
+    pthread_mutex_destroy(&self->awd_mutex);
+}
+
+/**
+ * Watch the heartbeat of @p loop, from any thread
+ *
+ * @return 0 on success, -1 if ASYNC_WATCHDOG_LOOPS are watched already
+ */
+int async_watchdog_watch(async_watchdog_t *self, async_loop_t *loop)
+{
+    async_watch_t *watch;
+    int rc = -1;
+
+    pthread_mutex_lock(&self->awd_mutex);
+
+    if (self->awd_nwatch < ASYNC_WATCHDOG_LOOPS)
+    {
+        watch = &self->awd_watch[self->awd_nwatch++];
+        watch->awt_loop = loop;
+        watch->awt_slice = atomic_load(&loop->al_slices);
+        watch->awt_since = async_watchdog_now();
+        watch->awt_reported = false;
+        rc = 0;
+    }
+
+    pthread_mutex_unlock(&self->awd_mutex);
+
+    return rc;
+}
+
+/**
+ * Stop watching @p loop, e.g. before async_loop_fini()
+ */
+void async_watchdog_unwatch(async_watchdog_t *self, async_loop_t *loop)
+{
+    int ii;
+
+    pthread_mutex_lock(&self->awd_mutex);
+
+    for (ii = 0; ii < self->awd_nwatch; ii++)
+    {
+        if (self->awd_watch[ii].awt_loop == loop)
+        {
+            self->awd_watch[ii] = self->awd_watch[--self->awd_nwatch];
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&self->awd_mutex);
+}
+
+/**
+ * Print a stall report on one line, the function by name if dladdr() knows
+ * it (link with -rdynamic)
+ */
+void async_stall_print(const async_stall_t *stall, FILE *out)
+{
+    Dl_info info;
+    int ii;
+
+    fprintf(out, "stall: task %p", (void *)stall->asl_task);
+
+    if (dladdr((void *)(uintptr_t)stall->asl_main, &info) != 0 && info.dli_sname != NULL)
+    {
+        fprintf(out, " (%s)", info.dli_sname);
+    }
+    else
+    {
+        fprintf(out, " (%p)", (void *)(uintptr_t)stall->asl_main);
+    }
+
+    fprintf(out, " running for %.1f ms", stall->asl_duration * 1e3);
+
+    if (stall->asl_depth < 0)
+    {
+        fprintf(out, ", resume points not on the built-in stack\n");
+        return;
+    }
+
+    fprintf(out, ", resume points");
+    for (ii = 0; ii <= stall->asl_depth; ii++) fprintf(out, " %d", (int)stall->asl_points[ii]);
+    fprintf(out, "\n");
+}
@@ -0,0 +1,83 @@
+#if !defined(ASYNC_WATCHDOG_H_INCLUDED)
+#define ASYNC_WATCHDOG_H_INCLUDED
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "async.h"
+
+/*
+ * Stall watchdog: a thread that samples the heartbeat of a set of loops
+ * (the task being resumed and a count of resumes, updated around each
+ * resume) and reports every slice that runs longer than a threshold -- a
+ * task that forgot to yield and blocks all the others of its loop.
+ *
+ * A stall is reported once per slice, between threshold and 1.25 times the
+ * threshold after the slice started, with the task, its function and the
+ * resume points of its crt_stack. The report is taken from the watchdog
+ * thread while the task runs; it is checked against the heartbeat
+ * afterwards and dropped if the slice ended meanwhile. It reads nothing but
+ * the task object, so the resume points are missing for tasks on a grown
+ * or external stack.
+ *
+ *      async_watchdog_init(&wd, 0.1, on_stall, NULL);
+ *      async_watchdog_watch(&wd, &loop);
+ */
+
+#if !defined(ASYNC_WATCHDOG_LOOPS)
+#define ASYNC_WATCHDOG_LOOPS        64                  /* Loops per watchdog */
+#endif
+
+#if !defined(ASYNC_WATCHDOG_DEPTH)
+#define ASYNC_WATCHDOG_DEPTH        16                  /* Resume points per report */
+#endif
+
+typedef struct async_stall async_stall_t;
+typedef struct async_watch async_watch_t;
+typedef struct async_watchdog async_watchdog_t;
+
+/* Called on the watchdog thread, must not call async_watchdog_*() */
+typedef void async_stall_fn(async_watchdog_t *wd, const async_stall_t *stall);
+
+struct async_stall
+{
+    async_loop_t   *asl_loop;               /* Loop that is blocked */
+    async_task_t   *asl_task;               /* Task running too long */
+    async_main_t   *asl_main;               /* Its function */
+    double          asl_duration;           /* Slice length so far in seconds, at least */
+    int             asl_depth;              /* Innermost frame in asl_points, -1 if not on the built-in stack */
+    crt_point_t     asl_points[ASYNC_WATCHDOG_DEPTH];   /* crt_stack: the await each frame is in */
+};
+
+/* Heartbeat of a loop as last sampled */
+struct async_watch
+{
+    async_loop_t   *awt_loop;
+    unsigned long   awt_slice;              /* al_slices at the first sample of this slice */
+    double          awt_since;              /* Time of that sample */
+    bool            awt_reported;           /* Slice reported already */
+};
+
+struct async_watchdog
+{
+    pthread_t       awd_thread;
+    pthread_mutex_t awd_mutex;              /* Guards everything below */
+    pthread_cond_t  awd_cond;               /* Signalled on stop */
+    double          awd_threshold;          /* Slice length reported as a stall */
+    async_stall_fn *awd_fn;                 /* Report callback, or NULL */
+    void           *awd_data;               /* Callback data */
+    async_watch_t   awd_watch[ASYNC_WATCHDOG_LOOPS];
+    int             awd_nwatch;
+    bool            awd_stop;
+    atomic_ulong    awd_stalls;             /* Stalls found */
+};
+
+extern int async_watchdog_init(async_watchdog_t *self, double threshold, async_stall_fn *fn, void *data);
+extern void async_watchdog_fini(async_watchdog_t *self);
+extern int async_watchdog_watch(async_watchdog_t *self, async_loop_t *loop);
+extern void async_watchdog_unwatch(async_watchdog_t *self, async_loop_t *loop);
+extern void async_stall_print(const async_stall_t *stall, FILE *out);
+
+#endif /* ASYNC_WATCHDOG_H_INCLUDED */
@@ -0,0 +1,88 @@
+#if !defined(BENCH_H_INCLUDED)
+#define BENCH_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Small helpers shared by the benchmark programs
+ */
+
+/**
+ * Monotonic time in nanoseconds
+ */
+static inline uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * CPU time used by the process in nanoseconds, excludes time spent blocked
+ */
+static inline uint64_t bench_cpu(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Resident set size of the current process in bytes, 0 if unknown
+ */
+static inline size_t bench_rss(void)
+{
+    FILE *f;
+    char line[128];
+    size_t rss = 0;
+
+    f = fopen("/proc/self/status", "r");
+    if (f == NULL) return 0;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+        {
+            rss = strtoull(line + 6, NULL, 10) * 1024;
+            break;
+        }
+    }
+
+    fclose(f);
+
+    return rss;
+}
+
+/**
+ * Cheap xorshift PRNG, @p state must be non-zero
+ */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+/**
+ * Parse an optional numeric command line argument
+ */
+static inline long bench_arg(int argc, char *argv[], int idx, long def)
+{
+    if (argc <= idx) return def;
+
+    return strtol(argv[idx], NULL, 0);
+}
+
+#endif /* BENCH_H_INCLUDED */
@@ -0,0 +1,109 @@
+/*
+ * Batched generator benchmark: a generator producing a sequence of numbers
+ * one value per resume (primes() style, 0 ends the stream) against the same
+ * generator filling CRT_YIELD_BATCH() batches of various sizes.
+ *
+ * Usage: bench_batch [items]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../crt.h"
+#include "bench.h"
+
+#define BATCH_MAX   1024
+
+CRT_BATCH_DEFINE(u32_batch_t, uint32_t);
+
+struct gen
+{
+    crt_t       crt;
+    _Alignas(CRT_LOCALS_ALIGN)
+    char        locals[64];
+};
+
+static long resumes;
+
+/* One value per resume, 0 doubles as end of stream */
+uint32_t numbers(crt_t *crt, uint32_t limit)
+{
+    resumes++;
+
+    CRT_LOCALS(crt, struct { uint32_t n; }, l)
+    {
+        for (l->n = 1; l->n <= limit; l->n++)
+        {
+            CRT_YIELD(l->n);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Same sequence, a batch per resume */
+void numbers_batch(crt_t *crt, u32_batch_t *batch, uint32_t limit)
+{
+    resumes++;
+
+    CRT_LOCALS(crt, struct { uint32_t n; }, l)
+    {
+        for (l->n = 1; l->n <= limit; l->n++)
+        {
+            CRT_YIELD_BATCH(batch, l->n);
+        }
+    }
+    CRT_END;
+}
+
+static void report(const char *name, uint64_t sum, uint64_t expect, long nitems, uint64_t ns)
+{
+    printf("%-12s %6.2f ns/item, %6.3f resumes/item %s\n", name,
+            (double)ns / (double)nitems, (double)resumes / (double)nitems,
+            sum == expect ? "" : "(bad checksum)");
+}
+
+int main(int argc, char *argv[])
+{
+    static uint32_t buf[BATCH_MAX];
+    static const size_t sizes[] = { 4, 16, 64, 256, 1024 };
+    long nitems = bench_arg(argc, argv, 1, 10000000);
+    uint64_t expect = (uint64_t)nitems * (nitems + 1) / 2;
+    struct gen g;
+    u32_batch_t batch;
+    uint64_t tstart;
+    uint64_t sum;
+    uint32_t n;
+    size_t ii;
+    size_t jj;
+    char name[32];
+
+    CRT_INIT_LOCALS(&g.crt, g.locals, sizeof(g.locals));
+    resumes = 0;
+    sum = 0;
+
+    tstart = bench_now();
+    while ((n = numbers(&g.crt, nitems)) > 0) sum += n;
+    report("one-item", sum, expect, nitems, bench_now() - tstart);
+
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++)
+    {
+        CRT_INIT_LOCALS(&g.crt, g.locals, sizeof(g.locals));
+        CRT_BATCH_INIT(&batch, buf, sizes[ii]);
+        resumes = 0;
+        sum = 0;
+
+        tstart = bench_now();
+        do
+        {
+            numbers_batch(&g.crt, &batch, nitems);
+            for (jj = 0; jj < batch.cb_count; jj++) sum += batch.cb_items[jj];
+        }
+        while (CRT_RUNNING(&g.crt));
+
+        snprintf(name, sizeof(name), "batch %zu", sizes[ii]);
+        report(name, sum, expect, nitems, bench_now() - tstart);
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Mass cancellation benchmark: parks a number of pooled tasks, then cancels
+ * them one by one, with async_task_cancel_many() and through a group. Reports
+ * the cost per task from the cancel call until every task has unwound and
+ * the loop iterations that took.
+ *
+ * Usage: bench_cancel [tasks]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+enum mode
+{
+    MODE_SINGLE,
+    MODE_MANY,
+    MODE_GROUP,
+};
+
+static const char *mode_names[] = { "single", "many", "group" };
+
+static long ncancelled;
+
+int parked_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        /* A couple of frames deep, like a task blocked in a read */
+        CRT_AWAIT(async_task_sleep(crt, 3600.0), 0);
+    }
+    CRT_END;
+
+    if (CRT_CANCELLED(crt)) ncancelled++;
+
+    return 0;
+}
+
+static void run(enum mode mode, long ntasks)
+{
+    async_loop_t loop;
+    async_group_t group;
+    async_task_t **tasks;
+    unsigned iter_start;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    tasks = calloc(ntasks, sizeof(*tasks));
+    if (tasks == NULL) return;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+    async_loop_timer_wheel(&loop, ASYNC_WHEEL_RESOLUTION, 1);
+    async_group_init(&group, NULL);
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        tasks[ii] = async_spawn(&loop, parked_task, NULL);
+        if (tasks[ii] == NULL) abort();
+
+        async_group_add(&group, tasks[ii]);
+    }
+
+    /* Park everything, the timers keep the loop alive */
+    while (loop.al_runq_len > 0) ev_run(loop.al_ev, EVRUN_NOWAIT);
+
+    ncancelled = 0;
+    iter_start = ev_iteration(loop.al_ev);
+    tstart = bench_now();
+
+    switch (mode)
+    {
+        case MODE_SINGLE:
+            for (ii = 0; ii < ntasks; ii++) async_task_cancel(tasks[ii]);
+            break;
+
+        case MODE_MANY:
+            async_task_cancel_many(tasks, ntasks);
+            break;
+
+        case MODE_GROUP:
+            async_group_cancel(&group);
+            break;
+    }
+
+    /* Pooled tasks are reaped, the loop ends once the last timer is gone */
+    async_loop_run(&loop);
+
+    tend = bench_now();
+
+    printf("%-8s %ld tasks, %ld cancelled, %.1f ns/task, %u loop iterations, %zu left in group\n",
+            mode_names[mode], ntasks, ncancelled, (double)(tend - tstart) / (double)ntasks,
+            ev_iteration(loop.al_ev) - iter_start, group.ag_count);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+    free(tasks);
+}
+
+int main(int argc, char *argv[])
+{
+    long ntasks = bench_arg(argc, argv, 1, 100000);
+
+    run(MODE_SINGLE, ntasks);
+    run(MODE_MANY, ntasks);
+    run(MODE_GROUP, ntasks);
+
+    return 0;
+}
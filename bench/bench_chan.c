@@ -0,0 +1,218 @@
+/*
+ * Channel pipeline benchmark: a source, two transform stages and a sink
+ * connected by three bounded channels. Runs with single-item and batched
+ * operations on one loop (local channels), and batched with every stage on
+ * its own runtime worker (shared channels).
+ *
+ * Usage: bench_chan [messages] [batch] [capacity]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_chan.h"
+#include "../async_rt.h"
+#include "bench.h"
+
+#define NSTAGES     4
+#define BATCH_MAX   1024
+
+struct stage
+{
+    async_chan_t   *s_in;                   /* NULL for the source */
+    async_chan_t   *s_out;                  /* NULL for the sink */
+    size_t          s_batch;                /* 1 uses the single item calls */
+    size_t          s_n;
+    size_t          s_rc;
+    int             s_irc;
+    uint64_t        s_sum;
+    uint64_t        s_buf[BATCH_MAX];
+};
+
+static long nmessages;
+static atomic_bool finished;
+
+int stage_task(crt_t *crt, void *arg)
+{
+    struct stage *s = arg;
+
+    CRT_LOCALS(crt, struct { long ii; }, l)
+    {
+        /* Source */
+        for (l->ii = 0; s->s_in == NULL && l->ii < nmessages; l->ii += s->s_n)
+        {
+            s->s_n = s->s_batch;
+            if (s->s_n > (size_t)(nmessages - l->ii)) s->s_n = nmessages - l->ii;
+
+            for (size_t jj = 0; jj < s->s_n; jj++) s->s_buf[jj] = l->ii + jj;
+
+            if (s->s_batch == 1)
+            {
+                CRT_AWAIT(async_chan_send(crt, s->s_out, s->s_buf, &s->s_irc), 0);
+            }
+            else
+            {
+                CRT_AWAIT(async_chan_send_many(crt, s->s_out, s->s_buf, s->s_n, &s->s_rc), 0);
+            }
+        }
+
+        /* Transform stages and sink */
+        while (s->s_in != NULL)
+        {
+            if (s->s_batch == 1)
+            {
+                CRT_AWAIT(async_chan_recv(crt, s->s_in, s->s_buf, &s->s_irc), 0);
+                s->s_n = (s->s_irc == 0) ? 1 : 0;
+            }
+            else
+            {
+                CRT_AWAIT(async_chan_recv_many(crt, s->s_in, s->s_buf, s->s_batch, &s->s_n), 0);
+            }
+
+            if (s->s_n == 0) break;
+
+            for (size_t jj = 0; jj < s->s_n; jj++) s->s_sum += s->s_buf[jj]++;
+
+            if (s->s_out == NULL) continue;
+
+            if (s->s_batch == 1)
+            {
+                CRT_AWAIT(async_chan_send(crt, s->s_out, s->s_buf, &s->s_irc), 0);
+            }
+            else
+            {
+                CRT_AWAIT(async_chan_send_many(crt, s->s_out, s->s_buf, s->s_n, &s->s_rc), 0);
+            }
+        }
+
+        if (s->s_out != NULL)
+        {
+            async_chan_close(s->s_out);
+        }
+        else
+        {
+            atomic_store(&finished, true);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void report(const char *name, struct stage *stages, uint64_t ns)
+{
+    uint64_t expect = (uint64_t)nmessages * (nmessages - 1) / 2 + 2 * (uint64_t)nmessages;
+
+    printf("%-24s %8.1f ns/msg %8.2f Mmsg/s %s\n", name, (double)ns / (double)nmessages,
+            (double)nmessages / ((double)ns / 1e3),
+            stages[NSTAGES - 1].s_sum == expect ? "" : "(bad checksum)");
+}
+
+static void setup(struct stage *stages, async_chan_t *chans, size_t batch, size_t capacity, unsigned flags)
+{
+    int ii;
+
+    memset(stages, 0, NSTAGES * sizeof(*stages));
+
+    for (ii = 0; ii < NSTAGES - 1; ii++)
+    {
+        if (async_chan_init(&chans[ii], sizeof(uint64_t), capacity, flags) != 0) abort();
+    }
+
+    for (ii = 0; ii < NSTAGES; ii++)
+    {
+        stages[ii].s_batch = batch;
+        stages[ii].s_in = (ii > 0) ? &chans[ii - 1] : NULL;
+        stages[ii].s_out = (ii < NSTAGES - 1) ? &chans[ii] : NULL;
+    }
+
+    atomic_store(&finished, false);
+}
+
+static void run_local(size_t batch, size_t capacity)
+{
+    static struct stage stages[NSTAGES];
+    async_chan_t chans[NSTAGES - 1];
+    async_task_t tasks[NSTAGES];
+    async_loop_t loop;
+    char name[64];
+    uint64_t tstart;
+    int ii;
+
+    setup(stages, chans, batch, capacity, 0);
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+
+    tstart = bench_now();
+
+    /* Consumers first so they are parked when the data arrives */
+    for (ii = NSTAGES - 1; ii >= 0; ii--)
+    {
+        async_task_start_on(&loop, &tasks[ii], stage_task, &stages[ii]);
+    }
+
+    async_loop_run(&loop);
+
+    snprintf(name, sizeof(name), "local batch %zu", batch);
+    report(name, stages, bench_now() - tstart);
+
+    for (ii = 0; ii < NSTAGES - 1; ii++) async_chan_fini(&chans[ii]);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+static void run_shared(size_t batch, size_t capacity)
+{
+    static struct stage stages[NSTAGES];
+    async_chan_t chans[NSTAGES - 1];
+    async_task_t tasks[NSTAGES];
+    async_runtime_t rt;
+    char name[64];
+    uint64_t tstart;
+    int ii;
+
+    setup(stages, chans, batch, capacity, ASYNC_CHAN_SHARED);
+    if (async_runtime_init(&rt, NSTAGES, true) != 0) return;
+
+    async_runtime_steal(&rt, false);
+    async_runtime_start(&rt);
+
+    tstart = bench_now();
+
+    for (ii = NSTAGES - 1; ii >= 0; ii--)
+    {
+        async_task_spawn_on(async_runtime_worker(&rt, ii), &tasks[ii], stage_task, &stages[ii]);
+    }
+
+    while (!atomic_load(&finished)) usleep(100);
+
+    snprintf(name, sizeof(name), "shared batch %zu", batch);
+    report(name, stages, bench_now() - tstart);
+
+    async_runtime_stop(&rt);
+    async_runtime_fini(&rt);
+
+    for (ii = 0; ii < NSTAGES - 1; ii++) async_chan_fini(&chans[ii]);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t batch;
+    size_t capacity;
+
+    nmessages = bench_arg(argc, argv, 1, 1000000);
+    batch = bench_arg(argc, argv, 2, 64);
+    capacity = bench_arg(argc, argv, 3, 256);
+
+    if (batch < 1 || batch > BATCH_MAX) batch = 64;
+
+    run_local(1, capacity);
+    run_local(batch, capacity);
+    run_shared(1, capacity);
+    run_shared(batch, capacity);
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Loopback echo server benchmark: one listener task spawns a task per
+ * accepted connection, client tasks on the same loop send fixed size
+ * requests and wait for the echo. Reports requests/s and latency
+ * percentiles.
+ *
+ * Usage: bench_echo [connections] [requests per connection] [message size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "bench.h"
+
+#define MSG_MAX     4096
+
+struct conn
+{
+    async_task_t        c_task;
+    int                 c_fd;
+    long                c_index;
+    char                c_buf[MSG_MAX];
+};
+
+static async_loop_t *loop;
+static struct sockaddr_in server_addr;
+static int server_fd;
+static async_task_t server_task;
+static struct conn *servers;
+static struct conn *clients;
+static long nconns;
+static long nrequests;
+static long msg_size;
+static long clients_done;
+static long nservers;
+static uint32_t *latency;
+
+int echo_task(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+
+    CRT_LOCALS(crt, struct { ssize_t n; ssize_t rc; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_read(crt, c->c_fd, c->c_buf, sizeof(c->c_buf), &l->n), 0);
+            if (l->n <= 0) break;
+
+            CRT_AWAIT(async_write(crt, c->c_fd, c->c_buf, l->n, &l->rc), 0);
+            if (l->rc < 0) break;
+        }
+    }
+    CRT_END;
+
+    close(c->c_fd);
+
+    return 0;
+}
+
+int server_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int fd; }, l)
+    {
+        while (nservers < nconns)
+        {
+            CRT_AWAIT(async_accept(crt, server_fd, NULL, NULL, &l->fd), 0);
+            if (l->fd < 0)
+            {
+                perror("accept");
+                break;
+            }
+
+            servers[nservers].c_fd = l->fd;
+            async_task_start_on(loop, &servers[nservers].c_task, echo_task, &servers[nservers]);
+            nservers++;
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int client_main(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+
+    CRT_LOCALS(crt, struct { long r; uint64_t t; ssize_t n; ssize_t got; int rc; }, l)
+    {
+        CRT_AWAIT(async_connect(crt, c->c_fd, (struct sockaddr *)&server_addr, sizeof(server_addr), &l->rc), 0);
+        if (l->rc != 0)
+        {
+            perror("connect");
+            CRT_EXIT(CRT_ERROR);
+        }
+
+        for (l->r = 0; l->r < nrequests; l->r++)
+        {
+            l->t = bench_now();
+
+            CRT_AWAIT(async_write(crt, c->c_fd, c->c_buf, msg_size, &l->n), 0);
+            if (l->n < 0) CRT_EXIT(CRT_ERROR);
+
+            for (l->got = 0; l->got < msg_size; l->got += l->n)
+            {
+                CRT_AWAIT(async_read(crt, c->c_fd, c->c_buf + l->got, msg_size - l->got, &l->n), 0);
+                if (l->n <= 0) CRT_EXIT(CRT_ERROR);
+            }
+
+            latency[c->c_index * nrequests + l->r] = (uint32_t)(bench_now() - l->t);
+        }
+    }
+    CRT_END;
+
+    close(c->c_fd);
+
+    if (++clients_done == nconns) async_task_cancel(&server_task);
+
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    struct rlimit rl;
+    socklen_t alen;
+    uint64_t tstart;
+    uint64_t tend;
+    long total;
+    long ii;
+    int one = 1;
+
+    nconns = bench_arg(argc, argv, 1, 10000);
+    nrequests = bench_arg(argc, argv, 2, 50);
+    msg_size = bench_arg(argc, argv, 3, 64);
+    if (msg_size > MSG_MAX) msg_size = MSG_MAX;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Both ends live in this process: two descriptors per connection */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if ((long)rl.rlim_cur < nconns * 2 + 64)
+        {
+            nconns = ((long)rl.rlim_cur - 64) / 2;
+            fprintf(stderr, "File descriptor limit, using %ld connections\n", nconns);
+        }
+    }
+
+    servers = calloc(nconns, sizeof(*servers));
+    clients = calloc(nconns, sizeof(*clients));
+    latency = calloc(nconns * nrequests, sizeof(*latency));
+    if (servers == NULL || clients == NULL || latency == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    loop = async_loop_default();
+
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0 ||
+            listen(server_fd, 65535) != 0)
+    {
+        perror("listen");
+        return 1;
+    }
+
+    alen = sizeof(server_addr);
+    getsockname(server_fd, (struct sockaddr *)&server_addr, &alen);
+
+    async_task_start_on(loop, &server_task, server_main, NULL);
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        clients[ii].c_index = ii;
+        clients[ii].c_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        setsockopt(clients[ii].c_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        memset(clients[ii].c_buf, 'x', msg_size);
+    }
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        async_task_start_on(loop, &clients[ii].c_task, client_main, &clients[ii]);
+    }
+
+    async_loop_run(loop);
+
+    tend = bench_now();
+
+    total = nconns * nrequests;
+    qsort(latency, total, sizeof(*latency), cmp_u32);
+
+    printf("connections %ld, requests %ld, message %ld bytes\n", nconns, total, msg_size);
+    printf("throughput:   %10.0f requests/s\n", (double)total / ((double)(tend - tstart) / 1e9));
+    printf("latency p50:  %10.1f us\n", latency[total / 2] / 1000.0);
+    printf("latency p99:  %10.1f us\n", latency[total * 99 / 100] / 1000.0);
+
+    close(server_fd);
+
+    return 0;
+}
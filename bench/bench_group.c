@@ -0,0 +1,118 @@
+/*
+ * Task group benchmark: hedged fan-out. A parent spawns a number of
+ * children into a group and waits for the first one with async_group_any(),
+ * which cancels the rest, then joins the group. Children finish after a
+ * random number of scheduler passes, so several complete in the same pass.
+ *
+ * Reports the round trip per fan-out, the latency from the winner's
+ * completion to the parent resuming, and how often the parent was woken.
+ *
+ * Usage: bench_group [rounds] [fanout] [max passes per child]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+static long nrounds;
+static long nfanout;
+static long npasses;
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t done_ts;
+static uint64_t any_ns;
+static uint64_t round_ns;
+static long parent_resumes;
+static async_group_t group;
+
+int child_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        l->n = bench_rand(&rng) % npasses;
+
+        while (l->n-- > 0)
+        {
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+
+        if (done_ts == 0) done_ts = bench_now();
+    }
+    CRT_END;
+
+    return 1;
+}
+
+int parent_task(crt_t *crt, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    async_loop_t *loop = arg;
+
+    parent_resumes++;
+
+    /* The group is kept out of the locals arena, async_group_join() needs room there */
+    CRT_LOCALS(crt, struct { long round; uint64_t tstart; void *data; int rc; }, l)
+    {
+        for (l->round = 0; l->round < nrounds; l->round++)
+        {
+            async_group_init(&group, self);
+            done_ts = 0;
+            l->tstart = bench_now();
+
+            for (long ii = 0; ii < nfanout; ii++)
+            {
+                if (async_group_spawn(&group, loop, child_task, (void *)ii) == NULL) abort();
+            }
+
+            CRT_AWAIT(async_group_any(crt, &group, &l->data, &l->rc), 0);
+            any_ns += bench_now() - done_ts;
+
+            CRT_AWAIT(async_group_join(crt, &group), 0);
+            round_ns += bench_now() - l->tstart;
+
+            async_group_fini(&group);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    async_loop_t loop;
+    async_task_t parent;
+    uint64_t tstart;
+
+    nrounds = bench_arg(argc, argv, 1, 10000);
+    nfanout = bench_arg(argc, argv, 2, 64);
+    npasses = bench_arg(argc, argv, 3, 8);
+    if (npasses < 1) npasses = 1;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+    async_loop_reserve(&loop, nfanout);
+    /* Room for a whole fan-out per pass */
+    loop.al_budget = nfanout + 1;
+
+    async_task_start_on(&loop, &parent, parent_task, &loop);
+
+    tstart = bench_now();
+    while (!parent.at_done)
+    {
+        ev_run(loop.al_ev, EVRUN_ONCE);
+    }
+
+    printf("fan-out %ld, %ld rounds: %.2f us/round, any latency %.0f ns, %.2f parent resumes/round, %.1f ms total\n",
+            nfanout, nrounds, (double)round_ns / (double)nrounds / 1e3,
+            (double)any_ns / (double)nrounds, (double)parent_resumes / (double)nrounds,
+            (double)(bench_now() - tstart) / 1e6);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * crt_t layout benchmark: memory taken by a large number of co-routine
+ * objects and resume throughput of a nested co-routine chain, for the
+ * layout selected at compile time. The build makes one program per layout,
+ * run them one after the other to compare:
+ *
+ *   bench_layout_wide:      -DCRT_POINT_BITS=32 -DCRT_STACK_DEPTH=32
+ *   bench_layout_compact:   -DCRT_POINT_BITS=16 -DCRT_STACK_DEPTH=8 (defaults)
+ *   bench_layout_growable:  -DCRT_STACK_DEPTH=4 -DCRT_STACK_GROWABLE
+ *
+ * Usage: bench_layout_<layout> [objects] [resumes] [nesting] [deep nesting]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../crt.h"
+#include "bench.h"
+
+int nest(crt_t *crt, int level)
+{
+    CRT(crt)
+    {
+        if (level > 0)
+        {
+            CRT_AWAIT(nest(crt, level - 1), 0);
+
+            /* Pass the overflow up so the caller sees it */
+            if (CRT_STATUS(crt) == CRT_ERROR_STACK_OVERFLOW) CRT_EXIT(CRT_ERROR_STACK_OVERFLOW);
+        }
+        else
+        {
+            for (;;) CRT_YIELD(1);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void bench_memory(long nobjs)
+{
+    crt_t *objs;
+    size_t rss_start;
+    size_t rss_end;
+    long ii;
+
+    rss_start = bench_rss();
+
+    objs = malloc(nobjs * sizeof(*objs));
+    if (objs == NULL) return;
+
+    for (ii = 0; ii < nobjs; ii++)
+    {
+        CRT_INIT(&objs[ii]);
+        nest(&objs[ii], 2);
+    }
+
+    rss_end = bench_rss();
+
+    printf("memory: sizeof(crt_t) = %zu (%d-bit slots, depth %d), %ld objects, RSS +%.1f MiB\n",
+            sizeof(crt_t), CRT_POINT_BITS, CRT_STACK_DEPTH, nobjs,
+            (double)(rss_end - rss_start) / (1024.0 * 1024.0));
+
+    for (ii = 0; ii < nobjs; ii++) CRT_FINI(&objs[ii]);
+    free(objs);
+}
+
+static void bench_resume(long nresumes, int level)
+{
+    crt_t crt;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    CRT_INIT(&crt);
+
+    tstart = bench_now();
+    for (ii = 0; ii < nresumes; ii++)
+    {
+        nest(&crt, level);
+    }
+    tend = bench_now();
+
+    printf("resume: nesting %d, %.2f ns/resume\n", level, (double)(tend - tstart) / (double)nresumes);
+
+    CRT_FINI(&crt);
+}
+
+static void bench_deep(int level)
+{
+    crt_t crt;
+
+    CRT_INIT(&crt);
+
+    nest(&crt, level);
+
+    if (CRT_RUNNING(&crt))
+    {
+        printf("deep: nesting %d runs, stack %d slots%s\n", level, crt.crt_stack_size,
+                (crt.crt_flags & CRT_FLAG_GROWN) ? " (grown)" : "");
+    }
+    else
+    {
+        printf("deep: nesting %d fails with status %d%s\n", level, CRT_STATUS(&crt),
+                CRT_STATUS(&crt) == CRT_ERROR_STACK_OVERFLOW ? " (stack overflow)" : "");
+    }
+
+    CRT_FINI(&crt);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_memory(bench_arg(argc, argv, 1, 1000000));
+    bench_resume(bench_arg(argc, argv, 2, 50000000), bench_arg(argc, argv, 3, 3));
+    bench_deep(bench_arg(argc, argv, 4, 24));
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Frame-local storage benchmark: run many concurrent instances of the same
+ * co-routine function and measure the memory cost per instance and the
+ * average resume latency.
+ *
+ * Usage: bench_locals [instances] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../crt.h"
+#include "bench.h"
+
+#define LOCALS_SIZE     64
+
+struct instance
+{
+    crt_t       crt;
+    _Alignas(CRT_LOCALS_ALIGN)
+    char        locals[LOCALS_SIZE];
+};
+
+/* Nested frame -- yields a couple of times with its own counter */
+int fetch(crt_t *crt, int id)
+{
+    CRT_LOCALS(crt, struct { int n; }, l)
+    {
+        for (l->n = 0; l->n < 2; l->n++)
+        {
+            CRT_YIELD(0);
+        }
+    }
+    CRT_END;
+
+    return id;
+}
+
+/* Outer frame -- the "handler" that is instantiated many times */
+int handler(crt_t *crt, int id)
+{
+    CRT_LOCALS(crt, struct { int ii; long sum; }, l)
+    {
+        for (l->ii = 0;; l->ii++)
+        {
+            CRT_AWAIT(fetch(crt, id), 0);
+            l->sum += l->ii;
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long ninst = bench_arg(argc, argv, 1, 100000);
+    long rounds = bench_arg(argc, argv, 2, 30);
+    struct instance *inst;
+    uint64_t tstart;
+    uint64_t tend;
+    unsigned maxtop = 0;
+    long ii;
+    long rr;
+
+    inst = aligned_alloc(CRT_LOCALS_ALIGN, sizeof(*inst) * ninst);
+    if (inst == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (ii = 0; ii < ninst; ii++)
+    {
+        CRT_INIT_LOCALS(&inst[ii].crt, inst[ii].locals, sizeof(inst[ii].locals));
+    }
+
+    tstart = bench_now();
+    for (rr = 0; rr < rounds; rr++)
+    {
+        for (ii = 0; ii < ninst; ii++)
+        {
+            handler(&inst[ii].crt, (int)ii);
+        }
+    }
+    tend = bench_now();
+
+    /* The bump pointer is only rewound on the next resume: high-water mark */
+    for (ii = 0; ii < ninst; ii++)
+    {
+        if (inst[ii].crt.crt_locals_top > maxtop) maxtop = inst[ii].crt.crt_locals_top;
+    }
+
+    printf("instances:            %ld\n", ninst);
+    printf("resumes:              %ld\n", ninst * rounds);
+    printf("bytes per task:       %zu (crt_t %zu + arena %d, %u used)\n",
+            sizeof(struct instance), sizeof(crt_t), LOCALS_SIZE, maxtop);
+    printf("resume latency:       %.1f ns\n", (double)(tend - tstart) / (double)(ninst * rounds));
+
+    free(inst);
+
+    return 0;
+}
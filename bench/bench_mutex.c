@@ -0,0 +1,208 @@
+/*
+ * Contended lock benchmark: a number of tasks take the same lock in a loop
+ * and yield while holding it, so every unlock finds waiters and hands the
+ * lock over. The same load runs on a local async mutex (one loop), a shared
+ * one (tasks spread over runtime workers) and a pthread mutex with one
+ * thread per task, where sched_yield() stands in for the yield.
+ *
+ * Reports lock handoffs per second and how many acquisitions had to wait.
+ * The tasks update a plain counter across the yield, read before and written
+ * after it; a count that does not add up fails the run.
+ *
+ * Usage: bench_mutex [acquisitions] [tasks] [workers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_rt.h"
+#include "../async_sync.h"
+#include "bench.h"
+
+#define TASKS_MAX   1024
+
+static long nacquire;
+static long ntasks;
+static long nworkers;
+
+static async_mutex_t mutex;
+static pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
+static long counter;
+static atomic_long ncontended;
+static atomic_long nfinished;
+
+int locker_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { long n; long seen; }, l)
+    {
+        for (l->n = nacquire / ntasks; l->n > 0; l->n--)
+        {
+            if (!async_mutex_trylock(&mutex))
+            {
+                atomic_fetch_add_explicit(&ncontended, 1, memory_order_relaxed);
+                CRT_AWAIT(async_mutex_lock(crt, &mutex), 0);
+            }
+
+            /* Lost updates unless the lock excludes the other tasks */
+            l->seen = counter;
+            CRT_AWAIT(async_task_yield(crt), 0);
+            counter = l->seen + 1;
+
+            async_mutex_unlock(&mutex);
+        }
+
+        atomic_fetch_add(&nfinished, 1);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void *locker_thread(void *arg)
+{
+    long seen;
+    long n;
+
+    (void)arg;
+
+    for (n = nacquire / ntasks; n > 0; n--)
+    {
+        if (pthread_mutex_trylock(&pmutex) != 0)
+        {
+            atomic_fetch_add_explicit(&ncontended, 1, memory_order_relaxed);
+            pthread_mutex_lock(&pmutex);
+        }
+
+        seen = counter;
+        sched_yield();
+        counter = seen + 1;
+
+        pthread_mutex_unlock(&pmutex);
+    }
+
+    return NULL;
+}
+
+/* Print a result line, returns 0 if the counter adds up */
+static int report(const char *name, uint64_t ns)
+{
+    long total = nacquire / ntasks * ntasks;
+
+    printf("%-8s %ld acquisitions by %ld tasks, %.2f M handoffs/s, %.1f ns/handoff, %.1f%% contended\n",
+            name, total, ntasks, (double)total / ((double)ns / 1e3), (double)ns / (double)total,
+            100.0 * (double)atomic_load(&ncontended) / (double)total);
+
+    if (counter == total) return 0;
+
+    fprintf(stderr, "%s: counter %ld, expected %ld\n", name, counter, total);
+
+    return 1;
+}
+
+static void reset(void)
+{
+    counter = 0;
+    atomic_store(&ncontended, 0);
+    atomic_store(&nfinished, 0);
+}
+
+static int run_local(void)
+{
+    static async_task_t tasks[TASKS_MAX];
+    struct ev_loop *ev;
+    async_loop_t loop;
+    uint64_t tstart;
+    int failed;
+    long ii;
+
+    reset();
+    async_mutex_init(&mutex, 0);
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++) async_task_start_on(&loop, &tasks[ii], locker_task, NULL);
+
+    async_loop_run(&loop);
+
+    failed = report("local", bench_now() - tstart);
+
+    ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+
+    return failed;
+}
+
+static int run_shared(void)
+{
+    static async_task_t tasks[TASKS_MAX];
+    async_runtime_t rt;
+    uint64_t tstart;
+    int failed;
+    long ii;
+
+    reset();
+    async_mutex_init(&mutex, ASYNC_SYNC_SHARED);
+    if (async_runtime_init(&rt, nworkers, false) != 0) return 1;
+
+    async_runtime_steal(&rt, false);
+    async_runtime_start(&rt);
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        async_task_spawn_on(async_runtime_worker(&rt, ii % nworkers), &tasks[ii], locker_task, NULL);
+    }
+
+    while (atomic_load(&nfinished) < ntasks) usleep(100);
+
+    failed = report("shared", bench_now() - tstart);
+
+    async_runtime_stop(&rt);
+    async_runtime_fini(&rt);
+
+    return failed;
+}
+
+static int run_pthread(void)
+{
+    static pthread_t threads[TASKS_MAX];
+    uint64_t tstart;
+    long ii;
+
+    reset();
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++) pthread_create(&threads[ii], NULL, locker_thread, NULL);
+    for (ii = 0; ii < ntasks; ii++) pthread_join(threads[ii], NULL);
+
+    return report("pthread", bench_now() - tstart);
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+
+    nacquire = bench_arg(argc, argv, 1, 1000000);
+    ntasks = bench_arg(argc, argv, 2, 8);
+    nworkers = bench_arg(argc, argv, 3, 2);
+
+    if (ntasks < 1) ntasks = 1;
+    if (ntasks > TASKS_MAX) ntasks = TASKS_MAX;
+    if (nworkers < 1) nworkers = 1;
+
+    failed += run_local();
+    failed += run_shared();
+    failed += run_pthread();
+
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Offload benchmark: a number of tasks each make one blocking call (a sleep
+ * standing in for stat(), fsync() or compression) while a ticker task asks
+ * to be woken every millisecond. The calls run inline on the loop thread,
+ * then through an offload pool. Reports how late the ticks were (timer
+ * jitter) and the loop wakeups taken by call completions.
+ *
+ * Usage: bench_offload [tasks] [call ms] [pool threads] [pool slots]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_offload.h"
+#include "bench.h"
+
+#define TICK            0.001
+#define TICKS_MAX       100000
+
+static long ncalls;
+static long call_us;
+static long nrunning;
+static bool offload;
+static async_pool_t pool;
+
+static uint64_t ticks[TICKS_MAX];
+static long nticks;
+
+static void blocking_call(void *arg)
+{
+    (void)arg;
+
+    usleep(call_us);
+}
+
+int caller_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        if (offload)
+        {
+            CRT_AWAIT(async_offload(crt, &pool, blocking_call, NULL), 0);
+        }
+        else
+        {
+            blocking_call(NULL);
+        }
+
+        nrunning--;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int ticker_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { uint64_t t; }, l)
+    {
+        while (nrunning > 0)
+        {
+            l->t = bench_now();
+            CRT_AWAIT(async_task_sleep(crt, TICK), 0);
+
+            /* Lateness of the tick */
+            if (nticks < TICKS_MAX) ticks[nticks++] = bench_now() - l->t - (uint64_t)(TICK * 1e9);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run(bool use_pool)
+{
+    async_loop_t loop;
+    async_task_t ticker;
+    uint64_t tstart;
+    uint64_t sum = 0;
+    unsigned iter;
+    long ii;
+
+    offload = use_pool;
+    nrunning = ncalls;
+    nticks = 0;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+    async_loop_reserve(&loop, ncalls);
+
+    tstart = bench_now();
+
+    async_task_start_on(&loop, &ticker, ticker_task, NULL);
+    for (ii = 0; ii < ncalls; ii++)
+    {
+        if (async_spawn(&loop, caller_task, NULL) == NULL) abort();
+    }
+
+    iter = ev_iteration(loop.al_ev);
+    async_loop_run(&loop);
+    iter = ev_iteration(loop.al_ev) - iter;
+
+    qsort(ticks, nticks, sizeof(ticks[0]), cmp_u64);
+    for (ii = 0; ii < nticks; ii++) sum += ticks[ii];
+
+    printf("%-8s %ld calls of %ld us, %.1f ms total, %ld ticks, jitter avg %.3f ms p99 %.3f ms max %.3f ms, "
+            "%u loop iterations\n",
+            use_pool ? "offload" : "inline", ncalls, call_us, (double)(bench_now() - tstart) / 1e6, nticks,
+            nticks ? (double)sum / (double)nticks / 1e6 : 0.0,
+            nticks ? (double)ticks[nticks * 99 / 100] / 1e6 : 0.0,
+            nticks ? (double)ticks[nticks - 1] / 1e6 : 0.0, iter);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+int main(int argc, char *argv[])
+{
+    long nthreads;
+    long nslots;
+
+    ncalls = bench_arg(argc, argv, 1, 1000);
+    call_us = bench_arg(argc, argv, 2, 5) * 1000;
+    nthreads = bench_arg(argc, argv, 3, 64);
+    nslots = bench_arg(argc, argv, 4, 128);
+
+    if (async_pool_init(&pool, nthreads, nslots) != 0) return 1;
+
+    run(false);
+    run(true);
+
+    async_pool_fini(&pool);
+
+    return 0;
+}
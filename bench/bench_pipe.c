@@ -0,0 +1,321 @@
+/*
+ * Generator pipeline benchmark: the same chain of stages built from one
+ * co-routine per stage that resumes its upstream for every item (naive), and
+ * as a fused crt_pipe_t. Reports throughput and generator resumes per
+ * output item.
+ *
+ *   map:   numbers -> map(*3) -> filter(even) -> map(+7) -> take(all)
+ *   flat:  numbers -> flat_map(x, x+1, x+2, x+3) -> filter(even) -> map(+7)
+ *
+ * Usage: bench_pipe [items]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../crt.h"
+#include "../crt_pipe.h"
+#include "bench.h"
+
+#define FLAT_FANOUT     4
+
+static int64_t nitems;
+
+static crt_item_t times3(crt_item_t v, void *arg) { (void)arg; return v * 3; }
+static crt_item_t plus7(crt_item_t v, void *arg) { (void)arg; return v + 7; }
+static bool even(crt_item_t v, void *arg) { (void)arg; return (v & 1) == 0; }
+
+/*
+ * Naive chaining: every stage is its own co-routine
+ */
+struct node;
+typedef int64_t node_fn(crt_t *crt, struct node *self);
+
+struct node
+{
+    crt_t           n_crt;
+    _Alignas(CRT_LOCALS_ALIGN)
+    char            n_locals[64];
+    node_fn        *n_fn;
+    struct node    *n_up;
+    crt_map_fn     *n_map;
+    crt_filter_fn  *n_filter;
+    int64_t         n_limit;
+    int64_t         n_limit_count;
+    int64_t         n_src_count;
+};
+
+static long naive_resumes;
+
+static int64_t node_next(struct node *self)
+{
+    naive_resumes++;
+
+    return self->n_fn(&self->n_crt, self);
+}
+
+#define NODE_DONE(n)    (!CRT_RUNNING(&(n)->n_crt))
+
+int64_t node_source(crt_t *crt, struct node *self)
+{
+    CRT_LOCALS(crt, struct { int64_t n; }, l)
+    {
+        for (l->n = 1; l->n <= self->n_src_count; l->n++) CRT_YIELD(l->n);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int64_t node_map(crt_t *crt, struct node *self)
+{
+    int64_t v;
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            v = node_next(self->n_up);
+            if (NODE_DONE(self->n_up)) break;
+
+            CRT_YIELD(self->n_map(v, NULL));
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int64_t node_filter(crt_t *crt, struct node *self)
+{
+    int64_t v;
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            v = node_next(self->n_up);
+            if (NODE_DONE(self->n_up)) break;
+
+            if (self->n_filter(v, NULL)) CRT_YIELD(v);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int64_t node_take(crt_t *crt, struct node *self)
+{
+    int64_t v;
+
+    CRT(crt)
+    {
+        while (self->n_limit_count < self->n_limit)
+        {
+            v = node_next(self->n_up);
+            if (NODE_DONE(self->n_up)) break;
+
+            self->n_limit_count++;
+            CRT_YIELD(v);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int64_t node_flat(crt_t *crt, struct node *self)
+{
+    CRT_LOCALS(crt, struct { int64_t v; int j; }, l)
+    {
+        for (;;)
+        {
+            l->v = node_next(self->n_up);
+            if (NODE_DONE(self->n_up)) break;
+
+            for (l->j = 0; l->j < FLAT_FANOUT; l->j++) CRT_YIELD(l->v + l->j);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static struct node *node_new(node_fn *fn, struct node *up)
+{
+    struct node *self = calloc(1, sizeof(*self));
+
+    if (self == NULL) abort();
+
+    CRT_INIT_LOCALS(&self->n_crt, self->n_locals, sizeof(self->n_locals));
+    self->n_fn = fn;
+    self->n_up = up;
+
+    return self;
+}
+
+/*
+ * Fused pipeline sources
+ */
+void pipe_numbers(crt_t *crt, crt_item_batch_t *batch, void *arg)
+{
+    int64_t count = *(int64_t *)arg;
+
+    CRT_LOCALS(crt, struct { int64_t n; }, l)
+    {
+        for (l->n = 1; l->n <= count; l->n++) CRT_YIELD_BATCH(batch, l->n);
+    }
+    CRT_END;
+}
+
+void pipe_fanout(crt_t *crt, crt_item_batch_t *batch, crt_item_t item, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int j; }, l)
+    {
+        for (l->j = 0; l->j < FLAT_FANOUT; l->j++) CRT_YIELD_BATCH(batch, item + l->j);
+    }
+    CRT_END;
+}
+
+static void report(const char *name, int64_t sum, int64_t nout, long resumes, uint64_t ns)
+{
+    printf("%-12s %10ld items, %6.2f ns/item, %6.3f resumes/item, sum %ld\n", name,
+            (long)nout, (double)ns / (double)nout, (double)resumes / (double)nout, (long)sum);
+}
+
+static void run_naive_map(void)
+{
+    struct node *src = node_new(node_source, NULL);
+    struct node *m1 = node_new(node_map, src);
+    struct node *f = node_new(node_filter, m1);
+    struct node *m2 = node_new(node_map, f);
+    struct node *t = node_new(node_take, m2);
+    int64_t sum = 0;
+    int64_t nout = 0;
+    int64_t v;
+    uint64_t tstart;
+
+    src->n_src_count = nitems;
+    m1->n_map = times3;
+    f->n_filter = even;
+    m2->n_map = plus7;
+    t->n_limit = nitems;
+
+    naive_resumes = 0;
+    tstart = bench_now();
+    for (;;)
+    {
+        v = node_next(t);
+        if (NODE_DONE(t)) break;
+
+        sum += v;
+        nout++;
+    }
+
+    report("naive map", sum, nout, naive_resumes, bench_now() - tstart);
+
+    free(src); free(m1); free(f); free(m2); free(t);
+}
+
+static void run_fused_map(void)
+{
+    crt_pipe_t *p = malloc(sizeof(*p));
+    crt_item_t out[CRT_PIPE_BATCH];
+    int64_t sum = 0;
+    int64_t nout = 0;
+    uint64_t tstart;
+    size_t n;
+    size_t ii;
+
+    crt_pipe_init(p, pipe_numbers, &nitems);
+    crt_pipe_map(p, times3, NULL);
+    crt_pipe_filter(p, even, NULL);
+    crt_pipe_map(p, plus7, NULL);
+    crt_pipe_take(p, nitems);
+
+    tstart = bench_now();
+    while ((n = crt_pipe_pull(p, out, CRT_PIPE_BATCH)) > 0)
+    {
+        for (ii = 0; ii < n; ii++) sum += out[ii];
+        nout += n;
+    }
+
+    report("fused map", sum, nout, p->cp_resumes, bench_now() - tstart);
+
+    crt_pipe_fini(p);
+    free(p);
+}
+
+static void run_naive_flat(void)
+{
+    struct node *src = node_new(node_source, NULL);
+    struct node *fm = node_new(node_flat, src);
+    struct node *f = node_new(node_filter, fm);
+    struct node *m = node_new(node_map, f);
+    int64_t sum = 0;
+    int64_t nout = 0;
+    int64_t v;
+    uint64_t tstart;
+
+    src->n_src_count = nitems / FLAT_FANOUT;
+    f->n_filter = even;
+    m->n_map = plus7;
+
+    naive_resumes = 0;
+    tstart = bench_now();
+    for (;;)
+    {
+        v = node_next(m);
+        if (NODE_DONE(m)) break;
+
+        sum += v;
+        nout++;
+    }
+
+    report("naive flat", sum, nout, naive_resumes, bench_now() - tstart);
+
+    free(src); free(fm); free(f); free(m);
+}
+
+static void run_fused_flat(void)
+{
+    crt_pipe_t *p = malloc(sizeof(*p));
+    crt_item_t out[CRT_PIPE_BATCH];
+    int64_t count = nitems / FLAT_FANOUT;
+    int64_t sum = 0;
+    int64_t nout = 0;
+    uint64_t tstart;
+    size_t n;
+    size_t ii;
+
+    crt_pipe_init(p, pipe_numbers, &count);
+    crt_pipe_flat_map(p, pipe_fanout, NULL);
+    crt_pipe_filter(p, even, NULL);
+    crt_pipe_map(p, plus7, NULL);
+
+    tstart = bench_now();
+    while ((n = crt_pipe_pull(p, out, CRT_PIPE_BATCH)) > 0)
+    {
+        for (ii = 0; ii < n; ii++) sum += out[ii];
+        nout += n;
+    }
+
+    report("fused flat", sum, nout, p->cp_resumes, bench_now() - tstart);
+
+    crt_pipe_fini(p);
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    nitems = bench_arg(argc, argv, 1, 10000000);
+
+    run_naive_map();
+    run_fused_map();
+    run_naive_flat();
+    run_fused_flat();
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Priority class benchmark: low priority tasks saturate the loop, each doing
+ * a slice of CPU work and yielding, while a few high priority tasks wake up
+ * from a short sleep over and over. Reports the high priority wakeup latency
+ * (timer due until resumed) and the low priority throughput.
+ *
+ * Runs twice: with all tasks in ASYNC_PRIO_NORMAL, i.e. one FIFO ready queue
+ * as before priority classes, and with the sleepers in ASYNC_PRIO_HIGH and
+ * the workers in ASYNC_PRIO_LOW at the default weights.
+ *
+ * Usage: bench_prio [low tasks] [work per resume in us] [high tasks] [samples per high task]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+#define INTERVAL        0.001               /* High priority sleep */
+
+struct high
+{
+    async_task_t        h_task;
+    uint64_t            h_due;              /* bench_now() the sleep ends */
+    uint64_t           *h_lat;              /* Latency samples */
+};
+
+static async_loop_t *loop;
+static async_task_t *lows;
+static struct high *highs;
+static uint64_t *latencies;
+static long nlow;
+static long nhigh;
+static long nsamples;
+static uint64_t work_ns;
+static long running;
+static bool stop;
+static uint64_t low_resumes;
+
+int low_main(crt_t *crt, void *arg)
+{
+    uint64_t start;
+
+    (void)arg;
+
+    CRT(crt)
+    {
+        while (!stop)
+        {
+            start = bench_now();
+            while (bench_now() - start < work_ns);
+            low_resumes++;
+
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int high_main(crt_t *crt, void *arg)
+{
+    struct high *h = arg;
+    uint64_t now;
+
+    CRT_LOCALS(crt, struct { long ii; }, l)
+    {
+        for (l->ii = 0; l->ii < nsamples; l->ii++)
+        {
+            /* The timer is relative to the loop time, which may be a whole pass old */
+            ev_now_update(loop->al_ev);
+            h->h_due = bench_now() + (uint64_t)(INTERVAL * 1e9);
+
+            CRT_AWAIT(async_task_sleep(crt, INTERVAL), 0);
+
+            now = bench_now();
+            h->h_lat[l->ii] = (now > h->h_due) ? now - h->h_due : 0;
+        }
+    }
+    CRT_END;
+
+    if (--running == 0) stop = true;
+
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void run(const char *name, int high_prio, int low_prio)
+{
+    uint64_t tstart;
+    uint64_t ns;
+    long total = nhigh * nsamples;
+    long ii;
+
+    stop = false;
+    running = nhigh;
+    low_resumes = 0;
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < nlow; ii++) async_task_start_prio(loop, &lows[ii], low_prio, low_main, NULL);
+
+    for (ii = 0; ii < nhigh; ii++)
+    {
+        highs[ii].h_lat = latencies + ii * nsamples;
+        async_task_start_prio(loop, &highs[ii].h_task, high_prio, high_main, &highs[ii]);
+    }
+
+    async_loop_run(loop);
+
+    ns = bench_now() - tstart;
+
+    qsort(latencies, total, sizeof(*latencies), cmp_u64);
+
+    printf("%-6s high latency p50 %8.1f us, p99 %8.1f us, max %8.1f us; low %9.0f resumes/s\n", name,
+            latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3, latencies[total - 1] / 1e3,
+            (double)low_resumes / ((double)ns / 1e9));
+}
+
+int main(int argc, char *argv[])
+{
+    nlow = bench_arg(argc, argv, 1, 500);
+    work_ns = bench_arg(argc, argv, 2, 10) * 1000;
+    nhigh = bench_arg(argc, argv, 3, 10);
+    nsamples = bench_arg(argc, argv, 4, 100);
+
+    if (nhigh < 1) nhigh = 1;
+    if (nsamples < 1) nsamples = 1;
+
+    lows = calloc(nlow, sizeof(*lows));
+    highs = calloc(nhigh, sizeof(*highs));
+    latencies = calloc(nhigh * nsamples, sizeof(*latencies));
+    if (lows == NULL || highs == NULL || latencies == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    loop = async_loop_default();
+
+    printf("low tasks %ld, work %llu us, high tasks %ld, sleep %.0f us, samples %ld\n", nlow,
+            (unsigned long long)(work_ns / 1000), nhigh, INTERVAL * 1e6, nhigh * nsamples);
+
+    run("fifo", ASYNC_PRIO_NORMAL, ASYNC_PRIO_NORMAL);
+    run("prio", ASYNC_PRIO_HIGH, ASYNC_PRIO_LOW);
+
+    free(latencies);
+    free(highs);
+    free(lows);
+
+    return 0;
+}
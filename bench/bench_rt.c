@@ -0,0 +1,199 @@
+/*
+ * Thread-per-core runtime scaling benchmark. Runs the same total amount of
+ * work on 1, 2, 4, ... workers:
+ *
+ *   timer - tasks doing back to back zero-length async_task_sleep() calls
+ *   echo  - socketpair ping-pong, client and echo task on the same worker
+ *
+ * Tasks count the rounds that completed correctly (the echo has to return
+ * the request); a run with rounds missing fails the benchmark.
+ *
+ * Usage: bench_rt [max workers] [tasks] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "../async_rt.h"
+#include "bench.h"
+
+struct pair
+{
+    async_task_t        p_client;
+    async_task_t        p_echo;
+    int                 p_fd[2];
+};
+
+#define TIMEOUT_S       60                  /* Give up on tasks that got stuck */
+
+static long rounds;
+static atomic_long done;
+static atomic_long completed;               /* Rounds completed correctly */
+static int failed;
+
+int timer_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (l->n = 0; l->n < rounds; l->n++)
+        {
+            CRT_AWAIT(async_task_sleep(crt, 0.0), 0);
+        }
+
+        atomic_fetch_add(&completed, l->n);
+    }
+    CRT_END;
+
+    atomic_fetch_add(&done, 1);
+
+    return 0;
+}
+
+int echo_task(crt_t *crt, void *arg)
+{
+    struct pair *p = arg;
+
+    CRT_LOCALS(crt, struct { ssize_t n; ssize_t rc; char buf[8]; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_read(crt, p->p_fd[1], l->buf, sizeof(l->buf), &l->n), 0);
+            if (l->n <= 0) break;
+
+            CRT_AWAIT(async_write(crt, p->p_fd[1], l->buf, l->n, &l->rc), 0);
+        }
+    }
+    CRT_END;
+
+    close(p->p_fd[1]);
+
+    return 0;
+}
+
+int client_task(crt_t *crt, void *arg)
+{
+    struct pair *p = arg;
+
+    CRT_LOCALS(crt, struct { long n; ssize_t rc; char buf[8]; }, l)
+    {
+        for (l->n = 0; l->n < rounds; l->n++)
+        {
+            CRT_AWAIT(async_write(crt, p->p_fd[0], "ping", 4, &l->rc), 0);
+            CRT_AWAIT(async_read(crt, p->p_fd[0], l->buf, 4, &l->rc), 0);
+            if (l->rc != 4 || memcmp(l->buf, "ping", 4) != 0) break;
+        }
+
+        atomic_fetch_add(&completed, l->n);
+    }
+    CRT_END;
+
+    close(p->p_fd[0]);
+    atomic_fetch_add(&done, 1);
+
+    return 0;
+}
+
+static double run(int nworkers, bool echo, long ntasks)
+{
+    async_runtime_t rt;
+    async_task_t *tasks = NULL;
+    struct pair *pairs = NULL;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    if (async_runtime_init(&rt, nworkers, true) != 0)
+    {
+        failed++;
+        return 0.0;
+    }
+
+    if (echo)
+    {
+        pairs = calloc(ntasks, sizeof(*pairs));
+        for (ii = 0; ii < ntasks; ii++)
+        {
+            socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pairs[ii].p_fd);
+        }
+    }
+    else
+    {
+        tasks = calloc(ntasks, sizeof(*tasks));
+    }
+
+    atomic_store(&done, 0);
+    atomic_store(&completed, 0);
+    async_runtime_start(&rt);
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        async_worker_t *worker = async_runtime_worker(&rt, ii);
+
+        if (echo)
+        {
+            async_task_spawn_on(worker, &pairs[ii].p_echo, echo_task, &pairs[ii]);
+            async_task_spawn_on(worker, &pairs[ii].p_client, client_task, &pairs[ii]);
+        }
+        else
+        {
+            async_task_spawn_on(worker, &tasks[ii], timer_task, NULL);
+        }
+    }
+
+    while (atomic_load(&done) < ntasks && bench_now() - tstart < TIMEOUT_S * 1000000000ull) usleep(100);
+
+    tend = bench_now();
+
+    async_runtime_stop(&rt);
+
+    /* Echo tasks that did not get to see EOF yet */
+    for (ii = 0; echo && ii < ntasks; ii++)
+    {
+        if (!pairs[ii].p_echo.at_done) close(pairs[ii].p_fd[1]);
+    }
+
+    async_runtime_fini(&rt);
+
+    if (atomic_load(&completed) != ntasks * rounds)
+    {
+        fprintf(stderr, "%s on %d workers: %ld of %ld rounds completed\n",
+                echo ? "echo" : "timer", nworkers, atomic_load(&completed), ntasks * rounds);
+        failed++;
+    }
+
+    free(tasks);
+    free(pairs);
+
+    return (double)(ntasks * rounds) / ((double)(tend - tstart) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    long maxworkers = bench_arg(argc, argv, 1, 16);
+    long ntasks = bench_arg(argc, argv, 2, 1024);
+    int nw;
+
+    rounds = bench_arg(argc, argv, 3, 200);
+
+    printf("online CPUs %ld, tasks %ld, rounds %ld\n", sysconf(_SC_NPROCESSORS_ONLN), ntasks, rounds);
+    printf("%8s %16s %16s\n", "workers", "timer wakeups/s", "echo requests/s");
+
+    for (nw = 1; nw <= maxworkers; nw *= 2)
+    {
+        double timer = run(nw, false, ntasks);
+        double echo = run(nw, true, ntasks);
+
+        printf("%8d %16.0f %16.0f\n", nw, timer, echo);
+    }
+
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Scheduler benchmark: pass a token around a ring of tasks and measure task
+ * switches per second.
+ *
+ *   direct/ev   - wakeups fed through libev, the callback resumes the task
+ *                 synchronously (the pre ready-queue path)
+ *   queued/ev   - wakeups fed through libev, the callback queues the task and
+ *                 the check watcher drains the ready queue
+ *   queued/wake - tasks wake each other with async_task_wake()
+ *
+ * Usage: bench_sched [tasks] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+enum ring_mode
+{
+    RING_DIRECT_EV,
+    RING_QUEUED_EV,
+    RING_QUEUED_WAKE,
+};
+
+struct ring_node
+{
+    async_task_t        rn_task;
+    ev_idle             rn_feed;            /* Watcher used to feed events */
+    struct ring_node   *rn_next;
+    int                 rn_index;
+};
+
+static enum ring_mode ring_mode;
+static long ring_rounds;
+static struct ev_loop *ring_ev;
+
+static void ring_pass(struct ring_node *node)
+{
+    if (ring_mode == RING_QUEUED_WAKE)
+    {
+        async_task_wake(&node->rn_task, NULL);
+    }
+    else
+    {
+        ev_feed_event(ring_ev, &node->rn_feed, EV_CUSTOM);
+    }
+}
+
+int ring_task(crt_t *crt, void *arg)
+{
+    struct ring_node *node = arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (l->n = 0; l->n < ring_rounds; l->n++)
+        {
+            /* Node 0 holds the token initially */
+            if (node->rn_index != 0) CRT_AWAIT(async_task_park(crt), 0);
+            ring_pass(node->rn_next);
+            if (node->rn_index == 0) CRT_AWAIT(async_task_park(crt), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static double ring_run(enum ring_mode mode, long ntasks, long rounds)
+{
+    struct ring_node *nodes;
+    async_loop_t loop;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    nodes = calloc(ntasks, sizeof(*nodes));
+    if (nodes == NULL) return 0.0;
+
+    ring_mode = mode;
+    ring_rounds = rounds;
+    ring_ev = ev_loop_new(0);
+
+    async_loop_init(&loop, ring_ev);
+    loop.al_direct = (mode == RING_DIRECT_EV);
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        nodes[ii].rn_index = ii;
+        nodes[ii].rn_next = &nodes[(ii + 1) % ntasks];
+        ev_idle_init(&nodes[ii].rn_feed, (void *)async_task_ev_generic_fn);
+        nodes[ii].rn_feed.data = &nodes[ii].rn_task;
+    }
+
+    tstart = bench_now();
+
+    /* Start node 0 last so everyone else is parked when the token starts moving */
+    for (ii = ntasks - 1; ii >= 0; ii--)
+    {
+        async_task_start_on(&loop, &nodes[ii].rn_task, ring_task, &nodes[ii]);
+    }
+
+    async_loop_run(&loop);
+
+    tend = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        if (!nodes[ii].rn_task.at_done) fprintf(stderr, "Task %ld did not finish\n", ii);
+    }
+
+    async_loop_fini(&loop);
+    ev_loop_destroy(ring_ev);
+    free(nodes);
+
+    return (double)(ntasks * rounds) / ((double)(tend - tstart) / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    long ntasks = bench_arg(argc, argv, 1, 1000);
+    long rounds = bench_arg(argc, argv, 2, 1000);
+
+    printf("tasks %ld, rounds %ld\n", ntasks, rounds);
+    printf("direct/ev:    %12.0f switches/s\n", ring_run(RING_DIRECT_EV, ntasks, rounds));
+    printf("queued/ev:    %12.0f switches/s\n", ring_run(RING_QUEUED_EV, ntasks, rounds));
+    printf("queued/wake:  %12.0f switches/s\n", ring_run(RING_QUEUED_WAKE, ntasks, rounds));
+
+    return 0;
+}
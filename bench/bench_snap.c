@@ -0,0 +1,253 @@
+/*
+ * Snapshot/restore benchmark: session tasks, two frames deep and parked in a
+ * sleep, are snapshot into a memory-mapped file; the benchmark then runs
+ * itself again as a new process which restores them from the file and lets
+ * them run to completion, checking that every one carried on where it was.
+ *
+ * Reports the snapshot and restore time per task and the record size.
+ *
+ * Usage: bench_snap [tasks] [file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../async.h"
+#include "../async_snap.h"
+#include "bench.h"
+
+#define SLEEP           0.5                 /* Sessions sleep through the restart */
+#define ROUNDS          2
+
+static async_loop_t *loop;
+static async_task_t *tasks;
+static uint64_t *results;
+static long ntasks;
+
+void session_step(crt_t *crt, long id)
+{
+    CRT_LOCALS(crt, struct { uint64_t seq; }, l)
+    {
+        l->seq = id * 7;
+        CRT_AWAIT(async_task_sleep(crt, SLEEP));
+
+        /* Locals of an inner frame survive the restart too */
+        if (l->seq != (uint64_t)id * 7) CRT_EXIT(CRT_ERROR);
+    }
+    CRT_END;
+}
+
+int session_main(crt_t *crt, void *arg)
+{
+    CRT_LOCALS(crt, struct { long id; long round; uint64_t sum; }, l)
+    {
+        /* Only on the fresh start, a restored session gets no argument */
+        l->id = (long)(intptr_t)arg;
+
+        for (l->round = 0; l->round < ROUNDS; l->round++)
+        {
+            l->sum += l->id + l->round;
+            CRT_AWAIT(session_step(crt, l->id), 0);
+        }
+
+        results[l->id] = l->sum;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static int snapshot(const char *path)
+{
+    uint64_t tstart;
+    uint64_t ns;
+    size_t total = 0;
+    size_t off = 0;
+    ssize_t n;
+    char *map;
+    int fd;
+    long ii;
+
+    for (ii = 0; ii < ntasks; ii++) async_task_start_on(loop, &tasks[ii], session_main, (void *)(intptr_t)ii);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    for (ii = 0; ii < ntasks; ii++) total += async_task_snapshot_size(&tasks[ii]);
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, total) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        n = async_task_snapshot(&tasks[ii], map + off, total - off);
+        if (n < 0)
+        {
+            perror("async_task_snapshot");
+            return -1;
+        }
+
+        off += n;
+    }
+
+    ns = bench_now() - tstart;
+
+    munmap(map, total);
+    close(fd);
+
+    printf("snapshot %8.1f ns/task, %5.1f bytes/task, %zu bytes\n", (double)ns / ntasks, (double)total / ntasks, total);
+
+    return 0;
+}
+
+static int restore(const char *path)
+{
+    uint64_t tstart;
+    uint64_t ns;
+    uint64_t run_ns;
+    struct stat st;
+    size_t off = 0;
+    ssize_t n;
+    char *map;
+    long ok = 0;
+    int fd;
+    long ii;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        n = async_task_restore(loop, &tasks[ii], map + off, st.st_size - off, NULL);
+        if (n < 0)
+        {
+            perror("async_task_restore");
+            return -1;
+        }
+
+        off += n;
+    }
+
+    ns = bench_now() - tstart;
+
+    munmap(map, st.st_size);
+    close(fd);
+
+    async_loop_run(loop);
+
+    run_ns = bench_now() - tstart;
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        if (results[ii] == 2 * (uint64_t)ii + 1 && tasks[ii].at_returncode == CRT_OK) ok++;
+    }
+
+    printf("restore  %8.1f ns/task, %ld/%ld sessions completed correctly, %.0f ms to completion\n",
+            (double)ns / ntasks, ok, ntasks, run_ns / 1e6);
+
+    return (ok == ntasks) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    char tmpl[] = "/tmp/bench_snap.XXXXXX";
+    const char *path = tmpl;
+    char count[32];
+    pid_t pid;
+    int status;
+    int fd;
+
+    /* Second stage: bench_snap --restore tasks file */
+    if (argc == 4 && strcmp(argv[1], "--restore") == 0)
+    {
+        ntasks = atol(argv[2]);
+    }
+    else
+    {
+        ntasks = bench_arg(argc, argv, 1, 100000);
+    }
+
+    if (ntasks < 1) ntasks = 1;
+
+    tasks = calloc(ntasks, sizeof(*tasks));
+    results = calloc(ntasks, sizeof(*results));
+    if (tasks == NULL || results == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    loop = async_loop_default();
+
+    if (argc == 4 && strcmp(argv[1], "--restore") == 0) return (restore(argv[3]) == 0) ? 0 : 1;
+
+    if (argc > 2)
+    {
+        path = argv[2];
+    }
+    else
+    {
+        fd = mkstemp(tmpl);
+        if (fd < 0)
+        {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+    }
+
+    printf("tasks %ld, build %016llx\n", ntasks, (unsigned long long)async_snap_build_id());
+
+    if (snapshot(path) != 0) return 1;
+
+    /* A new process, with its own address space layout */
+    fflush(stdout);
+    snprintf(count, sizeof(count), "%ld", ntasks);
+
+    pid = fork();
+    if (pid == 0)
+    {
+        execl("/proc/self/exe", argv[0], "--restore", count, path, (char *)NULL);
+        perror("execl");
+        _exit(1);
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    if (argc <= 2) unlink(path);
+
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+}
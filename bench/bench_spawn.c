@@ -0,0 +1,141 @@
+/*
+ * Pooled task benchmark: the cost of a full async_spawn() -> run -> reap
+ * lifecycle, and the memory taken by a large number of live, parked tasks.
+ *
+ * Usage: bench_spawn [lifecycles] [batch] [live tasks]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+static long nlifecycles;
+static long nbatch;
+static long nran;
+
+int child_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        nran++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int parked_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_park(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Spawns children in batches and lets them run to completion in between */
+int spawner_task(crt_t *crt, void *arg)
+{
+    async_loop_t *loop = arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (l->n = 0; l->n < nlifecycles; l->n += nbatch)
+        {
+            for (long ii = 0; ii < nbatch; ii++)
+            {
+                if (async_spawn(loop, child_task, NULL) == NULL) abort();
+            }
+
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void bench_lifecycle(void)
+{
+    async_loop_t loop;
+    async_task_t spawner;
+    uint64_t tstart;
+    uint64_t tend;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+
+    /* Enough room for one batch plus the budget slack */
+    async_loop_reserve(&loop, nbatch + ASYNC_LOOP_BUDGET);
+    /* Every batch drains within a single pass */
+    loop.al_budget = nbatch + 1;
+
+    nran = 0;
+    async_task_start_on(&loop, &spawner, spawner_task, &loop);
+
+    tstart = bench_now();
+    async_loop_run(&loop);
+    tend = bench_now();
+
+    printf("lifecycle: %ld tasks, batch %ld, %.1f ns/task, %zu pooled\n",
+            nran, nbatch, (double)(tend - tstart) / (double)nran, loop.al_pooled);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+static void bench_live(long nlive)
+{
+    async_loop_t loop;
+    size_t rss_start;
+    size_t rss_end;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+
+    rss_start = bench_rss();
+    tstart = bench_now();
+
+    for (ii = 0; ii < nlive; ii++)
+    {
+        if (async_spawn(&loop, parked_task, NULL) == NULL) abort();
+    }
+
+    /* First resume parks every task */
+    async_loop_run(&loop);
+
+    tend = bench_now();
+    rss_end = bench_rss();
+
+    printf("live: %ld parked tasks, %zu bytes/task (sizeof %zu), RSS +%.1f MiB, %.1f ns/spawn\n",
+            nlive,
+            (rss_end - rss_start) / (size_t)nlive,
+            sizeof(async_task_t),
+            (double)(rss_end - rss_start) / (1024.0 * 1024.0),
+            (double)(tend - tstart) / (double)nlive);
+
+    /* Parked tasks go away with their slabs */
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+int main(int argc, char *argv[])
+{
+    nlifecycles = bench_arg(argc, argv, 1, 10000000);
+    nbatch = bench_arg(argc, argv, 2, 256);
+
+    bench_lifecycle();
+    bench_live(bench_arg(argc, argv, 3, 1000000));
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Instrumentation overhead benchmark: a number of tasks yield in a loop,
+ * so nearly all the time goes to resuming them. Build it with and without
+ * -DASYNC_STATS (for all sources) and compare the ns/resume; with it, the
+ * collected statistics are printed as well, plus a task that sleeps to show
+ * time parked on timers.
+ *
+ * Usage: bench_stats [resumes] [tasks]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "../async_stats.h"
+#include "bench.h"
+
+#define TASKS_MAX   1024
+
+static long nresumes;
+static long ntasks;
+
+int yield_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (l->n = nresumes / ntasks; l->n > 0; l->n--) CRT_AWAIT(async_task_yield(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int sleep_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int n; }, l)
+    {
+        for (l->n = 0; l->n < 10; l->n++) CRT_AWAIT(async_task_sleep(crt, 0.001), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static async_task_t tasks[TASKS_MAX];
+    async_stats_snapshot_t snap;
+    async_task_t sleeper;
+    async_loop_t loop;
+    uint64_t tstart;
+    uint64_t ns;
+    long total;
+    long ii;
+
+    nresumes = bench_arg(argc, argv, 1, 10000000);
+    ntasks = bench_arg(argc, argv, 2, 100);
+
+    if (ntasks < 1) ntasks = 1;
+    if (ntasks > TASKS_MAX) ntasks = TASKS_MAX;
+    total = nresumes / ntasks * ntasks;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++) async_task_start_on(&loop, &tasks[ii], yield_task, NULL);
+
+    async_loop_run(&loop);
+
+    ns = bench_now() - tstart;
+
+#if defined(ASYNC_STATS)
+    printf("stats    ");
+#else
+    printf("no stats ");
+#endif
+    printf("%ld resumes by %ld tasks, %.1f ns/resume\n", total, ntasks, (double)ns / (double)total);
+
+#if defined(ASYNC_STATS)
+    async_task_start_on(&loop, &sleeper, sleep_task, NULL);
+    async_loop_run(&loop);
+
+    async_task_stats_dump(&tasks[0], stdout);
+    async_task_stats_dump(&sleeper, stdout);
+
+    async_stats_snapshot_init(&snap);
+    async_stats_snapshot(&loop, &snap);
+    async_stats_dump(&snap, stdout);
+    async_stats_snapshot_fini(&snap);
+#else
+    (void)sleeper;
+    (void)snap;
+#endif
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Work stealing benchmark with a skewed load: every task is spawned on
+ * worker 0 and alternates short CPU bursts with async_task_yield(). Compares
+ * throughput with stealing disabled and enabled.
+ *
+ * Every task counts the slices it ran; a task that ran a slice twice or
+ * lost one, or never finished, fails the run.
+ *
+ * Usage: bench_steal [workers] [tasks] [slices per task] [work per slice]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_rt.h"
+#include "bench.h"
+
+#define TIMEOUT_S       60                  /* Give up on tasks that got lost */
+
+static long nslices;
+static long nwork;
+static atomic_long done;
+static atomic_long *slices;                 /* Slices run, by task */
+
+static void burn(long n)
+{
+    volatile unsigned long x = 1;
+
+    while (n-- > 0) x = x * 6364136223846793005ul + 1442695040888963407ul;
+}
+
+int cpu_task(crt_t *crt, void *arg)
+{
+    atomic_long *count = arg;
+
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (l->n = 0; l->n < nslices; l->n++)
+        {
+            burn(nwork);
+            atomic_fetch_add_explicit(count, 1, memory_order_relaxed);
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+    }
+    CRT_END;
+
+    atomic_fetch_add(&done, 1);
+
+    return 0;
+}
+
+/* Run the load, returns 0 if every task ran each of its slices once */
+static int run(int nworkers, long ntasks, bool steal)
+{
+    async_runtime_t rt;
+    async_task_t *tasks;
+    uint64_t tstart;
+    uint64_t tend;
+    long bad = 0;
+    long ii;
+
+    tasks = calloc(ntasks, sizeof(*tasks));
+    slices = calloc(ntasks, sizeof(*slices));
+    if (tasks == NULL || slices == NULL || async_runtime_init(&rt, nworkers, true) != 0) return 1;
+
+    async_runtime_steal(&rt, steal);
+    atomic_store(&done, 0);
+
+    async_runtime_start(&rt);
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        async_task_spawn_on(async_runtime_worker(&rt, 0), &tasks[ii], cpu_task, &slices[ii]);
+    }
+
+    while (atomic_load(&done) < ntasks && bench_now() - tstart < TIMEOUT_S * 1000000000ull) usleep(100);
+
+    tend = bench_now();
+
+    async_runtime_stop(&rt);
+
+    printf("steal %-3s %10.0f slices/s, stolen per worker:", steal ? "on" : "off",
+            (double)(ntasks * nslices) / ((double)(tend - tstart) / 1e9));
+    for (ii = 0; ii < nworkers; ii++)
+    {
+        printf(" %ld", rt.ar_workers[ii].awr_stolen);
+    }
+    printf("\n");
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        if (atomic_load(&slices[ii]) != nslices) bad++;
+    }
+
+    if (bad > 0 || atomic_load(&done) != ntasks)
+    {
+        fprintf(stderr, "steal %s: %ld of %ld tasks finished, %ld ran a wrong number of slices\n",
+                steal ? "on" : "off", atomic_load(&done), ntasks, bad);
+    }
+
+    async_runtime_fini(&rt);
+    free(slices);
+    free(tasks);
+
+    return (bad > 0 || atomic_load(&done) != ntasks) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long nworkers = bench_arg(argc, argv, 1, 4);
+    long ntasks = bench_arg(argc, argv, 2, 4096);
+    int failed = 0;
+
+    nslices = bench_arg(argc, argv, 3, 50);
+    nwork = bench_arg(argc, argv, 4, 2000);
+
+    printf("online CPUs %ld, workers %ld, tasks %ld, slices %ld, work %ld\n",
+            sysconf(_SC_NPROCESSORS_ONLN), nworkers, ntasks, nslices, nwork);
+
+    failed += run(nworkers, ntasks, false);
+    failed += run(nworkers, ntasks, true);
+
+    return (failed > 0) ? 1 : 0;
+}
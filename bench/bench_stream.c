@@ -0,0 +1,248 @@
+/*
+ * Line protocol server benchmark: clients send batches of pipelined request
+ * lines over socket pairs and wait for one reply line per request, the
+ * server answers every line with "OK " and the line.
+ *
+ * Runs twice: with a server on async_stream_t (views, replies gathered per
+ * loop iteration) and with a conventional one (read into a buffer, copy each
+ * line out, build and write each reply, move the rest down). Reports
+ * requests/s, bytes copied and write system calls per request on the server
+ * side; the kernel's copies are not counted.
+ *
+ * Usage: bench_stream [connections] [requests per connection] [pipeline depth] [line size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "../async_stream.h"
+#include "bench.h"
+
+#define MAX_LINE        1024
+#define BUF_SIZE        16384
+
+struct conn
+{
+    async_task_t        c_task;
+    async_task_t        c_server;
+    int                 c_fd;               /* Client end */
+    int                 c_sfd;              /* Server end */
+    async_stream_t      c_stream;
+    char               *c_batch;            /* Pipelined requests */
+    size_t              c_fill;             /* Bytes in c_buf, copy server */
+    char                c_buf[BUF_SIZE];
+    char                c_line[MAX_LINE];
+    char                c_reply[MAX_LINE + 3];
+};
+
+struct result
+{
+    uint64_t            r_copied;
+    uint64_t            r_writes;
+};
+
+static async_loop_t *loop;
+static async_chunk_pool_t pool;
+static struct conn *conns;
+static struct result result;
+static long nconns;
+static long nrequests;
+static long depth;
+static long line_size;
+
+int stream_server(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+
+    CRT_LOCALS(crt, struct { async_view_t line; ssize_t rc; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_stream_read_until(crt, &c->c_stream, '\n', MAX_LINE, &l->line, &l->rc), 0);
+            if (l->rc <= 0) break;
+
+            async_stream_write(&c->c_stream, "OK ", 3);
+            async_stream_write_view(&c->c_stream, &l->line);
+            async_view_release(&l->line);
+        }
+    }
+    CRT_END;
+
+    result.r_copied += c->c_stream.ast_copied;
+    result.r_writes += c->c_stream.ast_writes;
+    async_stream_fini(&c->c_stream);
+    close(c->c_sfd);
+
+    return 0;
+}
+
+int copy_server(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+    char *nl;
+
+    CRT_LOCALS(crt, struct { size_t len; ssize_t n; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_read(crt, c->c_sfd, c->c_buf + c->c_fill, sizeof(c->c_buf) - c->c_fill, &l->n), 0);
+            if (l->n <= 0) break;
+            c->c_fill += l->n;
+
+            while ((nl = memchr(c->c_buf, '\n', c->c_fill)) != NULL)
+            {
+                /* The request is parsed out of the buffer, the reply built and sent */
+                l->len = nl - c->c_buf + 1;
+                memcpy(c->c_line, c->c_buf, l->len);
+                memcpy(c->c_reply, "OK ", 3);
+                memcpy(c->c_reply + 3, c->c_line, l->len);
+                memmove(c->c_buf, c->c_buf + l->len, c->c_fill - l->len);
+                c->c_fill -= l->len;
+                result.r_copied += 2 * l->len + 3 + c->c_fill;
+
+                CRT_AWAIT(async_write(crt, c->c_sfd, c->c_reply, l->len + 3, &l->n), 0);
+                result.r_writes++;
+                if (l->n < 0) break;
+            }
+        }
+    }
+    CRT_END;
+
+    close(c->c_sfd);
+
+    return 0;
+}
+
+int client_main(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+    char *p;
+
+    CRT_LOCALS(crt, struct { long r; long replies; ssize_t n; }, l)
+    {
+        for (l->r = 0; l->r < nrequests; l->r += depth)
+        {
+            CRT_AWAIT(async_write(crt, c->c_fd, c->c_batch, depth * line_size, &l->n), 0);
+            if (l->n < 0) CRT_EXIT(CRT_ERROR);
+
+            for (l->replies = 0; l->replies < depth; )
+            {
+                CRT_AWAIT(async_read(crt, c->c_fd, c->c_buf, sizeof(c->c_buf), &l->n), 0);
+                if (l->n <= 0) CRT_EXIT(CRT_ERROR);
+
+                for (p = c->c_buf; (p = memchr(p, '\n', c->c_buf + l->n - p)) != NULL; p++) l->replies++;
+            }
+        }
+    }
+    CRT_END;
+
+    shutdown(c->c_fd, SHUT_WR);
+
+    return 0;
+}
+
+static void run(const char *name, async_main_t *server)
+{
+    uint64_t tstart;
+    uint64_t ns;
+    long total = nconns * nrequests;
+    int fds[2];
+    long ii;
+
+    memset(&result, 0, sizeof(result));
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+
+        conns[ii].c_fd = fds[0];
+        conns[ii].c_sfd = fds[1];
+        if (server == stream_server && async_stream_init(&conns[ii].c_stream, loop, &pool, fds[1]) != 0)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        async_task_start_on(loop, &conns[ii].c_server, server, &conns[ii]);
+        async_task_start_on(loop, &conns[ii].c_task, client_main, &conns[ii]);
+    }
+
+    async_loop_run(loop);
+
+    ns = bench_now() - tstart;
+
+    for (ii = 0; ii < nconns; ii++) close(conns[ii].c_fd);
+
+    printf("%-8s %10.0f requests/s, %6.1f bytes copied/request, %5.3f writes/request\n", name,
+            (double)total / ((double)ns / 1e9), (double)result.r_copied / (double)total,
+            (double)result.r_writes / (double)total);
+}
+
+int main(int argc, char *argv[])
+{
+    long ii;
+    long jj;
+
+    nconns = bench_arg(argc, argv, 1, 1000);
+    nrequests = bench_arg(argc, argv, 2, 1000);
+    depth = bench_arg(argc, argv, 3, 16);
+    line_size = bench_arg(argc, argv, 4, 32);
+
+    if (line_size < 2) line_size = 2;
+    if (line_size > MAX_LINE) line_size = MAX_LINE;
+    if (depth < 1) depth = 1;
+    if (depth * (line_size + 3) > BUF_SIZE) depth = BUF_SIZE / (line_size + 3);
+    nrequests = (nrequests + depth - 1) / depth * depth;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    conns = calloc(nconns, sizeof(*conns));
+    if (conns == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        conns[ii].c_batch = malloc(depth * line_size);
+        if (conns[ii].c_batch == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+
+        for (jj = 0; jj < depth; jj++)
+        {
+            memset(conns[ii].c_batch + jj * line_size, 'x', line_size - 1);
+            conns[ii].c_batch[(jj + 1) * line_size - 1] = '\n';
+        }
+    }
+
+    loop = async_loop_default();
+    async_chunk_pool_init(&pool, 0, nconns);
+
+    printf("connections %ld, requests %ld, pipeline %ld, line %ld bytes\n", nconns,
+            nconns * nrequests, depth, line_size);
+
+    run("copy", copy_server);
+    run("stream", stream_server);
+
+    async_chunk_pool_fini(&pool);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Timeout benchmark: worker tasks issue requests that complete after a few
+ * scheduler passes, each under a timeout that rarely fires; one request in
+ * a thousand never completes and has to time out. Compares requests without
+ * a timeout, with CRT_AWAIT_TIMEOUT() and with the timeout raced in a group
+ * against a sleeping task, the way it had to be done before.
+ *
+ * Reports the CPU time per request, which leaves out the time spent blocked
+ * on the hung requests, and the timeouts that fired.
+ *
+ * Usage: bench_timeout [requests] [workers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+#define REQUEST_TIMEOUT     0.010
+#define HANG_ONE_IN         1000
+
+enum mode
+{
+    MODE_NONE,
+    MODE_DEADLINE,
+    MODE_RACE,
+};
+
+static const char *mode_names[] = { "none", "deadline", "race" };
+
+static enum mode mode;
+static long nrequests;
+static long nworkers;
+static long ntimeouts;
+static long ncompleted;
+static async_group_t *groups;
+static async_loop_t loop;
+static uint64_t rng = 88172645463325252ull;
+
+/*
+ * The request: a few scheduler passes, or parked for good
+ */
+void request(crt_t *crt)
+{
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        if (mode != MODE_NONE && bench_rand(&rng) % HANG_ONE_IN == 0)
+        {
+            CRT_AWAIT(async_task_park(crt));
+        }
+
+        for (l->n = bench_rand(&rng) % 4; l->n > 0; l->n--)
+        {
+            CRT_AWAIT(async_task_yield(crt));
+        }
+    }
+    CRT_END;
+}
+
+int request_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(request(crt), 0);
+    }
+    CRT_END;
+
+    return 1;
+}
+
+int sleep_task(crt_t *crt, void *arg)
+{
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_sleep(crt, *(double *)arg), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int worker_task(crt_t *crt, void *arg)
+{
+    static double timeout = REQUEST_TIMEOUT;
+    async_group_t *group = &groups[(long)arg];
+
+    CRT_LOCALS(crt, struct { long n; void *data; int rc; }, l)
+    {
+        for (l->n = nrequests / nworkers; l->n > 0; l->n--)
+        {
+            /* No switch here, its case labels would clash with the resume points */
+            if (mode == MODE_NONE)
+            {
+                CRT_AWAIT(request(crt), 0);
+                ncompleted++;
+            }
+            else if (mode == MODE_DEADLINE)
+            {
+                CRT_AWAIT_TIMEOUT(request(crt), REQUEST_TIMEOUT, 0);
+                if (CRT_TIMEDOUT(crt)) ntimeouts++; else ncompleted++;
+            }
+            else
+            {
+                async_group_init(group, ASYNC_TASK(crt));
+                if (async_group_spawn(group, &loop, request_task, NULL) == NULL) abort();
+                if (async_group_spawn(group, &loop, sleep_task, &timeout) == NULL) abort();
+
+                CRT_AWAIT(async_group_any(crt, group, &l->data, &l->rc), 0);
+                if (l->rc == 0) ntimeouts++; else ncompleted++;
+
+                CRT_AWAIT(async_group_join(crt, group), 0);
+                async_group_fini(group);
+            }
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void run(enum mode m)
+{
+    uint64_t tstart;
+    uint64_t cstart;
+    uint64_t ns;
+    long ii;
+
+    mode = m;
+    ntimeouts = 0;
+    ncompleted = 0;
+
+    async_loop_init(&loop, ev_loop_new(EVFLAG_AUTO));
+    async_loop_timer_wheel(&loop, ASYNC_WHEEL_RESOLUTION, 1);
+    async_loop_reserve(&loop, nworkers * 3);
+
+    tstart = bench_now();
+    cstart = bench_cpu();
+
+    for (ii = 0; ii < nworkers; ii++)
+    {
+        if (async_spawn(&loop, worker_task, (void *)ii) == NULL) abort();
+    }
+
+    async_loop_run(&loop);
+
+    ns = bench_cpu() - cstart;
+
+    printf("%-9s %ld requests, %ld completed, %ld timed out, %.1f ns CPU/request, %.1f ms total\n",
+            mode_names[m], ncompleted + ntimeouts, ncompleted, ntimeouts,
+            (double)ns / (double)(ncompleted + ntimeouts), (double)(bench_now() - tstart) / 1e6);
+
+    struct ev_loop *ev = loop.al_ev;
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+int main(int argc, char *argv[])
+{
+    nrequests = bench_arg(argc, argv, 1, 100000);
+    nworkers = bench_arg(argc, argv, 2, 1000);
+    if (nworkers < 1) nworkers = 1;
+
+    groups = calloc(nworkers, sizeof(*groups));
+    if (groups == NULL) return 1;
+
+    run(MODE_NONE);
+    run(MODE_DEADLINE);
+    run(MODE_RACE);
+
+    free(groups);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Timer backend benchmark, libev heap vs. timer wheel:
+ *
+ *   rearm  - arm N idle timeouts (10-60s) and keep re-arming them, as a
+ *            connection would on activity; reports ns per start/stop
+ *   sleep  - N tasks doing a few short async_task_sleep() calls each;
+ *            reports wakeups/s and mean lateness
+ *
+ * Usage: bench_timer [timers] [rearm rounds] [sleeps per task]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+#include "bench.h"
+
+#define SLEEP_MAX_MS    20
+
+static uint64_t seed = 1;
+static long sleep_count;
+static double sleep_late;
+
+static void loop_setup(async_loop_t *loop, int backend, unsigned coalesce)
+{
+    async_loop_init(loop, ev_loop_new(0));
+    if (backend == ASYNC_TIMER_WHEEL)
+    {
+        async_loop_timer_wheel(loop, ASYNC_WHEEL_RESOLUTION, coalesce);
+    }
+}
+
+static void loop_teardown(async_loop_t *loop)
+{
+    struct ev_loop *ev = loop->al_ev;
+
+    async_loop_fini(loop);
+    ev_loop_destroy(ev);
+}
+
+static double bench_rearm(int backend, long ntimers, long rounds)
+{
+    async_loop_t loop;
+    async_timer_t *timers;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+    long rr;
+
+    timers = calloc(ntimers, sizeof(*timers));
+    if (timers == NULL) return 0.0;
+
+    loop_setup(&loop, backend, 0);
+    seed = 1;
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntimers; ii++)
+    {
+        async_timer_init(&timers[ii], NULL);
+        async_timer_start(&loop, &timers[ii], 10.0 + (bench_rand(&seed) % 50000) / 1000.0);
+    }
+
+    for (rr = 0; rr < rounds; rr++)
+    {
+        for (ii = 0; ii < ntimers; ii++)
+        {
+            async_timer_start(&loop, &timers[ii], 10.0 + (bench_rand(&seed) % 50000) / 1000.0);
+        }
+    }
+
+    for (ii = 0; ii < ntimers; ii++)
+    {
+        async_timer_stop(&loop, &timers[ii]);
+    }
+
+    tend = bench_now();
+
+    loop_teardown(&loop);
+    free(timers);
+
+    return (double)(tend - tstart) / (double)(ntimers * (rounds + 2));
+}
+
+static long sleep_rounds;
+
+int sleep_task(crt_t *crt, void *arg)
+{
+    async_task_t *self = arg;
+
+    CRT_LOCALS(crt, struct { long n; double timeout; double target; }, l)
+    {
+        for (l->n = 0; l->n < sleep_rounds; l->n++)
+        {
+            l->timeout = (1 + bench_rand(&seed) % SLEEP_MAX_MS) / 1000.0;
+            l->target = ev_now(self->at_loop->al_ev) + l->timeout;
+
+            CRT_AWAIT(async_task_sleep(crt, l->timeout), 0);
+
+            sleep_late += ev_now(self->at_loop->al_ev) - l->target;
+            sleep_count++;
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void bench_sleep(const char *name, int backend, unsigned coalesce, long ntasks, long rounds)
+{
+    async_loop_t loop;
+    async_task_t *tasks;
+    uint64_t tstart;
+    uint64_t tend;
+    long ii;
+
+    tasks = calloc(ntasks, sizeof(*tasks));
+    if (tasks == NULL) return;
+
+    loop_setup(&loop, backend, coalesce);
+    seed = 1;
+
+    sleep_rounds = rounds;
+    sleep_count = 0;
+    sleep_late = 0.0;
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < ntasks; ii++)
+    {
+        async_task_start_on(&loop, &tasks[ii], sleep_task, &tasks[ii]);
+    }
+
+    async_loop_run(&loop);
+
+    tend = bench_now();
+
+    printf("sleep %-14s %10.0f wakeups/s, mean lateness %6.3f ms\n",
+            name,
+            (double)sleep_count / ((double)(tend - tstart) / 1e9),
+            sleep_count > 0 ? sleep_late / sleep_count * 1000.0 : 0.0);
+
+    loop_teardown(&loop);
+    free(tasks);
+}
+
+int main(int argc, char *argv[])
+{
+    long ntimers = bench_arg(argc, argv, 1, 100000);
+    long rounds = bench_arg(argc, argv, 2, 10);
+    long sleeps = bench_arg(argc, argv, 3, 5);
+
+    printf("timers %ld, rearm rounds %ld, sleeps per task %ld\n", ntimers, rounds, sleeps);
+    printf("rearm heap:          %6.1f ns/op\n", bench_rearm(ASYNC_TIMER_HEAP, ntimers, rounds));
+    printf("rearm wheel:         %6.1f ns/op\n", bench_rearm(ASYNC_TIMER_WHEEL, ntimers, rounds));
+
+    bench_sleep("heap:", ASYNC_TIMER_HEAP, 0, ntimers, sleeps);
+    bench_sleep("wheel:", ASYNC_TIMER_WHEEL, 0, ntimers, sleeps);
+    bench_sleep("wheel/coal 4:", ASYNC_TIMER_WHEEL, 4, ntimers, sleeps);
+
+    return 0;
+}
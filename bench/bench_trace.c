@@ -0,0 +1,98 @@
+/*
+ * Trace overhead benchmark: a number of co-routines are resumed round robin,
+ * each suspends in a nested frame (two records per suspend plus one per
+ * resume). Build it with and without -DCRT_TRACE (for all sources) and
+ * compare the ns/resume; with it, the trace is written to the given file,
+ * convert it with trace2json.
+ *
+ * Usage: bench_trace [resumes] [co-routines] [trace file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../crt.h"
+#include "bench.h"
+
+#define LOCALS_SIZE     64
+
+struct instance
+{
+    crt_t       crt;
+    _Alignas(CRT_LOCALS_ALIGN)
+    char        locals[LOCALS_SIZE];
+};
+
+int fetch(crt_t *crt)
+{
+    CRT(crt)
+    {
+        CRT_YIELD(0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int handler(crt_t *crt)
+{
+    CRT_LOCALS(crt, struct { long n; }, l)
+    {
+        for (;; l->n++) CRT_AWAIT(fetch(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long nresumes = bench_arg(argc, argv, 1, 10000000);
+    long ninst = bench_arg(argc, argv, 2, 100);
+    const char *path = argc > 3 ? argv[3] : "bench_trace.crtrace";
+    struct instance *inst;
+    uint64_t tstart;
+    uint64_t ns;
+    long rounds;
+    long ii;
+    long jj;
+
+    if (ninst < 1) ninst = 1;
+    rounds = nresumes / ninst;
+
+    inst = aligned_alloc(CRT_LOCALS_ALIGN, ninst * sizeof(*inst));
+    if (inst == NULL) return 1;
+
+    for (ii = 0; ii < ninst; ii++) CRT_INIT_LOCALS(&inst[ii].crt, inst[ii].locals, LOCALS_SIZE);
+
+#if defined(CRT_TRACE)
+    if (crt_trace_open(path, 0) != 0)
+    {
+        perror(path);
+        return 1;
+    }
+#else
+    (void)path;
+#endif
+
+    tstart = bench_now();
+
+    for (jj = 0; jj < rounds; jj++)
+    {
+        for (ii = 0; ii < ninst; ii++) handler(&inst[ii].crt);
+    }
+
+    ns = bench_now() - tstart;
+
+#if defined(CRT_TRACE)
+    crt_trace_close();
+    printf("trace    ");
+#else
+    printf("no trace ");
+#endif
+    printf("%ld resumes of %ld co-routines, %.1f ns/resume\n", rounds * ninst, ninst,
+            (double)ns / (double)(rounds * ninst));
+
+    free(inst);
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * io_uring against libev readiness: the same echo tasks (a server and a
+ * client task per socket pair, fixed size messages) run on a libev loop and
+ * on a loop with an io_uring. Reports requests/s and system calls/request.
+ *
+ * System calls are counted as reads and writes (syscr and syscw of
+ * /proc/self/io), loop iterations (one epoll_wait() each) and
+ * io_uring_enter() calls; epoll_ctl() calls are not counted.
+ *
+ * Usage: bench_uring [connections] [requests per connection] [message size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "../async_uring.h"
+#include "bench.h"
+
+#define MSG_MAX     4096
+
+struct conn
+{
+    async_task_t        c_server;
+    async_task_t        c_client;
+    int                 c_fd[2];            /* Client end, server end */
+    char                c_sbuf[MSG_MAX];
+    char                c_cbuf[MSG_MAX];
+};
+
+static struct conn *conns;
+static long nconns;
+static long nrequests;
+static long msg_size;
+
+int echo_task(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+
+    CRT_LOCALS(crt, struct { ssize_t n; ssize_t rc; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_read(crt, c->c_fd[1], c->c_sbuf, sizeof(c->c_sbuf), &l->n), 0);
+            if (l->n <= 0) break;
+
+            CRT_AWAIT(async_write(crt, c->c_fd[1], c->c_sbuf, l->n, &l->rc), 0);
+            if (l->rc < 0) break;
+        }
+    }
+    CRT_END;
+
+    close(c->c_fd[1]);
+
+    return 0;
+}
+
+int client_main(crt_t *crt, void *arg)
+{
+    struct conn *c = arg;
+
+    CRT_LOCALS(crt, struct { long r; ssize_t n; ssize_t got; }, l)
+    {
+        for (l->r = 0; l->r < nrequests; l->r++)
+        {
+            CRT_AWAIT(async_write(crt, c->c_fd[0], c->c_cbuf, msg_size, &l->n), 0);
+            if (l->n < 0) CRT_EXIT(CRT_ERROR);
+
+            for (l->got = 0; l->got < msg_size; l->got += l->n)
+            {
+                CRT_AWAIT(async_read(crt, c->c_fd[0], c->c_cbuf + l->got, msg_size - l->got, &l->n), 0);
+                if (l->n <= 0) CRT_EXIT(CRT_ERROR);
+            }
+        }
+    }
+    CRT_END;
+
+    close(c->c_fd[0]);
+
+    return 0;
+}
+
+/* Read and write system calls so far */
+static uint64_t io_syscalls(void)
+{
+    char line[128];
+    uint64_t n = 0;
+    FILE *f;
+
+    f = fopen("/proc/self/io", "r");
+    if (f == NULL) return 0;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (strncmp(line, "syscr:", 6) == 0 || strncmp(line, "syscw:", 6) == 0) n += strtoull(line + 6, NULL, 10);
+    }
+
+    fclose(f);
+
+    return n;
+}
+
+static int run(const char *name, bool uring)
+{
+    struct ev_loop *ev = ev_loop_new(EVBACKEND_EPOLL);
+    async_loop_t loop;
+    uint64_t tstart;
+    uint64_t ns;
+    uint64_t syscalls;
+    uint64_t enters = 0;
+    unsigned iterations;
+    long total = nconns * nrequests;
+    long ii;
+
+    if (ev == NULL) return -1;
+
+    async_loop_init(&loop, ev);
+    if (uring && async_loop_io_uring(&loop, 1024, ASYNC_URING_TIMERS) != 0)
+    {
+        perror("io_uring");
+        async_loop_fini(&loop);
+        ev_loop_destroy(ev);
+        return -1;
+    }
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, conns[ii].c_fd) != 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+    }
+
+    syscalls = io_syscalls();
+    iterations = ev_iteration(ev);
+    tstart = bench_now();
+
+    for (ii = 0; ii < nconns; ii++)
+    {
+        async_task_start_on(&loop, &conns[ii].c_server, echo_task, &conns[ii]);
+        async_task_start_on(&loop, &conns[ii].c_client, client_main, &conns[ii]);
+    }
+
+    async_loop_run(&loop);
+
+    ns = bench_now() - tstart;
+#if defined(__linux__)
+    if (loop.al_uring != NULL) enters = loop.al_uring->aur_enters;
+#endif
+    syscalls = io_syscalls() - syscalls + (ev_iteration(ev) - iterations) + enters;
+
+    printf("%-8s %10.0f requests/s, %6.2f syscalls/request (%.2f io_uring_enter, %.2f loop iterations)\n", name,
+            (double)total / ((double)ns / 1e9), (double)syscalls / (double)total,
+            (double)enters / (double)total, (double)(ev_iteration(ev) - iterations) / (double)total);
+
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long ii;
+
+    nconns = bench_arg(argc, argv, 1, 1000);
+    nrequests = bench_arg(argc, argv, 2, 200);
+    msg_size = bench_arg(argc, argv, 3, 64);
+    if (msg_size > MSG_MAX) msg_size = MSG_MAX;
+    if (msg_size < 1) msg_size = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    conns = calloc(nconns, sizeof(*conns));
+    if (conns == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (ii = 0; ii < nconns; ii++) memset(conns[ii].c_cbuf, 'x', msg_size);
+
+    printf("connections %ld, requests %ld, message %ld bytes\n", nconns, nconns * nrequests, msg_size);
+
+    run("libev", false);
+    run("io_uring", true);
+
+    free(conns);
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * Cross-thread wakeup benchmark: producer threads wake tasks parked on a
+ * single worker loop with async_task_wake_from_any_thread(). Reports wake
+ * calls/s, task resumes/s and resumes per loop iteration (how well bursts
+ * are batched into one loop wakeup) for 1..32 producers.
+ *
+ * Producers raise a flag of the task before each wake, the task clears it
+ * when it resumes; a flag still raised once the loop went quiet is a lost
+ * wakeup and fails the run.
+ *
+ * Usage: bench_wake [max producers] [wakes per producer]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_rt.h"
+#include "bench.h"
+
+#define TASKS_PER_PRODUCER  64
+#define SETTLE_MS           5000                /* Wait for the last wakes to resume */
+
+struct producer
+{
+    pthread_t           p_thread;
+    async_task_t       *p_tasks;
+    atomic_int         *p_pending;
+    long                p_count;
+};
+
+static atomic_long resumes;
+
+int parked_task(crt_t *crt, void *arg)
+{
+    atomic_int *pending = arg;
+
+    CRT(crt)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_task_park(crt), 0);
+            atomic_store(pending, 0);
+            atomic_fetch_add_explicit(&resumes, 1, memory_order_relaxed);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void *producer_thread(void *arg)
+{
+    struct producer *self = arg;
+    long ii;
+
+    for (ii = 0; ii < self->p_count; ii++)
+    {
+        atomic_store(&self->p_pending[ii % TASKS_PER_PRODUCER], 1);
+        async_task_wake_from_any_thread(&self->p_tasks[ii % TASKS_PER_PRODUCER]);
+    }
+
+    return NULL;
+}
+
+/* Tasks with a wake that never resumed them, after waiting for them to settle */
+static int lost_wakes(atomic_int *pending, int ntasks)
+{
+    int lost = 0;
+    int ms;
+    int ii;
+
+    for (ms = 0; ms < SETTLE_MS; ms++)
+    {
+        for (lost = 0, ii = 0; ii < ntasks; ii++) lost += atomic_load(&pending[ii]);
+        if (lost == 0) break;
+
+        usleep(1000);
+    }
+
+    return lost;
+}
+
+/* Run with @p nproducers producer threads, returns 0 if no wakeup was lost */
+static int run(int nproducers, long count)
+{
+    struct producer *producers;
+    atomic_int *pending;
+    async_task_t *tasks;
+    async_runtime_t rt;
+    unsigned iter;
+    uint64_t tstart;
+    uint64_t tend;
+    double secs;
+    long resumed;
+    int lost;
+    int ii;
+
+    tasks = calloc(nproducers * TASKS_PER_PRODUCER, sizeof(*tasks));
+    pending = calloc(nproducers * TASKS_PER_PRODUCER, sizeof(*pending));
+    producers = calloc(nproducers, sizeof(*producers));
+    if (tasks == NULL || pending == NULL || producers == NULL) return 1;
+
+    async_runtime_init(&rt, 1, false);
+
+    for (ii = 0; ii < nproducers * TASKS_PER_PRODUCER; ii++)
+    {
+        async_task_spawn_on(async_runtime_worker(&rt, 0), &tasks[ii], parked_task, &pending[ii]);
+    }
+
+    async_runtime_start(&rt);
+
+    /* Let every task reach its park point */
+    while (rt.ar_workers[0].awr_loop.al_runq_len > 0 || ev_iteration(rt.ar_workers[0].awr_loop.al_ev) < 2)
+    {
+        sched_yield();
+    }
+
+    atomic_store(&resumes, 0);
+    iter = ev_iteration(rt.ar_workers[0].awr_loop.al_ev);
+
+    tstart = bench_now();
+
+    for (ii = 0; ii < nproducers; ii++)
+    {
+        producers[ii].p_tasks = &tasks[ii * TASKS_PER_PRODUCER];
+        producers[ii].p_pending = &pending[ii * TASKS_PER_PRODUCER];
+        producers[ii].p_count = count;
+        pthread_create(&producers[ii].p_thread, NULL, producer_thread, &producers[ii]);
+    }
+
+    for (ii = 0; ii < nproducers; ii++)
+    {
+        pthread_join(producers[ii].p_thread, NULL);
+    }
+
+    tend = bench_now();
+    resumed = atomic_load(&resumes);
+
+    lost = lost_wakes(pending, nproducers * TASKS_PER_PRODUCER);
+
+    async_runtime_stop(&rt);
+
+    secs = (double)(tend - tstart) / 1e9;
+    iter = ev_iteration(rt.ar_workers[0].awr_loop.al_ev) - iter;
+
+    printf("%9d %14.0f %14.0f %14.1f\n",
+            nproducers,
+            (double)(nproducers * count) / secs,
+            (double)resumed / secs,
+            iter > 0 ? (double)resumed / iter : 0.0);
+
+    if (lost > 0 || atomic_load(&resumes) > nproducers * count)
+    {
+        fprintf(stderr, "%d producers: %d tasks lost a wakeup, %ld resumes for %ld wakes\n",
+                nproducers, lost, atomic_load(&resumes), nproducers * count);
+    }
+
+    async_runtime_fini(&rt);
+    free(producers);
+    free(pending);
+    free(tasks);
+
+    return (lost > 0 || atomic_load(&resumes) > nproducers * count) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long maxproducers = bench_arg(argc, argv, 1, 32);
+    long count = bench_arg(argc, argv, 2, 200000);
+    int failed = 0;
+    int np;
+
+    printf("%9s %14s %14s %14s\n", "producers", "wakes/s", "resumes/s", "resumes/iter");
+
+    for (np = 1; np <= maxproducers; np *= 2)
+    {
+        failed += run(np, count);
+    }
+
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * Benchmark suite of the core operations, with JSON output and a baseline
+ * check for regressions:
+ *
+ *   resume_yield       resume of a co-routine that yields right away
+ *   resume_nested      the same four frames deep, CRT_AWAIT() at each level
+ *   generator          one value per resume, the primes() pattern
+ *   generator_batch    values handed over 64 at a time, CRT_YIELD_BATCH()
+ *   sleep_heap         async_task_sleep() round trip, libev timer heap
+ *   sleep_wheel        async_task_sleep() round trip, timer wheel
+ *   spawn              async_spawn(), run and reap of a pooled task
+ *
+ * Every case runs a few times and reports its best CPU time per operation,
+ * which leaves out the time the loop spends blocked and most of the noise.
+ *
+ * With --baseline, each case is compared with the same case in a file that a
+ * previous --json run wrote; a case slower than the baseline by more than
+ * the tolerance fails the run. Baselines only compare on the same machine,
+ * regenerate them with:
+ *
+ *      crt_bench --json > bench/baseline.json
+ *
+ * ctest runs the comparison only when configured with -DCRT_BENCH_BASELINE=ON.
+ *
+ * Usage: crt_bench [--json] [--baseline file] [--tolerance percent] [--reps n] [case ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../crt.h"
+#include "../async.h"
+#include "bench.h"
+
+#define SLEEP_TASKS     1000
+#define SPAWN_BATCH     1000
+
+struct bench_case
+{
+    const char         *bc_name;
+    void              (*bc_fn)(long n);     /* Run @p n operations */
+    long                bc_ops;             /* Operations per run */
+    double              bc_ns;              /* Best ns/operation */
+};
+
+static volatile long sink;
+static long sleeps_left;
+static long spawned;
+
+/*
+ * Co-routines
+ */
+int ticker(crt_t *crt)
+{
+    CRT(crt)
+    {
+        for (;;) CRT_YIELD(1);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int nested(crt_t *crt, int depth)
+{
+    CRT(crt)
+    {
+        for (;;)
+        {
+            if (depth == 0)
+            {
+                CRT_YIELD(1);
+            }
+            else
+            {
+                CRT_AWAIT(nested(crt, depth - 1), 0);
+            }
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int counter(crt_t *crt)
+{
+    CRT_LOCALS(crt, struct { int n; }, l)
+    {
+        for (;;) CRT_YIELD(++l->n);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+CRT_BATCH_DEFINE(int_batch_t, int);
+
+void counter_batch(crt_t *crt, int_batch_t *batch)
+{
+    CRT_LOCALS(crt, struct { int n; }, l)
+    {
+        for (;;) CRT_YIELD_BATCH(batch, ++l->n);
+    }
+    CRT_END;
+}
+
+int sleeper_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        while (sleeps_left > 0)
+        {
+            sleeps_left--;
+            CRT_AWAIT(async_task_sleep(crt, 0.0), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int child_task(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        sink++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int spawner_task(crt_t *crt, void *arg)
+{
+    async_loop_t *loop = arg;
+    long ii;
+
+    CRT(crt)
+    {
+        while (spawned > 0)
+        {
+            for (ii = 0; ii < SPAWN_BATCH && spawned > 0; ii++, spawned--)
+            {
+                if (async_spawn(loop, child_task, NULL) == NULL) abort();
+            }
+
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/*
+ * Cases
+ */
+static void run_resume_yield(long n)
+{
+    crt_t crt;
+    long sum = 0;
+
+    CRT_INIT(&crt);
+    while (n-- > 0) sum += ticker(&crt);
+    sink = sum;
+}
+
+static void run_resume_nested(long n)
+{
+    crt_t crt;
+    long sum = 0;
+
+    CRT_INIT(&crt);
+    while (n-- > 0) sum += nested(&crt, 3);
+    sink = sum;
+}
+
+static void run_generator(long n)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    crt_t crt;
+    long sum = 0;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    while (n-- > 0) sum += counter(&crt);
+    sink = sum;
+}
+
+static void run_generator_batch(long n)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    crt_t crt;
+    int buf[64];
+    int_batch_t batch;
+    long sum = 0;
+    size_t ii;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    CRT_BATCH_INIT(&batch, buf, 64);
+
+    for (; n > 0; n -= batch.cb_count)
+    {
+        counter_batch(&crt, &batch);
+        for (ii = 0; ii < batch.cb_count; ii++) sum += batch.cb_items[ii];
+    }
+    sink = sum;
+}
+
+static void run_sleep(long n, bool wheel)
+{
+    struct ev_loop *ev = ev_loop_new(EVFLAG_AUTO);
+    async_loop_t loop;
+    async_task_t *tasks;
+    long ii;
+
+    tasks = calloc(SLEEP_TASKS, sizeof(*tasks));
+    if (ev == NULL || tasks == NULL) abort();
+
+    async_loop_init(&loop, ev);
+    if (wheel) async_loop_timer_wheel(&loop, ASYNC_WHEEL_RESOLUTION, 1);
+
+    sleeps_left = n;
+    for (ii = 0; ii < SLEEP_TASKS; ii++) async_task_start_on(&loop, &tasks[ii], sleeper_task, NULL);
+
+    async_loop_run(&loop);
+
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+    free(tasks);
+}
+
+static void run_sleep_heap(long n)
+{
+    run_sleep(n, false);
+}
+
+static void run_sleep_wheel(long n)
+{
+    run_sleep(n, true);
+}
+
+static void run_spawn(long n)
+{
+    struct ev_loop *ev = ev_loop_new(EVFLAG_AUTO);
+    async_loop_t loop;
+    async_task_t spawner;
+
+    if (ev == NULL) abort();
+
+    async_loop_init(&loop, ev);
+
+    spawned = n;
+    async_task_start_on(&loop, &spawner, spawner_task, &loop);
+    async_loop_run(&loop);
+
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+}
+
+static struct bench_case cases[] =
+{
+    { "resume_yield",       run_resume_yield,       20000000,   0 },
+    { "resume_nested",      run_resume_nested,      10000000,   0 },
+    { "generator",          run_generator,          20000000,   0 },
+    { "generator_batch",    run_generator_batch,    50000000,   0 },
+    { "sleep_heap",         run_sleep_heap,         1000000,    0 },
+    { "sleep_wheel",        run_sleep_wheel,        200000,     0 },
+    { "spawn",              run_spawn,              2000000,    0 },
+};
+
+#define NCASES      (sizeof(cases) / sizeof(cases[0]))
+
+/*
+ * Baseline value of case @p name in the JSON written by --json, -1 if it
+ * has none
+ */
+static double baseline_value(const char *json, const char *name)
+{
+    char key[128];
+    const char *p;
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    p = strstr(json, key);
+    if (p == NULL) return -1.0;
+
+    p = strstr(p, "\"ns_per_op\":");
+    if (p == NULL) return -1.0;
+
+    return strtod(p + strlen("\"ns_per_op\":"), NULL);
+}
+
+static char *read_file(const char *path)
+{
+    FILE *f;
+    char *buf;
+    long size;
+
+    f = fopen(path, "r");
+    if (f == NULL) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = malloc(size + 1);
+    if (buf != NULL)
+    {
+        size = fread(buf, 1, size, f);
+        buf[size] = '\0';
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+static bool selected(struct bench_case *bc, int argc, char *argv[], int first)
+{
+    int ii;
+
+    if (first >= argc) return true;
+
+    for (ii = first; ii < argc; ii++)
+    {
+        if (strcmp(argv[ii], bc->bc_name) == 0) return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_case *bc;
+    const char *baseline_path = NULL;
+    char *baseline = NULL;
+    double tolerance = 50.0;
+    double base;
+    bool json = false;
+    bool first = true;
+    int regressions = 0;
+    long reps = 5;
+    uint64_t start;
+    size_t ii;
+    long rr;
+    int arg;
+
+    for (arg = 1; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++)
+    {
+        if (strcmp(argv[arg], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (strcmp(argv[arg], "--baseline") == 0 && arg + 1 < argc)
+        {
+            baseline_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--tolerance") == 0 && arg + 1 < argc)
+        {
+            tolerance = strtod(argv[++arg], NULL);
+        }
+        else if (strcmp(argv[arg], "--reps") == 0 && arg + 1 < argc)
+        {
+            reps = strtol(argv[++arg], NULL, 0);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--json] [--baseline file] [--tolerance percent] [--reps n] [case ...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (reps < 1) reps = 1;
+
+    if (baseline_path != NULL)
+    {
+        baseline = read_file(baseline_path);
+        if (baseline == NULL)
+        {
+            perror(baseline_path);
+            return 2;
+        }
+    }
+
+    if (json) printf("{\n    \"results\": [\n");
+
+    for (ii = 0; ii < NCASES; ii++)
+    {
+        bc = &cases[ii];
+        if (!selected(bc, argc, argv, arg)) continue;
+
+        for (rr = 0; rr < reps; rr++)
+        {
+            double ns;
+
+            start = bench_cpu();
+            bc->bc_fn(bc->bc_ops);
+            ns = (double)(bench_cpu() - start) / (double)bc->bc_ops;
+
+            if (rr == 0 || ns < bc->bc_ns) bc->bc_ns = ns;
+        }
+
+        if (json)
+        {
+            printf("%s        { \"name\": \"%s\", \"ns_per_op\": %.3f, \"ops\": %ld }", first ? "" : ",\n",
+                    bc->bc_name, bc->bc_ns, bc->bc_ops);
+        }
+        else
+        {
+            printf("%-16s %10.2f ns/op\n", bc->bc_name, bc->bc_ns);
+        }
+        first = false;
+
+        if (baseline == NULL) continue;
+
+        base = baseline_value(baseline, bc->bc_name);
+        if (base <= 0.0)
+        {
+            fprintf(stderr, "%s: no baseline\n", bc->bc_name);
+        }
+        else if (bc->bc_ns > base * (1.0 + tolerance / 100.0))
+        {
+            fprintf(stderr, "REGRESSION %s: %.2f ns/op, baseline %.2f ns/op (+%.0f%%, tolerance %.0f%%)\n",
+                    bc->bc_name, bc->bc_ns, base, (bc->bc_ns / base - 1.0) * 100.0, tolerance);
+            regressions++;
+        }
+    }
+
+    if (json) printf("\n    ]\n}\n");
+
+    free(baseline);
+
+    return (regressions > 0) ? 1 : 0;
+}
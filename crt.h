@@ -1,12 +1,82 @@
 #if !defined(CRT_H_INCLUDED)
 #define CRT_H_INCLUDED
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 typedef struct crt crt_t;
 
-#define CRT_STACK_DEPTH             32
+/*
+ * Layout configuration, must be the same for all users of crt_t:
+ *
+ * CRT_POINT_BITS       Width of a stack slot (resume point or status), 16 or 32
+ * CRT_POINT_COUNTER    Number resume points with __COUNTER__ instead of
+ *                      __LINE__; needed with 16-bit slots in sources longer
+ *                      than 32767 lines
+ * CRT_STACK_DEPTH      Depth of the stack stored inside crt_t
+ * CRT_STACK_GROWABLE   Move the stack to the heap when it runs out instead of
+ *                      failing with CRT_ERROR_STACK_OVERFLOW
+ * CRT_STACK_MAX        Upper bound of a grown stack
+ * CRT_TRACE            Record suspends and resumes, see crt_trace.h
+ *
+ * The default depth used to be 32 and is 8 now. Co-routines that nest
+ * deeper than 8 levels fail at run time with CRT_ERROR_STACK_OVERFLOW
+ * unless they get a larger stack with CRT_INIT_STACK(), the build sets
+ * CRT_STACK_DEPTH=32 as before, or CRT_STACK_GROWABLE.
+ */
+#if !defined(CRT_POINT_BITS)
+#define CRT_POINT_BITS              16
+#endif
+
+#if !defined(CRT_STACK_DEPTH)
+#define CRT_STACK_DEPTH             8
+#endif
+
+#if !defined(CRT_STACK_MAX)
+#define CRT_STACK_MAX               1024
+#endif
+
+#if CRT_POINT_BITS == 16
+typedef int16_t crt_point_t;
+#define CRT_POINT_MAX               INT16_MAX
+#elif CRT_POINT_BITS == 32
+typedef int32_t crt_point_t;
+#define CRT_POINT_MAX               INT32_MAX
+#else
+#error "CRT_POINT_BITS must be 16 or 32"
+#endif
+
+#if CRT_STACK_DEPTH < 2 || CRT_STACK_DEPTH > CRT_STACK_MAX
+#error "CRT_STACK_DEPTH must be between 2 and CRT_STACK_MAX"
+#endif
+
+#if defined(CRT_POINT_COUNTER)
+#define CRT_POINT_NEXT              (__COUNTER__ + 1)
+#else
+#define CRT_POINT_NEXT              __LINE__
+#endif
+
+#if defined(CRT_TRACE)
+#include "crt_trace.h"
+
+/* One site per hook use, numbered when it first records */
+#define CRT_TRACE_EVENT(event, depth)                                           \
+do                                                                              \
+{                                                                               \
+    static crt_trace_site_t __crt_site = { __FILE__, __LINE__, 0 };             \
+    crt_trace_record(__crt->crt_id, (depth), &__crt_site, (event));             \
+}                                                                               \
+while (0)
+
+#define CRT_TRACE_INIT(C)       ((C)->crt_id = crt_trace_id())
+#else
+#define CRT_TRACE_EVENT(event, depth)   do { } while (0)
+#define CRT_TRACE_INIT(C)       ((void)0)
+#endif
+
+#define CRT_LOCALS_ALIGN            16                  /* Alignment of frame-local areas */
 
 #define CRT_OK                      0                   /* Status OK */
 #define CRT_ERROR                   (CRT_OK - 1)        /* General ERROR */
@@ -14,12 +84,25 @@ typedef struct crt crt_t;
 #define CRT_ERROR_STACK_OVERFLOW    (CRT_OK - 3)        /* Stack too small */
 #define CRT_ERROR_INVALID_DEPTH     (CRT_OK - 4)        /* Used "return" from inside CRT context */
 #define CRT_ERROR_RUNTIME           (CRT_OK - 5)        /* Invalid line */
+#define CRT_ERROR_TIMEOUT           (CRT_OK - 6)        /* Deadline expired */
+
+#define CRT_FLAG_GROWN              (1 << 0)            /* Stack was moved to the heap */
 
 struct crt
 {
-    int         crt_depth;                      /* Current stack depth */
-    int         crt_stack[CRT_STACK_DEPTH];     /* CRT stack */
-    void       *crt_data;                       /* Random data */
+    crt_point_t    *crt_stack;                  /* CRT stack, crt_inline or external */
+    void           *crt_data;                   /* Random data */
+    char           *crt_locals;                 /* Frame-local storage arena */
+    unsigned        crt_locals_size;            /* Arena size in bytes */
+    unsigned        crt_locals_top;             /* Arena bump pointer */
+    crt_point_t     crt_depth;                  /* Current stack depth */
+    crt_point_t     crt_top;                    /* Innermost suspended frame */
+    crt_point_t     crt_stack_size;             /* Stack depth bound */
+    crt_point_t     crt_flags;                  /* CRT_FLAG_* */
+    crt_point_t     crt_inline[CRT_STACK_DEPTH];/* Built-in stack */
+#if defined(CRT_TRACE)
+    uint32_t        crt_id;                     /* Task id in trace records */
+#endif
 };
 
 #define CRT_INIT(C)                                                             \
@@ -27,17 +110,137 @@ do
 {                                                                               \
     memset(C, 0, sizeof(crt_t));                                                \
     (C)->crt_depth = 0 - 1;                                                     \
+    (C)->crt_stack = (C)->crt_inline;                                           \
+    (C)->crt_stack_size = CRT_STACK_DEPTH;                                      \
+    CRT_TRACE_INIT(C);                                                          \
 }                                                                               \
 while (0)
 
-#define CRT(C)                                                                  \
+/**
+ * Initialize a co-routine with an external stack of @p depth slots, for
+ * co-routine types that nest deeper than CRT_STACK_DEPTH. The storage is a
+ * zeroed crt_point_t array owned by the caller.
+ */
+#define CRT_INIT_STACK(C, buf, depth)                                           \
+do                                                                              \
+{                                                                               \
+    CRT_INIT(C);                                                                \
+    (C)->crt_stack = (buf);                                                     \
+    (C)->crt_stack_size = (depth);                                              \
+}                                                                               \
+while (0)
+
+/**
+ * Release a stack grown on the heap; the final status is kept
+ */
+#define CRT_FINI(C)     crt_fini(C)
+
+#define CRT_INIT_LOCALS(C, buf, size)                                           \
+do                                                                              \
+{                                                                               \
+    CRT_INIT(C);                                                                \
+    (C)->crt_locals = (char *)(buf);                                            \
+    (C)->crt_locals_size = (size);                                              \
+}                                                                               \
+while (0)
+
+#define CRT_LOCALS_SIZEOF(type)                                                 \
+    ((sizeof(type) + CRT_LOCALS_ALIGN - 1) & ~(size_t)(CRT_LOCALS_ALIGN - 1))
+
+/*
+ * Frames are bump-allocated in depth order and resumed in the same order, so
+ * walking the arena from offset 0 on every resume of the outermost frame
+ * yields the same addresses each time. A frame that starts fresh always lands
+ * on the current top.
+ */
+static inline void *crt_locals_push(crt_t *crt, size_t size, int line, int *frame)
+{
+    char *locals;
+
+    if (crt->crt_locals_top + size > crt->crt_locals_size) return NULL;
+
+    locals = crt->crt_locals + crt->crt_locals_top;
+    *frame = (int)crt->crt_locals_top;
+    crt->crt_locals_top += size;
+
+    /* Fresh start (not a resume or an unwind) -- zero the locals */
+    if (line <= 0 && line != CRT_ERROR_CANCEL && line != CRT_ERROR_TIMEOUT) memset(locals, 0, size);
+
+    return locals;
+}
+
+static inline void crt_fini(crt_t *crt)
+{
+    if (!(crt->crt_flags & CRT_FLAG_GROWN)) return;
+
+    crt->crt_inline[0] = crt->crt_stack[0];
+    free(crt->crt_stack);
+
+    crt->crt_stack = crt->crt_inline;
+    crt->crt_stack_size = CRT_STACK_DEPTH;
+    crt->crt_flags &= ~CRT_FLAG_GROWN;
+}
+
+/*
+ * Called when entering a frame leaves no room for the status slot of its
+ * callee. Returns 0 if the stack was grown.
+ */
+static inline int crt_stack_overflow(crt_t *crt)
+{
+#if defined(CRT_STACK_GROWABLE)
+    crt_point_t *stack;
+    int size = crt->crt_stack_size * 2;
+
+    if (size > CRT_STACK_MAX) size = CRT_STACK_MAX;
+    if (size <= crt->crt_stack_size) return -1;
+
+    if (crt->crt_flags & CRT_FLAG_GROWN)
+    {
+        stack = realloc(crt->crt_stack, size * sizeof(*stack));
+        if (stack == NULL) return -1;
+    }
+    else
+    {
+        stack = malloc(size * sizeof(*stack));
+        if (stack == NULL) return -1;
+        memcpy(stack, crt->crt_stack, crt->crt_stack_size * sizeof(*stack));
+    }
+
+    memset(stack + crt->crt_stack_size, 0, (size - crt->crt_stack_size) * sizeof(*stack));
+
+    crt->crt_stack = stack;
+    crt->crt_stack_size = size;
+    crt->crt_flags |= CRT_FLAG_GROWN;
+
+    return 0;
+#else
+    (void)crt;
+    return -1;
+#endif
+}
+
+#define CRT_ENTER(C)                                                            \
 {                                                                               \
     crt_t *__crt = (C);                                                         \
     int __crt_depth = ++__crt->crt_depth;                                       \
     int __crt_line = __crt->crt_stack[__crt_depth];                             \
+    int __crt_frame = -1;                                                       \
                                                                                 \
-    /* XXX Handle stack overflow here */                                        \
+    /* No room left for the status of a callee */                               \
+    if (__crt_depth + 1 >= __crt->crt_stack_size &&                             \
+            crt_stack_overflow(__crt) != 0)                                     \
+    {                                                                           \
+        CRT_EXIT(CRT_ERROR_STACK_OVERFLOW);                                     \
+    }                                                                           \
                                                                                 \
+    /* Outermost frame: restart the locals walk */                              \
+    if (__crt_depth == 0)                                                       \
+    {                                                                           \
+        __crt->crt_locals_top = 0;                                              \
+        CRT_TRACE_EVENT(CRT_TRACE_RESUME, 0);                                   \
+    }
+
+#define CRT_DISPATCH                                                            \
     switch (__crt_line)                                                         \
     {                                                                           \
         default:                                                                \
@@ -49,16 +252,36 @@ while (0)
                                                                                 \
         case CRT_OK:;
 
+#define CRT(C)                                                                  \
+    CRT_ENTER(C)                                                                \
+    CRT_DISPATCH
+
+/**
+ * Same as CRT(), but also reserve a zero-initialized @p type area in the
+ * co-routine locals arena and point @p var to it. The area survives across
+ * CRT_YIELD()/CRT_AWAIT() and is released at CRT_END.
+ */
+#define CRT_LOCALS(C, type, var)                                                \
+    CRT_ENTER(C)                                                                \
+    type *var = crt_locals_push(__crt, CRT_LOCALS_SIZEOF(type),                 \
+                                __crt_line, &__crt_frame);                      \
+    if (var == NULL) CRT_EXIT(CRT_ERROR_STACK_OVERFLOW);                        \
+    CRT_DISPATCH
+
 #define CRT_END                                                                 \
             /* Co-routine terminated successfully */                            \
             CRT_EXIT(CRT_OK);                                                   \
             break;                                                              \
         case CRT_ERROR_CANCEL:                                                  \
+        case CRT_ERROR_TIMEOUT:                                                 \
             goto __crt_exit;                                                    \
     }                                                                           \
 __crt_exit:                                                                     \
                                                                                 \
     assert(("Return from within CRT", __crt->crt_depth == __crt_depth));        \
+    if (__crt_frame >= 0) __crt->crt_locals_top = __crt_frame;                  \
+    /* Terminated, a cancel now lands on the outermost frame */                 \
+    if (__crt_depth == 0) __crt->crt_top = 0;                                   \
     __crt->crt_depth--;                                                         \
 }
 
@@ -66,13 +289,88 @@ __crt_exit:
 #define CRT_STATUS(C)           ((C)->crt_stack[(C)->crt_depth + 1])
 #define CRT_RUNNING(C)          (CRT_STATUS(C) > 0)
 #define CRT_CANCELLED(C)        (CRT_STATUS(C) == CRT_ERROR_CANCEL)
+#define CRT_TIMEDOUT(C)         (CRT_STATUS(C) == CRT_ERROR_TIMEOUT)
+
+/*
+ * Resume points are generated once per macro use and passed down as @p point
+ * so the stored value and the case label always agree, also with __COUNTER__
+ */
+#define CRT_POINT_CHECK(point)                                                  \
+    _Static_assert((point) > 0 && (point) <= CRT_POINT_MAX,                     \
+            "Resume point does not fit crt_point_t, define CRT_POINT_COUNTER")
+
+#define CRT_YIELD(...)  CRT_YIELD_AT(CRT_POINT_NEXT, __VA_ARGS__)
 
-#define CRT_YIELD(...)                                                          \
+#define CRT_YIELD_AT(point, ...)                                                \
 do                                                                              \
 {                                                                               \
-    __crt->crt_stack[__crt->crt_depth--] = __LINE__;                            \
+    CRT_POINT_CHECK(point);                                                     \
+    __crt->crt_top = __crt->crt_depth;                                          \
+    CRT_TRACE_EVENT(CRT_TRACE_YIELD, __crt->crt_depth);                         \
+    __crt->crt_stack[__crt->crt_depth--] = (point);                             \
     return __VA_ARGS__;                                                         \
-    case __LINE__:;                                                             \
+    case (point):;                                                              \
+}                                                                               \
+while (0)
+
+/*
+ * Batched generators: instead of one resume per value, the producer appends
+ * values to a caller-provided batch and suspends only when it is full. The
+ * consumer walks the batch without re-entering the co-routine. End of stream
+ * is out of band: the co-routine is no longer CRT_RUNNING(), and the last
+ * batch may still hold values.
+ *
+ *      CRT_BATCH_DEFINE(int_batch_t, int);
+ *
+ *      CRT_BATCH_INIT(&b, buf, 64);
+ *      do
+ *      {
+ *          gen(&crt, &b);
+ *          for (ii = 0; ii < b.cb_count; ii++) use(b.cb_items[ii]);
+ *      }
+ *      while (CRT_RUNNING(&crt));
+ *
+ * The batch is passed again on every resume, so it must stay the same.
+ */
+#define CRT_BATCH_DEFINE(name, type)                                            \
+typedef struct name                                                             \
+{                                                                               \
+    type       *cb_items;                       /* Caller-provided buffer */    \
+    size_t      cb_count;                       /* Items in this batch */       \
+    size_t      cb_max;                         /* Buffer capacity */           \
+} name
+
+#define CRT_BATCH_INIT(B, buf, max)                                             \
+do                                                                              \
+{                                                                               \
+    (B)->cb_items = (buf);                                                      \
+    (B)->cb_count = 0;                                                          \
+    (B)->cb_max = (max);                                                        \
+}                                                                               \
+while (0)
+
+/**
+ * Append @p value to batch @p B, hand the batch over once it is full
+ */
+#define CRT_YIELD_BATCH(B, value, ...)                                          \
+do                                                                              \
+{                                                                               \
+    (B)->cb_items[(B)->cb_count++] = (value);                                   \
+    if ((B)->cb_count >= (B)->cb_max) CRT_YIELD_FLUSH(B, __VA_ARGS__);          \
+}                                                                               \
+while (0)
+
+/**
+ * Hand over a partial batch, e.g. before waiting for more input
+ */
+#define CRT_YIELD_FLUSH(B, ...)                                                 \
+do                                                                              \
+{                                                                               \
+    if ((B)->cb_count > 0)                                                      \
+    {                                                                           \
+        CRT_YIELD(__VA_ARGS__);                                                 \
+        (B)->cb_count = 0;                                                      \
+    }                                                                           \
 }                                                                               \
 while (0)
 
@@ -90,6 +388,7 @@ do
                                                                                 \
     if (CRT_RUNNING(__crt))                                                     \
     {                                                                           \
+        CRT_TRACE_EVENT(CRT_TRACE_AWAIT, __crt->crt_depth);                     \
         CRT_RETURN(__VA_ARGS__);                                                \
     }                                                                           \
 }                                                                               \
@@ -99,44 +398,52 @@ while (0)
 do                                                                              \
 {                                                                               \
     CRT_AWAIT_NC(expr, __VA_ARGS__);                                            \
-    /* Propagate cancellations */                                               \
+    /* Propagate cancellations and expired deadlines */                         \
     if (CRT_CANCELLED(__crt)) CRT_EXIT(CRT_ERROR_CANCEL);                       \
+    if (CRT_TIMEDOUT(__crt)) CRT_EXIT(CRT_ERROR_TIMEOUT);                       \
 }                                                                               \
 while (0)
 
 #define CRT_EXIT(code)                                                          \
 do                                                                              \
 {                                                                               \
+    CRT_TRACE_EVENT(CRT_TRACE_EXIT, __crt->crt_depth);                          \
     __crt->crt_stack[__crt->crt_depth] = (code);                                \
     goto __crt_exit;                                                            \
 }                                                                               \
 while (0)
 
-#define CRT_CANCEL(C)                                                           \
+/*
+ * The innermost suspended frame is the one that yielded last, its slot is
+ * where the resume starts unwinding from
+ */
+#define CRT_CANCEL(C)   ((C)->crt_stack[(C)->crt_top] = CRT_ERROR_CANCEL)
+
+/*
+ * Unwind the suspended frames with CRT_ERROR_TIMEOUT, like CRT_CANCEL(). A
+ * pending cancellation takes precedence.
+ */
+#define CRT_TIMEOUT(C)                                                          \
 do                                                                              \
 {                                                                               \
-    int __crti;                                                                 \
-                                                                                \
-    /* Find end of stack */                                                     \
-    for (__crti = 0; __crti < CRT_STACK_DEPTH; __crti++)                        \
+    if ((C)->crt_stack[(C)->crt_top] != CRT_ERROR_CANCEL)                       \
     {                                                                           \
-        if ((C)->crt_stack[__crti] == 0) break;                                 \
+        (C)->crt_stack[(C)->crt_top] = CRT_ERROR_TIMEOUT;                       \
     }                                                                           \
-                                                                                \
-    if (__crti > 0) __crti--;                                                   \
-                                                                                \
-    (C)->crt_stack[__crti] = CRT_ERROR_CANCEL;                                  \
 }                                                                               \
 while (0)
 
 /**
  * Rarely used
  */
-#define CRT_SET()                                                               \
+#define CRT_SET()       CRT_SET_AT(CRT_POINT_NEXT)
+
+#define CRT_SET_AT(point)                                                       \
 do                                                                              \
 {                                                                               \
-    case __LINE__:;                                                             \
-    __crt->crt_stack[__crt->crt_depth] = __LINE__;                              \
+    CRT_POINT_CHECK(point);                                                     \
+    case (point):;                                                              \
+    __crt->crt_stack[__crt->crt_depth] = (point);                               \
 }                                                                               \
 while (0)
 
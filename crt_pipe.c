@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crt.h"
+#include "crt_pipe.h"
+
+static void crt_level_init(crt_level_t *self)
+{
+    CRT_INIT_LOCALS(&self->cl_crt, self->cl_locals, sizeof(self->cl_locals));
+    CRT_BATCH_INIT(&self->cl_batch, self->cl_buf, CRT_PIPE_BATCH);
+    self->cl_pos = 0;
+    self->cl_active = true;
+    self->cl_more = true;
+}
+
+void crt_pipe_init(crt_pipe_t *self, crt_gen_fn *source, void *arg)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->cp_source = source;
+    self->cp_source_arg = arg;
+    self->cp_top = -1;
+    self->cp_cut = -1;
+
+    crt_level_init(&self->cp_level);
+}
+
+void crt_pipe_fini(crt_pipe_t *self)
+{
+    int ii;
+
+    for (ii = 0; ii < self->cp_nstages; ii++)
+    {
+        if (self->cp_stage[ii].cs_level != NULL) CRT_FINI(&self->cp_stage[ii].cs_level->cl_crt);
+
+        free(self->cp_stage[ii].cs_zbuf);
+        free(self->cp_stage[ii].cs_level);
+    }
+
+    CRT_FINI(&self->cp_level.cl_crt);
+
+    self->cp_nstages = 0;
+}
+
+static crt_stage_t *crt_pipe_stage(crt_pipe_t *self, enum crt_stage_kind kind, void *arg)
+{
+    crt_stage_t *stage;
+
+    if (self->cp_nstages >= CRT_PIPE_STAGES) return NULL;
+
+    stage = &self->cp_stage[self->cp_nstages++];
+    stage->cs_kind = kind;
+    stage->cs_arg = arg;
+
+    return stage;
+}
+
+/**
+ * Replace each item with fn(item)
+ *
+ * @return 0 on success, -1 if the pipeline is full
+ */
+int crt_pipe_map(crt_pipe_t *self, crt_map_fn *fn, void *arg)
+{
+    crt_stage_t *stage = crt_pipe_stage(self, CRT_STAGE_MAP, arg);
+
+    if (stage == NULL) return -1;
+
+    stage->cs_fn.map = fn;
+
+    return 0;
+}
+
+/**
+ * Pass only items for which fn(item) is true
+ */
+int crt_pipe_filter(crt_pipe_t *self, crt_filter_fn *fn, void *arg)
+{
+    crt_stage_t *stage = crt_pipe_stage(self, CRT_STAGE_FILTER, arg);
+
+    if (stage == NULL) return -1;
+
+    stage->cs_fn.filter = fn;
+
+    return 0;
+}
+
+/**
+ * Pass the first @p count items; upstream generators are not resumed once
+ * the count is reached
+ */
+int crt_pipe_take(crt_pipe_t *self, size_t count)
+{
+    crt_stage_t *stage = crt_pipe_stage(self, CRT_STAGE_TAKE, NULL);
+
+    if (stage == NULL) return -1;
+
+    stage->cs_limit = count;
+
+    /* take(0) passes nothing at all */
+    if (count == 0 && self->cp_cut < 0) self->cp_cut = self->cp_nstages - 1;
+
+    return 0;
+}
+
+/**
+ * Replace each item with fn(item, next item of @p other); ends with the
+ * shorter of the two
+ */
+int crt_pipe_zip(crt_pipe_t *self, crt_pipe_t *other, crt_zip_fn *fn, void *arg)
+{
+    crt_stage_t *stage = crt_pipe_stage(self, CRT_STAGE_ZIP, arg);
+
+    if (stage == NULL) return -1;
+
+    stage->cs_zbuf = malloc(CRT_PIPE_BATCH * sizeof(crt_item_t));
+    if (stage->cs_zbuf == NULL)
+    {
+        self->cp_nstages--;
+        return -1;
+    }
+
+    stage->cs_fn.zip = fn;
+    stage->cs_other = other;
+
+    return 0;
+}
+
+/**
+ * Replace each item with the items of the generator fn(item)
+ */
+int crt_pipe_flat_map(crt_pipe_t *self, crt_expand_fn *fn, void *arg)
+{
+    crt_stage_t *stage = crt_pipe_stage(self, CRT_STAGE_FLAT_MAP, arg);
+
+    if (stage == NULL) return -1;
+
+    stage->cs_level = calloc(1, sizeof(*stage->cs_level));
+    if (stage->cs_level == NULL)
+    {
+        self->cp_nstages--;
+        return -1;
+    }
+
+    stage->cs_fn.expand = fn;
+
+    return 0;
+}
+
+/* Stop pulling from generators that feed stage @p idx */
+static inline void crt_pipe_cut(crt_pipe_t *self, int idx)
+{
+    if (self->cp_cut < 0 || idx < self->cp_cut) self->cp_cut = idx;
+}
+
+/*
+ * Run the fresh batch of @p level through the fused stages from @p idx up
+ * to the next flat_map, in place and one stage at a time
+ */
+static void crt_pipe_segment(crt_pipe_t *self, crt_level_t *level, int idx)
+{
+    crt_item_t *items = level->cl_batch.cb_items;
+    size_t n = level->cl_batch.cb_count;
+    crt_stage_t *stage;
+    size_t ii;
+    size_t jj;
+
+    for (; idx < self->cp_nstages; idx++)
+    {
+        stage = &self->cp_stage[idx];
+
+        switch (stage->cs_kind)
+        {
+            case CRT_STAGE_MAP:
+                for (ii = 0; ii < n; ii++) items[ii] = stage->cs_fn.map(items[ii], stage->cs_arg);
+                break;
+
+            case CRT_STAGE_FILTER:
+                for (ii = 0, jj = 0; ii < n; ii++)
+                {
+                    if (stage->cs_fn.filter(items[ii], stage->cs_arg)) items[jj++] = items[ii];
+                }
+                n = jj;
+                break;
+
+            case CRT_STAGE_TAKE:
+                if (n >= stage->cs_limit - stage->cs_count)
+                {
+                    n = stage->cs_limit - stage->cs_count;
+                    crt_pipe_cut(self, idx);
+                }
+                stage->cs_count += n;
+                break;
+
+            case CRT_STAGE_ZIP:
+                for (ii = 0; ii < n; ii++)
+                {
+                    if (stage->cs_zpos >= stage->cs_zlen)
+                    {
+                        stage->cs_zlen = crt_pipe_pull(stage->cs_other, stage->cs_zbuf, CRT_PIPE_BATCH);
+                        stage->cs_zpos = 0;
+
+                        if (stage->cs_zlen == 0)
+                        {
+                            crt_pipe_cut(self, idx);
+                            break;
+                        }
+                    }
+
+                    items[ii] = stage->cs_fn.zip(items[ii], stage->cs_zbuf[stage->cs_zpos++], stage->cs_arg);
+                }
+                n = ii;
+                break;
+
+            case CRT_STAGE_FLAT_MAP:
+                goto out;
+        }
+    }
+
+out:
+    level->cl_batch.cb_count = n;
+    level->cl_pos = 0;
+    level->cl_end = idx;
+}
+
+/*
+ * The innermost generator with items left: the last active flat_map, or the
+ * source. *start is the first stage its items go through.
+ */
+static inline crt_level_t *crt_pipe_level(crt_pipe_t *self, int *start)
+{
+    *start = self->cp_top + 1;
+
+    return (self->cp_top < 0) ? &self->cp_level : self->cp_stage[self->cp_top].cs_level;
+}
+
+/* The innermost flat_map generator is drained, fall back to the next outer one */
+static void crt_pipe_pop(crt_pipe_t *self)
+{
+    self->cp_stage[self->cp_top].cs_level->cl_active = false;
+
+    while (--self->cp_top >= 0)
+    {
+        crt_stage_t *stage = &self->cp_stage[self->cp_top];
+
+        if (stage->cs_kind == CRT_STAGE_FLAT_MAP && stage->cs_level->cl_active) break;
+    }
+}
+
+/* Resume the generator of @p level for its next batch */
+static void crt_pipe_resume(crt_pipe_t *self, crt_level_t *level, int start)
+{
+    if (start == 0)
+    {
+        self->cp_source(&level->cl_crt, &level->cl_batch, self->cp_source_arg);
+    }
+    else
+    {
+        crt_stage_t *stage = &self->cp_stage[start - 1];
+
+        stage->cs_fn.expand(&level->cl_crt, &level->cl_batch, level->cl_item, stage->cs_arg);
+    }
+
+    self->cp_resumes++;
+    level->cl_more = CRT_RUNNING(&level->cl_crt);
+
+    crt_pipe_segment(self, level, start);
+}
+
+/**
+ * Pull up to @p max items into @p out
+ *
+ * @return Number of items, 0 once the pipeline is exhausted
+ */
+size_t crt_pipe_pull(crt_pipe_t *self, crt_item_t *out, size_t max)
+{
+    crt_level_t *level;
+    crt_stage_t *stage;
+    size_t n = 0;
+    size_t count;
+    int start;
+
+    while (n < max && !self->cp_done)
+    {
+        level = crt_pipe_level(self, &start);
+
+        if (level->cl_pos >= level->cl_batch.cb_count)
+        {
+            /* Anything this generator still has would be cut off */
+            if (self->cp_cut >= 0 && start <= self->cp_cut)
+            {
+                self->cp_done = true;
+            }
+            else if (level->cl_more)
+            {
+                crt_pipe_resume(self, level, start);
+            }
+            else if (start == 0)
+            {
+                self->cp_done = true;
+            }
+            else
+            {
+                crt_pipe_pop(self);
+            }
+
+            continue;
+        }
+
+        if (level->cl_end >= self->cp_nstages)
+        {
+            count = level->cl_batch.cb_count - level->cl_pos;
+            if (count > max - n) count = max - n;
+
+            memcpy(out + n, level->cl_batch.cb_items + level->cl_pos, count * sizeof(*out));
+            level->cl_pos += count;
+            n += count;
+            continue;
+        }
+
+        /* Expand the next item, its output goes through the stages after the flat_map */
+        stage = &self->cp_stage[level->cl_end];
+        crt_level_init(stage->cs_level);
+        stage->cs_level->cl_item = level->cl_batch.cb_items[level->cl_pos++];
+        self->cp_top = level->cl_end;
+    }
+
+    return n;
+}
@@ -0,0 +1,124 @@
+#if !defined(CRT_PIPE_H_INCLUDED)
+#define CRT_PIPE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "crt.h"
+
+/*
+ * Generator pipelines: a batched source generator followed by a chain of
+ * map, filter, take, zip and flat_map stages. Adjacent map/filter/take/zip
+ * stages are fused: each batch a generator produces runs through them stage
+ * by stage in tight loops, so one resume of the source drives the whole
+ * chain for up to CRT_PIPE_BATCH items. Only flat_map introduces another
+ * generator, whose output again runs through the fused stages that follow.
+ *
+ *      crt_pipe_init(&p, numbers, NULL);
+ *      crt_pipe_filter(&p, is_even, NULL);
+ *      crt_pipe_map(&p, square, NULL);
+ *      crt_pipe_take(&p, 10);
+ *
+ *      while ((n = crt_pipe_pull(&p, out, 64)) > 0) ...
+ */
+
+#if !defined(CRT_PIPE_ITEM)
+#define CRT_PIPE_ITEM               int64_t
+#endif
+
+#if !defined(CRT_PIPE_BATCH)
+#define CRT_PIPE_BATCH              64                  /* Items per generator resume */
+#endif
+
+#if !defined(CRT_PIPE_STAGES)
+#define CRT_PIPE_STAGES             8                   /* Max stages per pipeline */
+#endif
+
+#define CRT_PIPE_LOCALS             64                  /* Locals arena of each generator */
+
+typedef CRT_PIPE_ITEM crt_item_t;
+typedef struct crt_pipe crt_pipe_t;
+typedef struct crt_stage crt_stage_t;
+typedef struct crt_level crt_level_t;
+
+CRT_BATCH_DEFINE(crt_item_batch_t, crt_item_t);
+
+/* Batched generator, see CRT_YIELD_BATCH() */
+typedef void crt_gen_fn(crt_t *crt, crt_item_batch_t *batch, void *arg);
+/* Batched generator expanding a single item, for flat_map */
+typedef void crt_expand_fn(crt_t *crt, crt_item_batch_t *batch, crt_item_t item, void *arg);
+typedef crt_item_t crt_map_fn(crt_item_t item, void *arg);
+typedef bool crt_filter_fn(crt_item_t item, void *arg);
+typedef crt_item_t crt_zip_fn(crt_item_t a, crt_item_t b, void *arg);
+
+enum crt_stage_kind
+{
+    CRT_STAGE_MAP,
+    CRT_STAGE_FILTER,
+    CRT_STAGE_TAKE,
+    CRT_STAGE_ZIP,
+    CRT_STAGE_FLAT_MAP,
+};
+
+/*
+ * A running generator and the batch it last produced: the source, and one
+ * per flat_map stage
+ */
+struct crt_level
+{
+    crt_t               cl_crt;
+    _Alignas(CRT_LOCALS_ALIGN)
+    char                cl_locals[CRT_PIPE_LOCALS];
+    crt_item_batch_t    cl_batch;
+    size_t              cl_pos;                     /* Next item of the batch */
+    int                 cl_end;                     /* Stage the batch goes to next: flat_map or the end */
+    bool                cl_active;                  /* Batch or generator not yet drained */
+    bool                cl_more;                    /* Generator may produce more */
+    crt_item_t          cl_item;                    /* Item being expanded by flat_map */
+    crt_item_t          cl_buf[CRT_PIPE_BATCH];
+};
+
+struct crt_stage
+{
+    enum crt_stage_kind cs_kind;
+    union
+    {
+        crt_map_fn     *map;
+        crt_filter_fn  *filter;
+        crt_zip_fn     *zip;
+        crt_expand_fn  *expand;
+    }                   cs_fn;
+    void               *cs_arg;
+    size_t              cs_count;                   /* take: items passed so far */
+    size_t              cs_limit;                   /* take: items to pass */
+    crt_pipe_t         *cs_other;                   /* zip: pipeline paired with */
+    crt_item_t         *cs_zbuf;                    /* zip: items pulled from cs_other */
+    size_t              cs_zpos;
+    size_t              cs_zlen;
+    crt_level_t        *cs_level;                   /* flat_map: generator state */
+};
+
+struct crt_pipe
+{
+    crt_gen_fn         *cp_source;
+    void               *cp_source_arg;
+    crt_level_t         cp_level;                   /* Source generator */
+    crt_stage_t         cp_stage[CRT_PIPE_STAGES];
+    int                 cp_nstages;
+    int                 cp_top;                     /* Innermost active flat_map stage, or -1 */
+    int                 cp_cut;                     /* First stage that passes no more items, or -1 */
+    bool                cp_done;                    /* No more output */
+    unsigned long       cp_resumes;                 /* Generator resumes so far */
+};
+
+extern void crt_pipe_init(crt_pipe_t *self, crt_gen_fn *source, void *arg);
+extern void crt_pipe_fini(crt_pipe_t *self);
+extern int crt_pipe_map(crt_pipe_t *self, crt_map_fn *fn, void *arg);
+extern int crt_pipe_filter(crt_pipe_t *self, crt_filter_fn *fn, void *arg);
+extern int crt_pipe_take(crt_pipe_t *self, size_t count);
+extern int crt_pipe_zip(crt_pipe_t *self, crt_pipe_t *other, crt_zip_fn *fn, void *arg);
+extern int crt_pipe_flat_map(crt_pipe_t *self, crt_expand_fn *fn, void *arg);
+extern size_t crt_pipe_pull(crt_pipe_t *self, crt_item_t *out, size_t max);
+
+#endif /* CRT_PIPE_H_INCLUDED */
@@ -0,0 +1,305 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "crt_trace.h"
+
+/*
+ * Thread buffers live until their thread exits, also across
+ * crt_trace_close(); records taken while no trace file is open are dropped
+ * at the next flush. crt_trace_open() starts a new epoch instead of touching
+ * the buffers of other threads, each thread drops its records of an earlier
+ * trace itself. Flushes reserve their place in the file with an atomic
+ * add, so threads only serialize on the site table and buffer list.
+ */
+
+#define CRT_TRACE_SITES             UINT16_MAX          /* Site ids are 16 bits, 0 is unused */
+
+_Thread_local crt_trace_ring_t *crt_trace_ring;
+_Atomic uint32_t crt_trace_ids;
+_Atomic uint32_t crt_trace_epoch;               /* Bumped by every crt_trace_open() */
+_Atomic bool crt_trace_active;                  /* A trace file is open */
+
+static pthread_mutex_t crt_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t crt_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t crt_trace_key;
+
+static crt_trace_ring_t *crt_trace_rings;       /* All thread buffers */
+static uint32_t crt_trace_threads;              /* Thread numbers handed out */
+static crt_trace_site_t *crt_trace_sites[CRT_TRACE_SITES + 1];
+static uint16_t crt_trace_nsites;
+
+static int crt_trace_fd = -1;
+static char *crt_trace_map;                     /* Mapping of the trace file */
+static uint64_t crt_trace_max;                  /* Its size */
+static _Atomic uint64_t crt_trace_used;         /* Bytes reserved by flushes */
+static _Atomic uint64_t crt_trace_dropped;
+static uint64_t crt_trace_ns0;
+
+static uint64_t crt_trace_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Thread exit: write out what is left, then drop the buffer */
+static void crt_trace_detach(void *arg)
+{
+    crt_trace_ring_t *ring = arg;
+    crt_trace_ring_t **pring;
+
+    crt_trace_flush(ring);
+
+    pthread_mutex_lock(&crt_trace_lock);
+
+    for (pring = &crt_trace_rings; *pring != NULL; pring = &(*pring)->ctg_next)
+    {
+        if (*pring == ring)
+        {
+            *pring = ring->ctg_next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&crt_trace_lock);
+
+    free(ring);
+}
+
+static void crt_trace_key_init(void)
+{
+    pthread_key_create(&crt_trace_key, crt_trace_detach);
+}
+
+/**
+ * Give the calling thread a trace buffer, done on its first record
+ *
+ * @return NULL if no trace is open or out of memory
+ */
+crt_trace_ring_t *crt_trace_attach(void)
+{
+    crt_trace_ring_t *ring;
+
+    if (!atomic_load_explicit(&crt_trace_active, memory_order_acquire)) return NULL;
+
+    pthread_once(&crt_trace_once, crt_trace_key_init);
+
+    ring = malloc(sizeof(*ring));
+    if (ring == NULL) return NULL;
+
+    ring->ctg_count = 0;
+    ring->ctg_epoch = atomic_load_explicit(&crt_trace_epoch, memory_order_relaxed);
+
+    pthread_mutex_lock(&crt_trace_lock);
+
+    ring->ctg_thread = ++crt_trace_threads;
+    ring->ctg_next = crt_trace_rings;
+    crt_trace_rings = ring;
+
+    pthread_mutex_unlock(&crt_trace_lock);
+
+    pthread_setspecific(crt_trace_key, ring);
+    crt_trace_ring = ring;
+
+    return ring;
+}
+
+/**
+ * Number a hook site on its first record
+ *
+ * @return The site id, 0 once the table is full
+ */
+uint16_t crt_trace_site_register(crt_trace_site_t *site)
+{
+    uint16_t id;
+
+    pthread_mutex_lock(&crt_trace_lock);
+
+    /* Raced with another thread */
+    id = atomic_load_explicit(&site->cts_id, memory_order_relaxed);
+
+    if (id == 0 && crt_trace_nsites < CRT_TRACE_SITES)
+    {
+        id = ++crt_trace_nsites;
+        crt_trace_sites[id] = site;
+        atomic_store_explicit(&site->cts_id, id, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&crt_trace_lock);
+
+    return id;
+}
+
+/* Reserve @p size bytes in the trace file, NULL if it is full */
+static char *crt_trace_reserve(uint64_t size)
+{
+    uint64_t off = atomic_fetch_add_explicit(&crt_trace_used, size, memory_order_relaxed);
+
+    if (off + size > crt_trace_max) return NULL;
+
+    return crt_trace_map + off;
+}
+
+/**
+ * Copy the records of @p ring to the trace file and empty it
+ */
+void crt_trace_flush(crt_trace_ring_t *ring)
+{
+    crt_trace_chunk_t chunk;
+    uint64_t size;
+    char *dst;
+
+    if (ring->ctg_count == 0) return;
+
+    if (atomic_load_explicit(&crt_trace_active, memory_order_acquire) &&
+            ring->ctg_epoch == atomic_load_explicit(&crt_trace_epoch, memory_order_relaxed))
+    {
+        size = sizeof(chunk) + (uint64_t)ring->ctg_count * sizeof(crt_trace_rec_t);
+
+        dst = crt_trace_reserve(size);
+        if (dst != NULL)
+        {
+            chunk.ctc_thread = ring->ctg_thread;
+            chunk.ctc_count = ring->ctg_count;
+            memcpy(dst, &chunk, sizeof(chunk));
+            memcpy(dst + sizeof(chunk), ring->ctg_recs, size - sizeof(chunk));
+        }
+        else
+        {
+            atomic_fetch_add_explicit(&crt_trace_dropped, ring->ctg_count, memory_order_relaxed);
+        }
+    }
+
+    ring->ctg_count = 0;
+}
+
+/**
+ * Start tracing to @p path, which is truncated. At most @p max_size bytes
+ * are written, records beyond are counted as dropped; 0 selects
+ * CRT_TRACE_FILE_MAX. The file is sparse until filled.
+ *
+ * @return 0 on success, -1 on error (errno set)
+ */
+int crt_trace_open(const char *path, uint64_t max_size)
+{
+    crt_trace_header_t *hdr;
+    void *map;
+    int fd;
+
+    if (max_size == 0) max_size = CRT_TRACE_FILE_MAX;
+    if (max_size < sizeof(*hdr)) max_size = sizeof(*hdr);
+
+    if (atomic_load(&crt_trace_active)) return -1;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    if (ftruncate(fd, (off_t)max_size) != 0) goto error;
+
+    map = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) goto error;
+
+    crt_trace_fd = fd;
+    crt_trace_map = map;
+    crt_trace_max = max_size;
+    atomic_store(&crt_trace_used, sizeof(*hdr));
+    atomic_store(&crt_trace_dropped, 0);
+
+    hdr = map;
+    memcpy(hdr->cth_magic, CRT_TRACE_MAGIC, sizeof(hdr->cth_magic));
+    hdr->cth_version = CRT_TRACE_VERSION;
+    hdr->cth_rec_size = sizeof(crt_trace_rec_t);
+    crt_trace_ns0 = crt_trace_ns();
+    hdr->cth_tick0 = crt_trace_clock();
+
+    /* Records left over from before belong to no trace, their owners drop them */
+    atomic_fetch_add_explicit(&crt_trace_epoch, 1, memory_order_relaxed);
+
+    atomic_store_explicit(&crt_trace_active, true, memory_order_release);
+
+    return 0;
+
+error:
+    close(fd);
+    return -1;
+}
+
+/**
+ * Flush all thread buffers, append the site table and close the trace file
+ *
+ * @return 0 on success, -1 on error
+ */
+int crt_trace_close(void)
+{
+    crt_trace_header_t *hdr = (crt_trace_header_t *)crt_trace_map;
+    crt_trace_ring_t *ring;
+    uint64_t used;
+    uint64_t tick;
+    uint64_t ns;
+    char line[512];
+    int rc = 0;
+    int len;
+    int ii;
+
+    if (!atomic_load(&crt_trace_active)) return -1;
+
+    pthread_mutex_lock(&crt_trace_lock);
+    for (ring = crt_trace_rings; ring != NULL; ring = ring->ctg_next) crt_trace_flush(ring);
+    pthread_mutex_unlock(&crt_trace_lock);
+
+    atomic_store_explicit(&crt_trace_active, false, memory_order_release);
+
+    tick = crt_trace_clock();
+    ns = crt_trace_ns();
+
+    used = atomic_load(&crt_trace_used);
+    if (used > crt_trace_max) used = crt_trace_max;
+
+#if defined(__x86_64__) || defined(__i386__)
+    hdr->cth_ns_per_tick = tick > hdr->cth_tick0 ? (double)(ns - crt_trace_ns0) / (double)(tick - hdr->cth_tick0) : 1.0;
+#else
+    hdr->cth_ns_per_tick = 1.0;
+#endif
+    hdr->cth_sites = used;
+    hdr->cth_dropped = atomic_load(&crt_trace_dropped);
+
+    munmap(crt_trace_map, crt_trace_max);
+
+    /* The site table goes behind the records, with plain writes */
+    if (ftruncate(crt_trace_fd, (off_t)used) != 0 || lseek(crt_trace_fd, (off_t)used, SEEK_SET) < 0) rc = -1;
+
+    pthread_mutex_lock(&crt_trace_lock);
+    for (ii = 1; ii <= crt_trace_nsites && rc == 0; ii++)
+    {
+        len = snprintf(line, sizeof(line), "%d %s %d\n", ii, crt_trace_sites[ii]->cts_file,
+                crt_trace_sites[ii]->cts_line);
+        if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+        if (write(crt_trace_fd, line, len) != len) rc = -1;
+        used += len;
+    }
+    pthread_mutex_unlock(&crt_trace_lock);
+
+    /* Size last, a reader treats a file without one as incomplete */
+    if (rc == 0 && pwrite(crt_trace_fd, &used, sizeof(used), offsetof(crt_trace_header_t, cth_size)) != sizeof(used))
+    {
+        rc = -1;
+    }
+
+    if (close(crt_trace_fd) != 0) rc = -1;
+
+    crt_trace_fd = -1;
+    crt_trace_map = NULL;
+
+    return rc;
+}
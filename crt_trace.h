@@ -0,0 +1,181 @@
+#if !defined(CRT_TRACE_H_INCLUDED)
+#define CRT_TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * Binary trace of co-routine suspends and resumes, enabled by defining
+ * CRT_TRACE for all sources (it adds crt_id to crt_t) and linking
+ * crt_trace.c. Without it the hooks in crt.h compile to nothing.
+ *
+ * Each outermost resume, CRT_YIELD(), suspending CRT_AWAIT() and CRT_EXIT()
+ * appends a 16 byte record to a buffer of the calling thread. Every frame
+ * that unwinds on a suspend leaves a record, so the records between two
+ * resumes hold the crt_stack of that suspend. Full buffers are copied to a
+ * memory-mapped file; convert it with trace2json for chrome://tracing or
+ * Perfetto.
+ *
+ *      crt_trace_open("app.crtrace", 0);
+ *      ...
+ *      crt_trace_close();
+ *
+ * Threads that are still tracing must be quiescent at crt_trace_close(),
+ * threads that exit earlier flush their records on exit.
+ *
+ * Tracing is not free: a traced resume with its suspend records costs
+ * about 120-190 ns against 13-18 ns untraced, a tenfold slowdown of
+ * context switch heavy code. Build with CRT_TRACE to investigate, not in
+ * production. While no trace file is open every hook costs one relaxed
+ * load and records nothing.
+ */
+
+#if !defined(CRT_TRACE_RING)
+#define CRT_TRACE_RING              16384               /* Records per thread buffer */
+#endif
+
+#define CRT_TRACE_FILE_MAX          (1ull << 30)        /* Default trace file bound */
+#define CRT_TRACE_MAGIC             "CRTTRACE"
+#define CRT_TRACE_VERSION           1
+
+/* Record types */
+#define CRT_TRACE_RESUME            0                   /* Outermost frame entered */
+#define CRT_TRACE_YIELD             1                   /* CRT_YIELD() */
+#define CRT_TRACE_AWAIT             2                   /* CRT_AWAIT() suspended with its callee */
+#define CRT_TRACE_EXIT              3                   /* CRT_EXIT(), also at CRT_END */
+
+typedef struct crt_trace_site crt_trace_site_t;
+typedef struct crt_trace_rec crt_trace_rec_t;
+typedef struct crt_trace_ring crt_trace_ring_t;
+typedef struct crt_trace_header crt_trace_header_t;
+typedef struct crt_trace_chunk crt_trace_chunk_t;
+
+/* Source location of a hook, numbered on first use */
+struct crt_trace_site
+{
+    const char         *cts_file;
+    int                 cts_line;
+    _Atomic uint16_t    cts_id;             /* 0 until registered */
+};
+
+struct crt_trace_rec
+{
+    uint64_t            ctr_time;           /* crt_trace_clock() ticks */
+    uint32_t            ctr_task;           /* crt_id of the co-routine */
+    uint16_t            ctr_site;           /* File/line id */
+    uint8_t             ctr_depth;          /* Frame depth, saturates at 255 */
+    uint8_t             ctr_event;          /* CRT_TRACE_* */
+};
+
+struct crt_trace_ring
+{
+    crt_trace_ring_t   *ctg_next;           /* All buffers, for crt_trace_close() */
+    uint32_t            ctg_thread;         /* Thread number */
+    uint32_t            ctg_count;          /* Records in ctg_recs */
+    uint32_t            ctg_epoch;          /* crt_trace_epoch the records belong to */
+    crt_trace_rec_t     ctg_recs[CRT_TRACE_RING];
+};
+
+/*
+ * Trace file layout: the header, chunks of records as flushed by the
+ * threads, then the site table as "id file line" text lines
+ */
+struct crt_trace_header
+{
+    char                cth_magic[8];       /* CRT_TRACE_MAGIC */
+    uint32_t            cth_version;        /* CRT_TRACE_VERSION */
+    uint32_t            cth_rec_size;       /* sizeof(crt_trace_rec_t) */
+    double              cth_ns_per_tick;    /* Clock ticks to nanoseconds */
+    uint64_t            cth_tick0;          /* Clock at crt_trace_open() */
+    uint64_t            cth_sites;          /* Offset of the site table */
+    uint64_t            cth_size;           /* File size */
+    uint64_t            cth_dropped;        /* Records that did not fit the file */
+};
+
+struct crt_trace_chunk
+{
+    uint32_t            ctc_thread;         /* Thread number */
+    uint32_t            ctc_count;          /* Records that follow */
+};
+
+extern _Thread_local crt_trace_ring_t *crt_trace_ring;
+extern _Atomic uint32_t crt_trace_ids;
+extern _Atomic uint32_t crt_trace_epoch;
+extern _Atomic bool crt_trace_active;
+
+extern int crt_trace_open(const char *path, uint64_t max_size);
+extern int crt_trace_close(void);
+extern crt_trace_ring_t *crt_trace_attach(void);
+extern uint16_t crt_trace_site_register(crt_trace_site_t *site);
+extern void crt_trace_flush(crt_trace_ring_t *ring);
+
+/**
+ * Current time in clock ticks: the cycle counter where there is one
+ */
+static inline uint64_t crt_trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Ids of traced co-routines, 0 is never handed out */
+static inline uint32_t crt_trace_id(void)
+{
+    return atomic_fetch_add_explicit(&crt_trace_ids, 1, memory_order_relaxed) + 1;
+}
+
+static inline void crt_trace_record(uint32_t task, int depth, crt_trace_site_t *site, int event)
+{
+    crt_trace_ring_t *ring = crt_trace_ring;
+    crt_trace_rec_t *rec;
+    uint32_t epoch;
+    uint16_t id;
+
+    /* No trace file open, also after crt_trace_close() */
+    if (!atomic_load_explicit(&crt_trace_active, memory_order_relaxed)) return;
+
+    /* The first record of this thread */
+    if (ring == NULL && (ring = crt_trace_attach()) == NULL) return;
+
+    /* A trace was opened since, the records left over belong to none */
+    epoch = atomic_load_explicit(&crt_trace_epoch, memory_order_relaxed);
+    if (ring->ctg_epoch != epoch)
+    {
+        ring->ctg_epoch = epoch;
+        ring->ctg_count = 0;
+    }
+
+    id = atomic_load_explicit(&site->cts_id, memory_order_relaxed);
+    if (id == 0) id = crt_trace_site_register(site);
+
+    rec = &ring->ctg_recs[ring->ctg_count];
+
+    /* Unwinding a suspend right behind the callee's record, share its time */
+    if (event == CRT_TRACE_AWAIT && ring->ctg_count > 0 && rec[-1].ctr_task == task &&
+            rec[-1].ctr_depth == depth + 1)
+    {
+        rec->ctr_time = rec[-1].ctr_time;
+    }
+    else
+    {
+        rec->ctr_time = crt_trace_clock();
+    }
+
+    rec->ctr_task = task;
+    rec->ctr_site = id;
+    rec->ctr_depth = depth > UINT8_MAX ? UINT8_MAX : (uint8_t)depth;
+    rec->ctr_event = (uint8_t)event;
+
+    if (++ring->ctg_count == CRT_TRACE_RING) crt_trace_flush(ring);
+}
+
+#endif /* CRT_TRACE_H_INCLUDED */
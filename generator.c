@@ -23,10 +23,34 @@ int primes(crt_t *crt)
     return 0;
 }
 
+CRT_BATCH_DEFINE(int_batch_t, int);
+
+/*
+ * Same, batched: fill up @p batch and resume only when it is full
+ */
+void primes_batch(crt_t *crt, int_batch_t *batch, int limit)
+{
+    CRT_LOCALS(crt, struct { int n; }, l)
+    {
+        for (l->n = 2; l->n < limit; l->n++)
+        {
+            int d;
+
+            for (d = 2; d * d <= l->n && l->n % d != 0; d++);
+            if (d * d > l->n) CRT_YIELD_BATCH(batch, l->n);
+        }
+    }
+    CRT_END;
+}
+
 int main(void)
 {
     crt_t c;
     int n;
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    int buf[4];
+    int_batch_t batch;
+    size_t ii;
 
     CRT_INIT(&c);
 
@@ -35,4 +59,18 @@ int main(void)
     {
         printf("Number = %d\n", n);
     }
+
+    CRT_INIT_LOCALS(&c, locals, sizeof(locals));
+    CRT_BATCH_INIT(&batch, buf, 4);
+
+    /* End of stream is when the co-routine is done, not a special value */
+    do
+    {
+        primes_batch(&c, &batch, 50);
+
+        printf("Batch =");
+        for (ii = 0; ii < batch.cb_count; ii++) printf(" %d", batch.cb_items[ii]);
+        printf("\n");
+    }
+    while (CRT_RUNNING(&c));
 }
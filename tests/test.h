@@ -0,0 +1,75 @@
+#if !defined(TEST_H_INCLUDED)
+#define TEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../async.h"
+
+/*
+ * Small helpers shared by the test programs. A test program runs its cases
+ * one after the other, each on a loop of its own, and exits nonzero if a
+ * check failed:
+ *
+ *      static void test_something(async_loop_t *loop)
+ *      {
+ *          ...
+ *          TEST_CHECK(x == 1);
+ *      }
+ *
+ *      int main(void)
+ *      {
+ *          TEST_RUN(test_something);
+ *          return test_result();
+ *      }
+ */
+
+static int test_checks;
+static int test_failures;
+
+#define TEST_CHECK(cond)                                                        \
+do                                                                              \
+{                                                                               \
+    test_checks++;                                                              \
+    if (!(cond))                                                                \
+    {                                                                           \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);\
+        test_failures++;                                                        \
+    }                                                                           \
+}                                                                               \
+while (0)
+
+#define TEST_RUN(fn)            test_run(#fn, fn)
+
+/**
+ * Run the case @p fn on a fresh loop and report it
+ */
+static inline void test_run(const char *name, void (*fn)(async_loop_t *loop))
+{
+    struct ev_loop *ev = ev_loop_new(EVFLAG_AUTO);
+    async_loop_t loop;
+    int failures = test_failures;
+
+    if (ev == NULL) abort();
+
+    async_loop_init(&loop, ev);
+
+    fn(&loop);
+
+    async_loop_fini(&loop);
+    ev_loop_destroy(ev);
+
+    printf("%-40s %s\n", name, test_failures == failures ? "ok" : "FAILED");
+}
+
+/**
+ * Exit status of the test program
+ */
+static inline int test_result(void)
+{
+    printf("%d checks, %d failed\n", test_checks, test_failures);
+
+    return (test_failures > 0) ? 1 : 0;
+}
+
+#endif /* TEST_H_INCLUDED */
@@ -0,0 +1,160 @@
+/*
+ * Channels: FIFO order through a full channel, close, and the wakeup that
+ * a cancelled receiver has to pass on
+ */
+#include "../async.h"
+#include "../async_chan.h"
+#include "test.h"
+
+#define ITEMS       1000
+
+static async_chan_t chan;
+static long received;
+static long sum;
+static bool ordered;
+
+int producer_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; int rc; }, l)
+    {
+        for (l->ii = 0; l->ii < ITEMS; l->ii++)
+        {
+            CRT_AWAIT(async_chan_send(crt, &chan, &l->ii, &l->rc), 0);
+            if (l->rc != 0) break;
+        }
+
+        async_chan_close(&chan);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int consumer_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int item; int rc; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_chan_recv(crt, &chan, &l->item, &l->rc), 0);
+            if (l->rc != 0) break;
+
+            if (l->item != received) ordered = false;
+            received++;
+            sum += l->item;
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Receives one item, CRT_ERROR_CANCEL if cancelled meanwhile */
+int recv_once_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int item; int rc; }, l)
+    {
+        CRT_AWAIT(async_chan_recv(crt, &chan, &l->item, &l->rc), CRT_STATUS(crt));
+        if (l->rc == 0) received++;
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+/* Sends one item, then cancels the receiver it just woke */
+int send_cancel_main(crt_t *crt, void *arg)
+{
+    async_task_t *victim = arg;
+
+    CRT_LOCALS(crt, struct { int item; int rc; }, l)
+    {
+        l->item = 1;
+        CRT_AWAIT(async_chan_send(crt, &chan, &l->item, &l->rc), 0);
+
+        async_task_cancel(victim);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_fifo(async_loop_t *loop)
+{
+    async_task_t producer;
+    async_task_t consumer;
+
+    received = 0;
+    sum = 0;
+    ordered = true;
+    async_chan_init(&chan, sizeof(int), 4, 0);
+
+    async_task_start_on(loop, &consumer, consumer_main, NULL);
+    async_task_start_on(loop, &producer, producer_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(received == ITEMS);
+    TEST_CHECK(sum == (long)ITEMS * (ITEMS - 1) / 2);
+    TEST_CHECK(ordered);
+    TEST_CHECK(consumer.at_done && producer.at_done);
+
+    async_chan_fini(&chan);
+}
+
+static void test_close_wakes_receivers(async_loop_t *loop)
+{
+    async_task_t receivers[3];
+    int ii;
+
+    received = 0;
+    async_chan_init(&chan, sizeof(int), 1, 0);
+
+    for (ii = 0; ii < 3; ii++) async_task_start_on(loop, &receivers[ii], recv_once_main, NULL);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    async_chan_close(&chan);
+    async_loop_run(loop);
+
+    TEST_CHECK(received == 0);
+    for (ii = 0; ii < 3; ii++) TEST_CHECK(receivers[ii].at_done);
+
+    async_chan_fini(&chan);
+}
+
+static void test_cancelled_receiver(async_loop_t *loop)
+{
+    async_task_t first;
+    async_task_t second;
+    async_task_t sender;
+
+    /* The send wakes first, which unwinds; second must get the item */
+    received = 0;
+    async_chan_init(&chan, sizeof(int), 1, 0);
+
+    async_task_start_on(loop, &first, recv_once_main, NULL);
+    async_task_start_on(loop, &second, recv_once_main, NULL);
+    async_task_start_on(loop, &sender, send_cancel_main, &first);
+    async_loop_run(loop);
+
+    TEST_CHECK(first.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(second.at_done);
+    TEST_CHECK(received == 1);
+    TEST_CHECK(async_chan_len(&chan) == 0);
+
+    async_chan_fini(&chan);
+}
+
+int main(void)
+{
+    TEST_RUN(test_fifo);
+    TEST_RUN(test_close_wakes_receivers);
+    TEST_RUN(test_cancelled_receiver);
+
+    return test_result();
+}
@@ -0,0 +1,257 @@
+/*
+ * Co-routine core: yields, nested awaits, frame-locals, exit status, and
+ * stacks that overflow, are given by the caller or grow on the heap. Built
+ * a second time as test_crt_growable with CRT_STACK_GROWABLE.
+ */
+#include "../crt.h"
+#include "test.h"
+
+CRT_BATCH_DEFINE(int_batch_t, int);
+
+int count_to(crt_t *crt, int n)
+{
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 1; l->ii <= n; l->ii++) CRT_YIELD(l->ii);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Hands 1..n out through @p out, @p depth frames further down */
+void relay(crt_t *crt, int depth, int n, int *out)
+{
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        if (depth > 0)
+        {
+            CRT_AWAIT(relay(crt, depth - 1, n, out));
+        }
+        else
+        {
+            for (l->ii = 1; l->ii <= n; l->ii++)
+            {
+                *out = l->ii;
+                CRT_YIELD();
+            }
+        }
+    }
+    CRT_END;
+}
+
+void fail_after(crt_t *crt, int n)
+{
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < n; l->ii++) CRT_YIELD();
+        CRT_EXIT(CRT_ERROR);
+    }
+    CRT_END;
+}
+
+/* Errors are not propagated by CRT_AWAIT(), the caller sees the status */
+int propagate(crt_t *crt, int *status)
+{
+    CRT(crt)
+    {
+        CRT_AWAIT(fail_after(crt, 2), 0);
+        *status = CRT_STATUS(crt);
+        if (*status != CRT_OK) CRT_EXIT(*status);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Nests @p depth frames without locals, yields once at the bottom */
+void dive(crt_t *crt, int depth, int *reached)
+{
+    CRT(crt)
+    {
+        if (depth > 0)
+        {
+            CRT_AWAIT(dive(crt, depth - 1, reached));
+            if (CRT_STATUS(crt) != CRT_OK) CRT_EXIT(CRT_STATUS(crt));
+        }
+        else
+        {
+            *reached = crt->crt_depth;
+            CRT_YIELD();
+        }
+    }
+    CRT_END;
+}
+
+/* Run dive() to completion, @return the number of resumes */
+static int run_dive(crt_t *crt, int depth, int *reached)
+{
+    int resumes = 0;
+
+    do
+    {
+        dive(crt, depth, reached);
+        resumes++;
+    }
+    while (CRT_RUNNING(crt));
+
+    return resumes;
+}
+
+void batch_of(crt_t *crt, int_batch_t *batch, int n)
+{
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 1; l->ii <= n; l->ii++) CRT_YIELD_BATCH(batch, l->ii);
+    }
+    CRT_END;
+}
+
+static void test_yield(async_loop_t *loop)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    crt_t crt;
+    int sum = 0;
+    int n;
+
+    (void)loop;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    while ((n = count_to(&crt, 10)) > 0) sum += n;
+
+    TEST_CHECK(sum == 55);
+    TEST_CHECK(!CRT_RUNNING(&crt));
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+}
+
+static void test_nested_await(async_loop_t *loop)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[256];
+    crt_t crt;
+    int expect = 1;
+    int n = 0;
+
+    (void)loop;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    for (;;)
+    {
+        relay(&crt, 3, 5, &n);
+        if (!CRT_RUNNING(&crt)) break;
+
+        TEST_CHECK(n == expect);
+        expect++;
+    }
+
+    TEST_CHECK(expect == 6);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+}
+
+static void test_exit_status(async_loop_t *loop)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    crt_t crt;
+    int status = 1;
+    int resumes = 0;
+
+    (void)loop;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    do
+    {
+        propagate(&crt, &status);
+        resumes++;
+    }
+    while (CRT_RUNNING(&crt));
+
+    TEST_CHECK(resumes == 3);
+    TEST_CHECK(status == CRT_ERROR);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_ERROR);
+}
+
+static void test_batch(async_loop_t *loop)
+{
+    _Alignas(CRT_LOCALS_ALIGN) char locals[64];
+    crt_t crt;
+    int buf[4];
+    int_batch_t batch;
+    int expect = 1;
+    size_t ii;
+
+    (void)loop;
+
+    CRT_INIT_LOCALS(&crt, locals, sizeof(locals));
+    CRT_BATCH_INIT(&batch, buf, 4);
+
+    do
+    {
+        batch_of(&crt, &batch, 10);
+        for (ii = 0; ii < batch.cb_count; ii++) TEST_CHECK(batch.cb_items[ii] == expect++);
+    }
+    while (CRT_RUNNING(&crt));
+
+    TEST_CHECK(expect == 11);
+}
+
+static void test_deep_stack(async_loop_t *loop)
+{
+    crt_point_t stack[4 * CRT_STACK_DEPTH] = { 0 };
+    crt_t crt;
+    int reached = -1;
+
+    (void)loop;
+
+    /* Nests four times deeper than the built-in stack */
+    CRT_INIT_STACK(&crt, stack, 4 * CRT_STACK_DEPTH);
+    TEST_CHECK(run_dive(&crt, 3 * CRT_STACK_DEPTH, &reached) == 2);
+    TEST_CHECK(reached == 3 * CRT_STACK_DEPTH);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+    TEST_CHECK(crt.crt_stack == stack);
+}
+
+static void test_overflow(async_loop_t *loop)
+{
+    crt_t crt;
+    int reached = -1;
+
+    (void)loop;
+
+    CRT_INIT(&crt);
+
+#if defined(CRT_STACK_GROWABLE)
+    /* Moves to the heap on the way down, back to the built-in stack at CRT_FINI() */
+    TEST_CHECK(run_dive(&crt, 3 * CRT_STACK_DEPTH, &reached) == 2);
+    TEST_CHECK(reached == 3 * CRT_STACK_DEPTH);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+    TEST_CHECK(crt.crt_stack != crt.crt_inline && crt.crt_stack_size > CRT_STACK_DEPTH);
+
+    CRT_FINI(&crt);
+    TEST_CHECK(crt.crt_stack == crt.crt_inline);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+#else
+    /* Fails on the way down, before the bottom is reached */
+    TEST_CHECK(run_dive(&crt, 3 * CRT_STACK_DEPTH, &reached) == 1);
+    TEST_CHECK(reached == -1);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_ERROR_STACK_OVERFLOW);
+    TEST_CHECK(crt.crt_stack == crt.crt_inline);
+#endif
+
+    /* The deepest nesting that fits */
+    CRT_INIT(&crt);
+    reached = -1;
+    TEST_CHECK(run_dive(&crt, CRT_STACK_DEPTH - 2, &reached) == 2);
+    TEST_CHECK(reached == CRT_STACK_DEPTH - 2);
+    TEST_CHECK(CRT_STATUS(&crt) == CRT_OK);
+}
+
+int main(void)
+{
+    TEST_RUN(test_yield);
+    TEST_RUN(test_nested_await);
+    TEST_RUN(test_exit_status);
+    TEST_RUN(test_batch);
+    TEST_RUN(test_deep_stack);
+    TEST_RUN(test_overflow);
+
+    return test_result();
+}
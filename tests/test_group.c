@@ -0,0 +1,215 @@
+/*
+ * Task groups: join waits for all children, any takes the first and cancels
+ * the others, and cancelling or finishing the parent takes its children down
+ */
+#include "../async.h"
+#include "test.h"
+
+#define CHILDREN    5
+
+typedef struct
+{
+    double      sleep;
+    int         rc;
+} child_t;
+
+static child_t children[CHILDREN];
+static async_group_t group;
+static int cancelled;
+static int completed;
+static void *first_data;
+static int first_rc;
+static int join_status;
+
+int child_main(crt_t *crt, void *arg)
+{
+    child_t *self = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT_NC(async_task_sleep(crt, self->sleep), 0);
+        if (CRT_CANCELLED(crt))
+        {
+            cancelled++;
+            CRT_EXIT(CRT_ERROR_CANCEL);
+        }
+
+        completed++;
+    }
+    CRT_END;
+
+    return (CRT_STATUS(crt) == CRT_OK) ? self->rc : CRT_STATUS(crt);
+}
+
+static void spawn_children(async_loop_t *loop, async_task_t *owner)
+{
+    int ii;
+
+    async_group_init(&group, owner);
+    for (ii = 0; ii < CHILDREN; ii++) async_group_spawn(&group, loop, child_main, &children[ii]);
+}
+
+int join_main(crt_t *crt, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    (void)arg;
+
+    CRT(crt)
+    {
+        spawn_children(self->at_loop, self);
+
+        CRT_AWAIT_NC(async_group_join(crt, &group), 0);
+        join_status = CRT_STATUS(crt);
+
+        async_group_fini(&group);
+        if (join_status != CRT_OK) CRT_EXIT(join_status);
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int any_main(crt_t *crt, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    (void)arg;
+
+    CRT(crt)
+    {
+        spawn_children(self->at_loop, self);
+
+        CRT_AWAIT(async_group_any(crt, &group, &first_data, &first_rc), 0);
+        CRT_AWAIT(async_group_join(crt, &group), 0);
+
+        async_group_fini(&group);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Leaves its children behind, once they are asleep */
+int orphaning_main(crt_t *crt, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+
+    (void)arg;
+
+    CRT(crt)
+    {
+        spawn_children(self->at_loop, self);
+        CRT_AWAIT(async_task_yield(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int canceller_main(crt_t *crt, void *arg)
+{
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_sleep(crt, 0.01), 0);
+        async_task_cancel(arg);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void setup(double base, double step)
+{
+    int ii;
+
+    cancelled = 0;
+    completed = 0;
+    join_status = -1;
+
+    for (ii = 0; ii < CHILDREN; ii++)
+    {
+        children[ii].sleep = base + step * ii;
+        children[ii].rc = ii + 1;
+    }
+}
+
+static void test_join(async_loop_t *loop)
+{
+    async_task_t parent;
+    ev_tstamp start = ev_now(loop->al_ev);
+
+    setup(0.0, 0.005);
+
+    async_task_start_on(loop, &parent, join_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(parent.at_returncode == CRT_OK);
+    TEST_CHECK(join_status == CRT_OK);
+    TEST_CHECK(completed == CHILDREN && cancelled == 0);
+    TEST_CHECK(group.ag_count == 0 && group.ag_ndone == CHILDREN);
+    TEST_CHECK(ev_now(loop->al_ev) - start >= 0.005 * (CHILDREN - 1));
+}
+
+static void test_any(async_loop_t *loop)
+{
+    async_task_t parent;
+
+    /* The third child is much faster than the others */
+    setup(10.0, 0.0);
+    children[2].sleep = 0.001;
+    first_data = NULL;
+
+    async_task_start_on(loop, &parent, any_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(parent.at_returncode == CRT_OK);
+    TEST_CHECK(first_data == &children[2]);
+    TEST_CHECK(first_rc == 3);
+    TEST_CHECK(completed == 1 && cancelled == CHILDREN - 1);
+}
+
+static void test_cancel_parent(async_loop_t *loop)
+{
+    async_task_t parent;
+    async_task_t canceller;
+
+    setup(10.0, 0.0);
+
+    /* The children are cancelled and waited for, then the cancel propagates */
+    async_task_start_on(loop, &parent, join_main, NULL);
+    async_task_start_on(loop, &canceller, canceller_main, &parent);
+    async_loop_run(loop);
+
+    TEST_CHECK(join_status == CRT_ERROR_CANCEL);
+    TEST_CHECK(parent.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(cancelled == CHILDREN && completed == 0);
+    TEST_CHECK(group.ag_count == 0);
+}
+
+static void test_orphans(async_loop_t *loop)
+{
+    async_task_t parent;
+    ev_tstamp start = ev_now(loop->al_ev);
+
+    setup(10.0, 0.0);
+
+    async_task_start_on(loop, &parent, orphaning_main, NULL);
+    async_loop_run(loop);
+
+    /* Cancelled when the parent finished, and detached from its group */
+    TEST_CHECK(parent.at_done);
+    TEST_CHECK(cancelled == CHILDREN);
+    TEST_CHECK(group.ag_owner == NULL && group.ag_count == 0);
+    TEST_CHECK(ev_now(loop->al_ev) - start < 5.0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_join);
+    TEST_RUN(test_any);
+    TEST_RUN(test_cancel_parent);
+    TEST_RUN(test_orphans);
+
+    return test_result();
+}
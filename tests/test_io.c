@@ -0,0 +1,217 @@
+/*
+ * Socket awaitables: a TCP transfer large enough to park the writer,
+ * connect errors, and a task cancelled while parked on a read
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "test.h"
+
+#define BIG         (1 << 20)               /* Far more than the socket buffers */
+
+static char out[BIG];
+static char in[BIG + 16];
+static size_t received;
+static ssize_t results[3];
+static int error;
+static int fds[2];
+
+/* A listening socket on a free port of the loopback */
+static int listen_any(struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(*addr);
+    int fd;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 ||
+            listen(fd, 8) != 0 ||
+            getsockname(fd, (struct sockaddr *)addr, &len) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    async_io_nonblock(fd);
+
+    return fd;
+}
+
+/* Accepts one connection and reads it to the end */
+int server_main(crt_t *crt, void *arg)
+{
+    int lfd = *(int *)arg;
+
+    CRT_LOCALS(crt, struct { int fd; ssize_t rc; }, l)
+    {
+        CRT_AWAIT(async_accept(crt, lfd, NULL, NULL, &l->fd), 0);
+        if (l->fd < 0) CRT_EXIT(CRT_ERROR);
+
+        do
+        {
+            CRT_AWAIT(async_read(crt, l->fd, in + received, sizeof(in) - received, &l->rc), 0);
+            if (l->rc > 0) received += l->rc;
+        }
+        while (l->rc > 0);
+
+        results[2] = l->rc;
+        close(l->fd);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int client_main(crt_t *crt, void *arg)
+{
+    struct sockaddr_in *addr = arg;
+
+    CRT_LOCALS(crt, struct { int fd; int rc; ssize_t n; struct iovec iov[2]; }, l)
+    {
+        l->fd = socket(AF_INET, SOCK_STREAM, 0);
+        async_io_nonblock(l->fd);
+
+        CRT_AWAIT(async_connect(crt, l->fd, (struct sockaddr *)addr, sizeof(*addr), &l->rc), 0);
+        if (l->rc != 0) CRT_EXIT(CRT_ERROR);
+
+        CRT_AWAIT(async_write(crt, l->fd, out, BIG, &l->n), 0);
+        results[0] = l->n;
+
+        l->iov[0].iov_base = "vector";
+        l->iov[0].iov_len = 6;
+        l->iov[1].iov_base = "ed";
+        l->iov[1].iov_len = 2;
+        CRT_AWAIT(async_writev(crt, l->fd, l->iov, 2, &l->n), 0);
+        results[1] = l->n;
+
+        close(l->fd);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int connect_main(crt_t *crt, void *arg)
+{
+    struct sockaddr_in *addr = arg;
+
+    CRT_LOCALS(crt, struct { int fd; int rc; }, l)
+    {
+        l->fd = socket(AF_INET, SOCK_STREAM, 0);
+        async_io_nonblock(l->fd);
+
+        errno = 0;
+        CRT_AWAIT(async_connect(crt, l->fd, (struct sockaddr *)addr, sizeof(*addr), &l->rc), 0);
+        results[0] = l->rc;
+        error = errno;
+
+        close(l->fd);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int reader_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { ssize_t rc; }, l)
+    {
+        CRT_AWAIT(async_read(crt, fds[0], in, sizeof(in), &l->rc), CRT_STATUS(crt));
+        results[0] = l->rc;
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+static void test_transfer(async_loop_t *loop)
+{
+    struct sockaddr_in addr;
+    async_task_t server;
+    async_task_t client;
+    int lfd;
+    int ii;
+
+    lfd = listen_any(&addr);
+    TEST_CHECK(lfd >= 0);
+
+    for (ii = 0; ii < BIG; ii++) out[ii] = (char)(ii * 31 + ii / 4096);
+    received = 0;
+    memset(results, 0, sizeof(results));
+
+    async_task_start_on(loop, &server, server_main, &lfd);
+    async_task_start_on(loop, &client, client_main, &addr);
+    async_loop_run(loop);
+
+    TEST_CHECK(server.at_returncode == CRT_OK && client.at_returncode == CRT_OK);
+    TEST_CHECK(results[0] == BIG);
+    TEST_CHECK(results[1] == 8);
+    TEST_CHECK(results[2] == 0);
+    TEST_CHECK(received == BIG + 8);
+    TEST_CHECK(memcmp(in, out, BIG) == 0 && memcmp(in + BIG, "vectored", 8) == 0);
+
+    close(lfd);
+}
+
+static void test_refused(async_loop_t *loop)
+{
+    struct sockaddr_in addr;
+    async_task_t task;
+
+    /* A port nobody listens on any more */
+    close(listen_any(&addr));
+
+    async_task_start_on(loop, &task, connect_main, &addr);
+    async_loop_run(loop);
+
+    TEST_CHECK(results[0] == -1);
+    TEST_CHECK(error == ECONNREFUSED);
+}
+
+static void test_cancel_read(async_loop_t *loop)
+{
+    async_task_t task;
+
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    async_io_nonblock(fds[0]);
+
+    results[0] = -2;
+    async_task_start_on(loop, &task, reader_main, NULL);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    TEST_CHECK(ev_is_active(&task.at_io));
+
+    async_task_cancel(&task);
+    async_loop_run(loop);
+
+    /* Unwound without a result, and off the descriptor */
+    TEST_CHECK(task.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(results[0] == -2);
+    TEST_CHECK(!ev_is_active(&task.at_io));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(void)
+{
+    TEST_RUN(test_transfer);
+    TEST_RUN(test_refused);
+    TEST_RUN(test_cancel_read);
+
+    return test_result();
+}
@@ -0,0 +1,140 @@
+/*
+ * Offloaded calls: they run on a pool thread, and a wait that is cut short
+ * reports the cancel or timeout whether or not the call completed
+ */
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../async.h"
+#include "../async_offload.h"
+#include "test.h"
+
+static async_pool_t pool;
+static pthread_t caller;
+static bool other_thread;
+static atomic_bool ran;
+static bool timedout;
+
+static void note_fn(void *arg)
+{
+    (void)arg;
+
+    other_thread = !pthread_equal(pthread_self(), caller);
+    atomic_store(&ran, true);
+}
+
+static void slow_fn(void *arg)
+{
+    (void)arg;
+
+    usleep(100000);
+    atomic_store(&ran, true);
+}
+
+int offload_main(crt_t *crt, void *arg)
+{
+    async_offload_fn *fn = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_offload(crt, &pool, fn, NULL), CRT_STATUS(crt));
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int offload_timeout_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT_TIMEOUT(async_offload(crt, &pool, slow_fn, NULL), 0.01, 0);
+        timedout = CRT_TIMEDOUT(crt);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Cancels @p arg once its call completed and it is queued to resume */
+int canceller_main(crt_t *crt, void *arg)
+{
+    async_task_t *victim = arg;
+
+    CRT(crt)
+    {
+        while (!atomic_load(&ran) || !victim->at_queued) CRT_AWAIT(async_task_yield(crt), 0);
+
+        async_task_cancel(victim);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_offload(async_loop_t *loop)
+{
+    async_task_t task;
+
+    caller = pthread_self();
+    atomic_store(&ran, false);
+    async_pool_init(&pool, 2, 4);
+
+    async_task_start_on(loop, &task, offload_main, note_fn);
+    async_loop_run(loop);
+
+    TEST_CHECK(atomic_load(&ran));
+    TEST_CHECK(other_thread);
+    TEST_CHECK(task.at_returncode == CRT_OK);
+
+    async_pool_fini(&pool);
+}
+
+static void test_timeout_in_flight(async_loop_t *loop)
+{
+    async_task_t task;
+
+    timedout = false;
+    atomic_store(&ran, false);
+    async_pool_init(&pool, 2, 4);
+
+    async_task_start_on(loop, &task, offload_timeout_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(timedout);
+    TEST_CHECK(task.at_done);
+
+    /* The call still runs to completion */
+    async_pool_fini(&pool);
+    TEST_CHECK(atomic_load(&ran));
+}
+
+static void test_cancel_after_completion(async_loop_t *loop)
+{
+    async_task_t task;
+    async_task_t canceller;
+
+    atomic_store(&ran, false);
+    async_pool_init(&pool, 2, 4);
+
+    async_task_start_on(loop, &task, offload_main, note_fn);
+    async_task_start_on(loop, &canceller, canceller_main, &task);
+    async_loop_run(loop);
+
+    TEST_CHECK(atomic_load(&ran));
+    TEST_CHECK(task.at_returncode == CRT_ERROR_CANCEL);
+
+    async_pool_fini(&pool);
+}
+
+int main(void)
+{
+    TEST_RUN(test_offload);
+    TEST_RUN(test_timeout_in_flight);
+    TEST_RUN(test_cancel_after_completion);
+
+    return test_result();
+}
@@ -0,0 +1,198 @@
+/*
+ * Generator pipelines: fused stages give the same items as applying them one
+ * by one with one resume per batch, take stops the source, zip ends with the
+ * shorter side, and flat_map output runs through the stages that follow
+ */
+#include "../crt_pipe.h"
+#include "test.h"
+
+#define COUNT       1000
+#define FANOUT      3
+
+static crt_item_t times3(crt_item_t v, void *arg) { (void)arg; return v * 3; }
+static crt_item_t plus7(crt_item_t v, void *arg) { (void)arg; return v + 7; }
+static bool even(crt_item_t v, void *arg) { (void)arg; return (v & 1) == 0; }
+static crt_item_t pair(crt_item_t a, crt_item_t b, void *arg) { (void)arg; return a * 1000 + b; }
+
+/* 1 .. *arg */
+void numbers(crt_t *crt, crt_item_batch_t *batch, void *arg)
+{
+    crt_item_t count = *(crt_item_t *)arg;
+
+    CRT_LOCALS(crt, struct { crt_item_t n; }, l)
+    {
+        for (l->n = 1; l->n <= count; l->n++) CRT_YIELD_BATCH(batch, l->n);
+    }
+    CRT_END;
+}
+
+/* item * 10 + 0 .. FANOUT - 1 */
+void fanout(crt_t *crt, crt_item_batch_t *batch, crt_item_t item, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int jj; }, l)
+    {
+        for (l->jj = 0; l->jj < FANOUT; l->jj++) CRT_YIELD_BATCH(batch, item * 10 + l->jj);
+    }
+    CRT_END;
+}
+
+/* Pull everything in odd sized chunks, @return the number of items */
+static size_t pull_all(crt_pipe_t *p, crt_item_t *out, size_t max)
+{
+    size_t total = 0;
+    size_t chunk;
+    size_t n;
+
+    while (total < max)
+    {
+        chunk = (max - total < 7) ? max - total : 7;
+
+        n = crt_pipe_pull(p, out + total, chunk);
+        if (n == 0) break;
+
+        total += n;
+    }
+
+    return total;
+}
+
+static void test_fused(async_loop_t *loop)
+{
+    static crt_item_t out[COUNT];
+    crt_item_t count = COUNT;
+    crt_item_t expect = 1;
+    crt_pipe_t p;
+    size_t n;
+    size_t ii;
+    bool same = true;
+
+    (void)loop;
+
+    crt_pipe_init(&p, numbers, &count);
+    TEST_CHECK(crt_pipe_map(&p, times3, NULL) == 0);
+    TEST_CHECK(crt_pipe_filter(&p, even, NULL) == 0);
+    TEST_CHECK(crt_pipe_map(&p, plus7, NULL) == 0);
+
+    n = pull_all(&p, out, COUNT);
+
+    /* 3n is even for even n only */
+    for (ii = 0; ii < n; ii++, expect++)
+    {
+        while (!even(times3(expect, NULL), NULL)) expect++;
+        if (out[ii] != times3(expect, NULL) + 7) same = false;
+    }
+
+    TEST_CHECK(n == COUNT / 2);
+    TEST_CHECK(same);
+    TEST_CHECK(crt_pipe_pull(&p, out, COUNT) == 0);
+
+    /* One resume of the source per batch, none per stage */
+    TEST_CHECK(p.cp_resumes == (COUNT + CRT_PIPE_BATCH - 1) / CRT_PIPE_BATCH);
+
+    crt_pipe_fini(&p);
+}
+
+static void test_take(async_loop_t *loop)
+{
+    crt_item_t out[16];
+    crt_item_t count = 1000000;
+    crt_pipe_t p;
+
+    (void)loop;
+
+    crt_pipe_init(&p, numbers, &count);
+    crt_pipe_take(&p, 10);
+
+    /* The source is not resumed once the count is reached */
+    TEST_CHECK(pull_all(&p, out, 16) == 10);
+    TEST_CHECK(out[0] == 1 && out[9] == 10);
+    TEST_CHECK(p.cp_resumes == 1);
+    crt_pipe_fini(&p);
+
+    crt_pipe_init(&p, numbers, &count);
+    crt_pipe_take(&p, 0);
+
+    TEST_CHECK(crt_pipe_pull(&p, out, 16) == 0);
+    TEST_CHECK(p.cp_resumes == 0);
+    crt_pipe_fini(&p);
+}
+
+static void test_zip(async_loop_t *loop)
+{
+    crt_item_t out[128];
+    crt_item_t count = 100;
+    crt_item_t other_count = 50;
+    crt_pipe_t p;
+    crt_pipe_t other;
+    size_t n;
+
+    (void)loop;
+
+    crt_pipe_init(&other, numbers, &other_count);
+    crt_pipe_init(&p, numbers, &count);
+    TEST_CHECK(crt_pipe_zip(&p, &other, pair, NULL) == 0);
+
+    n = pull_all(&p, out, 128);
+
+    TEST_CHECK(n == 50);
+    TEST_CHECK(out[0] == 1001 && out[49] == 50050);
+
+    crt_pipe_fini(&p);
+    crt_pipe_fini(&other);
+}
+
+static void test_flat_map(async_loop_t *loop)
+{
+    static crt_item_t out[COUNT];
+    crt_item_t count = 10;
+    crt_pipe_t p;
+    size_t n;
+
+    (void)loop;
+
+    /* Two levels: 10 * 3 * 3 items, then the even ones */
+    crt_pipe_init(&p, numbers, &count);
+    TEST_CHECK(crt_pipe_flat_map(&p, fanout, NULL) == 0);
+    TEST_CHECK(crt_pipe_flat_map(&p, fanout, NULL) == 0);
+    TEST_CHECK(crt_pipe_filter(&p, even, NULL) == 0);
+
+    n = pull_all(&p, out, COUNT);
+
+    /* n*100 + j*10 + k, even for k = 0 and 2 */
+    TEST_CHECK(n == 10 * FANOUT * 2);
+    TEST_CHECK(out[0] == 100 && out[1] == 102 && out[2] == 110);
+    TEST_CHECK(out[n - 1] == 1022);
+
+    crt_pipe_fini(&p);
+}
+
+static void test_full(async_loop_t *loop)
+{
+    crt_item_t count = 1;
+    crt_pipe_t p;
+    int ii;
+
+    (void)loop;
+
+    crt_pipe_init(&p, numbers, &count);
+    for (ii = 0; ii < CRT_PIPE_STAGES; ii++) TEST_CHECK(crt_pipe_map(&p, plus7, NULL) == 0);
+
+    TEST_CHECK(crt_pipe_map(&p, plus7, NULL) == -1);
+    TEST_CHECK(crt_pipe_take(&p, 1) == -1);
+    TEST_CHECK(p.cp_nstages == CRT_PIPE_STAGES);
+
+    crt_pipe_fini(&p);
+}
+
+int main(void)
+{
+    TEST_RUN(test_fused);
+    TEST_RUN(test_take);
+    TEST_RUN(test_zip);
+    TEST_RUN(test_flat_map);
+    TEST_RUN(test_full);
+
+    return test_result();
+}
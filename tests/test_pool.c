@@ -0,0 +1,132 @@
+/*
+ * Pooled tasks: spawned tasks go back to the free list when done, slabs are
+ * reused, a reserve spawns without allocating, and a task that finishes
+ * with a remote wakeup in flight is reaped once that wakeup is drained
+ */
+#include "../async.h"
+#include "test.h"
+
+static int finished;
+static async_task_t *spawned;
+
+int worker_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < 3; l->ii++) CRT_AWAIT(async_task_yield(crt), 0);
+
+        finished++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int parker_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_park(crt), 0);
+        finished++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void spawn_many(async_loop_t *loop, int count)
+{
+    int ii;
+
+    for (ii = 0; ii < count; ii++) TEST_CHECK(async_spawn(loop, worker_main, NULL) != NULL);
+}
+
+static void test_reap(async_loop_t *loop)
+{
+    finished = 0;
+
+    spawn_many(loop, 3 * ASYNC_SLAB_TASKS);
+    TEST_CHECK(loop->al_pooled == 3 * ASYNC_SLAB_TASKS);
+    TEST_CHECK(loop->al_nfree == 0);
+
+    async_loop_run(loop);
+
+    /* All back on the free list */
+    TEST_CHECK(finished == 3 * ASYNC_SLAB_TASKS);
+    TEST_CHECK(loop->al_nfree == loop->al_pooled);
+}
+
+static void test_reuse(async_loop_t *loop)
+{
+    int round;
+
+    finished = 0;
+
+    /* The same slab serves every round */
+    for (round = 0; round < 4; round++)
+    {
+        spawn_many(loop, ASYNC_SLAB_TASKS);
+        async_loop_run(loop);
+    }
+
+    TEST_CHECK(finished == 4 * ASYNC_SLAB_TASKS);
+    TEST_CHECK(loop->al_pooled == ASYNC_SLAB_TASKS);
+    TEST_CHECK(loop->al_nfree == ASYNC_SLAB_TASKS);
+}
+
+static void test_reserve(async_loop_t *loop)
+{
+    size_t pooled;
+
+    TEST_CHECK(async_loop_reserve(loop, ASYNC_SLAB_TASKS + 1) == 0);
+    TEST_CHECK(loop->al_nfree >= ASYNC_SLAB_TASKS + 1);
+
+    pooled = loop->al_pooled;
+    finished = 0;
+
+    spawn_many(loop, ASYNC_SLAB_TASKS + 1);
+    TEST_CHECK(loop->al_pooled == pooled);
+
+    async_loop_run(loop);
+
+    TEST_CHECK(finished == ASYNC_SLAB_TASKS + 1);
+    TEST_CHECK(loop->al_nfree == pooled);
+}
+
+static void test_reap_remote(async_loop_t *loop)
+{
+    finished = 0;
+
+    spawned = async_spawn(loop, parker_main, NULL);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    /* Off the loop thread's run, so the wakeup takes the remote list */
+    async_task_wake_from_any_thread(spawned);
+    TEST_CHECK(atomic_load(&spawned->at_remote_queued));
+
+    /* Finishes on a local wakeup, draining the ready queue alone */
+    async_task_wake(spawned, NULL);
+    ev_invoke(loop->al_ev, &loop->al_check, EV_CHECK);
+
+    TEST_CHECK(finished == 1);
+    TEST_CHECK(spawned->at_flags & ASYNC_TASK_REAP);
+    TEST_CHECK(loop->al_nfree == loop->al_pooled - 1);
+
+    ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    TEST_CHECK(loop->al_nfree == loop->al_pooled);
+}
+
+int main(void)
+{
+    TEST_RUN(test_reap);
+    TEST_RUN(test_reuse);
+    TEST_RUN(test_reserve);
+    TEST_RUN(test_reap_remote);
+
+    return test_result();
+}
@@ -0,0 +1,228 @@
+/*
+ * Thread-per-core runtime: tasks spawned from outside run on the loop and
+ * thread of the worker they were spawned on, unless idle workers steal
+ * them; pinned tasks are never stolen
+ */
+#include <string.h>
+#include <time.h>
+
+#include "../async.h"
+#include "../async_rt.h"
+#include "test.h"
+
+#define WORKERS     4
+#define TASKS       64
+#define STEPS       8
+
+typedef struct
+{
+    async_task_t        task;
+    async_worker_t     *home;               /* Worker it was spawned on */
+    bool                strayed;            /* Ran on another worker or loop */
+} rt_task_t;
+
+static rt_task_t tasks[TASKS];
+static atomic_int finished;
+static double busy;                         /* Seconds each step spins */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void spin(double seconds)
+{
+    double end = now() + seconds;
+
+    while (now() < end);
+}
+
+/* Yields a few times, checking where it runs each time */
+int home_main(crt_t *crt, void *arg)
+{
+    rt_task_t *self = arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < STEPS; l->ii++)
+        {
+            if (async_worker_self() != self->home ||
+                    atomic_load(&ASYNC_TASK(crt)->at_loop) != &self->home->awr_loop)
+            {
+                self->strayed = true;
+            }
+
+            /* Keeps the home worker's ready queue long enough to share */
+            spin(busy);
+
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+
+        atomic_fetch_add(&finished, 1);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Wait up to 10 s for @p count tasks to finish */
+static bool wait_finished(int count)
+{
+    struct timespec ts = { 0, 1000000 };
+    int ii;
+
+    for (ii = 0; ii < 10000 && atomic_load(&finished) < count; ii++) nanosleep(&ts, NULL);
+
+    return atomic_load(&finished) == count;
+}
+
+static void test_spawn(async_loop_t *loop)
+{
+    async_runtime_t rt;
+    int strayed = 0;
+    int ii;
+
+    (void)loop;
+
+    TEST_CHECK(async_runtime_init(&rt, WORKERS, false) == 0);
+    async_runtime_steal(&rt, false);
+    TEST_CHECK(async_runtime_start(&rt) == 0);
+
+    /* From a thread that is no worker */
+    TEST_CHECK(async_worker_self() == NULL);
+
+    atomic_store(&finished, 0);
+    memset(tasks, 0, sizeof(tasks));
+
+    for (ii = 0; ii < TASKS; ii++)
+    {
+        tasks[ii].home = async_runtime_worker(&rt, ii);
+        async_task_spawn_on(tasks[ii].home, &tasks[ii].task, home_main, &tasks[ii]);
+    }
+
+    TEST_CHECK(wait_finished(TASKS));
+
+    async_runtime_stop(&rt);
+
+    for (ii = 0; ii < TASKS; ii++)
+    {
+        if (tasks[ii].strayed || !tasks[ii].task.at_done) strayed++;
+    }
+
+    TEST_CHECK(strayed == 0);
+    TEST_CHECK(async_runtime_worker(&rt, WORKERS + 1) == &rt.ar_workers[1]);
+
+    async_runtime_fini(&rt);
+}
+
+/*
+ * Spawn all tasks on worker 0 of @p rt, with @p flags, wait for them and
+ * stop the runtime
+ *
+ * @return the number of tasks that ran elsewhere, -1 if they did not finish
+ */
+static int run_on_first(async_runtime_t *rt, unsigned flags)
+{
+    async_worker_t *first = async_runtime_worker(rt, 0);
+    int strayed = 0;
+    int ii;
+
+    atomic_store(&finished, 0);
+    memset(tasks, 0, sizeof(tasks));
+    busy = 0.00002;
+
+    for (ii = 0; ii < TASKS; ii++)
+    {
+        tasks[ii].home = first;
+        async_task_init(&first->awr_loop, &tasks[ii].task, home_main, &tasks[ii]);
+        tasks[ii].task.at_flags |= flags;
+    }
+
+    /* All at once, so that the first drain pass finds a surplus */
+    for (ii = 0; ii < TASKS; ii++) async_task_wake_from_any_thread(&tasks[ii].task);
+
+    if (!wait_finished(TASKS)) strayed = -1;
+
+    async_runtime_stop(rt);
+    busy = 0.0;
+
+    for (ii = 0; ii < TASKS && strayed >= 0; ii++)
+    {
+        if (tasks[ii].strayed) strayed++;
+    }
+
+    return strayed;
+}
+
+static long stolen(async_runtime_t *rt)
+{
+    long count = 0;
+    int ii;
+
+    for (ii = 0; ii < rt->ar_nworkers; ii++) count += rt->ar_workers[ii].awr_stolen;
+
+    return count;
+}
+
+static void test_steal(async_loop_t *loop)
+{
+    async_runtime_t rt;
+
+    (void)loop;
+
+    TEST_CHECK(async_runtime_init(&rt, WORKERS, false) == 0);
+    TEST_CHECK(async_runtime_start(&rt) == 0);
+
+    /* The idle workers take over part of the load */
+    TEST_CHECK(run_on_first(&rt, 0) > 0);
+    TEST_CHECK(stolen(&rt) > 0);
+
+    async_runtime_fini(&rt);
+}
+
+static void test_pinned(async_loop_t *loop)
+{
+    async_runtime_t rt;
+
+    (void)loop;
+
+    TEST_CHECK(async_runtime_init(&rt, WORKERS, false) == 0);
+    TEST_CHECK(async_runtime_start(&rt) == 0);
+
+    TEST_CHECK(run_on_first(&rt, ASYNC_TASK_PINNED) == 0);
+    TEST_CHECK(stolen(&rt) == 0);
+
+    async_runtime_fini(&rt);
+}
+
+static void test_stop_idle(async_loop_t *loop)
+{
+    async_runtime_t rt;
+
+    (void)loop;
+
+    /* Workers without tasks stay up until stopped */
+    TEST_CHECK(async_runtime_init(&rt, WORKERS, true) == 0);
+    TEST_CHECK(async_runtime_start(&rt) == 0);
+    TEST_CHECK(rt.ar_running);
+
+    async_runtime_stop(&rt);
+    TEST_CHECK(!rt.ar_running);
+
+    async_runtime_fini(&rt);
+    TEST_CHECK(rt.ar_workers == NULL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_spawn);
+    TEST_RUN(test_steal);
+    TEST_RUN(test_pinned);
+    TEST_RUN(test_stop_idle);
+
+    return test_result();
+}
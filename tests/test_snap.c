@@ -0,0 +1,164 @@
+/*
+ * Snapshot and restore of suspended tasks: frames, locals and the time
+ * left on the sleep carry over; tasks holding on to loop state are refused
+ */
+#include <errno.h>
+
+#include "../async.h"
+#include "../async_snap.h"
+#include "../async_sync.h"
+#include "../async_uring.h"
+#include "test.h"
+
+#define SLEEP       0.05
+
+static long result;
+
+void step(crt_t *crt, long id, double sleep)
+{
+    CRT_LOCALS(crt, struct { long seq; }, l)
+    {
+        l->seq = id * 7;
+        CRT_AWAIT(async_task_sleep(crt, sleep));
+
+        if (l->seq != id * 7) CRT_EXIT(CRT_ERROR);
+    }
+    CRT_END;
+}
+
+int session_main(crt_t *crt, void *arg)
+{
+    double *sleep = arg;
+
+    CRT_LOCALS(crt, struct { long id; long sum; double sleep; }, l)
+    {
+        /* Only on the fresh start, a restored session gets no argument */
+        l->id = 3;
+        l->sleep = *sleep;
+
+        l->sum = l->id;
+        CRT_AWAIT(step(crt, l->id, l->sleep), CRT_STATUS(crt));
+        if (CRT_STATUS(crt) != CRT_OK) CRT_EXIT(CRT_STATUS(crt));
+
+        result = l->sum + 1;
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int locked_main(crt_t *crt, void *arg)
+{
+    async_mutex_t *mutex = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_mutex_lock(crt, mutex), 0);
+        async_mutex_unlock(mutex);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Start a session and let it park in its sleep */
+static void start_session(async_loop_t *loop, async_task_t *task, double *sleep)
+{
+    async_task_start_on(loop, task, session_main, sleep);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+}
+
+static void test_restore(async_loop_t *loop)
+{
+    _Alignas(8) char buf[512];
+    async_task_t task;
+    async_task_t restored;
+    double sleep = SLEEP;
+    ev_tstamp start;
+    ssize_t n;
+
+    result = 0;
+    start_session(loop, &task, &sleep);
+
+    n = async_task_snapshot(&task, buf, sizeof(buf));
+    TEST_CHECK(n > 0 && (size_t)n == async_task_snapshot_size(&task));
+    TEST_CHECK(((async_snap_record_t *)buf)->asr_timer > 0.0);
+
+    /* The original goes away, as with the old process */
+    async_timer_stop(loop, &task.at_timer);
+
+    ev_now_update(loop->al_ev);
+    start = ev_now(loop->al_ev);
+
+    TEST_CHECK(async_task_restore(loop, &restored, buf, n, NULL) == n);
+    async_loop_run(loop);
+
+    TEST_CHECK(restored.at_done);
+    TEST_CHECK(restored.at_returncode == CRT_OK);
+    TEST_CHECK(result == 4);
+    TEST_CHECK(ev_now(loop->al_ev) - start >= SLEEP / 2);
+}
+
+static void test_refused(async_loop_t *loop)
+{
+    _Alignas(8) char buf[512];
+    async_task_t task;
+    async_mutex_t mutex;
+    double sleep = 0.0;
+
+    /* Parked on a wait queue */
+    async_mutex_init(&mutex, 0);
+    async_mutex_trylock(&mutex);
+    async_task_start_on(loop, &task, locked_main, &mutex);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    errno = 0;
+    TEST_CHECK(async_task_snapshot(&task, buf, sizeof(buf)) == -1 && errno == EBUSY);
+
+    async_mutex_unlock(&mutex);
+    async_loop_run(loop);
+
+    /* Done */
+    errno = 0;
+    TEST_CHECK(async_task_snapshot(&task, buf, sizeof(buf)) == -1 && errno == EINVAL);
+
+    /* Too small */
+    start_session(loop, &task, &sleep);
+
+    errno = 0;
+    TEST_CHECK(async_task_snapshot(&task, buf, sizeof(async_snap_record_t)) == -1 && errno == ENOSPC);
+
+    async_loop_run(loop);
+}
+
+static void test_uring_timer(async_loop_t *loop)
+{
+    _Alignas(8) char buf[512];
+    async_task_t task;
+    double sleep = 10.0;
+    ssize_t n;
+
+    /* Without io_uring in this kernel there is nothing to test */
+    if (async_loop_io_uring(loop, 0, ASYNC_URING_TIMERS) != 0) return;
+
+    start_session(loop, &task, &sleep);
+
+    /* The ring does not tell the time left, the loop has to remember it */
+    n = async_task_snapshot(&task, buf, sizeof(buf));
+    TEST_CHECK(n > 0);
+    TEST_CHECK(((async_snap_record_t *)buf)->asr_timer > sleep / 2);
+
+    async_task_cancel(&task);
+    async_loop_run(loop);
+
+    TEST_CHECK(task.at_returncode == CRT_ERROR_CANCEL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_restore);
+    TEST_RUN(test_refused);
+    TEST_RUN(test_uring_timer);
+
+    return test_result();
+}
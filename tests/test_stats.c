@@ -0,0 +1,174 @@
+/*
+ * Scheduler instrumentation: histograms keep their precision, every resume
+ * is counted but only one in ASYNC_STATS_SAMPLE is timed, and time parked is
+ * filed under the kind of wakeup that ended it
+ */
+#include "../async.h"
+#include "../async_stats.h"
+#include "test.h"
+
+#define YIELDERS    3
+#define YIELDS      99
+#define SLEEPS      (2 * ASYNC_STATS_SAMPLE + 1)
+
+/* Within the 12.5% precision of a bucket */
+static bool near(uint64_t value, uint64_t expect)
+{
+    return value >= expect - expect / 8 && value <= expect + expect / 8;
+}
+
+static void test_hist(async_loop_t *loop)
+{
+    static async_hist_t hist;
+    static async_hist_t sum;
+    uint64_t ii;
+
+    (void)loop;
+
+    TEST_CHECK(async_hist_count(&hist) == 0);
+    TEST_CHECK(async_hist_percentile(&hist, 50.0) == 0);
+
+    for (ii = 1; ii <= 1000; ii++) async_hist_record(&hist, ii);
+
+    TEST_CHECK(async_hist_count(&hist) == 1000);
+    TEST_CHECK(near(async_hist_percentile(&hist, 50.0), 500));
+    TEST_CHECK(near(async_hist_percentile(&hist, 99.0), 990));
+    TEST_CHECK(near(async_hist_percentile(&hist, 100.0), 1000));
+
+    /* Small values have a bucket each */
+    TEST_CHECK(async_hist_percentile(&hist, 0.1) == 1);
+
+    /* The whole range fits */
+    async_hist_record(&sum, UINT64_MAX);
+    TEST_CHECK(async_hist_percentile(&sum, 100.0) > UINT64_MAX / 2);
+
+    async_hist_merge(&sum, &hist);
+    async_hist_merge(&sum, &hist);
+
+    TEST_CHECK(async_hist_count(&sum) == 2001);
+    TEST_CHECK(near(async_hist_percentile(&sum, 50.0), 500));
+}
+
+#if defined(ASYNC_STATS)
+
+int yielder_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < YIELDS; l->ii++) CRT_AWAIT(async_task_yield(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int sleeper_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < SLEEPS; l->ii++) CRT_AWAIT(async_task_sleep(crt, 0.002), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static async_stats_fn_t *find(async_stats_snapshot_t *snap, async_main_t *fn)
+{
+    size_t ii;
+
+    for (ii = 0; ii < snap->ass_count; ii++)
+    {
+        if (snap->ass_fn[ii]->asf_fn == fn) return snap->ass_fn[ii];
+    }
+
+    return NULL;
+}
+
+static void test_resumes(async_loop_t *loop)
+{
+    async_task_t tasks[YIELDERS];
+    async_stats_snapshot_t snap;
+    async_stats_fn_t *fs;
+    const uint64_t resumes = YIELDS + 1;
+    const uint64_t timed = (resumes + ASYNC_STATS_SAMPLE - 1) / ASYNC_STATS_SAMPLE;
+    int ii;
+
+    for (ii = 0; ii < YIELDERS; ii++) async_task_start_on(loop, &tasks[ii], yielder_main, NULL);
+    async_loop_run(loop);
+
+    for (ii = 0; ii < YIELDERS; ii++)
+    {
+        TEST_CHECK(tasks[ii].at_stats.ats_resumes == resumes);
+        TEST_CHECK(tasks[ii].at_stats.ats_timed == timed);
+        TEST_CHECK(tasks[ii].at_stats.ats_run > 0);
+        TEST_CHECK(tasks[ii].at_stats.ats_longest <= tasks[ii].at_stats.ats_run);
+    }
+
+    async_stats_snapshot_init(&snap);
+    TEST_CHECK(async_stats_snapshot(loop, &snap) == 0);
+    TEST_CHECK(snap.ass_ns_per_tick > 0.0);
+
+    /* One entry for all tasks of a function */
+    fs = find(&snap, yielder_main);
+    TEST_CHECK(fs != NULL);
+    if (fs != NULL)
+    {
+        TEST_CHECK(fs->asf_resumes == YIELDERS * resumes);
+        TEST_CHECK(async_hist_count(&fs->asf_run_hist) == YIELDERS * timed);
+
+        /* Parked before every timed resume but the first */
+        TEST_CHECK(async_hist_count(&fs->asf_park_hist[ASYNC_WAIT_YIELD]) == YIELDERS * (timed - 1));
+        TEST_CHECK(async_hist_count(&fs->asf_park_hist[ASYNC_WAIT_TIMER]) == 0);
+    }
+
+    async_stats_snapshot_fini(&snap);
+}
+
+static void test_parked(async_loop_t *loop)
+{
+    async_task_t task;
+    async_stats_snapshot_t snap;
+    async_stats_fn_t *fs;
+    double ns;
+
+    async_task_start_on(loop, &task, sleeper_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(task.at_stats.ats_resumes == SLEEPS + 1);
+    TEST_CHECK(task.at_stats.ats_parked[ASYNC_WAIT_TIMER] > 0);
+    TEST_CHECK(task.at_stats.ats_parked[ASYNC_WAIT_YIELD] == 0);
+
+    async_stats_snapshot_init(&snap);
+    TEST_CHECK(async_stats_snapshot(loop, &snap) == 0);
+
+    fs = find(&snap, sleeper_main);
+    TEST_CHECK(fs != NULL);
+    if (fs != NULL)
+    {
+        /* The timed resumes after the first each slept about 2 ms */
+        TEST_CHECK(async_hist_count(&fs->asf_park_hist[ASYNC_WAIT_TIMER]) == 2);
+
+        ns = (double)async_hist_percentile(&fs->asf_park_hist[ASYNC_WAIT_TIMER], 50.0) * snap.ass_ns_per_tick;
+        TEST_CHECK(ns >= 1e6);
+    }
+
+    async_stats_snapshot_fini(&snap);
+}
+
+#endif
+
+int main(void)
+{
+    TEST_RUN(test_hist);
+#if defined(ASYNC_STATS)
+    TEST_RUN(test_resumes);
+    TEST_RUN(test_parked);
+#endif
+
+    return test_result();
+}
@@ -0,0 +1,242 @@
+/*
+ * Buffered streams: lines spanning chunks, lines over the limit, switching
+ * delimiters between reads, and queued writes reaching the peer
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../async.h"
+#include "../async_stream.h"
+#include "test.h"
+
+#define CHUNK       16                      /* Small chunks, so lines span them */
+#define BIG_CHUNK   256                     /* Takes a whole long line in one read */
+
+static async_chunk_pool_t pool;
+static async_stream_t stream;
+static int fds[2];
+
+static char lines[4][64];
+static int nlines;
+static ssize_t results[3];
+static int error;
+
+int lines_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { async_view_t view; ssize_t rc; }, l)
+    {
+        for (;;)
+        {
+            CRT_AWAIT(async_stream_read_until(crt, &stream, '\n', 64, &l->view, &l->rc), 0);
+            if (l->rc <= 0) break;
+
+            async_view_copy(&l->view, lines[nlines]);
+            lines[nlines][l->rc] = '\0';
+            nlines++;
+            async_view_release(&l->view);
+        }
+
+        results[0] = l->rc;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Reads one line of at most 10 bytes, then what follows it */
+int short_line_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { async_view_t view; ssize_t rc; }, l)
+    {
+        CRT_AWAIT(async_stream_read_until(crt, &stream, '\n', 10, &l->view, &l->rc), 0);
+        results[0] = l->rc;
+        error = errno;
+        if (l->rc > 0) async_view_release(&l->view);
+
+        /* Nothing was consumed */
+        CRT_AWAIT(async_stream_read_exact(crt, &stream, 5, &l->view, &l->rc), 0);
+        results[1] = l->rc;
+        if (l->rc > 0)
+        {
+            async_view_copy(&l->view, lines[0]);
+            lines[0][l->rc] = '\0';
+            async_view_release(&l->view);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int delims_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { async_view_t view; ssize_t rc; }, l)
+    {
+        /* Searches all of it for '\n' and gives up */
+        CRT_AWAIT(async_stream_read_until(crt, &stream, '\n', 4, &l->view, &l->rc), 0);
+        results[0] = l->rc;
+        error = errno;
+
+        CRT_AWAIT(async_stream_read_until(crt, &stream, ';', 64, &l->view, &l->rc), 0);
+        results[1] = l->rc;
+        if (l->rc > 0)
+        {
+            async_view_copy(&l->view, lines[0]);
+            lines[0][l->rc] = '\0';
+            async_view_release(&l->view);
+        }
+
+        CRT_AWAIT(async_stream_read_exact(crt, &stream, 4, &l->view, &l->rc), 0);
+        results[2] = l->rc;
+        if (l->rc > 0)
+        {
+            async_view_copy(&l->view, lines[1]);
+            lines[1][l->rc] = '\0';
+            async_view_release(&l->view);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int writer_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; int rc; }, l)
+    {
+        for (l->ii = 0; l->ii < 100; l->ii++) async_stream_write(&stream, "0123456789", 10);
+
+        CRT_AWAIT(async_stream_drain(crt, &stream, &l->rc), 0);
+        results[0] = l->rc;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* A stream on one end of a socket pair, with @p data waiting on it */
+static void setup(async_loop_t *loop, const char *data, size_t chunk)
+{
+    nlines = 0;
+    memset(results, 0, sizeof(results));
+    memset(lines, 0, sizeof(lines));
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) abort();
+    if (data != NULL && write(fds[1], data, strlen(data)) != (ssize_t)strlen(data)) abort();
+
+    async_chunk_pool_init(&pool, chunk, 4);
+    async_stream_init(&stream, loop, &pool, fds[0]);
+}
+
+static void teardown(void)
+{
+    async_stream_fini(&stream);
+    async_chunk_pool_fini(&pool);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_lines(async_loop_t *loop)
+{
+    async_task_t task;
+
+    setup(loop, "alpha\nbravo charlie delta echo\nfoxtrot\n", CHUNK);
+    shutdown(fds[1], SHUT_WR);
+
+    async_task_start_on(loop, &task, lines_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(nlines == 3);
+    TEST_CHECK(strcmp(lines[0], "alpha\n") == 0);
+    TEST_CHECK(strcmp(lines[1], "bravo charlie delta echo\n") == 0);
+    TEST_CHECK(strcmp(lines[2], "foxtrot\n") == 0);
+    TEST_CHECK(results[0] == 0);
+    TEST_CHECK(pool.acp_live <= 1);
+
+    teardown();
+}
+
+static void test_line_too_long(async_loop_t *loop)
+{
+    async_task_t task;
+    char data[101];
+
+    /* One read brings in all of it, the delimiter past the limit included */
+    memset(data, 'x', 100);
+    memcpy(data, "first", 5);
+    data[50] = '\n';
+    data[100] = '\0';
+
+    setup(loop, data, BIG_CHUNK);
+    shutdown(fds[1], SHUT_WR);
+
+    async_task_start_on(loop, &task, short_line_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(results[0] == -1 && error == EMSGSIZE);
+    TEST_CHECK(results[1] == 5);
+    TEST_CHECK(strcmp(lines[0], "first") == 0);
+
+    teardown();
+}
+
+static void test_delimiter_change(async_loop_t *loop)
+{
+    async_task_t task;
+
+    setup(loop, "ab;cdef", CHUNK);
+    shutdown(fds[1], SHUT_WR);
+
+    async_task_start_on(loop, &task, delims_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(results[0] == -1 && error == EMSGSIZE);
+    TEST_CHECK(results[1] == 3);
+    TEST_CHECK(strcmp(lines[0], "ab;") == 0);
+    TEST_CHECK(results[2] == 4);
+    TEST_CHECK(strcmp(lines[1], "cdef") == 0);
+
+    teardown();
+}
+
+static void test_write_drain(async_loop_t *loop)
+{
+    async_task_t task;
+    char buf[2048];
+    ssize_t total = 0;
+    ssize_t n;
+
+    setup(loop, NULL, CHUNK);
+
+    async_task_start_on(loop, &task, writer_main, NULL);
+    async_loop_run(loop);
+
+    while ((n = read(fds[1], buf + total, sizeof(buf) - total)) > 0) total += n;
+
+    TEST_CHECK(results[0] == 0);
+    TEST_CHECK(total == 1000);
+    TEST_CHECK(memcmp(buf + 990, "0123456789", 10) == 0);
+
+    teardown();
+}
+
+int main(void)
+{
+    TEST_RUN(test_lines);
+    TEST_RUN(test_line_too_long);
+    TEST_RUN(test_delimiter_change);
+    TEST_RUN(test_write_drain);
+
+    return test_result();
+}
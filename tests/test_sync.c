@@ -0,0 +1,241 @@
+/*
+ * Mutex, semaphore and condition variable: exclusion, handover to the
+ * longest waiter, and handover past a waiter that was cancelled
+ */
+#include "../async.h"
+#include "../async_sync.h"
+#include "test.h"
+
+#define TASKS       8
+#define ROUNDS      100
+
+static async_mutex_t mutex;
+static async_sem_t sem;
+static async_cond_t cond;
+static long counter;
+static int holders;
+static int max_holders;
+static int ready;
+static int woken;
+
+int locker_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int n; long seen; }, l)
+    {
+        for (l->n = 0; l->n < ROUNDS; l->n++)
+        {
+            CRT_AWAIT(async_mutex_lock(crt, &mutex), 0);
+
+            /* Lost updates unless the other tasks are kept out across the yield */
+            l->seen = counter;
+            CRT_AWAIT(async_task_yield(crt), 0);
+            counter = l->seen + 1;
+
+            async_mutex_unlock(&mutex);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Locks the mutex once and counts it, CRT_ERROR_CANCEL if cancelled meanwhile */
+int lock_once_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_mutex_lock(crt, &mutex), CRT_STATUS(crt));
+
+        counter++;
+        async_mutex_unlock(&mutex);
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+/* Holds the mutex over a yield, then cancels the waiter it was handed to */
+int holder_main(crt_t *crt, void *arg)
+{
+    async_task_t *next = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_mutex_lock(crt, &mutex), 0);
+        CRT_AWAIT(async_task_yield(crt), 0);
+
+        async_mutex_unlock(&mutex);
+        async_task_cancel(next);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int sem_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_sem_acquire(crt, &sem), 0);
+
+        if (++holders > max_holders) max_holders = holders;
+        CRT_AWAIT(async_task_yield(crt), 0);
+        holders--;
+
+        async_sem_release(&sem);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int waiter_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_mutex_lock(crt, &mutex), 0);
+
+        while (!ready) CRT_AWAIT(async_cond_wait(crt, &cond, &mutex), 0);
+
+        /* Woken with the mutex held, one at a time */
+        if (++holders > max_holders) max_holders = holders;
+        woken++;
+        CRT_AWAIT(async_task_yield(crt), 0);
+        holders--;
+
+        async_mutex_unlock(&mutex);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int signaller_main(crt_t *crt, void *arg)
+{
+    bool broadcast = *(bool *)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_mutex_lock(crt, &mutex), 0);
+
+        ready = 1;
+        if (broadcast)
+        {
+            async_cond_broadcast(&cond);
+        }
+        else
+        {
+            async_cond_signal(&cond);
+        }
+
+        async_mutex_unlock(&mutex);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_mutex_exclusion(async_loop_t *loop)
+{
+    async_task_t tasks[TASKS];
+    int ii;
+
+    counter = 0;
+    async_mutex_init(&mutex, 0);
+
+    for (ii = 0; ii < TASKS; ii++) async_task_start_on(loop, &tasks[ii], locker_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(counter == TASKS * ROUNDS);
+    for (ii = 0; ii < TASKS; ii++) TEST_CHECK(tasks[ii].at_done);
+}
+
+static void test_mutex_cancelled_waiter(async_loop_t *loop)
+{
+    async_task_t holder;
+    async_task_t first;
+    async_task_t second;
+
+    counter = 0;
+    async_mutex_init(&mutex, 0);
+
+    /* The unlock hands the mutex to first, which is cancelled before it runs */
+    async_task_start_on(loop, &holder, holder_main, &first);
+    async_task_start_on(loop, &first, lock_once_main, NULL);
+    async_task_start_on(loop, &second, lock_once_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(first.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(second.at_done);
+    TEST_CHECK(second.at_returncode == CRT_OK);
+    TEST_CHECK(counter == 1);
+    TEST_CHECK(async_mutex_trylock(&mutex));
+}
+
+static void test_sem_limit(async_loop_t *loop)
+{
+    async_task_t tasks[TASKS];
+    int ii;
+
+    holders = 0;
+    max_holders = 0;
+    async_sem_init(&sem, 2, 0);
+
+    for (ii = 0; ii < TASKS; ii++) async_task_start_on(loop, &tasks[ii], sem_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(max_holders == 2);
+    TEST_CHECK(holders == 0);
+    for (ii = 0; ii < TASKS; ii++) TEST_CHECK(tasks[ii].at_done);
+}
+
+static void run_cond(async_loop_t *loop, bool broadcast, int expect)
+{
+    async_task_t waiters[3];
+    async_task_t signaller;
+    int ii;
+
+    holders = 0;
+    max_holders = 0;
+    ready = 0;
+    woken = 0;
+    async_mutex_init(&mutex, 0);
+    async_cond_init(&cond, 0);
+
+    for (ii = 0; ii < 3; ii++) async_task_start_on(loop, &waiters[ii], waiter_main, NULL);
+    async_task_start_on(loop, &signaller, signaller_main, &broadcast);
+    async_loop_run(loop);
+
+    TEST_CHECK(woken == expect);
+    TEST_CHECK(max_holders == 1);
+}
+
+static void test_cond_signal(async_loop_t *loop)
+{
+    /* Signalled once, the other two stay parked on the condition */
+    run_cond(loop, false, 1);
+}
+
+static void test_cond_broadcast(async_loop_t *loop)
+{
+    run_cond(loop, true, 3);
+}
+
+int main(void)
+{
+    TEST_RUN(test_mutex_exclusion);
+    TEST_RUN(test_mutex_cancelled_waiter);
+    TEST_RUN(test_sem_limit);
+    TEST_RUN(test_cond_signal);
+    TEST_RUN(test_cond_broadcast);
+
+    return test_result();
+}
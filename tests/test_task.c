@@ -0,0 +1,208 @@
+/*
+ * Tasks on a loop: cancellation, one at a time and in batches, deadlines
+ * and priority classes
+ */
+#include <string.h>
+
+#include "../async.h"
+#include "test.h"
+
+#define MANY        100
+
+static int runs;
+static char order[16];
+static int norder;
+
+int sleeper_main(crt_t *crt, void *arg)
+{
+    double *timeout = arg;
+
+    CRT(crt)
+    {
+        runs++;
+        CRT_AWAIT(async_task_sleep(crt, *timeout), CRT_STATUS(crt));
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int timeout_main(crt_t *crt, void *arg)
+{
+    bool *timedout = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT_TIMEOUT(async_task_sleep(crt, 10.0), 0.01, 0);
+        *timedout = CRT_TIMEDOUT(crt);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int canceller_main(crt_t *crt, void *arg)
+{
+    async_task_t *victim = arg;
+
+    CRT(crt)
+    {
+        async_task_cancel(victim);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int mark_main(crt_t *crt, void *arg)
+{
+    CRT(crt)
+    {
+        order[norder++] = *(const char *)arg;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_cancel_sleep(async_loop_t *loop)
+{
+    async_task_t sleeper;
+    async_task_t canceller;
+    double timeout = 10.0;
+
+    runs = 0;
+    async_task_start_on(loop, &sleeper, sleeper_main, &timeout);
+    async_task_start_on(loop, &canceller, canceller_main, &sleeper);
+    async_loop_run(loop);
+
+    TEST_CHECK(sleeper.at_done);
+    TEST_CHECK(sleeper.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(!async_timer_active(loop, &sleeper.at_timer));
+}
+
+static void test_cancel_done(async_loop_t *loop)
+{
+    async_task_t sleeper;
+    double timeout = 0.0;
+
+    runs = 0;
+    async_task_start_on(loop, &sleeper, sleeper_main, &timeout);
+    async_loop_run(loop);
+
+    TEST_CHECK(sleeper.at_done);
+    TEST_CHECK(sleeper.at_returncode == CRT_OK);
+
+    /* A finished task is neither marked nor queued again */
+    async_task_cancel(&sleeper);
+    TEST_CHECK(!sleeper.at_queued);
+    TEST_CHECK(loop->al_runq_len == 0);
+
+    async_loop_run(loop);
+    TEST_CHECK(runs == 1);
+    TEST_CHECK(sleeper.at_returncode == CRT_OK);
+}
+
+static void test_cancel_many(async_loop_t *loop)
+{
+    static async_task_t sleepers[MANY + 1];
+    async_task_t *victims[MANY + 2];
+    double timeout = 10.0;
+    double done = 0.0;
+    ev_tstamp start;
+    int cancelled = 0;
+    int ii;
+
+    runs = 0;
+    start = ev_now(loop->al_ev);
+
+    /* The last one finishes right away */
+    for (ii = 0; ii < MANY; ii++) async_task_start_on(loop, &sleepers[ii], sleeper_main, &timeout);
+    async_task_start_on(loop, &sleepers[MANY], sleeper_main, &done);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+    while (!sleepers[MANY].at_done) ev_run(loop->al_ev, EVRUN_ONCE);
+
+    /* With a finished task and one named twice */
+    for (ii = 0; ii <= MANY; ii++) victims[ii] = &sleepers[ii];
+    victims[MANY + 1] = &sleepers[0];
+
+    async_task_cancel_many(victims, MANY + 2);
+
+    /* Only marked and queued, nothing unwound inline */
+    for (ii = 0; ii < MANY; ii++) TEST_CHECK(sleepers[ii].at_queued && !sleepers[ii].at_done);
+
+    async_loop_run(loop);
+
+    for (ii = 0; ii < MANY; ii++)
+    {
+        if (sleepers[ii].at_done && sleepers[ii].at_returncode == CRT_ERROR_CANCEL &&
+                !async_timer_active(loop, &sleepers[ii].at_timer))
+        {
+            cancelled++;
+        }
+    }
+
+    TEST_CHECK(cancelled == MANY);
+    TEST_CHECK(runs == MANY + 1);
+    TEST_CHECK(sleepers[MANY].at_returncode == CRT_OK);
+    TEST_CHECK(ev_now(loop->al_ev) - start < 5.0);
+}
+
+static void test_timeout(async_loop_t *loop)
+{
+    async_task_t task;
+    ev_tstamp start = ev_now(loop->al_ev);
+    bool timedout = false;
+
+    async_task_start_on(loop, &task, timeout_main, &timedout);
+    async_loop_run(loop);
+
+    TEST_CHECK(task.at_done);
+    TEST_CHECK(timedout);
+    TEST_CHECK(ev_now(loop->al_ev) - start < 5.0);
+}
+
+static void test_priority_order(async_loop_t *loop)
+{
+    async_task_t tasks[3];
+
+    norder = 0;
+    async_task_start_prio(loop, &tasks[0], ASYNC_PRIO_LOW, mark_main, "l");
+    async_task_start_prio(loop, &tasks[1], ASYNC_PRIO_NORMAL, mark_main, "n");
+    async_task_start_prio(loop, &tasks[2], ASYNC_PRIO_HIGH, mark_main, "h");
+    async_loop_run(loop);
+
+    order[norder] = '\0';
+    TEST_CHECK(strcmp(order, "hnl") == 0);
+}
+
+static void test_priority_change(async_loop_t *loop)
+{
+    async_task_t tasks[3];
+
+    norder = 0;
+    async_task_start_on(loop, &tasks[0], mark_main, "a");
+    async_task_start_on(loop, &tasks[1], mark_main, "b");
+    async_task_start_on(loop, &tasks[2], mark_main, "c");
+
+    /* Queued already: moves to the low class, behind the others */
+    async_task_set_priority(&tasks[0], ASYNC_PRIO_LOW);
+    async_loop_run(loop);
+
+    order[norder] = '\0';
+    TEST_CHECK(strcmp(order, "bca") == 0);
+    TEST_CHECK(loop->al_runq_len == 0);
+    TEST_CHECK(tasks[0].at_prio == ASYNC_PRIO_LOW);
+}
+
+int main(void)
+{
+    TEST_RUN(test_cancel_sleep);
+    TEST_RUN(test_cancel_done);
+    TEST_RUN(test_cancel_many);
+    TEST_RUN(test_timeout);
+    TEST_RUN(test_priority_order);
+    TEST_RUN(test_priority_change);
+
+    return test_result();
+}
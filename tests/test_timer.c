@@ -0,0 +1,168 @@
+/*
+ * Timer wheel: timers on every level fire in order and never early,
+ * coalesced deadlines fire in one pass, stopped timers never fire, and many
+ * sleeping tasks all wake
+ */
+#include <string.h>
+
+#include "../async.h"
+#include "test.h"
+
+#define SLEEPERS    1000
+
+static double fired[8];
+static int nfired;
+static int woken;
+static bool early;
+
+static void on_expire(async_timer_t *timer)
+{
+    async_loop_t *loop = (async_loop_t *)timer->atm_task;
+
+    fired[nfired++] = ev_now(loop->al_ev);
+}
+
+/* A timer that records its expiry; the loop rides in atm_task */
+static void timer_init(async_timer_t *timer, async_loop_t *loop)
+{
+    async_timer_init(timer, (async_task_t *)loop);
+    timer->atm_fn = on_expire;
+}
+
+int sleeper_main(crt_t *crt, void *arg)
+{
+    async_task_t *self = ASYNC_TASK(crt);
+    double after = (double)(intptr_t)arg / 1e4;
+
+    CRT_LOCALS(crt, struct { double start; }, l)
+    {
+        l->start = ev_now(self->at_loop->al_ev);
+        CRT_AWAIT(async_task_sleep(crt, after), 0);
+
+        if (ev_now(self->at_loop->al_ev) - l->start < after) early = true;
+        woken++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_cascade(async_loop_t *loop)
+{
+    /* Ticks of 10 us: level 0 covers 2.56 ms, level 1 0.65 s */
+    static const double after[] = { 0.7, 0.001, 0.02 };
+    async_timer_t timers[3];
+    double start;
+    int ii;
+
+    async_loop_timer_wheel(loop, 1e-5, 0);
+
+    ev_now_update(loop->al_ev);
+    start = ev_now(loop->al_ev);
+    nfired = 0;
+
+    for (ii = 0; ii < 3; ii++)
+    {
+        timer_init(&timers[ii], loop);
+        async_timer_start(loop, &timers[ii], after[ii]);
+    }
+
+    async_loop_run(loop);
+
+    /* The level 2 timer cascaded down through level 1 */
+    TEST_CHECK(nfired == 3);
+    TEST_CHECK(fired[0] - start >= after[1]);
+    TEST_CHECK(fired[1] - start >= after[2]);
+    TEST_CHECK(fired[2] - start >= after[0]);
+    TEST_CHECK(loop->al_wheel.aw_count == 0);
+    TEST_CHECK(!ev_is_active(&loop->al_wheel.aw_tick));
+}
+
+static void test_coalesce(async_loop_t *loop)
+{
+    static const double after[] = { 0.001, 0.004, 0.008 };
+    async_timer_t timers[3];
+    double start;
+    int ii;
+
+    /* 1 ms ticks rounded up to 10 ms: the three deadlines share a slot */
+    async_loop_timer_wheel(loop, 0.001, 10);
+
+    ev_now_update(loop->al_ev);
+    start = ev_now(loop->al_ev);
+    nfired = 0;
+
+    for (ii = 0; ii < 3; ii++)
+    {
+        timer_init(&timers[ii], loop);
+        async_timer_start(loop, &timers[ii], after[ii]);
+    }
+
+    async_loop_run(loop);
+
+    TEST_CHECK(nfired == 3);
+    TEST_CHECK(fired[0] == fired[1] && fired[1] == fired[2]);
+    TEST_CHECK(fired[0] - start >= after[2]);
+}
+
+static void test_stop(async_loop_t *loop)
+{
+    async_timer_t kept;
+    async_timer_t stopped;
+    async_timer_t rearmed;
+
+    async_loop_timer_wheel(loop, 0.001, 0);
+    nfired = 0;
+
+    timer_init(&kept, loop);
+    timer_init(&stopped, loop);
+    timer_init(&rearmed, loop);
+
+    async_timer_start(loop, &kept, 0.005);
+    async_timer_start(loop, &stopped, 0.002);
+    async_timer_start(loop, &rearmed, 0.001);
+
+    async_timer_stop(loop, &stopped);
+    TEST_CHECK(!async_timer_active(loop, &stopped));
+
+    /* Re-arming moves it, it fires once */
+    async_timer_start(loop, &rearmed, 0.003);
+    TEST_CHECK(loop->al_wheel.aw_count == 2);
+    TEST_CHECK(async_timer_remaining(loop, &rearmed) > 0.002);
+
+    async_loop_run(loop);
+
+    TEST_CHECK(nfired == 2);
+    TEST_CHECK(!async_timer_active(loop, &kept));
+}
+
+static void test_sleepers(async_loop_t *loop)
+{
+    static async_task_t tasks[SLEEPERS];
+    int ii;
+
+    async_loop_timer_wheel(loop, 0.001, 0);
+    woken = 0;
+    early = false;
+
+    /* Sleeps of 0 to 50 ms */
+    for (ii = 0; ii < SLEEPERS; ii++)
+    {
+        async_task_start_on(loop, &tasks[ii], sleeper_main, (void *)(intptr_t)(ii * 7 % 500));
+    }
+
+    async_loop_run(loop);
+
+    TEST_CHECK(woken == SLEEPERS);
+    TEST_CHECK(!early);
+}
+
+int main(void)
+{
+    TEST_RUN(test_cascade);
+    TEST_RUN(test_coalesce);
+    TEST_RUN(test_stop);
+    TEST_RUN(test_sleepers);
+
+    return test_result();
+}
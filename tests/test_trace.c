@@ -0,0 +1,150 @@
+/*
+ * Co-routine trace: the records of a run reach the trace file, nothing is
+ * recorded once it is closed, and trace2json converts it. Only with
+ * CRT_TRACE, otherwise there is nothing to test.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../async.h"
+#include "../crt_trace.h"
+#include "test.h"
+
+#define YIELDS      10
+
+#if defined(CRT_TRACE)
+
+static char path[] = "/tmp/test_trace.XXXXXX";
+
+void step(crt_t *crt)
+{
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_yield(crt));
+    }
+    CRT_END;
+}
+
+int yielder_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < YIELDS; l->ii++) CRT_AWAIT(step(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Count the records of @p event in the trace file, -1 if it is no trace */
+static long count_records(int event)
+{
+    crt_trace_header_t hdr;
+    crt_trace_chunk_t chunk;
+    crt_trace_rec_t rec;
+    long count = 0;
+    uint64_t off;
+    uint32_t ii;
+    FILE *in;
+
+    in = fopen(path, "rb");
+    if (in == NULL) return -1;
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.cth_magic, CRT_TRACE_MAGIC, 8) != 0)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    for (off = sizeof(hdr); off < hdr.cth_sites; off += sizeof(chunk) + chunk.ctc_count * sizeof(rec))
+    {
+        if (fread(&chunk, sizeof(chunk), 1, in) != 1) break;
+
+        for (ii = 0; ii < chunk.ctc_count && fread(&rec, sizeof(rec), 1, in) == 1; ii++)
+        {
+            if (rec.ctr_event == event) count++;
+        }
+    }
+
+    fclose(in);
+
+    return count;
+}
+
+static void run_yielder(async_loop_t *loop)
+{
+    async_task_t task;
+
+    async_task_start_on(loop, &task, yielder_main, NULL);
+    async_loop_run(loop);
+}
+
+static void test_trace_file(async_loop_t *loop)
+{
+    int fd = mkstemp(path);
+
+    TEST_CHECK(fd >= 0);
+    close(fd);
+
+    TEST_CHECK(crt_trace_open(path, 1 << 20) == 0);
+    run_yielder(loop);
+    TEST_CHECK(crt_trace_close() == 0);
+
+    /* Each await of step() suspends the task in both frames */
+    TEST_CHECK(count_records(CRT_TRACE_RESUME) >= YIELDS);
+    TEST_CHECK(count_records(CRT_TRACE_YIELD) >= YIELDS);
+    TEST_CHECK(count_records(CRT_TRACE_AWAIT) >= YIELDS);
+
+    /* Closed: the hooks record nothing */
+    TEST_CHECK(crt_trace_ring == NULL || crt_trace_ring->ctg_count == 0);
+    run_yielder(loop);
+    TEST_CHECK(crt_trace_ring == NULL || crt_trace_ring->ctg_count == 0);
+}
+
+static void test_trace2json(async_loop_t *loop)
+{
+    char cmd[256];
+    char json[4096];
+    size_t len;
+    FILE *in;
+
+    (void)loop;
+
+    snprintf(cmd, sizeof(cmd), "%s %s %s.json", TRACE2JSON, path, path);
+    TEST_CHECK(system(cmd) == 0);
+
+    snprintf(cmd, sizeof(cmd), "%s.json", path);
+    in = fopen(cmd, "r");
+    TEST_CHECK(in != NULL);
+    if (in == NULL) return;
+
+    len = fread(json, 1, sizeof(json) - 1, in);
+    json[len] = '\0';
+    fclose(in);
+    unlink(cmd);
+
+    /* A slice per resume, named after yielder_main's CRT() */
+    TEST_CHECK(strstr(json, "\"traceEvents\"") != NULL);
+    TEST_CHECK(strstr(json, "\"ph\":\"X\"") != NULL);
+    TEST_CHECK(strstr(json, "test_trace.c:") != NULL);
+}
+
+#endif
+
+int main(void)
+{
+#if defined(CRT_TRACE)
+    TEST_RUN(test_trace_file);
+    TEST_RUN(test_trace2json);
+
+    unlink(path);
+#endif
+
+    return test_result();
+}
@@ -0,0 +1,185 @@
+/*
+ * io_uring backend: reads and writes through the ring, a read on an idle
+ * socket cancelled in flight, a poll the kernel refuses, and more timers
+ * than the submission queue has entries
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../async.h"
+#include "../async_io.h"
+#include "../async_uring.h"
+#include "test.h"
+
+#define TIMERS      64                      /* Far more than the ring entries */
+
+static int fds[2];
+static char got[16];
+static ssize_t results[2];
+static int error;
+static int expired;
+
+int writer_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { ssize_t rc; }, l)
+    {
+        CRT_AWAIT(async_write(crt, fds[1], "hello", 5, &l->rc), 0);
+        results[1] = l->rc;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+int reader_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT_LOCALS(crt, struct { ssize_t rc; }, l)
+    {
+        l->rc = 0;
+        CRT_AWAIT(async_read(crt, fds[0], got, sizeof(got), &l->rc), CRT_STATUS(crt));
+        results[0] = l->rc;
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int poll_main(crt_t *crt, void *arg)
+{
+    int *fd = arg;
+
+    CRT(crt)
+    {
+        errno = 0;
+        CRT_AWAIT(async_io_wait(crt, *fd, EV_READ), CRT_STATUS(crt));
+        error = errno;
+        if (CRT_STATUS(crt) != CRT_OK) CRT_EXIT(CRT_STATUS(crt));
+    }
+    CRT_END;
+
+    return CRT_STATUS(crt);
+}
+
+int sleeper_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_sleep(crt, 0.01), 0);
+        expired++;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Without io_uring in this kernel there is nothing to test */
+static bool ring(async_loop_t *loop, unsigned entries, unsigned flags)
+{
+    return async_loop_io_uring(loop, entries, flags) == 0;
+}
+
+static void test_read_write(async_loop_t *loop)
+{
+    async_task_t reader;
+    async_task_t writer;
+
+    if (!ring(loop, 0, 0)) return;
+
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    async_io_nonblock(fds[0]);
+    async_io_nonblock(fds[1]);
+
+    memset(got, 0, sizeof(got));
+    results[0] = results[1] = 0;
+
+    /* The read is in flight before anything was written */
+    async_task_start_on(loop, &reader, reader_main, NULL);
+    async_task_start_on(loop, &writer, writer_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(reader.at_returncode == CRT_OK);
+    TEST_CHECK(results[1] == 5);
+    TEST_CHECK(results[0] == 5 && memcmp(got, "hello", 5) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_cancel_idle(async_loop_t *loop)
+{
+    async_task_t reader;
+
+    if (!ring(loop, 0, 0)) return;
+
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    async_io_nonblock(fds[0]);
+
+    /* Park it on a read that never completes by itself */
+    results[0] = -2;
+    async_task_start_on(loop, &reader, reader_main, NULL);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+    ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    async_task_cancel(&reader);
+    async_loop_run(loop);
+
+    TEST_CHECK(reader.at_done);
+    TEST_CHECK(reader.at_returncode == CRT_ERROR_CANCEL);
+    TEST_CHECK(results[0] == -2);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_poll_refused(async_loop_t *loop)
+{
+    async_task_t task;
+    int fd;
+
+    if (!ring(loop, 0, 0)) return;
+
+    /* A descriptor that is surely closed */
+    fd = dup(0);
+    TEST_CHECK(fd >= 0);
+    close(fd);
+
+    error = 0;
+    async_task_start_on(loop, &task, poll_main, &fd);
+    async_loop_run(loop);
+
+    TEST_CHECK(task.at_returncode == CRT_ERROR);
+    TEST_CHECK(error == EBADF);
+}
+
+static void test_timers(async_loop_t *loop)
+{
+    async_task_t tasks[TIMERS];
+    int ii;
+
+    if (!ring(loop, 2, ASYNC_URING_TIMERS)) return;
+
+    expired = 0;
+
+    for (ii = 0; ii < TIMERS; ii++) async_task_start_on(loop, &tasks[ii], sleeper_main, NULL);
+    async_loop_run(loop);
+
+    TEST_CHECK(expired == TIMERS);
+}
+
+int main(void)
+{
+    TEST_RUN(test_read_write);
+    TEST_RUN(test_cancel_idle);
+    TEST_RUN(test_poll_refused);
+    TEST_RUN(test_timers);
+
+    return test_result();
+}
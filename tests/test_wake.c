@@ -0,0 +1,183 @@
+/*
+ * Wakeups from other threads: no wakeup is lost while several threads wake
+ * one task, and every parked task of a batch is resumed once
+ */
+#include <string.h>
+#include <pthread.h>
+
+#include "../async.h"
+#include "test.h"
+
+#define PRODUCERS   4
+#define MESSAGES    20000                   /* Per producer */
+#define PARKED      100
+
+static async_task_t consumer;
+static async_task_t parked[PARKED];
+static atomic_long sent;
+static long consumed;
+static long resumes;
+static int woken;
+static int wrong_reason;
+
+static ev_async keep;                       /* Keeps the loop up while tasks wait */
+static ev_timer limit;                      /* Gives up on a lost wakeup */
+
+static void keep_fn(struct ev_loop *loop, ev_async *w, int revents)
+{
+    (void)loop;
+    (void)w;
+    (void)revents;
+}
+
+static void limit_fn(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    (void)w;
+    (void)revents;
+
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void keep_start(async_loop_t *loop)
+{
+    ev_async_init(&keep, keep_fn);
+    ev_async_start(loop->al_ev, &keep);
+
+    ev_timer_init(&limit, limit_fn, 10.0, 0.0);
+    ev_timer_start(loop->al_ev, &limit);
+}
+
+static void keep_stop(async_loop_t *loop)
+{
+    ev_async_stop(loop->al_ev, &keep);
+    ev_timer_stop(loop->al_ev, &limit);
+}
+
+/* Takes what was sent, parks until woken when there is nothing */
+int consumer_main(crt_t *crt, void *arg)
+{
+    async_loop_t *loop = arg;
+    long count;
+
+    CRT(crt)
+    {
+        while (consumed < PRODUCERS * MESSAGES)
+        {
+            count = atomic_load(&sent);
+            if (count > consumed)
+            {
+                consumed = count;
+                continue;
+            }
+
+            CRT_AWAIT(async_task_park(crt), 0);
+            resumes++;
+        }
+
+        keep_stop(loop);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void *producer_fn(void *arg)
+{
+    int ii;
+
+    (void)arg;
+
+    for (ii = 0; ii < MESSAGES; ii++)
+    {
+        atomic_fetch_add(&sent, 1);
+        async_task_wake_from_any_thread(&consumer);
+    }
+
+    return NULL;
+}
+
+int parked_main(crt_t *crt, void *arg)
+{
+    async_loop_t *loop = arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_park(crt), 0);
+
+        if (ASYNC_TASK(crt)->at_what_scheduled != &loop->al_remote) wrong_reason++;
+        if (++woken == PARKED) keep_stop(loop);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void *waker_fn(void *arg)
+{
+    int ii;
+
+    (void)arg;
+
+    /* Twice each: the second one finds it pending or already resumed */
+    for (ii = 0; ii < PARKED * 2; ii++) async_task_wake_from_any_thread(&parked[ii % PARKED]);
+
+    return NULL;
+}
+
+static void test_producers(async_loop_t *loop)
+{
+    pthread_t threads[PRODUCERS];
+    int ii;
+
+    atomic_store(&sent, 0);
+    consumed = 0;
+    resumes = 0;
+
+    keep_start(loop);
+    async_task_start_on(loop, &consumer, consumer_main, loop);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    for (ii = 0; ii < PRODUCERS; ii++) pthread_create(&threads[ii], NULL, producer_fn, NULL);
+
+    async_loop_run(loop);
+
+    for (ii = 0; ii < PRODUCERS; ii++) pthread_join(threads[ii], NULL);
+
+    /* Wakeups that find the task pending are merged */
+    TEST_CHECK(consumer.at_done);
+    TEST_CHECK(consumed == PRODUCERS * MESSAGES);
+    TEST_CHECK(resumes > 0 && resumes <= PRODUCERS * MESSAGES);
+}
+
+static void test_batch(async_loop_t *loop)
+{
+    pthread_t thread;
+    int ii;
+
+    woken = 0;
+    wrong_reason = 0;
+
+    keep_start(loop);
+    for (ii = 0; ii < PARKED; ii++) async_task_start_on(loop, &parked[ii], parked_main, loop);
+    while (loop->al_runq_len > 0) ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    pthread_create(&thread, NULL, waker_fn, NULL);
+    async_loop_run(loop);
+    pthread_join(thread, NULL);
+
+    /* Late wakeups of finished tasks are dropped */
+    ev_run(loop->al_ev, EVRUN_NOWAIT);
+
+    TEST_CHECK(woken == PARKED);
+    TEST_CHECK(wrong_reason == 0);
+
+    for (ii = 0; ii < PARKED; ii++) TEST_CHECK(parked[ii].at_done);
+}
+
+int main(void)
+{
+    TEST_RUN(test_producers);
+    TEST_RUN(test_batch);
+
+    return test_result();
+}
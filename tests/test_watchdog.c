@@ -0,0 +1,171 @@
+/*
+ * Stall watchdog and run budgets: a task that hogs its loop is reported
+ * with its resume points, and a budget makes a busy task yield
+ */
+#include <string.h>
+#include <time.h>
+
+#include "../async.h"
+#include "../async_watchdog.h"
+#include "test.h"
+
+#define ROUNDS      100
+
+static async_stall_t last;
+static bool done;
+static long others;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void spin(double seconds)
+{
+    double end = now() + seconds;
+
+    while (now() < end);
+}
+
+void hog(crt_t *crt)
+{
+    CRT(crt)
+    {
+        CRT_AWAIT(async_task_yield(crt));
+
+        /* Blocks the loop, long enough to be seen */
+        spin(0.1);
+    }
+    CRT_END;
+}
+
+int hog_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        CRT_AWAIT(hog(crt), 0);
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void on_stall(async_watchdog_t *wd, const async_stall_t *stall)
+{
+    (void)wd;
+
+    last = *stall;
+}
+
+/* Runs ROUNDS iterations under the budget @p arg */
+int budget_main(crt_t *crt, void *arg)
+{
+    async_budget_t *budget = arg;
+
+    CRT_LOCALS(crt, struct { int ii; }, l)
+    {
+        for (l->ii = 0; l->ii < ROUNDS; l->ii++)
+        {
+            if (budget->ab_slice != 0.0) spin(0.001);
+            ASYNC_BUDGET_YIELD(crt, budget, 0);
+        }
+
+        done = true;
+    }
+    CRT_END;
+
+    return 0;
+}
+
+/* Counts how often it got to run before the budget task finished */
+int other_main(crt_t *crt, void *arg)
+{
+    (void)arg;
+
+    CRT(crt)
+    {
+        while (!done)
+        {
+            others++;
+            CRT_AWAIT(async_task_yield(crt), 0);
+        }
+    }
+    CRT_END;
+
+    return 0;
+}
+
+static void test_stall_reported(async_loop_t *loop)
+{
+    async_watchdog_t wd;
+    async_task_t task;
+
+    memset(&last, 0, sizeof(last));
+    TEST_CHECK(async_watchdog_init(&wd, 0.02, on_stall, NULL) == 0);
+    TEST_CHECK(async_watchdog_watch(&wd, loop) == 0);
+
+    async_task_start_on(loop, &task, hog_main, NULL);
+    async_loop_run(loop);
+
+    async_watchdog_unwatch(&wd, loop);
+    async_watchdog_fini(&wd);
+
+    /* Once per slice, with the await the outer frame is in */
+    TEST_CHECK(atomic_load(&wd.awd_stalls) == 1);
+    TEST_CHECK(last.asl_loop == loop);
+    TEST_CHECK(last.asl_task == &task);
+    TEST_CHECK(last.asl_main == hog_main);
+    TEST_CHECK(last.asl_depth == 1);
+    TEST_CHECK(last.asl_points[0] > 0);
+    TEST_CHECK(last.asl_duration >= 0.02);
+}
+
+static void run_budget(async_loop_t *loop, async_budget_t *budget)
+{
+    async_task_t busy;
+    async_task_t other;
+
+    done = false;
+    others = 0;
+
+    async_task_start_on(loop, &busy, budget_main, budget);
+    async_task_start_on(loop, &other, other_main, NULL);
+    async_loop_run(loop);
+}
+
+static void test_budget_iterations(async_loop_t *loop)
+{
+    async_budget_t budget;
+
+    /* Yields every 10 iterations, the other task runs in between */
+    async_budget_init(&budget, 10, 0.0);
+    run_budget(loop, &budget);
+
+    TEST_CHECK(others >= ROUNDS / 10 - 1 && others <= ROUNDS / 10 + 1);
+}
+
+static void test_budget_slice(async_loop_t *loop)
+{
+    async_budget_t budget;
+
+    /* 1 ms per iteration, yields every 10 ms or so */
+    async_budget_init(&budget, 0, 0.01);
+    run_budget(loop, &budget);
+
+    TEST_CHECK(others >= 2 && others <= ROUNDS / 5);
+}
+
+int main(void)
+{
+    TEST_RUN(test_stall_reported);
+    TEST_RUN(test_budget_iterations);
+    TEST_RUN(test_budget_slice);
+
+    return test_result();
+}
@@ -0,0 +1,310 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crt_trace.h"
+
+/*
+ * Convert a trace file written with CRT_TRACE (see crt_trace.h) to the
+ * Chrome trace event format, for chrome://tracing or ui.perfetto.dev.
+ *
+ * Every resume of a co-routine becomes a slice, named after the file:line
+ * of its outermost CRT() and ending where it suspended or exited. Slices
+ * are grouped by thread (pid) and co-routine (tid).
+ *
+ * Usage: trace2json trace.crtrace [out.json]
+ */
+
+struct site
+{
+    const char         *s_file;
+    int                 s_file_len;
+    int                 s_line;
+};
+
+struct task
+{
+    uint64_t            t_start;            /* Time of the resume */
+    uint16_t            t_fn;               /* Site of the outermost frame */
+    uint16_t            t_at;               /* Site of the innermost suspend */
+    uint8_t             t_depth;            /* Its depth */
+    bool                t_active;           /* Between resume and suspend */
+};
+
+struct chunk
+{
+    const crt_trace_chunk_t *c_chunk;
+    const crt_trace_rec_t   *c_recs;
+};
+
+static struct site *sites;
+static size_t nsites;
+static struct task *tasks;
+static size_t ntasks;
+static double ns_per_tick;
+static uint64_t tick0;
+static bool first = true;
+
+static int parse_sites(const char *text, const char *end)
+{
+    const char *nl;
+    const char *sp;
+    const char *rsp;
+    long id;
+
+    sites = calloc(UINT16_MAX + 1, sizeof(*sites));
+    if (sites == NULL) return -1;
+
+    for (; text < end; text = nl + 1)
+    {
+        nl = memchr(text, '\n', end - text);
+        if (nl == NULL) return -1;
+
+        /* "id file line", the file may contain spaces */
+        id = strtol(text, NULL, 10);
+        sp = memchr(text, ' ', nl - text);
+        for (rsp = nl; rsp > text && rsp[-1] != ' '; rsp--);
+        if (id <= 0 || id > UINT16_MAX || sp == NULL || rsp - 1 <= sp) return -1;
+
+        sites[id].s_file = sp + 1;
+        sites[id].s_file_len = (int)(rsp - 1 - (sp + 1));
+        sites[id].s_line = atoi(rsp);
+        if ((size_t)id >= nsites) nsites = id + 1;
+    }
+
+    return 0;
+}
+
+static struct task *task_get(uint32_t id)
+{
+    size_t n;
+
+    if (id >= ntasks)
+    {
+        n = ntasks ? ntasks : 1024;
+        while (n <= id) n *= 2;
+
+        tasks = realloc(tasks, n * sizeof(*tasks));
+        if (tasks == NULL) abort();
+
+        memset(tasks + ntasks, 0, (n - ntasks) * sizeof(*tasks));
+        ntasks = n;
+    }
+
+    return &tasks[id];
+}
+
+static double to_us(uint64_t tick)
+{
+    return (double)(tick - tick0) * ns_per_tick / 1e3;
+}
+
+static void print_site(FILE *out, uint16_t id)
+{
+    if (id < nsites && sites[id].s_file != NULL)
+    {
+        fprintf(out, "%.*s:%d", sites[id].s_file_len, sites[id].s_file, sites[id].s_line);
+    }
+    else
+    {
+        fprintf(out, "site %u", id);
+    }
+}
+
+static void emit(FILE *out, uint32_t thread, uint32_t id, struct task *task, uint64_t end, bool exited)
+{
+    fprintf(out, "%s\n{\"name\":\"", first ? "" : ",");
+    print_site(out, task->t_fn);
+    fprintf(out, "\",\"cat\":\"crt\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{",
+            to_us(task->t_start), to_us(end) - to_us(task->t_start), thread, id);
+
+    if (task->t_at != 0)
+    {
+        fprintf(out, "\"suspend\":\"");
+        print_site(out, task->t_at);
+        fprintf(out, "\",\"depth\":%u%s", task->t_depth, exited ? "," : "");
+    }
+    if (exited) fprintf(out, "\"exit\":true");
+
+    fprintf(out, "}}");
+
+    first = false;
+}
+
+static void convert(FILE *out, const struct chunk *chunk)
+{
+    uint32_t thread = chunk->c_chunk->ctc_thread;
+    const crt_trace_rec_t *rec;
+    struct task *task;
+    uint32_t ii;
+
+    for (ii = 0; ii < chunk->c_chunk->ctc_count; ii++)
+    {
+        rec = &chunk->c_recs[ii];
+        task = task_get(rec->ctr_task);
+
+        if (rec->ctr_event == CRT_TRACE_RESUME)
+        {
+            task->t_start = rec->ctr_time;
+            task->t_fn = rec->ctr_site;
+            task->t_at = 0;
+            task->t_active = true;
+            continue;
+        }
+
+        if (!task->t_active) continue;
+
+        /* The first suspend record is the innermost frame, the outer ones follow */
+        if (rec->ctr_event != CRT_TRACE_EXIT && task->t_at == 0)
+        {
+            task->t_at = rec->ctr_site;
+            task->t_depth = rec->ctr_depth;
+        }
+
+        if (rec->ctr_depth == 0)
+        {
+            emit(out, thread, rec->ctr_task, task, rec->ctr_time, rec->ctr_event == CRT_TRACE_EXIT);
+            task->t_active = false;
+        }
+    }
+}
+
+/* Chunks of a thread in file order, slices never span threads */
+static int chunk_cmp(const void *a, const void *b)
+{
+    const struct chunk *x = a;
+    const struct chunk *y = b;
+
+    if (x->c_chunk->ctc_thread != y->c_chunk->ctc_thread)
+    {
+        return x->c_chunk->ctc_thread < y->c_chunk->ctc_thread ? -1 : 1;
+    }
+
+    return (x->c_chunk > y->c_chunk) - (x->c_chunk < y->c_chunk);
+}
+
+int main(int argc, char *argv[])
+{
+    const crt_trace_header_t *hdr;
+    const crt_trace_chunk_t *c;
+    struct chunk *chunks = NULL;
+    size_t nchunks = 0;
+    size_t ii;
+    uint64_t off;
+    uint64_t nrecs = 0;
+    uint32_t thread = 0;
+    struct stat st;
+    const char *map;
+    FILE *out = stdout;
+    int fd;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace.crtrace [out.json]\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if ((size_t)st.st_size < sizeof(*hdr))
+    {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    hdr = (const crt_trace_header_t *)map;
+    if (memcmp(hdr->cth_magic, CRT_TRACE_MAGIC, sizeof(hdr->cth_magic)) != 0 ||
+            hdr->cth_version != CRT_TRACE_VERSION || hdr->cth_rec_size != sizeof(crt_trace_rec_t))
+    {
+        fprintf(stderr, "%s: not a trace file of this version\n", argv[1]);
+        return 1;
+    }
+
+    if (hdr->cth_size == 0 || hdr->cth_size > (uint64_t)st.st_size || hdr->cth_sites > hdr->cth_size)
+    {
+        fprintf(stderr, "%s: incomplete trace, crt_trace_close() was not called\n", argv[1]);
+        return 1;
+    }
+
+    if (parse_sites(map + hdr->cth_sites, map + hdr->cth_size) != 0)
+    {
+        fprintf(stderr, "%s: bad site table\n", argv[1]);
+        return 1;
+    }
+
+    ns_per_tick = hdr->cth_ns_per_tick;
+    tick0 = hdr->cth_tick0;
+
+    for (off = sizeof(*hdr); off + sizeof(*c) <= hdr->cth_sites; )
+    {
+        c = (const crt_trace_chunk_t *)(map + off);
+        if (c->ctc_thread == 0) break;
+        if (off + sizeof(*c) + (uint64_t)c->ctc_count * sizeof(crt_trace_rec_t) > hdr->cth_sites) break;
+
+        if (nchunks % 256 == 0)
+        {
+            chunks = realloc(chunks, (nchunks + 256) * sizeof(*chunks));
+            if (chunks == NULL) abort();
+        }
+
+        chunks[nchunks].c_chunk = c;
+        chunks[nchunks].c_recs = (const crt_trace_rec_t *)(c + 1);
+        nchunks++;
+        nrecs += c->ctc_count;
+
+        off += sizeof(*c) + (uint64_t)c->ctc_count * sizeof(crt_trace_rec_t);
+    }
+
+    qsort(chunks, nchunks, sizeof(*chunks), chunk_cmp);
+
+    if (argc > 2 && (out = fopen(argv[2], "w")) == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (ii = 0; ii < nchunks; ii++)
+    {
+        if (chunks[ii].c_chunk->ctc_thread != thread)
+        {
+            thread = chunks[ii].c_chunk->ctc_thread;
+            fprintf(out, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                    first ? "" : ",", thread, thread);
+            first = false;
+
+            /* Slices left open by the previous thread are cut off */
+            if (tasks != NULL) memset(tasks, 0, ntasks * sizeof(*tasks));
+        }
+
+        convert(out, &chunks[ii]);
+    }
+
+    fprintf(out, "\n]}\n");
+
+    fprintf(stderr, "%llu records, %zu chunks, %zu sites, %llu dropped\n", (unsigned long long)nrecs,
+            nchunks, nsites ? nsites - 1 : 0, (unsigned long long)hdr->cth_dropped);
+
+    if (out != stdout) fclose(out);
+
+    return 0;
+}